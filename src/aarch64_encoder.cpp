@@ -0,0 +1,380 @@
+#include "aarch64_encoder.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+[[noreturn]] void cannot_encode(const std::string& what) {
+    std::cerr << "Error: Cannot encode ARM64 instruction: " << what << std::endl;
+    exit(1);
+}
+
+// A general-purpose register; 31 is sp or the zero register, depending on
+// the instruction.
+struct Register {
+    uint32_t num;
+    bool wide;   // x rather than w
+    bool sp;
+};
+
+Register parse_register(const std::string& text) {
+    if (text == "sp") return { 31, true, true };
+    if (text == "xzr" || text == "wzr") return { 31, text[0] == 'x', false };
+    if (text.size() < 2 || (text[0] != 'x' && text[0] != 'w') || text.find_first_not_of("0123456789", 1) != std::string::npos) {
+        cannot_encode("register " + text);
+    }
+    uint32_t num = static_cast<uint32_t>(std::stoul(text.substr(1)));
+    if (num > 30) cannot_encode("register " + text);
+    return { num, text[0] == 'x', false };
+}
+
+bool is_immediate(const std::string& text) {
+    return !text.empty() && text[0] == '#';
+}
+
+long long parse_immediate(const std::string& text) {
+    if (!is_immediate(text)) cannot_encode("immediate " + text);
+    return std::stoll(text.substr(1));
+}
+
+// The amount of a "lsl #k" operand.
+int parse_shift(const std::string& text, std::string& kind) {
+    kind = text.substr(0, 3);
+    if (text.size() < 6 || text[3] != ' ' || (kind != "lsl" && kind != "lsr" && kind != "asr")) cannot_encode("shift " + text);
+    return static_cast<int>(parse_immediate(text.substr(4)));
+}
+
+// A memory operand: "[b]", "[b, #off]", "[b, #off]!" or "[b, i{, lsl #k}]".
+struct Memory {
+    Register base;
+    bool indexed = false;
+    Register index = {};
+    int shift = -1;   // -1 without "lsl"
+    long long offset = 0;
+    bool pre_index = false;
+};
+
+Memory parse_memory(const std::string& text) {
+    Memory mem;
+    std::string inner = text;
+    if (!inner.empty() && inner.back() == '!') {
+        mem.pre_index = true;
+        inner.pop_back();
+    }
+    if (inner.size() < 3 || inner.front() != '[' || inner.back() != ']') cannot_encode("address " + text);
+    inner = inner.substr(1, inner.size() - 2);
+    std::vector<std::string> parts;
+    for (size_t start = 0;;) {
+        size_t comma = inner.find(", ", start);
+        parts.push_back(inner.substr(start, comma - start));
+        if (comma == std::string::npos) break;
+        start = comma + 2;
+    }
+    mem.base = parse_register(parts[0]);
+    if (parts.size() == 2 && is_immediate(parts[1])) {
+        mem.offset = parse_immediate(parts[1]);
+    } else if (parts.size() >= 2) {
+        mem.indexed = true;
+        mem.index = parse_register(parts[1]);
+        if (parts.size() == 3) {
+            std::string kind;
+            mem.shift = parse_shift(parts[2], kind);
+            if (kind != "lsl") cannot_encode("address " + text);
+        } else if (parts.size() > 3) {
+            cannot_encode("address " + text);
+        }
+    }
+    if (mem.pre_index && mem.indexed) cannot_encode("address " + text);
+    return mem;
+}
+
+uint32_t condition_code(const std::string& cond) {
+    static const char* const codes[] = { "eq", "ne", "hs", "lo", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le" };
+    for (uint32_t i = 0; i < 14; ++i) {
+        if (cond == codes[i]) return i;
+    }
+    cannot_encode("condition " + cond);
+}
+
+uint32_t sf(const Register& reg) {
+    return reg.wide ? 1u << 31 : 0;
+}
+
+// The symbol of an operand "sym@PAGE" / "sym@PAGEOFF", without the suffix.
+bool symbol_operand(const std::string& text, const std::string& suffix, std::string& symbol) {
+    if (text.size() <= suffix.size() || text.compare(text.size() - suffix.size(), suffix.size(), suffix) != 0) return false;
+    symbol = text.substr(0, text.size() - suffix.size());
+    return true;
+}
+
+// ELF name of an assembly symbol.
+std::string elf_symbol(const std::string& name) {
+    return !name.empty() && name[0] == '_' ? name.substr(1) : name;
+}
+
+} // namespace
+
+AArch64Encoder::AArch64Encoder(ElfObject& object)
+    : m_object(object), m_text(object.contents(ElfObject::Section::Text)) {
+}
+
+void AArch64Encoder::add_function(const std::vector<AsmInstr>& code) {
+    if (code.empty() || !code[0].op.empty()) cannot_encode("function without a label");
+    uint64_t start = m_text.size();
+    m_labels.clear();
+    uint64_t offset = start;
+    for (const AsmInstr& instr : code) {
+        if (instr.op.empty()) m_labels[instr.label] = offset;
+        else offset += 4;
+    }
+
+    m_listing << code[0].label << ":\n";
+    for (size_t i = 1; i < code.size(); ++i) {
+        const AsmInstr& instr = code[i];
+        if (instr.op.empty()) {
+            m_listing << instr.label << ":\n";
+            continue;
+        }
+        uint64_t at = m_text.size();
+        uint32_t word = encode(instr, at);
+        for (int byte = 0; byte < 4; ++byte) m_text.push_back(static_cast<uint8_t>(word >> (8 * byte)));
+        m_listing << std::setw(8) << std::setfill('0') << std::hex << at << ":  " << std::setw(8) << word << std::dec << std::setfill(' ') << "  " << instr.print().substr(4) << "\n";
+    }
+    m_object.define_symbol(elf_symbol(code[0].label), ElfObject::Section::Text, start, m_text.size() - start, true, true);
+}
+
+uint32_t AArch64Encoder::branch_offset(const std::string& label, uint64_t offset, int bits) const {
+    auto it = m_labels.find(label);
+    if (it == m_labels.end()) cannot_encode("branch to unknown label " + label);
+    int64_t delta = (static_cast<int64_t>(it->second) - static_cast<int64_t>(offset)) / 4;
+    if (delta < -(int64_t(1) << (bits - 1)) || delta >= (int64_t(1) << (bits - 1))) cannot_encode("branch to " + label + " out of range");
+    return static_cast<uint32_t>(delta) & ((1u << bits) - 1);
+}
+
+void AArch64Encoder::relocate(uint64_t offset, const std::string& symbol, uint32_t type) {
+    m_object.add_relocation(offset, elf_symbol(symbol), type);
+}
+
+uint32_t AArch64Encoder::encode(const AsmInstr& instr, uint64_t offset) {
+    const std::string& op = instr.op;
+    const auto& ops = instr.operands;
+    auto expect = [&](size_t min, size_t max) {
+        if (ops.size() < min || ops.size() > max) cannot_encode(instr.print());
+    };
+
+    // add/sub/cmp/cmn with an immediate, a shifted register, or sp (extended
+    // register form).
+    auto arithmetic = [&](bool subtract, bool set_flags, Register rd, Register rn, size_t first) -> uint32_t {
+        uint32_t base = sf(rd) | (subtract ? 1u << 30 : 0) | (set_flags ? 1u << 29 : 0);
+        std::string symbol;
+        if (symbol_operand(ops[first], "@PAGEOFF", symbol)) {
+            relocate(offset, symbol, ElfObject::R_AARCH64_ADD_ABS_LO12_NC);
+            return base | 0x11000000 | rn.num << 5 | rd.num;
+        }
+        if (is_immediate(ops[first])) {
+            long long imm = parse_immediate(ops[first]);
+            uint32_t shifted = 0;
+            if (ops.size() > first + 1) {
+                std::string kind;
+                if (parse_shift(ops[first + 1], kind) != 12 || kind != "lsl") cannot_encode(instr.print());
+                shifted = 1;
+            }
+            if (imm < 0 || imm > 4095) cannot_encode(instr.print());
+            return base | 0x11000000 | shifted << 22 | static_cast<uint32_t>(imm) << 10 | rn.num << 5 | rd.num;
+        }
+        Register rm = parse_register(ops[first]);
+        if (rd.sp || rn.sp) {
+            if (ops.size() > first + 1) cannot_encode(instr.print());
+            return base | 0x0B200000 | rm.num << 16 | (rd.wide ? 3u : 2u) << 13 | rn.num << 5 | rd.num;
+        }
+        uint32_t kind_bits = 0;
+        uint32_t amount = 0;
+        if (ops.size() > first + 1) {
+            std::string kind;
+            amount = static_cast<uint32_t>(parse_shift(ops[first + 1], kind));
+            kind_bits = kind == "lsl" ? 0 : kind == "lsr" ? 1 : 2;
+            if (amount >= (rd.wide ? 64u : 32u)) cannot_encode(instr.print());
+        }
+        return base | 0x0B000000 | kind_bits << 22 | rm.num << 16 | amount << 10 | rn.num << 5 | rd.num;
+    };
+
+    // ubfm/sbfm, for shifts by an immediate and sign extension.
+    auto bitfield = [](bool is_signed, Register rd, Register rn, uint32_t immr, uint32_t imms) -> uint32_t {
+        return sf(rd) | (is_signed ? 0 : 2u << 29) | 0x13000000 | (rd.wide ? 1u << 22 : 0) | immr << 16 | imms << 10 | rn.num << 5 | rd.num;
+    };
+
+    if (op == "mov") {
+        expect(2, 2);
+        Register rd = parse_register(ops[0]);
+        if (is_immediate(ops[1])) {
+            long long value = parse_immediate(ops[1]);
+            if (value < -65536 || value > 65535) cannot_encode(instr.print());
+            if (value >= 0) return sf(rd) | 0x52800000 | static_cast<uint32_t>(value) << 5 | rd.num;
+            return sf(rd) | 0x12800000 | (static_cast<uint32_t>(~value) & 0xffff) << 5 | rd.num;
+        }
+        Register rm = parse_register(ops[1]);
+        if (rd.sp || rm.sp) return sf(rd) | 0x11000000 | rm.num << 5 | rd.num;
+        return sf(rd) | 0x2A0003E0 | rm.num << 16 | rd.num;
+    }
+    if (op == "movz" || op == "movn" || op == "movk") {
+        expect(2, 3);
+        Register rd = parse_register(ops[0]);
+        long long value = parse_immediate(ops[1]);
+        uint32_t hw = 0;
+        if (ops.size() == 3) {
+            std::string kind;
+            int shift = parse_shift(ops[2], kind);
+            if (kind != "lsl" || shift % 16 || shift >= (rd.wide ? 64 : 32)) cannot_encode(instr.print());
+            hw = static_cast<uint32_t>(shift / 16);
+        }
+        if (value < 0 || value > 0xffff) cannot_encode(instr.print());
+        uint32_t opc = op == "movn" ? 0 : op == "movz" ? 2 : 3;
+        return sf(rd) | opc << 29 | 0x12800000 | hw << 21 | static_cast<uint32_t>(value) << 5 | rd.num;
+    }
+    if (op == "add" || op == "sub") {
+        expect(3, 4);
+        return arithmetic(op == "sub", false, parse_register(ops[0]), parse_register(ops[1]), 2);
+    }
+    if (op == "cmp" || op == "cmn") {
+        expect(2, 3);
+        Register rn = parse_register(ops[0]);
+        return arithmetic(op == "cmp", true, { 31, rn.wide, false }, rn, 1);
+    }
+    if (op == "neg") {
+        expect(2, 2);
+        Register rd = parse_register(ops[0]);
+        return sf(rd) | 0x4B0003E0 | parse_register(ops[1]).num << 16 | rd.num;
+    }
+    if (op == "mul" || op == "madd" || op == "msub") {
+        expect(op == "mul" ? 3 : 4, op == "mul" ? 3 : 4);
+        Register rd = parse_register(ops[0]);
+        uint32_t ra = op == "mul" ? 31 : parse_register(ops[3]).num;
+        uint32_t negate = op == "msub" ? 1u << 15 : 0;
+        return sf(rd) | 0x1B000000 | parse_register(ops[2]).num << 16 | negate | ra << 10 | parse_register(ops[1]).num << 5 | rd.num;
+    }
+    if (op == "smull") {
+        expect(3, 3);
+        return 0x9B207C00 | parse_register(ops[2]).num << 16 | parse_register(ops[1]).num << 5 | parse_register(ops[0]).num;
+    }
+    if (op == "sdiv") {
+        expect(3, 3);
+        Register rd = parse_register(ops[0]);
+        return sf(rd) | 0x1AC00C00 | parse_register(ops[2]).num << 16 | parse_register(ops[1]).num << 5 | rd.num;
+    }
+    if (op == "lsl" || op == "lsr" || op == "asr") {
+        expect(3, 3);
+        Register rd = parse_register(ops[0]);
+        Register rn = parse_register(ops[1]);
+        uint32_t size = rd.wide ? 64 : 32;
+        if (!is_immediate(ops[2])) {
+            uint32_t kind = op == "lsl" ? 0 : op == "lsr" ? 1 : 2;
+            return sf(rd) | 0x1AC02000 | parse_register(ops[2]).num << 16 | kind << 10 | rn.num << 5 | rd.num;
+        }
+        long long amount = parse_immediate(ops[2]);
+        if (amount < 0 || amount >= size) cannot_encode(instr.print());
+        uint32_t shift = static_cast<uint32_t>(amount);
+        if (op == "lsl") return bitfield(false, rd, rn, (size - shift) % size, size - 1 - shift);
+        return bitfield(op == "asr", rd, rn, shift, size - 1);
+    }
+    if (op == "sxtw") {
+        expect(2, 2);
+        Register rd = parse_register(ops[0]);
+        return bitfield(true, rd, parse_register(ops[1]), 0, 31);
+    }
+    if (op == "and") {
+        // Only masks of the low bits (2^k - 1) as immediates.
+        expect(3, 3);
+        Register rd = parse_register(ops[0]);
+        uint64_t mask = static_cast<uint64_t>(parse_immediate(ops[2]));
+        uint32_t ones = 0;
+        while (ones < 64 && (mask >> ones & 1)) ++ones;
+        if (ones == 0 || ones >= (rd.wide ? 64u : 32u) || (mask >> ones) != 0) cannot_encode(instr.print());
+        return sf(rd) | 0x12000000 | (rd.wide ? 1u << 22 : 0) | (ones - 1) << 10 | parse_register(ops[1]).num << 5 | rd.num;
+    }
+    if (op == "csel" || op == "csinc") {
+        expect(4, 4);
+        Register rd = parse_register(ops[0]);
+        uint32_t increment = op == "csinc" ? 1u << 10 : 0;
+        return sf(rd) | 0x1A800000 | parse_register(ops[2]).num << 16 | condition_code(ops[3]) << 12 | increment | parse_register(ops[1]).num << 5 | rd.num;
+    }
+    if (op == "cset") {
+        expect(2, 2);
+        Register rd = parse_register(ops[0]);
+        return sf(rd) | 0x1A9F07E0 | (condition_code(ops[1]) ^ 1) << 12 | rd.num;
+    }
+    if (op == "b" || op == "bl") {
+        expect(1, 1);
+        if (op == "b" && m_labels.count(ops[0])) return 0x14000000 | branch_offset(ops[0], offset, 26);
+        relocate(offset, ops[0], op == "bl" ? ElfObject::R_AARCH64_CALL26 : ElfObject::R_AARCH64_JUMP26);
+        return op == "bl" ? 0x94000000 : 0x14000000;
+    }
+    if (op.rfind("b.", 0) == 0) {
+        expect(1, 1);
+        return 0x54000000 | branch_offset(ops[0], offset, 19) << 5 | condition_code(op.substr(2));
+    }
+    if (op == "cbz" || op == "cbnz") {
+        expect(2, 2);
+        Register rt = parse_register(ops[0]);
+        return sf(rt) | 0x34000000 | (op == "cbnz" ? 1u << 24 : 0) | branch_offset(ops[1], offset, 19) << 5 | rt.num;
+    }
+    if (op == "ret") {
+        expect(0, 0);
+        return 0xD65F03C0;
+    }
+    if (op == "adrp") {
+        expect(2, 2);
+        std::string symbol;
+        if (!symbol_operand(ops[1], "@PAGE", symbol)) cannot_encode(instr.print());
+        relocate(offset, symbol, ElfObject::R_AARCH64_ADR_PREL_PG_HI21);
+        return 0x90000000 | parse_register(ops[0]).num;
+    }
+    if (op == "ldr" || op == "str" || op == "ldrsw" || op == "ldrb" || op == "strb") {
+        // Offset, register offset, or post-index ("[x9]", "#4").
+        expect(2, 3);
+        Register rt = parse_register(ops[0]);
+        Memory mem = parse_memory(ops[1]);
+        if (mem.pre_index) cannot_encode(instr.print());
+        uint32_t size_log2 = op == "ldrsw" ? 2 : (op == "ldrb" || op == "strb") ? 0 : rt.wide ? 3 : 2;
+        uint32_t opc = op == "ldrsw" ? 2 : op[0] == 'l' ? 1 : 0;
+        uint32_t base = size_log2 << 30 | opc << 22 | mem.base.num << 5 | rt.num;
+        if (ops.size() == 3) {
+            long long imm = parse_immediate(ops[2]);
+            if (mem.indexed || mem.offset != 0 || imm < -256 || imm > 255) cannot_encode(instr.print());
+            return base | 0x38000400 | (static_cast<uint32_t>(imm) & 0x1ff) << 12;
+        }
+        if (mem.indexed) {
+            if (mem.shift != -1 && mem.shift != 0 && static_cast<uint32_t>(mem.shift) != size_log2) cannot_encode(instr.print());
+            uint32_t scaled = mem.shift > 0 ? 1u << 12 : 0;
+            return base | 0x38206800 | mem.index.num << 16 | scaled;
+        }
+        long long size = 1LL << size_log2;
+        if (mem.offset >= 0 && mem.offset % size == 0 && mem.offset / size <= 4095) {
+            return base | 0x39000000 | static_cast<uint32_t>(mem.offset / size) << 10;
+        }
+        if (mem.offset >= -256 && mem.offset <= 255) {
+            return base | 0x38000000 | (static_cast<uint32_t>(mem.offset) & 0x1ff) << 12;
+        }
+        cannot_encode(instr.print());
+    }
+    if (op == "ldp" || op == "stp") {
+        // 64-bit pairs: signed offset, pre-index ("[sp, #-16]!") or
+        // post-index ("[sp]", "#16").
+        expect(3, 4);
+        Register rt = parse_register(ops[0]);
+        Register rt2 = parse_register(ops[1]);
+        Memory mem = parse_memory(ops[2]);
+        if (!rt.wide || mem.indexed) cannot_encode(instr.print());
+        uint32_t mode = mem.pre_index ? 0x29800000 : 0x29000000;
+        long long imm = mem.offset;
+        if (ops.size() == 4) {
+            if (mem.pre_index || mem.offset != 0) cannot_encode(instr.print());
+            mode = 0x28800000;
+            imm = parse_immediate(ops[3]);
+        }
+        if (imm % 8 || imm / 8 < -64 || imm / 8 > 63) cannot_encode(instr.print());
+        uint32_t load = op == "ldp" ? 1u << 22 : 0;
+        return 2u << 30 | mode | load | (static_cast<uint32_t>(imm / 8) & 0x7f) << 15 | rt2.num << 10 | mem.base.num << 5 | rt.num;
+    }
+    cannot_encode(instr.print());
+}
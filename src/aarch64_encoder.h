@@ -0,0 +1,38 @@
+#pragma once
+#include "elf_object.h"
+#include "peephole.h"
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// AArch64 machine code for the instructions the Generator emits.
+//
+// Each function's AsmInstr list is encoded into the .text of an ElfObject,
+// starting with its label, which becomes a global function symbol. Local
+// labels (".L<n>") are resolved by the encoder itself; branches and calls to
+// functions, and the adrp/add pair addressing a data symbol ("sym@PAGE",
+// "sym@PAGEOFF"), are left to the linker as relocations. Symbols lose the
+// leading underscore of Apple assembly, so "_main" is "main" in the object.
+//
+// Only the forms the Generator and the Peephole produce are supported; any
+// other instruction is an internal error. listing() shows every encoded
+// instruction next to its offset and encoding, like a disassembler would.
+class AArch64Encoder {
+public:
+    explicit AArch64Encoder(ElfObject& object);
+    void add_function(const std::vector<AsmInstr>& code);
+    std::string listing() const { return m_listing.str(); }
+
+private:
+    ElfObject& m_object;
+    std::vector<uint8_t>& m_text;
+    std::unordered_map<std::string, uint64_t> m_labels;   // Local labels of the current function
+    std::stringstream m_listing;
+
+    uint32_t encode(const AsmInstr& instr, uint64_t offset);
+    // Offset of local label `label` from the instruction at `offset`, in
+    // instructions, checked to fit `bits` signed bits.
+    uint32_t branch_offset(const std::string& label, uint64_t offset, int bits) const;
+    void relocate(uint64_t offset, const std::string& symbol, uint32_t type);
+};
@@ -0,0 +1,342 @@
+#include "algebraic_simplifier.h"
+#include "ast_utils.h"
+#include <cstdint>
+
+namespace {
+
+// Two's complement wrap-around at 32 bits, the width of int in every backend.
+int wrap(int64_t value) {
+    return static_cast<int>(static_cast<uint32_t>(value));
+}
+
+bool is_int_lit(const Expr* expr) {
+    return dynamic_cast<const IntLitExpr*>(expr) != nullptr;
+}
+
+int log2_exact(int value) {
+    if (value <= 0 || (value & (value - 1)) != 0) return -1;
+    int k = 0;
+    while ((1 << k) != value) ++k;
+    return k;
+}
+
+// Signed magic number and shift for division by d (Hacker's Delight, 10-1).
+// Requires 2 <= d < 2^31 and d not a power of two.
+struct Magic {
+    int multiplier;
+    int shift;
+};
+
+Magic signed_magic(int d) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = static_cast<uint32_t>(d);
+    uint32_t t = two31;
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc;
+    uint32_t r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad;
+    uint32_t r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do {
+        p = p + 1;
+        q1 = 2 * q1;
+        r1 = 2 * r1;
+        if (r1 >= anc) {
+            q1 = q1 + 1;
+            r1 = r1 - anc;
+        }
+        q2 = 2 * q2;
+        r2 = 2 * r2;
+        if (r2 >= ad) {
+            q2 = q2 + 1;
+            r2 = r2 - ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    return { static_cast<int>(q2 + 1), p - 32 };
+}
+
+std::unique_ptr<Expr> make_int(int value, int line, int col) {
+    return std::make_unique<IntLitExpr>(value, line, col);
+}
+
+std::unique_ptr<Expr> make_bin(std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs, TokenType op, int line, int col) {
+    return std::make_unique<BinaryExpr>(std::move(lhs), std::move(rhs), op, line, col);
+}
+
+} // namespace
+
+AlgebraicSimplifier::AlgebraicSimplifier(Program* program) : m_prog(program) {
+}
+
+void AlgebraicSimplifier::simplify() {
+    for (auto& func : m_prog->functions) {
+        simplify_stmt(func->body.get());
+    }
+    for (auto& layer : m_prog->layers) {
+        simplify_stmt(layer->body.get());
+    }
+    for (auto& global : m_prog->globals) {
+        simplify_stmt(global.get());
+    }
+}
+
+// Strength reduction runs once the algebraic rewrites have settled so that
+// it sees fully folded constants ((x * 2) * 4 becomes x << 3, not (x << 1) * 4).
+void AlgebraicSimplifier::simplify_stmt(Stmt* stmt) {
+    for_each_expr(stmt, [this](std::unique_ptr<Expr>& expr) {
+        simplify_expr(expr);
+        reduce_expr(expr);
+    });
+}
+
+void AlgebraicSimplifier::simplify_expr(std::unique_ptr<Expr>& expr) {
+    if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr.get())) {
+        simplify_expr(arr->index);
+        return;
+    }
+    if (auto* call = dynamic_cast<CallExpr*>(expr.get())) {
+        for (auto& arg : call->args) simplify_expr(arg);
+        return;
+    }
+    if (auto* unary = dynamic_cast<UnaryExpr*>(expr.get())) {
+        simplify_expr(unary->operand);
+        return;
+    }
+    auto* bin = dynamic_cast<BinaryExpr*>(expr.get());
+    if (!bin) return;
+
+    simplify_expr(bin->lhs);
+    simplify_expr(bin->rhs);
+
+    canonicalize(bin);
+    if (auto folded = fold_constants(bin)) {
+        expr = std::move(folded);
+        return;
+    }
+    if (auto reassociated = reassociate(expr)) {
+        expr = std::move(reassociated);
+        simplify_expr(expr);
+        return;
+    }
+    if (auto simplified = apply_identities(bin)) {
+        expr = std::move(simplified);
+    }
+}
+
+void AlgebraicSimplifier::reduce_expr(std::unique_ptr<Expr>& expr) {
+    if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr.get())) {
+        reduce_expr(arr->index);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr.get())) {
+        for (auto& arg : call->args) reduce_expr(arg);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr.get())) {
+        reduce_expr(unary->operand);
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr.get())) {
+        reduce_expr(bin->lhs);
+        reduce_expr(bin->rhs);
+        if (auto reduced = reduce_strength(bin)) {
+            expr = std::move(reduced);
+        }
+    }
+}
+
+// Moves literals to the right-hand side and turns `x - c` into `x + (-c)` so
+// that later rules only have to look for one shape.
+void AlgebraicSimplifier::canonicalize(BinaryExpr* bin) {
+    bool lhs_lit = is_int_lit(bin->lhs.get());
+    bool rhs_lit = is_int_lit(bin->rhs.get());
+    if (bin->op == TokenType::minus && rhs_lit && !lhs_lit) {
+        auto* rhs = static_cast<IntLitExpr*>(bin->rhs.get());
+        if (rhs->value != INT32_MIN) {
+            bin->op = TokenType::plus;
+            rhs->value = -rhs->value;
+        }
+        return;
+    }
+    if (!lhs_lit || rhs_lit) return;
+    switch (bin->op) {
+    case TokenType::plus:
+    case TokenType::star:
+    case TokenType::eq_eq:
+    case TokenType::neq:
+        std::swap(bin->lhs, bin->rhs);
+        break;
+    case TokenType::lt:
+        std::swap(bin->lhs, bin->rhs);
+        bin->op = TokenType::gt;
+        break;
+    case TokenType::gt:
+        std::swap(bin->lhs, bin->rhs);
+        bin->op = TokenType::lt;
+        break;
+    default:
+        break;
+    }
+}
+
+std::unique_ptr<Expr> AlgebraicSimplifier::fold_constants(BinaryExpr* bin) {
+    auto lhs = int_value(bin->lhs.get());
+    auto rhs = int_value(bin->rhs.get());
+    if (!lhs || !rhs) return nullptr;
+    int64_t a = *lhs;
+    int64_t b = *rhs;
+    switch (bin->op) {
+    case TokenType::plus: return make_int(wrap(a + b), bin->line, bin->col);
+    case TokenType::minus: return make_int(wrap(a - b), bin->line, bin->col);
+    case TokenType::star: return make_int(wrap(a * b), bin->line, bin->col);
+    case TokenType::slash:
+        if (b == 0 || (a == INT32_MIN && b == -1)) return nullptr;
+        return make_int(static_cast<int>(a / b), bin->line, bin->col);
+    case TokenType::shl: return make_int(wrap(static_cast<int64_t>(static_cast<uint32_t>(a) << (b & 31))), bin->line, bin->col);
+    case TokenType::ashr: return make_int(static_cast<int>(a) >> (b & 31), bin->line, bin->col);
+    case TokenType::lshr: return make_int(static_cast<int>(static_cast<uint32_t>(a) >> (b & 31)), bin->line, bin->col);
+    case TokenType::mulhi: return make_int(static_cast<int>((a * b) >> 32), bin->line, bin->col);
+    case TokenType::eq_eq: return std::make_unique<BoolLitExpr>(a == b, bin->line, bin->col);
+    case TokenType::neq: return std::make_unique<BoolLitExpr>(a != b, bin->line, bin->col);
+    case TokenType::lt: return std::make_unique<BoolLitExpr>(a < b, bin->line, bin->col);
+    case TokenType::gt: return std::make_unique<BoolLitExpr>(a > b, bin->line, bin->col);
+    default: return nullptr;
+    }
+}
+
+// Folds nested constants and floats them outwards, e.g.
+//   (x + 1) + 2  ->  x + 3
+//   (x * 2) * 4  ->  x * 8
+//   (x + 1) + y  ->  (x + y) + 1
+//   (x + 1) == 3 ->  x == 2
+std::unique_ptr<Expr> AlgebraicSimplifier::reassociate(std::unique_ptr<Expr>& expr) {
+    auto* bin = static_cast<BinaryExpr*>(expr.get());
+    auto* inner = dynamic_cast<BinaryExpr*>(bin->lhs.get());
+    auto rhs = int_value(bin->rhs.get());
+
+    if (inner && rhs) {
+        auto c1 = int_value(inner->rhs.get());
+        if (c1 && inner->op == TokenType::plus && bin->op == TokenType::plus) {
+            return make_bin(std::move(inner->lhs), make_int(wrap(static_cast<int64_t>(*c1) + *rhs), bin->line, bin->col),
+                            TokenType::plus, bin->line, bin->col);
+        }
+        if (c1 && inner->op == TokenType::star && bin->op == TokenType::star) {
+            return make_bin(std::move(inner->lhs), make_int(wrap(static_cast<int64_t>(*c1) * *rhs), bin->line, bin->col),
+                            TokenType::star, bin->line, bin->col);
+        }
+        if (c1 && inner->op == TokenType::plus && (bin->op == TokenType::eq_eq || bin->op == TokenType::neq)) {
+            return make_bin(std::move(inner->lhs), make_int(wrap(static_cast<int64_t>(*rhs) - *c1), bin->line, bin->col),
+                            bin->op, bin->line, bin->col);
+        }
+        return nullptr;
+    }
+
+    if (bin->op != TokenType::plus || rhs) return nullptr;
+    if (inner && inner->op == TokenType::plus && is_int_lit(inner->rhs.get())) {
+        auto constant = std::move(inner->rhs);
+        auto sum = make_bin(std::move(inner->lhs), std::move(bin->rhs), TokenType::plus, bin->line, bin->col);
+        return make_bin(std::move(sum), std::move(constant), TokenType::plus, bin->line, bin->col);
+    }
+    auto* rhs_inner = dynamic_cast<BinaryExpr*>(bin->rhs.get());
+    if (rhs_inner && rhs_inner->op == TokenType::plus && is_int_lit(rhs_inner->rhs.get())) {
+        auto constant = std::move(rhs_inner->rhs);
+        auto sum = make_bin(std::move(bin->lhs), std::move(rhs_inner->lhs), TokenType::plus, bin->line, bin->col);
+        return make_bin(std::move(sum), std::move(constant), TokenType::plus, bin->line, bin->col);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<Expr> AlgebraicSimplifier::apply_identities(BinaryExpr* bin) {
+    auto rhs = int_value(bin->rhs.get());
+    bool lhs_pure = is_pure(bin->lhs.get());
+
+    if (rhs) {
+        if (*rhs == 0 && (bin->op == TokenType::plus || bin->op == TokenType::minus)) return std::move(bin->lhs);
+        if (*rhs == 1 && (bin->op == TokenType::star || bin->op == TokenType::slash)) return std::move(bin->lhs);
+        if (*rhs == 0 && bin->op == TokenType::star && lhs_pure) return make_int(0, bin->line, bin->col);
+        if (*rhs == 0 && (bin->op == TokenType::shl || bin->op == TokenType::ashr || bin->op == TokenType::lshr)) {
+            return std::move(bin->lhs);
+        }
+        if (*rhs == -1 && (bin->op == TokenType::star || bin->op == TokenType::slash)) {
+            return make_bin(make_int(0, bin->line, bin->col), std::move(bin->lhs), TokenType::minus, bin->line, bin->col);
+        }
+    }
+
+    // Boolean short-circuit identities; a literal left operand decides the
+    // result before the right operand is ever evaluated.
+    auto* l_bool = dynamic_cast<BoolLitExpr*>(bin->lhs.get());
+    auto* r_bool = dynamic_cast<BoolLitExpr*>(bin->rhs.get());
+    if (bin->op == TokenType::amp_amp) {
+        if (l_bool) return l_bool->value ? std::move(bin->rhs) : std::move(bin->lhs);
+        if (r_bool && r_bool->value) return std::move(bin->lhs);
+        if (r_bool && !r_bool->value && lhs_pure) return std::move(bin->rhs);
+    } else if (bin->op == TokenType::pipe_pipe) {
+        if (l_bool) return l_bool->value ? std::move(bin->lhs) : std::move(bin->rhs);
+        if (r_bool && !r_bool->value) return std::move(bin->lhs);
+        if (r_bool && r_bool->value && lhs_pure) return std::move(bin->rhs);
+    }
+
+    // x - x, x == x, x < x, ... for side-effect free operands.
+    if (lhs_pure && exprs_equal(bin->lhs.get(), bin->rhs.get())) {
+        switch (bin->op) {
+        case TokenType::minus: return make_int(0, bin->line, bin->col);
+        case TokenType::eq_eq: return std::make_unique<BoolLitExpr>(true, bin->line, bin->col);
+        case TokenType::neq:
+        case TokenType::lt:
+        case TokenType::gt: return std::make_unique<BoolLitExpr>(false, bin->line, bin->col);
+        default: break;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<Expr> AlgebraicSimplifier::reduce_strength(BinaryExpr* bin) {
+    auto rhs = int_value(bin->rhs.get());
+    if (!rhs) return nullptr;
+
+    if (bin->op == TokenType::star) {
+        int k = log2_exact(*rhs);
+        if (k > 0) {
+            return make_bin(std::move(bin->lhs), make_int(k, bin->line, bin->col), TokenType::shl, bin->line, bin->col);
+        }
+        return nullptr;
+    }
+
+    // The division sequences read the dividend more than once, so only
+    // expand them when re-evaluating it is cheap and side-effect free.
+    if (bin->op == TokenType::slash && *rhs != 0 && *rhs != 1 && *rhs != -1 && *rhs != INT32_MIN &&
+        is_pure(bin->lhs.get()) && expr_size(bin->lhs.get()) <= 3) {
+        return divide_by_constant(std::move(bin->lhs), *rhs, bin->line, bin->col);
+    }
+    return nullptr;
+}
+
+// Builds a truncating signed division by a constant out of shifts, adds and
+// a multiply-high:
+//   n / 2^k -> (n + ((n >> 31) >>> (32 - k))) >> k
+//   n / d   -> ((mulhi(n, M) [+ n]) >> s) + (n >>> 31)
+std::unique_ptr<Expr> AlgebraicSimplifier::divide_by_constant(std::unique_ptr<Expr> n, int d, int line, int col) {
+    if (d < 0) {
+        return make_bin(make_int(0, line, col), divide_by_constant(std::move(n), -d, line, col), TokenType::minus, line, col);
+    }
+
+    int k = log2_exact(d);
+    if (k > 0) {
+        std::unique_ptr<Expr> bias;
+        if (k == 1) {
+            bias = make_bin(clone_expr(n.get()), make_int(31, line, col), TokenType::lshr, line, col);
+        } else {
+            auto sign = make_bin(clone_expr(n.get()), make_int(31, line, col), TokenType::ashr, line, col);
+            bias = make_bin(std::move(sign), make_int(32 - k, line, col), TokenType::lshr, line, col);
+        }
+        auto biased = make_bin(std::move(n), std::move(bias), TokenType::plus, line, col);
+        return make_bin(std::move(biased), make_int(k, line, col), TokenType::ashr, line, col);
+    }
+
+    Magic magic = signed_magic(d);
+    auto q = make_bin(clone_expr(n.get()), make_int(magic.multiplier, line, col), TokenType::mulhi, line, col);
+    if (magic.multiplier < 0) {
+        q = make_bin(std::move(q), clone_expr(n.get()), TokenType::plus, line, col);
+    }
+    if (magic.shift > 0) {
+        q = make_bin(std::move(q), make_int(magic.shift, line, col), TokenType::ashr, line, col);
+    }
+    auto sign = make_bin(std::move(n), make_int(31, line, col), TokenType::lshr, line, col);
+    return make_bin(std::move(q), std::move(sign), TokenType::plus, line, col);
+}
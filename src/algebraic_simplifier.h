@@ -0,0 +1,29 @@
+#pragma once
+#include "parser.h"
+#include <memory>
+
+// Rewrites integer expressions in place:
+//  - canonicalises constants to the right of commutative operators,
+//  - reassociates and folds nested constants ((x + 1) + 2 -> x + 3),
+//  - removes algebraic identities (x * 1, x + 0, x - x, ...),
+//  - strength-reduces multiplication by 2^k into shifts and division by
+//    constants into multiply-high "magic number" sequences.
+class AlgebraicSimplifier {
+public:
+    explicit AlgebraicSimplifier(Program* program);
+    void simplify();
+
+private:
+    Program* m_prog;
+
+    void simplify_stmt(Stmt* stmt);
+    void simplify_expr(std::unique_ptr<Expr>& expr);
+    void reduce_expr(std::unique_ptr<Expr>& expr);
+
+    void canonicalize(BinaryExpr* bin);
+    std::unique_ptr<Expr> fold_constants(BinaryExpr* bin);
+    std::unique_ptr<Expr> reassociate(std::unique_ptr<Expr>& expr);
+    std::unique_ptr<Expr> apply_identities(BinaryExpr* bin);
+    std::unique_ptr<Expr> reduce_strength(BinaryExpr* bin);
+    std::unique_ptr<Expr> divide_by_constant(std::unique_ptr<Expr> dividend, int divisor, int line, int col);
+};
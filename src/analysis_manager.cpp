@@ -0,0 +1,34 @@
+#include "analysis_manager.h"
+#include "ast_utils.h"
+
+AnalysisManager::AnalysisManager(Program* program) : m_prog(program) {
+}
+
+void AnalysisManager::set_program(Program* program) {
+    m_prog = program;
+}
+
+void AnalysisManager::invalidate() {
+    m_side_effect_free.reset();
+    m_pure.reset();
+}
+
+const std::unordered_set<std::string>& AnalysisManager::side_effect_free() {
+    if (m_side_effect_free) {
+        ++m_hits;
+    } else {
+        ++m_misses;
+        m_side_effect_free = side_effect_free_functions(m_prog);
+    }
+    return *m_side_effect_free;
+}
+
+const std::unordered_set<std::string>& AnalysisManager::pure() {
+    if (m_pure) {
+        ++m_hits;
+    } else {
+        ++m_misses;
+        m_pure = pure_functions(m_prog);
+    }
+    return *m_pure;
+}
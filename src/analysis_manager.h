@@ -0,0 +1,40 @@
+#pragma once
+#include "parser.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Caches the whole-program facts that several AST passes query.
+//
+// Each analysis is computed on first use and kept until invalidate() is
+// called, which the pass manager does after a pass that changed the program
+// and does not declare the analyses preserved.
+class AnalysisManager {
+public:
+    explicit AnalysisManager(Program* program);
+
+    // Points the cache at a rebuilt program without dropping its results.
+    void set_program(Program* program);
+    void invalidate();
+
+    // See side_effect_free_functions() and pure_functions() in ast_utils.h.
+    const std::unordered_set<std::string>& side_effect_free();
+    const std::unordered_set<std::string>& pure();
+
+    // Results of calls run by the ConstantEvaluator, keyed by call text;
+    // nullopt for calls that could not be evaluated. Every pass preserves the
+    // meaning of the program, so invalidate() keeps them.
+    std::unordered_map<std::string, std::optional<long long>>& evaluated_calls() { return m_evaluated_calls; }
+
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+
+private:
+    Program* m_prog;
+    std::optional<std::unordered_set<std::string>> m_side_effect_free;
+    std::optional<std::unordered_set<std::string>> m_pure;
+    std::unordered_map<std::string, std::optional<long long>> m_evaluated_calls;
+    int m_hits = 0;
+    int m_misses = 0;
+};
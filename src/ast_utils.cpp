@@ -0,0 +1,463 @@
+#include "ast_utils.h"
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+
+std::unique_ptr<Expr> clone_expr(const Expr* expr) {
+    if (!expr) return nullptr;
+    if (const auto* int_lit = dynamic_cast<const IntLitExpr*>(expr)) {
+        return std::make_unique<IntLitExpr>(int_lit->value, int_lit->line, int_lit->col);
+    }
+    if (const auto* bool_lit = dynamic_cast<const BoolLitExpr*>(expr)) {
+        return std::make_unique<BoolLitExpr>(bool_lit->value, bool_lit->line, bool_lit->col);
+    }
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) {
+        return std::make_unique<IdentifierExpr>(ident->name, ident->line, ident->col);
+    }
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        return std::make_unique<ArrayAccessExpr>(arr->name, clone_expr(arr->index.get()), arr->line, arr->col);
+    }
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        std::vector<std::unique_ptr<Expr>> args;
+        for (const auto& arg : call->args) {
+            args.push_back(clone_expr(arg.get()));
+        }
+        return std::make_unique<CallExpr>(call->callee, std::move(args), call->line, call->col);
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        return std::make_unique<UnaryExpr>(clone_expr(unary->operand.get()), unary->op, unary->line, unary->col);
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        return std::make_unique<BinaryExpr>(clone_expr(bin->lhs.get()), clone_expr(bin->rhs.get()), bin->op, bin->line, bin->col);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<Stmt> clone_stmt(const Stmt* stmt) {
+    if (!stmt) return nullptr;
+    if (const auto* ret = dynamic_cast<const ReturnStmt*>(stmt)) {
+        auto copy = std::make_unique<ReturnStmt>(clone_expr(ret->expr.get()), ret->line, ret->col);
+        copy->tail_call = ret->tail_call;
+        return copy;
+    }
+    if (const auto* expr_stmt = dynamic_cast<const ExprStmt*>(stmt)) {
+        return std::make_unique<ExprStmt>(clone_expr(expr_stmt->expr.get()), expr_stmt->line, expr_stmt->col);
+    }
+    if (const auto* decl = dynamic_cast<const VarDecl*>(stmt)) {
+        return std::make_unique<VarDecl>(decl->name, decl->type, clone_expr(decl->init.get()), decl->line, decl->col, decl->array_size);
+    }
+    if (const auto* assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        return std::make_unique<AssignStmt>(assign->name, clone_expr(assign->value.get()), assign->line, assign->col);
+    }
+    if (const auto* arr_assign = dynamic_cast<const ArrayAssignStmt*>(stmt)) {
+        return std::make_unique<ArrayAssignStmt>(arr_assign->name, clone_expr(arr_assign->index.get()),
+                                                 clone_expr(arr_assign->value.get()), arr_assign->line, arr_assign->col);
+    }
+    if (const auto* ptr_assign = dynamic_cast<const PointerAssignStmt*>(stmt)) {
+        return std::make_unique<PointerAssignStmt>(clone_expr(ptr_assign->ptr_expr.get()), clone_expr(ptr_assign->value.get()),
+                                                   ptr_assign->line, ptr_assign->col);
+    }
+    if (const auto* scope = dynamic_cast<const ScopeStmt*>(stmt)) {
+        std::vector<std::unique_ptr<Stmt>> stmts;
+        for (const auto& s : scope->stmts) {
+            stmts.push_back(clone_stmt(s.get()));
+        }
+        return std::make_unique<ScopeStmt>(std::move(stmts), scope->line, scope->col);
+    }
+    if (const auto* if_stmt = dynamic_cast<const IfStmt*>(stmt)) {
+        return std::make_unique<IfStmt>(clone_expr(if_stmt->condition.get()), clone_stmt(if_stmt->then_stmt.get()),
+                                        clone_stmt(if_stmt->else_stmt.get()), if_stmt->line, if_stmt->col);
+    }
+    if (const auto* while_stmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        return std::make_unique<WhileStmt>(clone_expr(while_stmt->condition.get()), clone_stmt(while_stmt->body.get()),
+                                           while_stmt->line, while_stmt->col);
+    }
+    if (const auto* for_stmt = dynamic_cast<const ForStmt*>(stmt)) {
+        return std::make_unique<ForStmt>(clone_stmt(for_stmt->init.get()), clone_expr(for_stmt->condition.get()),
+                                         clone_stmt(for_stmt->increment.get()), clone_stmt(for_stmt->body.get()),
+                                         for_stmt->line, for_stmt->col);
+    }
+    return nullptr;
+}
+
+bool exprs_equal(const Expr* a, const Expr* b) {
+    if (!a || !b) return a == b;
+    if (const auto* x = dynamic_cast<const IntLitExpr*>(a)) {
+        const auto* y = dynamic_cast<const IntLitExpr*>(b);
+        return y && x->value == y->value;
+    }
+    if (const auto* x = dynamic_cast<const BoolLitExpr*>(a)) {
+        const auto* y = dynamic_cast<const BoolLitExpr*>(b);
+        return y && x->value == y->value;
+    }
+    if (const auto* x = dynamic_cast<const IdentifierExpr*>(a)) {
+        const auto* y = dynamic_cast<const IdentifierExpr*>(b);
+        return y && x->name == y->name;
+    }
+    if (const auto* x = dynamic_cast<const ArrayAccessExpr*>(a)) {
+        const auto* y = dynamic_cast<const ArrayAccessExpr*>(b);
+        return y && x->name == y->name && exprs_equal(x->index.get(), y->index.get());
+    }
+    if (const auto* x = dynamic_cast<const CallExpr*>(a)) {
+        const auto* y = dynamic_cast<const CallExpr*>(b);
+        if (!y || x->callee != y->callee || x->args.size() != y->args.size()) return false;
+        for (size_t i = 0; i < x->args.size(); ++i) {
+            if (!exprs_equal(x->args[i].get(), y->args[i].get())) return false;
+        }
+        return true;
+    }
+    if (const auto* x = dynamic_cast<const UnaryExpr*>(a)) {
+        const auto* y = dynamic_cast<const UnaryExpr*>(b);
+        return y && x->op == y->op && exprs_equal(x->operand.get(), y->operand.get());
+    }
+    if (const auto* x = dynamic_cast<const BinaryExpr*>(a)) {
+        const auto* y = dynamic_cast<const BinaryExpr*>(b);
+        return y && x->op == y->op && exprs_equal(x->lhs.get(), y->lhs.get()) && exprs_equal(x->rhs.get(), y->rhs.get());
+    }
+    return false;
+}
+
+size_t expr_hash(const Expr* expr) {
+    auto combine = [](size_t seed, size_t value) { return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2)); };
+    if (!expr) return 0;
+    if (const auto* int_lit = dynamic_cast<const IntLitExpr*>(expr)) return combine(1, std::hash<int>()(int_lit->value));
+    if (const auto* bool_lit = dynamic_cast<const BoolLitExpr*>(expr)) return combine(2, bool_lit->value);
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) return combine(3, std::hash<std::string>()(ident->name));
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        return combine(combine(4, std::hash<std::string>()(arr->name)), expr_hash(arr->index.get()));
+    }
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        size_t seed = combine(5, std::hash<std::string>()(call->callee));
+        for (const auto& arg : call->args) seed = combine(seed, expr_hash(arg.get()));
+        return seed;
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        return combine(combine(6, static_cast<size_t>(unary->op)), expr_hash(unary->operand.get()));
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        size_t seed = combine(7, static_cast<size_t>(bin->op));
+        return combine(combine(seed, expr_hash(bin->lhs.get())), expr_hash(bin->rhs.get()));
+    }
+    return 0;
+}
+
+size_t stmt_hash(const Stmt* stmt) {
+    auto combine = [](size_t seed, size_t value) { return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2)); };
+    auto name_hash = [](const std::string& name) { return std::hash<std::string>()(name); };
+    if (!stmt) return 0;
+    if (const auto* ret = dynamic_cast<const ReturnStmt*>(stmt)) return combine(combine(11, ret->tail_call), expr_hash(ret->expr.get()));
+    if (const auto* expr_stmt = dynamic_cast<const ExprStmt*>(stmt)) return combine(12, expr_hash(expr_stmt->expr.get()));
+    if (const auto* decl = dynamic_cast<const VarDecl*>(stmt)) {
+        size_t seed = combine(combine(13, name_hash(decl->name)), static_cast<size_t>(decl->type.base) * 8 + decl->type.ptr_level);
+        return combine(combine(seed, decl->array_size.value_or(-1)), expr_hash(decl->init.get()));
+    }
+    if (const auto* assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        return combine(combine(14, name_hash(assign->name)), expr_hash(assign->value.get()));
+    }
+    if (const auto* arr_assign = dynamic_cast<const ArrayAssignStmt*>(stmt)) {
+        size_t seed = combine(combine(15, name_hash(arr_assign->name)), expr_hash(arr_assign->index.get()));
+        return combine(seed, expr_hash(arr_assign->value.get()));
+    }
+    if (const auto* ptr_assign = dynamic_cast<const PointerAssignStmt*>(stmt)) {
+        return combine(combine(16, expr_hash(ptr_assign->ptr_expr.get())), expr_hash(ptr_assign->value.get()));
+    }
+    if (const auto* scope = dynamic_cast<const ScopeStmt*>(stmt)) {
+        size_t seed = combine(17, scope->stmts.size());
+        for (const auto& s : scope->stmts) seed = combine(seed, stmt_hash(s.get()));
+        return seed;
+    }
+    if (const auto* if_stmt = dynamic_cast<const IfStmt*>(stmt)) {
+        size_t seed = combine(combine(18, expr_hash(if_stmt->condition.get())), stmt_hash(if_stmt->then_stmt.get()));
+        return combine(seed, stmt_hash(if_stmt->else_stmt.get()));
+    }
+    if (const auto* while_stmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        return combine(combine(19, expr_hash(while_stmt->condition.get())), stmt_hash(while_stmt->body.get()));
+    }
+    if (const auto* for_stmt = dynamic_cast<const ForStmt*>(stmt)) {
+        size_t seed = combine(combine(20, stmt_hash(for_stmt->init.get())), expr_hash(for_stmt->condition.get()));
+        return combine(combine(seed, stmt_hash(for_stmt->increment.get())), stmt_hash(for_stmt->body.get()));
+    }
+    return 0;
+}
+
+bool is_pure(const Expr* expr) {
+    if (!expr) return true;
+    if (dynamic_cast<const CallExpr*>(expr)) return false;
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) return is_pure(arr->index.get());
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return is_pure(unary->operand.get());
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) return is_pure(bin->lhs.get()) && is_pure(bin->rhs.get());
+    return true;
+}
+
+int expr_size(const Expr* expr) {
+    if (!expr) return 0;
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) return 1 + expr_size(arr->index.get());
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        int size = 1;
+        for (const auto& arg : call->args) size += expr_size(arg.get());
+        return size;
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return 1 + expr_size(unary->operand.get());
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) return 1 + expr_size(bin->lhs.get()) + expr_size(bin->rhs.get());
+    return 1;
+}
+
+int stmt_size(const Stmt* stmt) {
+    if (!stmt) return 0;
+    int size = 1;
+    if (const auto* scope = dynamic_cast<const ScopeStmt*>(stmt)) {
+        for (const auto& s : scope->stmts) size += stmt_size(s.get());
+        return size;
+    }
+    if (const auto* if_stmt = dynamic_cast<const IfStmt*>(stmt)) {
+        return size + expr_size(if_stmt->condition.get()) + stmt_size(if_stmt->then_stmt.get()) +
+               stmt_size(if_stmt->else_stmt.get());
+    }
+    if (const auto* while_stmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        return size + expr_size(while_stmt->condition.get()) + stmt_size(while_stmt->body.get());
+    }
+    if (const auto* for_stmt = dynamic_cast<const ForStmt*>(stmt)) {
+        return size + stmt_size(for_stmt->init.get()) + expr_size(for_stmt->condition.get()) +
+               stmt_size(for_stmt->increment.get()) + stmt_size(for_stmt->body.get());
+    }
+    if (const auto* ret = dynamic_cast<const ReturnStmt*>(stmt)) return size + expr_size(ret->expr.get());
+    if (const auto* expr_stmt = dynamic_cast<const ExprStmt*>(stmt)) return size + expr_size(expr_stmt->expr.get());
+    if (const auto* decl = dynamic_cast<const VarDecl*>(stmt)) return size + expr_size(decl->init.get());
+    if (const auto* assign = dynamic_cast<const AssignStmt*>(stmt)) return size + expr_size(assign->value.get());
+    if (const auto* arr_assign = dynamic_cast<const ArrayAssignStmt*>(stmt)) {
+        return size + expr_size(arr_assign->index.get()) + expr_size(arr_assign->value.get());
+    }
+    if (const auto* ptr_assign = dynamic_cast<const PointerAssignStmt*>(stmt)) {
+        return size + expr_size(ptr_assign->ptr_expr.get()) + expr_size(ptr_assign->value.get());
+    }
+    return size;
+}
+
+std::optional<int> int_value(const Expr* expr) {
+    if (const auto* int_lit = dynamic_cast<const IntLitExpr*>(expr)) return int_lit->value;
+    return std::nullopt;
+}
+
+void for_each_expr(Stmt* stmt, const std::function<void(std::unique_ptr<Expr>&)>& fn) {
+    if (!stmt) return;
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        fn(ret->expr);
+    } else if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+        fn(expr_stmt->expr);
+    } else if (auto* decl = dynamic_cast<VarDecl*>(stmt)) {
+        if (decl->init) fn(decl->init);
+    } else if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+        fn(assign->value);
+    } else if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+        fn(arr_assign->index);
+        fn(arr_assign->value);
+    } else if (auto* ptr_assign = dynamic_cast<PointerAssignStmt*>(stmt)) {
+        fn(ptr_assign->ptr_expr);
+        fn(ptr_assign->value);
+    } else if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+        for (auto& s : scope->stmts) for_each_expr(s.get(), fn);
+    } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+        fn(if_stmt->condition);
+        for_each_expr(if_stmt->then_stmt.get(), fn);
+        for_each_expr(if_stmt->else_stmt.get(), fn);
+    } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+        fn(while_stmt->condition);
+        for_each_expr(while_stmt->body.get(), fn);
+    } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+        for_each_expr(for_stmt->init.get(), fn);
+        if (for_stmt->condition) fn(for_stmt->condition);
+        for_each_expr(for_stmt->increment.get(), fn);
+        for_each_expr(for_stmt->body.get(), fn);
+    }
+}
+
+namespace {
+
+template <typename S>
+void walk_stmts(S* stmt, const std::function<void(S*)>& fn) {
+    if (!stmt) return;
+    fn(stmt);
+    if (auto* scope = dynamic_cast<std::conditional_t<std::is_const_v<S>, const ScopeStmt, ScopeStmt>*>(stmt)) {
+        for (auto& s : scope->stmts) walk_stmts<S>(s.get(), fn);
+    } else if (auto* if_stmt = dynamic_cast<std::conditional_t<std::is_const_v<S>, const IfStmt, IfStmt>*>(stmt)) {
+        walk_stmts<S>(if_stmt->then_stmt.get(), fn);
+        walk_stmts<S>(if_stmt->else_stmt.get(), fn);
+    } else if (auto* while_stmt = dynamic_cast<std::conditional_t<std::is_const_v<S>, const WhileStmt, WhileStmt>*>(stmt)) {
+        walk_stmts<S>(while_stmt->body.get(), fn);
+    } else if (auto* for_stmt = dynamic_cast<std::conditional_t<std::is_const_v<S>, const ForStmt, ForStmt>*>(stmt)) {
+        walk_stmts<S>(for_stmt->init.get(), fn);
+        walk_stmts<S>(for_stmt->increment.get(), fn);
+        walk_stmts<S>(for_stmt->body.get(), fn);
+    }
+}
+
+} // namespace
+
+void for_each_stmt(Stmt* stmt, const std::function<void(Stmt*)>& fn) {
+    walk_stmts<Stmt>(stmt, fn);
+}
+
+void for_each_stmt(const Stmt* stmt, const std::function<void(const Stmt*)>& fn) {
+    walk_stmts<const Stmt>(stmt, fn);
+}
+
+void for_each_subexpr(const Expr* expr, const std::function<void(const Expr*)>& fn) {
+    if (!expr) return;
+    fn(expr);
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        for_each_subexpr(arr->index.get(), fn);
+    } else if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        for (const auto& arg : call->args) for_each_subexpr(arg.get(), fn);
+    } else if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        for_each_subexpr(unary->operand.get(), fn);
+    } else if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        for_each_subexpr(bin->lhs.get(), fn);
+        for_each_subexpr(bin->rhs.get(), fn);
+    }
+}
+
+bool takes_address(Function* func) {
+    bool found = false;
+    for_each_expr(func->body.get(), [&found](std::unique_ptr<Expr>& expr) {
+        for_each_subexpr(expr.get(), [&found](const Expr* e) {
+            const auto* unary = dynamic_cast<const UnaryExpr*>(e);
+            if (unary && unary->op == TokenType::amp) found = true;
+        });
+    });
+    return found;
+}
+
+std::unordered_set<std::string> side_effect_free_functions(Program* program) {
+    std::unordered_set<std::string> result;
+    std::unordered_map<std::string, std::vector<std::string>> callees;
+
+    // Local checks first: no output, no stores through pointers and no
+    // assignments to anything but the function's own parameters and locals.
+    for (const auto& func : program->functions) {
+        std::unordered_set<std::string> locals;
+        for (const auto& arg : func->args) locals.insert(arg.name);
+        for_each_stmt(func->body.get(), [&locals](Stmt* stmt) {
+            if (auto* decl = dynamic_cast<VarDecl*>(stmt)) locals.insert(decl->name);
+        });
+
+        bool clean = true;
+        for_each_stmt(func->body.get(), [&](Stmt* stmt) {
+            if (dynamic_cast<PointerAssignStmt*>(stmt)) clean = false;
+            if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) clean = clean && locals.count(assign->name);
+            if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) clean = clean && locals.count(arr_assign->name);
+        });
+        for_each_expr(func->body.get(), [&](std::unique_ptr<Expr>& expr) {
+            for_each_subexpr(expr.get(), [&](const Expr* e) {
+                if (const auto* call = dynamic_cast<const CallExpr*>(e)) callees[func->name].push_back(call->callee);
+            });
+        });
+        if (clean) result.insert(func->name);
+    }
+
+    // Then drop every function that calls something outside the set (print
+    // included) until nothing changes. Recursion on its own does not count.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = result.begin(); it != result.end();) {
+            const auto& calls = callees[*it];
+            bool ok = std::all_of(calls.begin(), calls.end(), [&result](const std::string& c) { return result.count(c) > 0; });
+            if (ok) {
+                ++it;
+            } else {
+                it = result.erase(it);
+                changed = true;
+            }
+        }
+    }
+    return result;
+}
+
+std::unordered_set<std::string> pure_functions(Program* program) {
+    std::unordered_set<std::string> result = side_effect_free_functions(program);
+    for (const auto& func : program->functions) {
+        bool takes_pointer = std::any_of(func->args.begin(), func->args.end(),
+                                         [](const Arg& arg) { return arg.type.ptr_level > 0; });
+        if (takes_pointer) result.erase(func->name);
+    }
+    return result;
+}
+
+bool contains_return(const Stmt* stmt) {
+    bool found = false;
+    for_each_stmt(stmt, [&found](const Stmt* s) { found = found || dynamic_cast<const ReturnStmt*>(s) != nullptr; });
+    return found;
+}
+
+std::unordered_map<std::string, std::optional<Type>> collect_var_types(const std::vector<std::unique_ptr<Stmt>>& stmts,
+                                                                       const std::vector<Arg>& params) {
+    std::unordered_map<std::string, std::optional<Type>> types;
+    for (const auto& param : params) {
+        types[param.name] = param.type;
+    }
+    for (const auto& stmt : stmts) {
+        for_each_stmt(static_cast<const Stmt*>(stmt.get()), [&types](const Stmt* s) {
+            const auto* decl = dynamic_cast<const VarDecl*>(s);
+            if (!decl) return;
+            auto it = types.find(decl->name);
+            if (it == types.end()) types[decl->name] = decl->type;
+            else if (it->second != decl->type) it->second = std::nullopt;
+        });
+    }
+    return types;
+}
+
+std::unordered_set<std::string> address_taken_vars(const std::vector<std::unique_ptr<Stmt>>& stmts) {
+    std::unordered_set<std::string> names;
+    for (const auto& stmt : stmts) {
+        for_each_expr(stmt.get(), [&names](std::unique_ptr<Expr>& expr) {
+            for_each_subexpr(expr.get(), [&names](const Expr* e) {
+                const auto* unary = dynamic_cast<const UnaryExpr*>(e);
+                if (!unary || unary->op != TokenType::amp) return;
+                if (const auto* ident = dynamic_cast<const IdentifierExpr*>(unary->operand.get())) names.insert(ident->name);
+                if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(unary->operand.get())) names.insert(arr->name);
+            });
+        });
+    }
+    return names;
+}
+
+std::optional<Type> infer_type(const Expr* expr, const std::unordered_map<std::string, std::optional<Type>>& var_types,
+                               const Program* program) {
+    auto var_type = [&var_types](const std::string& name) -> std::optional<Type> {
+        auto it = var_types.find(name);
+        return it == var_types.end() ? std::nullopt : it->second;
+    };
+    if (dynamic_cast<const IntLitExpr*>(expr)) return Type::Int();
+    if (dynamic_cast<const BoolLitExpr*>(expr)) return Type::Bool();
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) return var_type(ident->name);
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) return var_type(arr->name);
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        for (const auto& func : program->functions) {
+            if (func->name == call->callee) return func->return_type;
+        }
+        return std::nullopt;
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        if (unary->op == TokenType::bang) return Type::Bool();
+        if (unary->op != TokenType::star) return std::nullopt;
+        auto pointer = infer_type(unary->operand.get(), var_types, program);
+        if (!pointer || pointer->ptr_level == 0) return std::nullopt;
+        pointer->ptr_level--;
+        return pointer;
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        switch (bin->op) {
+            case TokenType::eq_eq:
+            case TokenType::neq:
+            case TokenType::lt:
+            case TokenType::gt:
+            case TokenType::amp_amp:
+            case TokenType::pipe_pipe:
+                return Type::Bool();
+            default:
+                return Type::Int();
+        }
+    }
+    return std::nullopt;
+}
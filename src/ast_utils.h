@@ -0,0 +1,75 @@
+#pragma once
+#include "parser.h"
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Small helpers shared by the AST rewriting passes.
+
+// Deep copy of an expression tree.
+std::unique_ptr<Expr> clone_expr(const Expr* expr);
+
+// Deep copy of a statement tree.
+std::unique_ptr<Stmt> clone_stmt(const Stmt* stmt);
+
+// Structural equality of two expression trees.
+bool exprs_equal(const Expr* a, const Expr* b);
+
+// Structural hash, consistent with exprs_equal().
+size_t expr_hash(const Expr* expr);
+
+// Structural hash of a statement tree and the expressions it owns.
+size_t stmt_hash(const Stmt* stmt);
+
+// True if evaluating the expression has no side effects (no calls).
+bool is_pure(const Expr* expr);
+
+// Number of nodes in an expression tree.
+int expr_size(const Expr* expr);
+
+// Number of nodes in a statement tree, counting the expressions it owns.
+int stmt_size(const Stmt* stmt);
+
+// Returns the literal value if the expression is an integer literal.
+std::optional<int> int_value(const Expr* expr);
+
+// Calls `fn` on every top-level expression slot owned by `stmt` and by the
+// statements nested inside it, in source order.
+void for_each_expr(Stmt* stmt, const std::function<void(std::unique_ptr<Expr>&)>& fn);
+
+// Calls `fn` on `stmt` and on every statement nested inside it, parents first.
+void for_each_stmt(Stmt* stmt, const std::function<void(Stmt*)>& fn);
+void for_each_stmt(const Stmt* stmt, const std::function<void(const Stmt*)>& fn);
+
+// Calls `fn` on `expr` and on every expression nested inside it, parents first.
+void for_each_subexpr(const Expr* expr, const std::function<void(const Expr*)>& fn);
+
+// True if `stmt` is or contains a return statement.
+bool contains_return(const Stmt* stmt);
+
+// True if the function body takes the address of anything (`&x`), so
+// pointers into its frame may outlive a call it makes.
+bool takes_address(Function* func);
+
+// Names of the functions whose only effect is their return value: no
+// printing, no stores through pointers and only calls to other such functions.
+std::unordered_set<std::string> side_effect_free_functions(Program* program);
+
+// The subset of side_effect_free_functions() that take no pointer arguments,
+// so their result depends on nothing but the argument values.
+std::unordered_set<std::string> pure_functions(Program* program);
+
+// Declared type of every parameter and local; nullopt for a name that is
+// declared more than once with different types.
+std::unordered_map<std::string, std::optional<Type>> collect_var_types(const std::vector<std::unique_ptr<Stmt>>& stmts,
+                                                                       const std::vector<Arg>& params);
+
+// Names of the variables and arrays whose address is taken in `stmts`.
+std::unordered_set<std::string> address_taken_vars(const std::vector<std::unique_ptr<Stmt>>& stmts);
+
+// Type of `expr`, or nullopt if it reads a variable of unknown type.
+std::optional<Type> infer_type(const Expr* expr, const std::unordered_map<std::string, std::optional<Type>>& var_types,
+                               const Program* program);
@@ -0,0 +1,325 @@
+#include "common_subexpression.h"
+#include "ast_utils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+bool worth_reusing(const Expr* expr) {
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return unary->op != TokenType::amp;
+    return dynamic_cast<const BinaryExpr*>(expr) || dynamic_cast<const ArrayAccessExpr*>(expr);
+}
+
+std::unordered_set<std::string> vars_read(const Expr* expr) {
+    std::unordered_set<std::string> names;
+    for_each_subexpr(expr, [&names](const Expr* e) {
+        if (const auto* ident = dynamic_cast<const IdentifierExpr*>(e)) names.insert(ident->name);
+        if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(e)) names.insert(arr->name);
+    });
+    return names;
+}
+
+// Addresses of the expression slots owned by `expr` and its descendants.
+void child_slots(Expr* expr, std::unordered_set<const std::unique_ptr<Expr>*>& slots) {
+    auto visit = [&slots](std::unique_ptr<Expr>& slot) {
+        slots.insert(&slot);
+        child_slots(slot.get(), slots);
+    };
+    if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+        visit(arr->index);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->args) visit(arg);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        visit(unary->operand);
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+        visit(bin->lhs);
+        visit(bin->rhs);
+    }
+}
+
+} // namespace
+
+CommonSubexpressionEliminator::CommonSubexpressionEliminator(Program* program, AnalysisManager& analyses) : m_prog(program), m_analyses(analyses) {
+}
+
+void CommonSubexpressionEliminator::remark(const std::string& message) const {
+    std::cout << "Remark [cse]: " << message << std::endl;
+}
+
+void CommonSubexpressionEliminator::run() {
+    m_side_effect_free = m_analyses.side_effect_free();
+    for (const auto& func : m_prog->functions) {
+        process_body(func->body->stmts, func->args, func->name);
+    }
+    process_body(m_prog->globals, {}, "main");
+}
+
+void CommonSubexpressionEliminator::process_body(std::vector<std::unique_ptr<Stmt>>& stmts, const std::vector<Arg>& params,
+                                                 const std::string& name) {
+    m_table.clear();
+    m_depth = 0;
+    m_reused = 0;
+    m_address_taken = address_taken_vars(stmts);
+    m_var_types = collect_var_types(stmts, params);
+    process_list(stmts);
+    if (m_reused > 0) {
+        remark("reused " + std::to_string(m_reused) + " common subexpression(s) in '" + name + "'");
+    }
+}
+
+void CommonSubexpressionEliminator::process_list(std::vector<std::unique_ptr<Stmt>>& stmts) {
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        Stmt* stmt = stmts[i].get();
+        process_stmt(stmt, stmts);
+        // Temporaries may have been inserted in front of it.
+        while (stmts[i].get() != stmt) ++i;
+    }
+}
+
+void CommonSubexpressionEliminator::process_block(Stmt* stmt) {
+    if (!stmt) return;
+    ++m_depth;
+    if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+        process_list(scope->stmts);
+    } else {
+        // Nowhere to put temporaries; just account for what it writes.
+        kill_loop_effects(stmt);
+    }
+    --m_depth;
+    m_table.remove_if([this](const Available& entry) { return entry.depth > m_depth; });
+}
+
+void CommonSubexpressionEliminator::process_stmt(Stmt* stmt, std::vector<std::unique_ptr<Stmt>>& list) {
+    auto site = [&](const Expr* expr, bool record = true) { return Site{ stmt, &list, record, clobbers_memory(expr) }; };
+
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        Site s = site(ret->expr.get());
+        process_expr(ret->expr, s);
+        if (s.clobbers) kill_memory();
+    } else if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+        Site s = site(expr_stmt->expr.get());
+        process_expr(expr_stmt->expr, s);
+        if (s.clobbers) kill_memory();
+    } else if (auto* decl = dynamic_cast<VarDecl*>(stmt)) {
+        Site s = site(decl->init.get());
+        process_expr(decl->init, s, true);
+        if (s.clobbers) kill_memory();
+        kill_var(decl->name);
+        if (decl->init && !decl->array_size) record_holder(decl->name, decl->init.get());
+    } else if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+        Site s = site(assign->value.get());
+        process_expr(assign->value, s, true);
+        if (s.clobbers) kill_memory();
+        kill_var(assign->name);
+        record_holder(assign->name, assign->value.get());
+    } else if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+        Site s = site(arr_assign->index.get());
+        s.clobbers = s.clobbers || clobbers_memory(arr_assign->value.get());
+        process_expr(arr_assign->index, s);
+        process_expr(arr_assign->value, s);
+        if (s.clobbers || m_address_taken.count(arr_assign->name)) kill_memory();
+        kill_var(arr_assign->name);
+    } else if (auto* ptr_assign = dynamic_cast<PointerAssignStmt*>(stmt)) {
+        Site s = site(ptr_assign->ptr_expr.get());
+        s.clobbers = s.clobbers || clobbers_memory(ptr_assign->value.get());
+        process_expr(ptr_assign->ptr_expr, s);
+        process_expr(ptr_assign->value, s);
+        kill_memory();
+    } else if (dynamic_cast<ScopeStmt*>(stmt)) {
+        process_block(stmt);
+    } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+        Site s = site(if_stmt->condition.get());
+        process_expr(if_stmt->condition, s);
+        if (s.clobbers) kill_memory();
+        // Anything a branch invalidates stays invalid after the if.
+        process_block(if_stmt->then_stmt.get());
+        process_block(if_stmt->else_stmt.get());
+    } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+        // The condition runs once per iteration, so it can only reuse values.
+        kill_loop_effects(stmt);
+        process_expr(while_stmt->condition, site(while_stmt->condition.get(), false));
+        process_block(while_stmt->body.get());
+    } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+        kill_loop_effects(stmt);
+        if (auto* init_decl = dynamic_cast<VarDecl*>(for_stmt->init.get())) {
+            process_expr(init_decl->init, site(init_decl->init.get(), false));
+        } else if (auto* init_assign = dynamic_cast<AssignStmt*>(for_stmt->init.get())) {
+            process_expr(init_assign->value, site(init_assign->value.get(), false));
+        }
+        process_expr(for_stmt->condition, site(for_stmt->condition.get(), false));
+        process_block(for_stmt->body.get());
+        if (auto* inc = dynamic_cast<AssignStmt*>(for_stmt->increment.get())) {
+            process_expr(inc->value, site(inc->value.get(), false));
+        }
+    }
+}
+
+// Visits children before parents, so that a repeated tree is matched after
+// its repeated subtrees have already been replaced in both places.
+void CommonSubexpressionEliminator::process_expr(std::unique_ptr<Expr>& slot, const Site& site, bool top) {
+    Expr* expr = slot.get();
+    if (!expr) return;
+
+    if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->args) process_expr(arg, site);
+    } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+        process_expr(arr->index, site);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        if (unary->op != TokenType::amp) {
+            process_expr(unary->operand, site);
+        } else if (auto* target = dynamic_cast<ArrayAccessExpr*>(unary->operand.get())) {
+            process_expr(target->index, site);
+        }
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+        process_expr(bin->lhs, site);
+        // The right operand of && and || may not run, so it can't start entries.
+        bool short_circuit = bin->op == TokenType::amp_amp || bin->op == TokenType::pipe_pipe;
+        Site rhs_site = site;
+        rhs_site.record = site.record && !short_circuit;
+        process_expr(bin->rhs, rhs_site);
+    }
+
+    if (!worth_reusing(expr) || !is_pure(expr)) return;
+    if (Available* entry = lookup(expr, site)) {
+        reuse(*entry, slot);
+        return;
+    }
+    // A call elsewhere in the statement may run first and change memory.
+    if (!top && site.record && !(site.clobbers && reads_memory(expr))) record(slot, site);
+}
+
+CommonSubexpressionEliminator::Available* CommonSubexpressionEliminator::lookup(const Expr* expr, const Site& site) {
+    size_t hash = expr_hash(expr);
+    for (auto& entry : m_table) {
+        if (entry.hash != hash || !exprs_equal(entry.expr, expr)) continue;
+        if (site.clobbers && entry.reads_memory) return nullptr;
+        return &entry;
+    }
+    return nullptr;
+}
+
+void CommonSubexpressionEliminator::record(std::unique_ptr<Expr>& slot, const Site& site) {
+    auto type = infer_type(slot.get(), m_var_types, m_prog);
+    if (!type) return;
+    Available entry;
+    entry.hash = expr_hash(slot.get());
+    entry.expr = slot.get();
+    entry.slot = &slot;
+    entry.anchor = site.anchor;
+    entry.list = site.list;
+    entry.type = type;
+    entry.reads = vars_read(slot.get());
+    entry.reads_memory = reads_memory(slot.get());
+    entry.depth = m_depth;
+    m_table.push_back(std::move(entry));
+}
+
+// `holder = expr` has just run: later occurrences of `expr` can read `holder`.
+void CommonSubexpressionEliminator::record_holder(const std::string& holder, const Expr* expr) {
+    if (!worth_reusing(expr) || !is_pure(expr)) return;
+    auto reads = vars_read(expr);
+    if (reads.count(holder)) return;
+    Available entry;
+    entry.hash = expr_hash(expr);
+    entry.expr = expr;
+    entry.holder = holder;
+    entry.reads = std::move(reads);
+    entry.reads_memory = reads_memory(expr);
+    entry.depth = m_depth;
+    m_table.push_back(std::move(entry));
+}
+
+void CommonSubexpressionEliminator::reuse(Available& entry, std::unique_ptr<Expr>& slot) {
+    if (entry.holder.empty()) materialize(entry);
+    int line = slot->line;
+    int col = slot->col;
+    forget(slot.get());
+    slot = std::make_unique<IdentifierExpr>(entry.holder, line, col);
+    ++m_reused;
+}
+
+// Moves the first occurrence of `entry` into `__cse<N> = expr` in front of
+// the statement that evaluated it.
+void CommonSubexpressionEliminator::materialize(Available& entry) {
+    std::string name = "__cse" + std::to_string(m_next_id++);
+    Expr* expr = entry.slot->get();
+    int line = expr->line;
+    int col = expr->col;
+    auto decl = std::make_unique<VarDecl>(name, *entry.type, std::move(*entry.slot), line, col);
+    *entry.slot = std::make_unique<IdentifierExpr>(name, line, col);
+
+    // Entries inside the moved expression are now evaluated by the declaration.
+    std::unordered_set<const std::unique_ptr<Expr>*> moved;
+    child_slots(decl->init.get(), moved);
+    for (auto& other : m_table) {
+        if (other.slot && moved.count(other.slot)) other.anchor = decl.get();
+    }
+
+    auto& list = *entry.list;
+    auto at = std::find_if(list.begin(), list.end(), [&entry](const std::unique_ptr<Stmt>& s) { return s.get() == entry.anchor; });
+    list.insert(at, std::move(decl));
+
+    m_var_types[name] = entry.type;
+    entry.holder = name;
+    entry.slot = nullptr;
+    entry.anchor = nullptr;
+    entry.list = nullptr;
+    rehash();
+}
+
+// Drops entries that point into `expr`, which is about to be destroyed.
+void CommonSubexpressionEliminator::forget(const Expr* expr) {
+    std::unordered_set<const std::unique_ptr<Expr>*> slots;
+    child_slots(const_cast<Expr*>(expr), slots);
+    m_table.remove_if([&slots](const Available& entry) { return entry.slot && slots.count(entry.slot); });
+}
+
+// Materialising an entry rewrites the trees of the entries that contain it.
+void CommonSubexpressionEliminator::rehash() {
+    for (auto& entry : m_table) {
+        entry.hash = expr_hash(entry.expr);
+    }
+}
+
+bool CommonSubexpressionEliminator::reads_memory(const Expr* expr) const {
+    bool found = false;
+    for_each_subexpr(expr, [this, &found](const Expr* e) {
+        if (const auto* unary = dynamic_cast<const UnaryExpr*>(e)) found = found || unary->op == TokenType::star;
+        if (const auto* ident = dynamic_cast<const IdentifierExpr*>(e)) found = found || m_address_taken.count(ident->name);
+        if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(e)) found = found || m_address_taken.count(arr->name);
+    });
+    return found;
+}
+
+bool CommonSubexpressionEliminator::clobbers_memory(const Expr* expr) const {
+    bool found = false;
+    for_each_subexpr(expr, [this, &found](const Expr* e) {
+        const auto* call = dynamic_cast<const CallExpr*>(e);
+        // print writes no memory; user functions may store through pointers.
+        if (call && call->callee != "print" && !m_side_effect_free.count(call->callee)) found = true;
+    });
+    return found;
+}
+
+void CommonSubexpressionEliminator::kill_var(const std::string& name) {
+    m_table.remove_if([&name](const Available& entry) { return entry.holder == name || entry.reads.count(name); });
+}
+
+void CommonSubexpressionEliminator::kill_memory() {
+    m_table.remove_if([](const Available& entry) { return entry.reads_memory; });
+}
+
+void CommonSubexpressionEliminator::kill_loop_effects(Stmt* loop) {
+    bool memory = false;
+    for_each_stmt(loop, [this, &memory](Stmt* stmt) {
+        if (auto* decl = dynamic_cast<VarDecl*>(stmt)) kill_var(decl->name);
+        if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) kill_var(assign->name);
+        if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+            kill_var(arr_assign->name);
+            memory = memory || m_address_taken.count(arr_assign->name);
+        }
+        if (dynamic_cast<PointerAssignStmt*>(stmt)) memory = true;
+    });
+    for_each_expr(loop, [this, &memory](std::unique_ptr<Expr>& expr) { memory = memory || clobbers_memory(expr.get()); });
+    if (memory) kill_memory();
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "analysis_manager.h"
+#include "parser.h"
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Common subexpression elimination over hash-consed expression trees.
+//
+// Statements are walked in order, and every pure expression that is evaluated
+// unconditionally is entered in a table keyed by its structural hash. A later
+// occurrence of an equal expression reads the earlier value instead: either
+// the variable it was assigned to, or a `__cse<N>` temporary that is
+// introduced in front of the statement holding the first occurrence.
+//
+// Entries are invalidated when a variable they read is assigned or
+// redeclared, and entries that read memory (through a pointer, or from an
+// address-taken variable) are dropped by pointer stores and calls to
+// functions with side effects. Entries made in a block are only visible in
+// that block and the blocks it encloses, i.e. along dominating paths; loops
+// first drop everything their body may invalidate.
+class CommonSubexpressionEliminator {
+public:
+    CommonSubexpressionEliminator(Program* program, AnalysisManager& analyses);
+    void run();
+
+private:
+    struct Available {
+        size_t hash;
+        const Expr* expr;
+        std::string holder;                              // Variable holding the value, once there is one
+        std::unique_ptr<Expr>* slot = nullptr;           // First occurrence, until it gets a holder
+        const Stmt* anchor = nullptr;                    // Statement evaluating `slot`
+        std::vector<std::unique_ptr<Stmt>>* list = nullptr; // List holding `anchor`
+        std::optional<Type> type;
+        std::unordered_set<std::string> reads;
+        bool reads_memory;
+        int depth;
+    };
+
+    // Where the expressions being visited are evaluated.
+    struct Site {
+        const Stmt* anchor;
+        std::vector<std::unique_ptr<Stmt>>* list;
+        bool record;       // May start new entries (evaluated once, unconditionally)
+        bool clobbers;     // The statement also makes a call that may write memory
+    };
+
+    Program* m_prog;
+    AnalysisManager& m_analyses;
+    std::unordered_set<std::string> m_side_effect_free;
+    std::unordered_set<std::string> m_address_taken;
+    std::unordered_map<std::string, std::optional<Type>> m_var_types;
+    std::list<Available> m_table;
+    int m_depth = 0;
+    int m_next_id = 0;
+    int m_reused = 0;
+
+    void process_body(std::vector<std::unique_ptr<Stmt>>& stmts, const std::vector<Arg>& params, const std::string& name);
+    void process_list(std::vector<std::unique_ptr<Stmt>>& stmts);
+    void process_stmt(Stmt* stmt, std::vector<std::unique_ptr<Stmt>>& list);
+    void process_block(Stmt* stmt);
+    void kill_loop_effects(Stmt* loop);
+    void process_expr(std::unique_ptr<Expr>& slot, const Site& site, bool top = false);
+
+    Available* lookup(const Expr* expr, const Site& site);
+    void record(std::unique_ptr<Expr>& slot, const Site& site);
+    void record_holder(const std::string& holder, const Expr* expr);
+    void reuse(Available& entry, std::unique_ptr<Expr>& slot);
+    void materialize(Available& entry);
+    void forget(const Expr* expr);
+    void rehash();
+
+    bool reads_memory(const Expr* expr) const;
+    bool clobbers_memory(const Expr* expr) const;
+    void kill_var(const std::string& name);
+    void kill_memory();
+
+    void remark(const std::string& message) const;
+};
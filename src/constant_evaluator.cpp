@@ -0,0 +1,398 @@
+#include "constant_evaluator.h"
+#include "ast_utils.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+
+namespace {
+
+// Two's complement wrap-around at 32 bits, the width of int in every backend.
+long long wrap(long long value) {
+    return static_cast<int>(static_cast<uint32_t>(value));
+}
+
+std::string call_text(const CallExpr* call) {
+    std::string text = call->callee + "(";
+    for (size_t i = 0; i < call->args.size(); ++i) {
+        if (i > 0) text += ", ";
+        if (const auto* bool_lit = dynamic_cast<const BoolLitExpr*>(call->args[i].get())) {
+            text += bool_lit->value ? "true" : "false";
+        } else {
+            text += std::to_string(*int_value(call->args[i].get()));
+        }
+    }
+    return text + ")";
+}
+
+} // namespace
+
+ConstantEvaluator::ConstantEvaluator(Program* program, AnalysisManager& analyses) : m_prog(program), m_analyses(analyses) {
+}
+
+void ConstantEvaluator::remark(const std::string& message) const {
+    std::cout << "Remark [eval]: " << message << std::endl;
+}
+
+void ConstantEvaluator::run() {
+    for (const auto& func : m_prog->functions) {
+        m_functions[func->name] = func.get();
+    }
+    find_evaluable();
+
+    for (const auto& func : m_prog->functions) {
+        for_each_expr(func->body.get(), [this](std::unique_ptr<Expr>& expr) { process_expr(expr); });
+    }
+    for (const auto& global : m_prog->globals) {
+        for_each_expr(global.get(), [this](std::unique_ptr<Expr>& expr) { process_expr(expr); });
+    }
+
+    // A tail call that was folded away is just a return of a constant now.
+    if (m_folded == 0) return;
+    auto clear_tail_calls = [](Stmt* stmt) {
+        for_each_stmt(stmt, [](Stmt* s) {
+            auto* ret = dynamic_cast<ReturnStmt*>(s);
+            if (ret && !dynamic_cast<CallExpr*>(ret->expr.get())) ret->tail_call = false;
+        });
+    };
+    for (const auto& func : m_prog->functions) clear_tail_calls(func->body.get());
+}
+
+// Functions that neither print nor call anything that does. Their only other
+// effect can be stores through pointers, which the interpreter confines to
+// its own memory.
+void ConstantEvaluator::find_evaluable() {
+    std::unordered_map<std::string, std::vector<std::string>> callees;
+    for (const auto& func : m_prog->functions) {
+        m_evaluable.insert(func->name);
+        for_each_expr(func->body.get(), [&](std::unique_ptr<Expr>& expr) {
+            for_each_subexpr(expr.get(), [&](const Expr* e) {
+                if (const auto* call = dynamic_cast<const CallExpr*>(e)) callees[func->name].push_back(call->callee);
+            });
+        });
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = m_evaluable.begin(); it != m_evaluable.end();) {
+            const auto& calls = callees[*it];
+            bool ok = std::all_of(calls.begin(), calls.end(), [this](const std::string& c) { return m_evaluable.count(c) > 0; });
+            if (ok) {
+                ++it;
+            } else {
+                it = m_evaluable.erase(it);
+                changed = true;
+            }
+        }
+    }
+}
+
+void ConstantEvaluator::process_expr(std::unique_ptr<Expr>& expr) {
+    if (!expr) return;
+    if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr.get())) {
+        process_expr(arr->index);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr.get())) {
+        process_expr(unary->operand);
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr.get())) {
+        process_expr(bin->lhs);
+        process_expr(bin->rhs);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr.get())) {
+        for (auto& arg : call->args) process_expr(arg);
+        if (auto folded = try_fold(call)) {
+            expr = std::move(folded);
+            ++m_folded;
+        }
+    }
+}
+
+std::unique_ptr<Expr> ConstantEvaluator::try_fold(const CallExpr* call) {
+    if (!m_evaluable.count(call->callee)) return nullptr;
+    const Function* func = m_functions.at(call->callee);
+    if (func->return_type != Type::Int() && func->return_type != Type::Bool()) return nullptr;
+    std::vector<long long> args;
+    for (const auto& arg : call->args) {
+        if (const auto* bool_lit = dynamic_cast<const BoolLitExpr*>(arg.get())) {
+            args.push_back(bool_lit->value);
+        } else if (auto value = int_value(arg.get())) {
+            args.push_back(*value);
+        } else {
+            return nullptr;
+        }
+    }
+
+    std::string text = call_text(call);
+    auto& cache = m_analyses.evaluated_calls();
+    auto cached = cache.find(text);
+    if (cached == cache.end()) {
+        m_status = Status::Ok;
+        m_steps = 0;
+        m_depth = 0;
+        m_memory.clear();
+        m_scopes.clear();
+        long long result = invoke(func, args);
+        if (m_status == Status::Ok) {
+            remark("evaluated '" + text + "' = " + std::to_string(result) + " at compile time (" + std::to_string(m_steps) + " steps)");
+            cached = cache.emplace(text, result).first;
+        } else {
+            remark("not evaluating '" + text + "': " + m_reason);
+            cached = cache.emplace(text, std::nullopt).first;
+        }
+    }
+    if (!cached->second) return nullptr;
+    if (func->return_type == Type::Bool()) return std::make_unique<BoolLitExpr>(*cached->second != 0, call->line, call->col);
+    return std::make_unique<IntLitExpr>(static_cast<int>(*cached->second), call->line, call->col);
+}
+
+bool ConstantEvaluator::step() {
+    if (m_status != Status::Ok) return false;
+    if (++m_steps > step_budget) {
+        fail(Status::OutOfSteps, "step budget of " + std::to_string(step_budget) + " exceeded");
+        return false;
+    }
+    return true;
+}
+
+void ConstantEvaluator::fail(Status status, const std::string& reason) {
+    if (m_status != Status::Ok) return;
+    m_status = status;
+    m_reason = reason;
+}
+
+size_t ConstantEvaluator::allocate(int count) {
+    size_t cell = m_memory.size();
+    if (cell + count > memory_budget) {
+        fail(Status::OutOfMemory, "memory budget of " + std::to_string(memory_budget) + " cells exceeded");
+        return cell;
+    }
+    m_memory.resize(cell + count);
+    return cell;
+}
+
+const ConstantEvaluator::Variable* ConstantEvaluator::lookup(const std::string& name) {
+    for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
+        auto found = it->find(name);
+        if (found != it->end()) return &found->second;
+    }
+    fail(Status::Unsupported, "unknown variable '" + name + "'");
+    return nullptr;
+}
+
+long long ConstantEvaluator::load(long long pointer) {
+    if (m_status != Status::Ok) return 0;
+    if (pointer <= 0 || static_cast<size_t>(pointer) > m_memory.size()) {
+        fail(Status::Unsupported, "load through an invalid pointer");
+        return 0;
+    }
+    const Cell& cell = m_memory[pointer - 1];
+    if (!cell.initialized) {
+        fail(Status::Unsupported, "read of an uninitialised variable");
+        return 0;
+    }
+    return cell.value;
+}
+
+void ConstantEvaluator::store(long long pointer, long long value) {
+    if (m_status != Status::Ok) return;
+    if (pointer <= 0 || static_cast<size_t>(pointer) > m_memory.size()) {
+        fail(Status::Unsupported, "store through an invalid pointer");
+        return;
+    }
+    m_memory[pointer - 1] = { value, true };
+}
+
+long long ConstantEvaluator::invoke(const Function* func, const std::vector<long long>& args) {
+    if (m_status != Status::Ok) return 0;
+    if (++m_depth > max_call_depth) {
+        fail(Status::OutOfMemory, "call depth limit of " + std::to_string(max_call_depth) + " exceeded");
+        return 0;
+    }
+    size_t memory_mark = m_memory.size();
+    std::vector<std::unordered_map<std::string, Variable>> caller_scopes;
+    caller_scopes.swap(m_scopes);
+    m_scopes.emplace_back();
+    for (size_t i = 0; i < func->args.size() && i < args.size(); ++i) {
+        size_t cell = allocate(1);
+        if (m_status != Status::Ok) break;
+        m_memory[cell] = { args[i], true };
+        m_scopes.back()[func->args[i].name] = { cell, 1 };
+    }
+
+    m_return_value = 0;
+    bool returned = exec(func->body.get());
+    long long result = returned ? m_return_value : 0;
+
+    m_scopes.swap(caller_scopes);
+    m_memory.resize(memory_mark);
+    --m_depth;
+    return result;
+}
+
+// Runs `stmt`; returns true once a return statement has been executed.
+bool ConstantEvaluator::exec(const Stmt* stmt) {
+    if (!stmt || !step()) return false;
+    if (const auto* ret = dynamic_cast<const ReturnStmt*>(stmt)) {
+        long long value = ret->expr ? eval(ret->expr.get()) : 0;
+        m_return_value = value;
+        return m_status == Status::Ok;
+    }
+    if (const auto* expr_stmt = dynamic_cast<const ExprStmt*>(stmt)) {
+        eval(expr_stmt->expr.get());
+        return false;
+    }
+    if (const auto* decl = dynamic_cast<const VarDecl*>(stmt)) {
+        int size = decl->array_size.value_or(1);
+        long long value = decl->init ? eval(decl->init.get()) : 0;
+        size_t cell = allocate(size);
+        if (m_status != Status::Ok) return false;
+        if (decl->init) m_memory[cell] = { value, true };
+        m_scopes.back()[decl->name] = { cell, size };
+        return false;
+    }
+    if (const auto* assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        long long value = eval(assign->value.get());
+        if (const Variable* var = lookup(assign->name)) store(var->cell + 1, value);
+        return false;
+    }
+    if (const auto* arr_assign = dynamic_cast<const ArrayAssignStmt*>(stmt)) {
+        long long index = eval(arr_assign->index.get());
+        long long value = eval(arr_assign->value.get());
+        const Variable* var = lookup(arr_assign->name);
+        if (!var) return false;
+        if (index < 0 || index >= var->size) {
+            fail(Status::Unsupported, "index " + std::to_string(index) + " out of bounds of '" + arr_assign->name + "'");
+            return false;
+        }
+        store(var->cell + index + 1, value);
+        return false;
+    }
+    if (const auto* ptr_assign = dynamic_cast<const PointerAssignStmt*>(stmt)) {
+        long long pointer = eval(ptr_assign->ptr_expr.get());
+        long long value = eval(ptr_assign->value.get());
+        store(pointer, value);
+        return false;
+    }
+    if (const auto* scope = dynamic_cast<const ScopeStmt*>(stmt)) {
+        size_t memory_mark = m_memory.size();
+        m_scopes.emplace_back();
+        bool returned = false;
+        for (const auto& s : scope->stmts) {
+            returned = exec(s.get());
+            if (returned || m_status != Status::Ok) break;
+        }
+        m_scopes.pop_back();
+        m_memory.resize(memory_mark);
+        return returned;
+    }
+    if (const auto* if_stmt = dynamic_cast<const IfStmt*>(stmt)) {
+        long long cond = eval(if_stmt->condition.get());
+        if (m_status != Status::Ok) return false;
+        return exec(cond ? if_stmt->then_stmt.get() : if_stmt->else_stmt.get());
+    }
+    if (const auto* while_stmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        while (eval(while_stmt->condition.get()) && m_status == Status::Ok) {
+            if (exec(while_stmt->body.get())) return true;
+        }
+        return false;
+    }
+    if (const auto* for_stmt = dynamic_cast<const ForStmt*>(stmt)) {
+        size_t memory_mark = m_memory.size();
+        m_scopes.emplace_back();
+        bool returned = exec(for_stmt->init.get());
+        while (!returned && m_status == Status::Ok) {
+            if (for_stmt->condition && !eval(for_stmt->condition.get())) break;
+            if (m_status != Status::Ok) break;
+            returned = exec(for_stmt->body.get());
+            if (!returned) exec(for_stmt->increment.get());
+        }
+        m_scopes.pop_back();
+        m_memory.resize(memory_mark);
+        return returned && m_status == Status::Ok;
+    }
+    fail(Status::Unsupported, "unsupported statement");
+    return false;
+}
+
+long long ConstantEvaluator::eval(const Expr* expr) {
+    if (!expr || !step()) return 0;
+    if (const auto* int_lit = dynamic_cast<const IntLitExpr*>(expr)) return int_lit->value;
+    if (const auto* bool_lit = dynamic_cast<const BoolLitExpr*>(expr)) return bool_lit->value;
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) {
+        const Variable* var = lookup(ident->name);
+        return var ? load(var->cell + 1) : 0;
+    }
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        long long index = eval(arr->index.get());
+        const Variable* var = lookup(arr->name);
+        if (!var || m_status != Status::Ok) return 0;
+        if (index < 0 || index >= var->size) {
+            fail(Status::Unsupported, "index " + std::to_string(index) + " out of bounds of '" + arr->name + "'");
+            return 0;
+        }
+        return load(var->cell + index + 1);
+    }
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        auto callee = m_functions.find(call->callee);
+        if (callee == m_functions.end() || !m_evaluable.count(call->callee)) {
+            fail(Status::Unsupported, "call to '" + call->callee + "'");
+            return 0;
+        }
+        std::vector<long long> args;
+        for (const auto& arg : call->args) args.push_back(eval(arg.get()));
+        return invoke(callee->second, args);
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        if (unary->op == TokenType::amp) {
+            if (const auto* ident = dynamic_cast<const IdentifierExpr*>(unary->operand.get())) {
+                const Variable* var = lookup(ident->name);
+                return var ? static_cast<long long>(var->cell) + 1 : 0;
+            }
+            if (const auto* arr_access = dynamic_cast<const ArrayAccessExpr*>(unary->operand.get())) {
+                long long index = eval(arr_access->index.get());
+                const Variable* var = lookup(arr_access->name);
+                if (!var || m_status != Status::Ok) return 0;
+                if (index < 0 || index >= var->size) {
+                    fail(Status::Unsupported, "index " + std::to_string(index) + " out of bounds of '" + arr_access->name + "'");
+                    return 0;
+                }
+                return static_cast<long long>(var->cell) + index + 1;
+            }
+            fail(Status::Unsupported, "address of an r-value");
+            return 0;
+        }
+        long long operand = eval(unary->operand.get());
+        if (unary->op == TokenType::bang) return !operand;
+        if (unary->op == TokenType::star) return load(operand);
+        fail(Status::Unsupported, "unsupported unary operator");
+        return 0;
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        long long a = eval(bin->lhs.get());
+        if (bin->op == TokenType::amp_amp) return a && eval(bin->rhs.get());
+        if (bin->op == TokenType::pipe_pipe) return a || eval(bin->rhs.get());
+        long long b = eval(bin->rhs.get());
+        switch (bin->op) {
+        case TokenType::plus: return wrap(a + b);
+        case TokenType::minus: return wrap(a - b);
+        case TokenType::star: return wrap(a * b);
+        case TokenType::slash:
+            if (b == 0 || (a == INT32_MIN && b == -1)) {
+                fail(Status::Unsupported, "division overflows or divides by zero");
+                return 0;
+            }
+            return a / b;
+        case TokenType::shl: return wrap(static_cast<long long>(static_cast<uint32_t>(a) << (b & 31)));
+        case TokenType::ashr: return static_cast<int>(a) >> (b & 31);
+        case TokenType::lshr: return static_cast<int>(static_cast<uint32_t>(a) >> (b & 31));
+        case TokenType::mulhi: return static_cast<int>((a * b) >> 32);
+        case TokenType::eq_eq: return a == b;
+        case TokenType::neq: return a != b;
+        case TokenType::lt: return a < b;
+        case TokenType::gt: return a > b;
+        default:
+            fail(Status::Unsupported, "unsupported binary operator");
+            return 0;
+        }
+    }
+    fail(Status::Unsupported, "unsupported expression");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "analysis_manager.h"
+#include "parser.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Replaces calls to pure functions whose arguments are all constants with
+// their result, computed at compile time.
+//
+// A function qualifies when it returns int or bool and neither it nor
+// anything it calls prints. The call is then run by a small interpreter over
+// the AST. Its memory only holds the frames of the evaluation itself, so
+// pointer stores can only reach locals of those frames. Evaluation gives up,
+// leaving the call in place, on anything whose runtime behaviour it cannot
+// reproduce (division by zero, reading an uninitialised variable, an
+// out-of-bounds index) and when it runs past `step_budget` evaluated nodes,
+// `memory_budget` cells or `max_call_depth` nested calls. Both outcomes are
+// reported as remarks.
+//
+// Results are cached in the AnalysisManager by call text. Every pass keeps
+// the meaning of the program, so they stay valid for the whole pipeline.
+class ConstantEvaluator {
+public:
+    static constexpr long long step_budget = 100000;
+    static constexpr size_t memory_budget = 4096;
+    static constexpr int max_call_depth = 256;
+
+    ConstantEvaluator(Program* program, AnalysisManager& analyses);
+    void run();
+
+private:
+    enum class Status { Ok, Unsupported, OutOfSteps, OutOfMemory };
+
+    struct Variable {
+        size_t cell;
+        int size;
+    };
+
+    // Interpreter memory: one cell per scalar or array element. Pointers
+    // are cell index + 1, so that 0 stays null.
+    struct Cell {
+        long long value = 0;
+        bool initialized = false;
+    };
+
+    Program* m_prog;
+    AnalysisManager& m_analyses;
+    std::unordered_map<std::string, const Function*> m_functions;
+    std::unordered_set<std::string> m_evaluable;
+    int m_folded = 0;
+
+    // State of the evaluation in progress.
+    Status m_status = Status::Ok;
+    std::string m_reason;
+    long long m_steps = 0;
+    int m_depth = 0;
+    std::vector<Cell> m_memory;
+    std::vector<std::unordered_map<std::string, Variable>> m_scopes;
+    long long m_return_value = 0;
+
+    void find_evaluable();
+    void process_expr(std::unique_ptr<Expr>& expr);
+    std::unique_ptr<Expr> try_fold(const CallExpr* call);
+
+    long long invoke(const Function* func, const std::vector<long long>& args);
+    bool exec(const Stmt* stmt);
+    long long eval(const Expr* expr);
+
+    bool step();
+    void fail(Status status, const std::string& reason);
+    size_t allocate(int count);
+    const Variable* lookup(const std::string& name);
+    long long load(long long pointer);
+    void store(long long pointer, long long value);
+
+    void remark(const std::string& message) const;
+};
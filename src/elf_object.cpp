@@ -0,0 +1,189 @@
+#include "elf_object.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint16_t ET_REL = 1;
+constexpr uint16_t EM_X86_64 = 62;
+constexpr uint16_t EM_AARCH64 = 183;
+
+constexpr uint32_t SHT_PROGBITS = 1;
+constexpr uint32_t SHT_SYMTAB = 2;
+constexpr uint32_t SHT_STRTAB = 3;
+constexpr uint32_t SHT_RELA = 4;
+
+constexpr uint64_t SHF_WRITE = 0x1;
+constexpr uint64_t SHF_ALLOC = 0x2;
+constexpr uint64_t SHF_EXECINSTR = 0x4;
+constexpr uint64_t SHF_INFO_LINK = 0x40;
+
+constexpr uint8_t STB_LOCAL = 0;
+constexpr uint8_t STB_GLOBAL = 1;
+constexpr uint8_t STT_NOTYPE = 0;
+constexpr uint8_t STT_OBJECT = 1;
+constexpr uint8_t STT_FUNC = 2;
+
+// Section header indices, in the order write() lays the sections out.
+enum SectionIndex : uint16_t { Null, Text, Data, Rodata, GnuStack, RelaText, Symtab, Strtab, Shstrtab, SectionCount };
+
+void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void align(std::vector<uint8_t>& out, size_t alignment) {
+    while (out.size() % alignment) out.push_back(0);
+}
+
+// A string table: NUL-separated names, starting with the empty one.
+class StringTable {
+public:
+    uint32_t add(const std::string& name) {
+        if (name.empty()) return 0;
+        uint32_t offset = static_cast<uint32_t>(m_bytes.size());
+        m_bytes.insert(m_bytes.end(), name.begin(), name.end());
+        m_bytes.push_back(0);
+        return offset;
+    }
+    const std::vector<uint8_t>& bytes() const { return m_bytes; }
+
+private:
+    std::vector<uint8_t> m_bytes = { 0 };
+};
+
+struct SectionHeader {
+    uint32_t name = 0;
+    uint32_t type = 0;
+    uint64_t flags = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t link = 0;
+    uint32_t info = 0;
+    uint64_t align = 0;
+    uint64_t entsize = 0;
+};
+
+} // namespace
+
+ElfObject::ElfObject(Target target) : m_target(target) {
+}
+
+std::vector<uint8_t>& ElfObject::contents(Section section) {
+    switch (section) {
+        case Section::Data: return m_data;
+        case Section::Rodata: return m_rodata;
+        default: return m_text;
+    }
+}
+
+const std::vector<uint8_t>& ElfObject::contents(Section section) const {
+    switch (section) {
+        case Section::Data: return m_data;
+        case Section::Rodata: return m_rodata;
+        default: return m_text;
+    }
+}
+
+void ElfObject::define_symbol(const std::string& name, Section section, uint64_t offset, uint64_t size, bool global, bool function) {
+    m_symbols.push_back({ name, section, offset, size, global, function });
+}
+
+void ElfObject::add_relocation(uint64_t offset, const std::string& symbol, uint32_t type, int64_t addend) {
+    m_relocations.push_back({ offset, symbol, type, addend });
+}
+
+std::vector<uint8_t> ElfObject::write() const {
+    // Symbols referenced but not defined here are undefined globals.
+    std::vector<Symbol> symbols = m_symbols;
+    for (const Relocation& reloc : m_relocations) {
+        auto defined = [&reloc](const Symbol& symbol) { return symbol.name == reloc.symbol; };
+        if (std::none_of(symbols.begin(), symbols.end(), defined)) {
+            symbols.push_back({ reloc.symbol, Section::Undefined, 0, 0, true, false });
+        }
+    }
+    std::stable_partition(symbols.begin(), symbols.end(), [](const Symbol& symbol) { return !symbol.global; });
+
+    StringTable strtab;
+    std::vector<uint8_t> symtab(24, 0);
+    std::unordered_map<std::string, uint32_t> symbol_index;
+    uint32_t first_global = 1;
+    for (const Symbol& symbol : symbols) {
+        symbol_index[symbol.name] = static_cast<uint32_t>(symtab.size() / 24);
+        if (!symbol.global) ++first_global;
+        uint8_t type = symbol.section == Section::Undefined ? STT_NOTYPE : symbol.function ? STT_FUNC : STT_OBJECT;
+        uint16_t shndx = 0;
+        switch (symbol.section) {
+            case Section::Text: shndx = Text; break;
+            case Section::Data: shndx = Data; break;
+            case Section::Rodata: shndx = Rodata; break;
+            case Section::Undefined: break;
+        }
+        put(symtab, strtab.add(symbol.name), 4);
+        put(symtab, ((symbol.global ? STB_GLOBAL : STB_LOCAL) << 4) | type, 1);
+        put(symtab, 0, 1);
+        put(symtab, shndx, 2);
+        put(symtab, symbol.offset, 8);
+        put(symtab, symbol.size, 8);
+    }
+
+    std::vector<uint8_t> rela;
+    for (const Relocation& reloc : m_relocations) {
+        put(rela, reloc.offset, 8);
+        put(rela, (static_cast<uint64_t>(symbol_index.at(reloc.symbol)) << 32) | reloc.type, 8);
+        put(rela, static_cast<uint64_t>(reloc.addend), 8);
+    }
+
+    StringTable shstrtab;
+    std::vector<SectionHeader> headers(SectionCount);
+    headers[Text] = { shstrtab.add(".text"), SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, 0, 0, 0, 4, 0 };
+    headers[Data] = { shstrtab.add(".data"), SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0, 0, 0, 0, 8, 0 };
+    headers[Rodata] = { shstrtab.add(".rodata"), SHT_PROGBITS, SHF_ALLOC, 0, 0, 0, 0, 1, 0 };
+    // Empty: the code does not need an executable stack.
+    headers[GnuStack] = { shstrtab.add(".note.GNU-stack"), SHT_PROGBITS, 0, 0, 0, 0, 0, 1, 0 };
+    headers[RelaText] = { shstrtab.add(".rela.text"), SHT_RELA, SHF_INFO_LINK, 0, 0, Symtab, Text, 8, 24 };
+    headers[Symtab] = { shstrtab.add(".symtab"), SHT_SYMTAB, 0, 0, 0, Strtab, first_global, 8, 24 };
+    headers[Strtab] = { shstrtab.add(".strtab"), SHT_STRTAB, 0, 0, 0, 0, 0, 1, 0 };
+    headers[Shstrtab] = { shstrtab.add(".shstrtab"), SHT_STRTAB, 0, 0, 0, 0, 0, 1, 0 };
+
+    // Section contents follow the 64-byte ELF header.
+    std::vector<uint8_t> out(64, 0);
+    const std::vector<uint8_t> none;
+    const std::vector<uint8_t>* contents[SectionCount] = { nullptr, &m_text, &m_data, &m_rodata, &none, &rela, &symtab, &strtab.bytes(), &shstrtab.bytes() };
+    for (int i = Text; i < SectionCount; ++i) {
+        align(out, headers[i].align);
+        headers[i].offset = out.size();
+        headers[i].size = contents[i]->size();
+        out.insert(out.end(), contents[i]->begin(), contents[i]->end());
+    }
+    align(out, 8);
+    uint64_t shoff = out.size();
+    for (const SectionHeader& header : headers) {
+        put(out, header.name, 4);
+        put(out, header.type, 4);
+        put(out, header.flags, 8);
+        put(out, 0, 8);
+        put(out, header.offset, 8);
+        put(out, header.size, 8);
+        put(out, header.link, 4);
+        put(out, header.info, 4);
+        put(out, header.align, 8);
+        put(out, header.entsize, 8);
+    }
+
+    std::vector<uint8_t> header = { 0x7f, 'E', 'L', 'F', 2, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    put(header, ET_REL, 2);
+    put(header, m_target == Target::X86_64 ? EM_X86_64 : EM_AARCH64, 2);
+    put(header, 1, 4);
+    put(header, 0, 8);       // e_entry
+    put(header, 0, 8);       // e_phoff
+    put(header, shoff, 8);
+    put(header, 0, 4);       // e_flags
+    put(header, 64, 2);      // e_ehsize
+    put(header, 0, 2);       // e_phentsize
+    put(header, 0, 2);       // e_phnum
+    put(header, 64, 2);      // e_shentsize
+    put(header, SectionCount, 2);
+    put(header, Shstrtab, 2);
+    std::copy(header.begin(), header.end(), out.begin());
+    return out;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "target.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ELF64 relocatable object file for AArch64 or x86-64 Linux.
+//
+// Holds the contents of .text, .data and .rodata, the symbols defined in
+// them or referenced from .text, and the relocations of .text (with
+// explicit addends, in .rela.text). write() lays the sections out after the
+// ELF header, followed by the section header table. Local symbols come first
+// in .symtab, as the format requires.
+class ElfObject {
+public:
+    enum class Section { Undefined, Text, Data, Rodata };
+
+    // Relocation types used by the code generators.
+    static constexpr uint32_t R_AARCH64_ADR_PREL_PG_HI21 = 275;
+    static constexpr uint32_t R_AARCH64_ADD_ABS_LO12_NC = 277;
+    static constexpr uint32_t R_AARCH64_JUMP26 = 282;
+    static constexpr uint32_t R_AARCH64_CALL26 = 283;
+    static constexpr uint32_t R_X86_64_PC32 = 2;
+    static constexpr uint32_t R_X86_64_PLT32 = 4;
+
+    struct Symbol {
+        std::string name;
+        Section section;
+        uint64_t offset;
+        uint64_t size;
+        bool global;
+        bool function;
+    };
+    struct Relocation {
+        uint64_t offset;
+        std::string symbol;
+        uint32_t type;
+        int64_t addend;
+    };
+
+    explicit ElfObject(Target target = Target::AArch64);
+
+    Target target() const { return m_target; }
+    std::vector<uint8_t>& contents(Section section);
+    const std::vector<uint8_t>& contents(Section section) const;
+    // Defines `name` at `offset` in `section`; undefined symbols are added by
+    // relocations referring to them.
+    void define_symbol(const std::string& name, Section section, uint64_t offset, uint64_t size, bool global, bool function);
+    void add_relocation(uint64_t offset, const std::string& symbol, uint32_t type, int64_t addend = 0);
+    const std::vector<Symbol>& symbols() const { return m_symbols; }
+    // Relocations of .text.
+    const std::vector<Relocation>& relocations() const { return m_relocations; }
+
+    std::vector<uint8_t> write() const;
+
+private:
+    Target m_target;
+    std::vector<uint8_t> m_text;
+    std::vector<uint8_t> m_data;
+    std::vector<uint8_t> m_rodata;
+    std::vector<Symbol> m_symbols;
+    std::vector<Relocation> m_relocations;
+};
@@ -1,368 +1,750 @@
 #include "generation.h"
-#include <iostream>
+#include "aarch64_encoder.h"
+#include <algorithm>
+#include <cstdint>
 
-Generator::Generator(const Program* root) : m_root(root) {
+using ir::Opcode;
+
+namespace {
+
+std::string xreg(int reg) {
+    return "x" + std::to_string(reg);
 }
 
-std::string Generator::create_label() {
-    return ".L" + std::to_string(m_label_count++);
+std::string wreg(int reg) {
+    return "w" + std::to_string(reg);
 }
 
-void Generator::push_scope() {
-    m_scopes.push_back({});
+bool is_memory_alloca(const ir::Value* value) {
+    return value->kind == ir::Value::Kind::Instruction && static_cast<const ir::Instruction*>(value)->op == Opcode::Alloca;
 }
 
-void Generator::pop_scope() {
-    m_scopes.pop_back();
+bool is_constant(const ir::Value* value) {
+    return value->kind == ir::Value::Kind::Constant;
 }
 
-void Generator::declare_var(const std::string& name, std::optional<int> array_size) {
-    if (m_scopes.back().count(name)) {
-        std::cerr << "Error: Variable '" << name << "' already declared in this scope." << std::endl;
-        exit(1);
+long long constant_value(const ir::Value* value) {
+    return static_cast<const ir::Constant*>(value)->value;
+}
+
+// Condition code under which a comparison holds.
+const char* condition(Opcode op) {
+    switch (op) {
+        case Opcode::CmpEq: return "eq";
+        case Opcode::CmpNe: return "ne";
+        case Opcode::CmpLt: return "lt";
+        default: return "gt";
     }
-    size_t size = array_size.has_value() ? (*array_size * 16) : 16;
-    m_stack_ptr += size;
-    m_scopes.back()[name] = { m_stack_ptr };
 }
 
-std::optional<VarInfo> Generator::find_var(const std::string& name) {
-    for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
-        if (it->count(name)) {
-            return it->at(name);
-        }
+// Condition code under which a comparison fails.
+const char* inverse_condition(Opcode op) {
+    switch (op) {
+        case Opcode::CmpEq: return "ne";
+        case Opcode::CmpNe: return "eq";
+        case Opcode::CmpLt: return "ge";
+        default: return "le";
     }
-    return std::nullopt;
 }
 
-std::string Generator::generate() {
-    m_root->accept(this);
-    return m_output.str();
+Type element_type(Type pointer) {
+    return { pointer.base, pointer.ptr_level - 1 };
+}
+
+// Bytes a value of `type` takes in memory. Ints are stored as 32 bits, like
+// in the LLVM backend.
+size_t type_size(Type type) {
+    if (type.ptr_level > 0) return 8;
+    return type.base == Type::Base::Bool ? 1 : 4;
+}
+
+// Immediate operand(s) of an add, sub or cmp by `magnitude`: 12 bits,
+// optionally shifted left by 12. Empty when neither form can encode it.
+std::vector<std::string> arithmetic_immediate(long long magnitude) {
+    if (magnitude >= 0 && magnitude <= 4095) return { "#" + std::to_string(magnitude) };
+    if (magnitude > 0 && magnitude % 4096 == 0 && magnitude / 4096 <= 4095) return { "#" + std::to_string(magnitude / 4096), "lsl #12" };
+    return {};
+}
+
+} // namespace
+
+Generator::Generator(const ir::Module* module, bool peephole) : m_module(module), m_peephole(peephole) {
+}
+
+void Generator::emit(const std::string& op, std::vector<std::string> operands) {
+    m_code.push_back({ op, std::move(operands), "" });
+}
+
+void Generator::emit_label(const std::string& label) {
+    m_code.push_back({ "", {}, label });
+}
+
+std::string Generator::create_label() {
+    return ".L" + std::to_string(m_label_count++);
+}
+
+std::string Generator::frame_slot(size_t stack_offset) {
+    // ldr/str with a negative offset only reach 256 bytes below x29.
+    if (stack_offset <= 256) {
+        return "[x29, #-" + std::to_string(stack_offset) + "]";
+    }
+    frame_address(stack_offset, "x8");
+    return "[x8]";
+}
+
+void Generator::frame_address(size_t stack_offset, const std::string& reg) {
+    if (stack_offset <= 4095) {
+        emit("sub", { reg, "x29", "#" + std::to_string(stack_offset) });
+        return;
+    }
+    move_immediate(reg, static_cast<long long>(stack_offset));
+    emit("sub", { reg, "x29", reg });
 }
 
-void Generator::visit(const Program* node) {
+void Generator::move_immediate(const std::string& reg, long long value) {
+    if (value >= -65536 && value <= 65535) {
+        emit("mov", { reg, "#" + std::to_string(value) });
+        return;
+    }
+    // Wider constants (e.g. division magic numbers) are built 16 bits at a
+    // time: movz starts from zeros and movn from ones, whichever leaves fewer
+    // halfwords for movk to insert.
+    uint64_t bits = static_cast<uint64_t>(value);
+    int zeros = 0;
+    int ones = 0;
+    for (int shift = 0; shift < 64; shift += 16) {
+        uint64_t half = (bits >> shift) & 0xffff;
+        zeros += half == 0;
+        ones += half == 0xffff;
+    }
+    bool inverted = ones > zeros;
+    bool first = true;
+    for (int shift = 0; shift < 64; shift += 16) {
+        uint64_t half = (bits >> shift) & 0xffff;
+        if (half == (inverted ? 0xffff : 0)) continue;
+        std::vector<std::string> operands = { reg, "#" + std::to_string(first && inverted ? ~half & 0xffff : half) };
+        if (shift > 0) operands.push_back("lsl #" + std::to_string(shift));
+        emit(first ? (inverted ? "movn" : "movz") : "movk", std::move(operands));
+        first = false;
+    }
+}
+
+std::string Generator::generate() {
     m_output << ".global _main\n";
     m_output << ".align 2\n\n";
     m_output << ".data\n";
     m_output << "fmt: .asciz \"%d\n\"\n";
     m_output << ".text\n\n";
+    for (const auto& func : m_module->functions) {
+        emit_function(*func);
+    }
+    return m_output.str();
+}
+
+ElfObject Generator::generate_object(std::string& listing) const {
+    ElfObject object;
+    // The format string of print, which the assembly keeps in .data.
+    std::vector<uint8_t>& rodata = object.contents(ElfObject::Section::Rodata);
+    rodata = { '%', 'd', '\n', 0 };
+    object.define_symbol("fmt", ElfObject::Section::Rodata, 0, rodata.size(), false, false);
+    AArch64Encoder encoder(object);
+    for (const auto& code : m_functions) encoder.add_function(code);
+    listing = encoder.listing();
+    return object;
+}
+
+void Generator::layout_frame(const ir::Function& func) {
+    m_selector = std::make_unique<InstructionSelector>(func);
+    m_alloc = std::make_unique<RegisterAllocator>(func, *m_selector);
+    m_alloc->run();
+    m_slots.clear();
+    m_skipped.clear();
 
-    bool has_main = false;
-    for (const auto& func : node->functions) {
-        if (func->name == "main") has_main = true;
-        func->accept(this);
-    }
-
-    if (!has_main && !node->globals.empty()) {
-        m_output << "_main:\n";
-        m_output << "    stp x29, x30, [sp, #-16]!\n";
-        m_output << "    mov x29, sp\n";
-        
-        m_stack_ptr = 0;
-        push_scope();
-        for (const auto& stmt : node->globals) {
-            stmt->accept(this);
+    // Frame objects at their natural size and alignment: allocas kept in
+    // memory, with densely packed elements, and 8-byte spill slots.
+    struct FrameObject {
+        const ir::Value* value;
+        size_t size;
+        size_t align;
+        std::pair<int, int> lifetime;
+        size_t offset = 0;   // From the bottom of the object area
+    };
+    std::vector<FrameObject> objects;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::Alloca || m_alloc->promoted(instr.get())) continue;
+            auto lifetime = m_alloc->lifetime(instr.get());
+            if (lifetime.first > lifetime.second) continue;
+            size_t size = type_size(element_type(instr->type));
+            objects.push_back({ instr.get(), size * static_cast<size_t>(instr->count), size, lifetime });
         }
-        m_output << "    mov x0, #0\n";
-        m_output << "    mov sp, x29\n";
-        m_output << "    ldp x29, x30, [sp], #16\n";
-        m_output << "    ret\n\n";
-        pop_scope();
-    }
-}
-
-void Generator::visit(const Function* node) {
-    m_output << "_" << node->name << ":\n";
-    m_output << "    stp x29, x30, [sp, #-16]!\n";
-    m_output << "    mov x29, sp\n";
-    
-    m_stack_ptr = 0; 
-    push_scope(); 
-    
-    for (size_t i = 0; i < node->args.size(); ++i) {
-        if (i < 8) {
-            m_output << "    str x" << i << ", [sp, #-16]!\n";
-            declare_var(node->args[i].name);
-        } else {
-             std::cerr << "Error: Too many arguments (max 8 supported)" << std::endl;
-             exit(1);
+    }
+    for (const ir::Value* value : m_alloc->spilled()) objects.push_back({ value, 8, 8, m_alloc->lifetime(value) });
+
+    // Largest objects first, each at the lowest offset that does not overlap
+    // an object live at the same time.
+    std::stable_sort(objects.begin(), objects.end(), [](const FrameObject& a, const FrameObject& b) { return a.size > b.size; });
+    std::vector<const FrameObject*> placed;
+    size_t area = 0;
+    for (FrameObject& object : objects) {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (const FrameObject* other : placed) {
+                bool coexist = object.lifetime.first <= other->lifetime.second && other->lifetime.first <= object.lifetime.second;
+                bool overlap = object.offset < other->offset + other->size && other->offset < object.offset + object.size;
+                if (coexist && overlap) {
+                    object.offset = (other->offset + other->size + object.align - 1) / object.align * object.align;
+                    moved = true;
+                }
+            }
         }
+        placed.push_back(&object);
+        area = std::max(area, object.offset + object.size);
     }
-    
-    node->body->accept(this);
-    
-    m_output << "    mov x0, #0\n";
-    m_output << "    mov sp, x29\n"; 
-    m_output << "    ldp x29, x30, [sp], #16\n";
-    m_output << "    ret\n\n";
-    
-    pop_scope();
+
+    // The callee-saved registers in use are saved right below x29, the
+    // objects go below them, and the arguments of calls that do not fit in
+    // registers at the bottom, where sp points.
+    size_t saved = m_alloc->used_callee_saved().size() * 8;
+    area = (area + 7) / 8 * 8;
+    for (const FrameObject& object : objects) {
+        m_slots[object.value] = saved + area - object.offset;
+    }
+    size_t outgoing = 0;
+    bool calls = false;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::Call && instr->op != Opcode::Print) continue;
+            calls = true;
+            if (instr->operands.size() > 8) outgoing = std::max(outgoing, (instr->operands.size() - 8) * 8);
+        }
+    }
+    m_frame_size = (saved + area + outgoing + 15) / 16 * 16;
+    // A leaf without a frame leaves x29 and x30 alone.
+    m_frameless = !calls && m_frame_size == 0;
 }
 
-void Generator::visit(const ReturnStmt* node) {
-    node->expr->accept(this);
-    m_output << "    mov sp, x29\n";
-    m_output << "    ldp x29, x30, [sp], #16\n";
-    m_output << "    ret\n";
+std::string Generator::stack_argument(size_t index) {
+    // Arguments beyond the eighth are passed in 8-byte slots from the
+    // caller's sp, which is 16 bytes above x29 once the frame record is pushed.
+    size_t offset = (index - 8) * 8;
+    if (m_frameless) return "[sp, #" + std::to_string(offset) + "]";
+    return "[x29, #" + std::to_string(offset + 16) + "]";
 }
 
-void Generator::visit(const ExprStmt* node) {
-    node->expr->accept(this);
+void Generator::emit_function(const ir::Function& func) {
+    m_func = &func;
+    layout_frame(func);
+    m_labels.clear();
+    for (const auto& block : func.blocks) {
+        if (block.get() != func.entry()) m_labels[block.get()] = create_label();
+    }
+
+    m_code.clear();
+    emit_label("_" + func.name);
+    if (!m_frameless) {
+        emit("stp", { "x29", "x30", "[sp, #-16]!" });
+        emit("mov", { "x29", "sp" });
+    }
+    if (m_frame_size > 4095) {
+        move_immediate("x8", static_cast<long long>(m_frame_size));
+        emit("sub", { "sp", "sp", "x8" });
+    } else if (m_frame_size > 0) {
+        emit("sub", { "sp", "sp", "#" + std::to_string(m_frame_size) });
+    }
+    const auto& saved = m_alloc->used_callee_saved();
+    for (size_t i = 0; i < saved.size(); i += 2) {
+        std::string slot = "[x29, #-" + std::to_string(i * 8 + (i + 1 < saved.size() ? 16 : 8)) + "]";
+        if (i + 1 < saved.size()) emit("stp", { xreg(saved[i]), xreg(saved[i + 1]), slot });
+        else emit("str", { xreg(saved[i]), slot });
+    }
+    for (const auto& arg : func.args) {
+        if (!m_alloc->live(arg.get())) continue;
+        if (arg->index < 8) {
+            emit_move(location(arg.get()), { static_cast<int>(arg->index), 0 });
+            continue;
+        }
+        Location loc = location(arg.get());
+        int reg = loc.reg >= 0 ? loc.reg : 16;
+        emit("ldr", { xreg(reg), stack_argument(arg->index) });
+        emit_move(loc, { reg, 0 });
+    }
+
+    for (size_t b = 0; b < func.blocks.size(); ++b) {
+        const ir::BasicBlock& block = *func.blocks[b];
+        const ir::BasicBlock* next = b + 1 < func.blocks.size() ? func.blocks[b + 1].get() : nullptr;
+        if (&block != func.entry()) emit_label(m_labels.at(&block));
+        for (const auto& instr : block.instrs) {
+            if (!m_skipped.count(instr.get())) emit_instruction(*instr, next);
+        }
+    }
+    for (const auto& stub : m_stubs) {
+        emit_label(stub.label);
+        emit_branch(*stub.from, *stub.to, nullptr);
+    }
+    m_stubs.clear();
+
+    if (m_peephole) {
+        Peephole peephole(m_code);
+        peephole.run();
+        for (const auto& [rule, count] : peephole.fired()) m_peephole_fired[rule] += count;
+    }
+    for (const AsmInstr& line : m_code) m_output << line.print() << "\n";
+    m_output << "\n";
+    m_functions.push_back(std::move(m_code));
 }
 
-void Generator::visit(const VarDecl* node) {
-    if (node->init) {
-        node->init->accept(this);
-        m_output << "    str x0, [sp, #-16]!\n";
-    } else {
-        if (node->array_size) {
-            int bytes = *node->array_size * 16;
-            m_output << "    sub sp, sp, #" << bytes << "\n";
-        } else {
-            m_output << "    sub sp, sp, #16\n";
+void Generator::emit_epilogue() {
+    if (m_frameless) return;
+    const auto& saved = m_alloc->used_callee_saved();
+    for (size_t i = 0; i < saved.size(); i += 2) {
+        std::string slot = "[x29, #-" + std::to_string(i * 8 + (i + 1 < saved.size() ? 16 : 8)) + "]";
+        if (i + 1 < saved.size()) emit("ldp", { xreg(saved[i]), xreg(saved[i + 1]), slot });
+        else emit("ldr", { xreg(saved[i]), slot });
+    }
+    // Without a frame below it, sp still equals x29.
+    if (m_frame_size > 0) emit("mov", { "sp", "x29" });
+    emit("ldp", { "x29", "x30", "[sp]", "#16" });
+}
+
+void Generator::emit_load(Type type, int reg, const std::string& address) {
+    if (type.ptr_level > 0) emit("ldr", { xreg(reg), address });
+    else if (type.base == Type::Base::Bool) emit("ldrb", { wreg(reg), address });
+    else emit("ldrsw", { xreg(reg), address });
+}
+
+void Generator::emit_store(Type type, int reg, const std::string& address) {
+    if (type.ptr_level > 0) emit("str", { xreg(reg), address });
+    else if (type.base == Type::Base::Bool) emit("strb", { wreg(reg), address });
+    else emit("str", { wreg(reg), address });
+}
+
+Generator::Location Generator::location(const ir::Value* vreg) {
+    int reg = m_alloc->reg(vreg);
+    return { reg, reg >= 0 ? 0 : m_slots.at(vreg) };
+}
+
+std::string Generator::address(const ir::Value* pointer, int base_scratch, int index_scratch) {
+    if (is_memory_alloca(pointer)) return frame_slot(m_slots.at(pointer));
+    if (!m_selector->covered(pointer)) return "[" + xreg(read(pointer, base_scratch)) + "]";
+
+    // A covered element address becomes the addressing mode: an offset from
+    // x29 or the base for a constant index, a scaled register offset otherwise.
+    const auto* element = static_cast<const ir::Instruction*>(pointer);
+    const ir::Value* base = element->operands[0];
+    const ir::Value* index = element->operands[1];
+    size_t size = type_size(element_type(element->type));
+    if (is_constant(index)) {
+        size_t offset = size * static_cast<size_t>(constant_value(index));
+        if (is_memory_alloca(base) && offset < m_slots.at(base)) return frame_slot(m_slots.at(base) - offset);
+        std::string b = xreg(read(base, base_scratch));
+        return offset == 0 ? "[" + b + "]" : "[" + b + ", #" + std::to_string(offset) + "]";
+    }
+    std::string b = xreg(read(base, base_scratch));
+    std::string i = xreg(read(index, index_scratch));
+    if (size == 1) return "[" + b + ", " + i + "]";
+    return "[" + b + ", " + i + ", lsl #" + (size == 8 ? "3" : "2") + "]";
+}
+
+Opcode Generator::emit_compare(const ir::Instruction& cmp) {
+    // A literal moves to the right, where cmp and cmn take immediates.
+    Opcode op = cmp.op;
+    const ir::Value* left = cmp.operands[0];
+    const ir::Value* right = cmp.operands[1];
+    if (is_constant(left) && !is_constant(right)) {
+        std::swap(left, right);
+        if (op == Opcode::CmpLt) op = Opcode::CmpGt;
+        else if (op == Opcode::CmpGt) op = Opcode::CmpLt;
+    }
+    int lhs = read(left, 16);
+    if (is_constant(right)) {
+        long long imm = constant_value(right);
+        std::vector<std::string> encoded = arithmetic_immediate(imm < 0 ? -imm : imm);
+        if (!encoded.empty()) {
+            encoded.insert(encoded.begin(), xreg(lhs));
+            emit(imm < 0 ? "cmn" : "cmp", encoded);
+            return op;
         }
     }
-    declare_var(node->name, node->array_size);
-}
-
-void Generator::visit(const AssignStmt* node) {
-    auto var = find_var(node->name);
-    if (!var.has_value()) {
-        std::cerr << "Error: Undeclared variable: " << node->name << std::endl;
-        exit(1);
-    }
-    node->value->accept(this);
-    int offset = -(int)var->stack_offset;
-    m_output << "    str x0, [x29, #" << offset << "]\n";
-}
-
-void Generator::visit(const ArrayAssignStmt* node) {
-    auto var = find_var(node->name);
-    if (!var.has_value()) {
-        std::cerr << "Error: Undeclared variable: " << node->name << std::endl;
-        exit(1);
-    }
-    node->value->accept(this);
-    m_output << "    str x0, [sp, #-16]!\n";
-    node->index->accept(this);
-    m_output << "    mov x1, #16\n";
-    m_output << "    mul x0, x0, x1\n";
-    int base_offset = -(int)var->stack_offset;
-    m_output << "    add x1, x29, #" << base_offset << "\n";
-    m_output << "    add x1, x1, x0\n";
-    m_output << "    ldr x0, [sp], #16\n";
-    m_output << "    str x0, [x1]\n";
-}
-
-void Generator::visit(const PointerAssignStmt* node) {
-    node->value->accept(this); // Result in x0
-    m_output << "    str x0, [sp, #-16]!\n";
-    node->ptr_expr->accept(this); // Address (value of p) in x0
-    m_output << "    ldr x1, [sp], #16\n";
-    m_output << "    str x1, [x0]\n";
-}
-
-void Generator::visit(const ScopeStmt* node) {
-    size_t saved_stack_ptr = m_stack_ptr;
-    push_scope();
-    for (const auto& s : node->stmts) {
-        s->accept(this);
-    }
-    size_t bytes_to_pop = m_stack_ptr - saved_stack_ptr;
-    if (bytes_to_pop > 0) {
-        m_output << "    add sp, sp, #" << bytes_to_pop << "\n";
-    }
-    m_stack_ptr = saved_stack_ptr;
-    pop_scope();
-}
-
-void Generator::visit(const IfStmt* node) {
-    std::string label_else = create_label();
-    std::string label_end = create_label();
-    
-    node->condition->accept(this);
-    m_output << "    cmp x0, #0\n";
-    m_output << "    b.eq " << label_else << "\n"; 
-    
-    node->then_stmt->accept(this);
-    m_output << "    b " << label_end << "\n";
-    
-    m_output << label_else << ":\n";
-    if (node->else_stmt) {
-        node->else_stmt->accept(this);
-    }
-    m_output << label_end << ":\n";
-}
-
-void Generator::visit(const WhileStmt* node) {
-    std::string label_start = create_label();
-    std::string label_end = create_label();
-    
-    m_output << label_start << ":\n";
-    node->condition->accept(this);
-    m_output << "    cmp x0, #0\n";
-    m_output << "    b.eq " << label_end << "\n";
-    
-    node->body->accept(this);
-    m_output << "    b " << label_start << "\n";
-    m_output << label_end << ":\n";
-}
-
-void Generator::visit(const ForStmt* node) {
-    size_t saved_stack_ptr = m_stack_ptr;
-    push_scope();
-    if (node->init) node->init->accept(this);
-    
-    std::string label_start = create_label();
-    std::string label_end = create_label();
-    
-    m_output << label_start << ":\n";
-    if (node->condition) {
-        node->condition->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    b.eq " << label_end << "\n";
-    }
-    node->body->accept(this);
-    if (node->increment) node->increment->accept(this);
-    m_output << "    b " << label_start << "\n";
-    m_output << label_end << ":\n";
-    
-    size_t bytes_to_pop = m_stack_ptr - saved_stack_ptr;
-    if (bytes_to_pop > 0) {
-        m_output << "    add sp, sp, #" << bytes_to_pop << "\n";
-    }
-    m_stack_ptr = saved_stack_ptr;
-    pop_scope();
-}
-
-void Generator::visit(const IntLitExpr* node) {
-    m_output << "    mov x0, #" << node->value << "\n";
-}
-
-void Generator::visit(const BoolLitExpr* node) {
-    m_output << "    mov x0, #" << (node->value ? 1 : 0) << "\n";
-}
-
-void Generator::visit(const IdentifierExpr* node) {
-    auto var = find_var(node->name);
-    if (!var.has_value()) {
-        std::cerr << "Error: Undeclared variable: " << node->name << std::endl;
-        exit(1);
-    }
-    int offset = -(int)var->stack_offset;
-    m_output << "    ldr x0, [x29, #" << offset << "]\n";
-}
-
-void Generator::visit(const ArrayAccessExpr* node) {
-    auto var = find_var(node->name);
-    if (!var.has_value()) {
-        std::cerr << "Error: Undeclared variable: " << node->name << std::endl;
-        exit(1);
-    }
-    node->index->accept(this);
-    m_output << "    mov x1, #16\n";
-    m_output << "    mul x0, x0, x1\n";
-    int base_offset = -(int)var->stack_offset;
-    m_output << "    add x1, x29, #" << base_offset << "\n";
-    m_output << "    add x1, x1, x0\n";
-    m_output << "    ldr x0, [x1]\n";
-}
-
-void Generator::visit(const CallExpr* node) {
-    if (node->callee == "print") {
-        node->args[0]->accept(this);
-        m_output << "    mov x1, x0\n";
-        m_output << "    adrp x0, fmt@PAGE\n";
-        m_output << "    add x0, x0, fmt@PAGEOFF\n";
-        m_output << "    bl _printf\n";
-    } else {
-        for (const auto& arg : node->args) {
-            arg->accept(this);
-            m_output << "    str x0, [sp, #-16]!\n";
+    int rhs = read(right, 17);
+    emit("cmp", { xreg(lhs), xreg(rhs) });
+    return op;
+}
+
+int Generator::read(const ir::Value* value, int scratch) {
+    if (value->kind == ir::Value::Kind::Constant) {
+        move_immediate(xreg(scratch), static_cast<const ir::Constant*>(value)->value);
+        return scratch;
+    }
+    const ir::Value* vreg = m_alloc->vreg(value);
+    if (!vreg) {
+        frame_address(m_slots.at(value), xreg(scratch));
+        return scratch;
+    }
+    Location loc = location(vreg);
+    if (loc.reg >= 0) return loc.reg;
+    std::string slot = frame_slot(loc.slot);
+    emit("ldr", { xreg(scratch), slot });
+    return scratch;
+}
+
+void Generator::read_into(const ir::Value* value, int reg) {
+    int src = read(value, reg);
+    if (src != reg) emit("mov", { xreg(reg), xreg(src) });
+}
+
+int Generator::result_reg(const ir::Instruction& instr) {
+    int reg = m_alloc->live(&instr) ? m_alloc->reg(&instr) : -1;
+    return reg >= 0 ? reg : 16;
+}
+
+void Generator::narrow(const ir::Instruction& instr, int reg) {
+    if (instr.type == Type::Int()) emit("sxtw", { xreg(reg), wreg(reg) });
+}
+
+void Generator::write_result(const ir::Instruction& instr, int reg) {
+    if (!m_alloc->live(&instr)) return;
+    emit_move(location(&instr), { reg, 0 });
+}
+
+void Generator::emit_move(const Location& dst, const Location& src) {
+    if (dst == src) return;
+    if (dst.reg >= 0 && src.reg >= 0) {
+        emit("mov", { xreg(dst.reg), xreg(src.reg) });
+        return;
+    }
+    int reg = src.reg;
+    if (reg < 0) {
+        reg = dst.reg >= 0 ? dst.reg : 16;
+        std::string slot = frame_slot(src.slot);
+        emit("ldr", { xreg(reg), slot });
+    }
+    if (dst.reg < 0) {
+        std::string slot = frame_slot(dst.slot);
+        emit("str", { xreg(reg), slot });
+    }
+}
+
+void Generator::emit_phi_copies(const ir::BasicBlock& from, const ir::BasicBlock& to) {
+    // The copies happen in parallel. Copies between locations go first, in
+    // an order that reads every location before overwriting it, with x17
+    // breaking cycles; constants and frame addresses are materialised last.
+    std::vector<std::pair<Location, Location>> moves;
+    std::vector<std::pair<Location, const ir::Value*>> materialised;
+    for (const auto& instr : to.instrs) {
+        if (instr->op != Opcode::Phi) break;
+        if (!m_alloc->live(instr.get())) continue;
+        for (size_t i = 0; i < instr->blocks.size(); ++i) {
+            if (instr->blocks[i] != &from) continue;
+            const ir::Value* value = instr->operands[i];
+            const ir::Value* vreg = m_alloc->vreg(value);
+            if (vreg) moves.push_back({ location(instr.get()), location(vreg) });
+            else materialised.push_back({ location(instr.get()), value });
+        }
+    }
+    while (!moves.empty()) {
+        auto is_read = [&moves](const Location& loc) {
+            return std::any_of(moves.begin(), moves.end(), [&loc](const auto& move) { return move.second == loc && !(move.first == loc); });
+        };
+        auto ready = std::find_if(moves.begin(), moves.end(), [&is_read](const auto& move) { return !is_read(move.first); });
+        if (ready == moves.end()) {
+            Location temp { 17, 0 };
+            Location saved = moves.front().first;
+            emit_move(temp, saved);
+            for (auto& move : moves) {
+                if (move.second == saved) move.second = temp;
+            }
+            continue;
         }
-        for (int i = (int)node->args.size() - 1; i >= 0; --i) {
-            m_output << "    ldr x" << i << ", [sp], #16\n";
+        emit_move(ready->first, ready->second);
+        moves.erase(ready);
+    }
+    for (const auto& [dst, value] : materialised) {
+        int reg = read(value, dst.reg >= 0 ? dst.reg : 16);
+        emit_move(dst, { reg, 0 });
+    }
+}
+
+void Generator::emit_branch(const ir::BasicBlock& from, const ir::BasicBlock& to, const ir::BasicBlock* next) {
+    emit_phi_copies(from, to);
+    if (&to != next) emit("b", { m_labels.at(&to) });
+}
+
+void Generator::emit_instruction(const ir::Instruction& instr, const ir::BasicBlock* next) {
+    const auto& ops = instr.operands;
+    // Pure instructions whose result is never read generate no code.
+    bool dead = instr.has_result() && instr.op != Opcode::Call && !m_alloc->live(&instr);
+
+    switch (instr.op) {
+        case Opcode::Alloca:
+        case Opcode::Phi:
+        case Opcode::LifetimeStart:
+        case Opcode::LifetimeEnd:
+            // Allocas are registers or frame slots, whose sharing the
+            // allocator works out itself; phis are written by their predecessors.
+            return;
+        case Opcode::Load: {
+            if (dead || m_alloc->folded(&instr)) return;
+            int dst = result_reg(instr);
+            if (m_alloc->promoted(ops[0])) {
+                read_into(ops[0], dst);
+            } else {
+                emit_load(instr.type, dst, address(ops[0], 16, 17));
+            }
+            write_result(instr, dst);
+            return;
         }
-        m_output << "    bl _" << node->callee << "\n";
-    }
-}
-
-void Generator::visit(const UnaryExpr* node) {
-    if (node->op == TokenType::bang) {
-        node->operand->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    cset x0, eq\n";
-    } else if (node->op == TokenType::star) { // Dereference
-        node->operand->accept(this); // Evaluates to an address
-        m_output << "    ldr x0, [x0]\n";
-    } else if (node->op == TokenType::amp) { // Address-of
-        // We need the address of the operand, NOT its value.
-        // This requires special handling because visit(IdentifierExpr) loads the value.
-        // We can check the type of operand.
-        if (const auto* ident = dynamic_cast<const IdentifierExpr*>(node->operand.get())) {
-             auto var = find_var(ident->name);
-             if (!var.has_value()) {
-                 std::cerr << "Error: Undeclared variable: " << ident->name << std::endl;
-                 exit(1);
-             }
-             int offset = -(int)var->stack_offset;
-             m_output << "    add x0, x29, #" << offset << "\n";
-        } else if (const auto* arr_access = dynamic_cast<const ArrayAccessExpr*>(node->operand.get())) {
-             auto var = find_var(arr_access->name);
-             arr_access->index->accept(this); // Index in x0
-             m_output << "    mov x1, #16\n";
-             m_output << "    mul x0, x0, x1\n";
-             int base_offset = -(int)var->stack_offset;
-             m_output << "    add x1, x29, #" << base_offset << "\n";
-             m_output << "    add x0, x1, x0\n"; // Address in x0
+        case Opcode::Store:
+            if (m_alloc->promoted(ops[1])) {
+                if (!m_alloc->live(ops[1])) return;
+                Location var = location(ops[1]);
+                int reg = read(ops[0], var.reg >= 0 ? var.reg : 16);
+                emit_move(var, { reg, 0 });
+            } else {
+                int value = read(ops[0], 16);
+                emit_store(ops[0]->type, value, address(ops[1], 17, 8));
+            }
+            return;
+        case Opcode::ElementAddr: {
+            if (dead) return;
+            int base = read(ops[0], 16);
+            int dst = result_reg(instr);
+            size_t size = type_size(element_type(instr.type));
+            if (is_constant(ops[1])) {
+                long long offset = constant_value(ops[1]) * static_cast<long long>(size);
+                std::vector<std::string> encoded = arithmetic_immediate(offset < 0 ? -offset : offset);
+                if (!encoded.empty()) {
+                    encoded.insert(encoded.begin(), { xreg(dst), xreg(base) });
+                    emit(offset < 0 ? "sub" : "add", encoded);
+                    write_result(instr, dst);
+                    return;
+                }
+            }
+            int index = read(ops[1], 17);
+            if (size > 1) emit("add", { xreg(dst), xreg(base), xreg(index), size == 8 ? "lsl #3" : "lsl #2" });
+            else emit("add", { xreg(dst), xreg(base), xreg(index) });
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Not: {
+            if (dead) return;
+            int operand = read(ops[0], 16);
+            int dst = result_reg(instr);
+            emit("cmp", { xreg(operand), "#0" });
+            emit("cset", { xreg(dst), "eq" });
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Select: {
+            if (dead) return;
+            Opcode op = Opcode::CmpNe;
+            if (m_selector->covered(ops[0])) {
+                op = emit_compare(*static_cast<const ir::Instruction*>(ops[0]));
+            } else {
+                emit("cmp", { xreg(read(ops[0], 16)), "#0" });
+            }
+            // csinc picks its first operand or its second plus one; an
+            // increment the select covers, or the literal 1 (xzr plus one),
+            // goes second, reversing the condition if it was the first arm.
+            auto is_one = [](const ir::Value* value) { return is_constant(value) && constant_value(value) == 1; };
+            const ir::Value* picked = ops[1];
+            const ir::Value* incremented = ops[2];
+            bool increment = m_selector->covered(incremented) || (is_one(incremented) && !m_selector->covered(picked));
+            const char* cond = condition(op);
+            if (!increment && (m_selector->covered(picked) || is_one(picked))) {
+                std::swap(picked, incremented);
+                increment = true;
+                cond = inverse_condition(op);
+            }
+            auto operand = [this](const ir::Value* value, int scratch) {
+                if (is_constant(value) && constant_value(value) == 0) return std::string("xzr");
+                return xreg(read(value, scratch));
+            };
+            int dst = result_reg(instr);
+            std::string first = operand(picked, 16);
+            if (!increment) {
+                emit("csel", { xreg(dst), first, operand(incremented, 17), cond });
+            } else if (m_selector->covered(incremented)) {
+                const auto* add = static_cast<const ir::Instruction*>(incremented);
+                emit("csinc", { xreg(dst), first, xreg(read(add->operands[0], 17)), cond });
+                narrow(instr, dst);
+            } else {
+                emit("csinc", { xreg(dst), first, "xzr", cond });
+            }
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Call: {
+            // Arguments beyond the eighth go to the bottom of the frame first,
+            // through the scratch registers. Virtual registers never live in
+            // x0-x7, so the others go straight to their registers.
+            for (size_t i = 8; i < ops.size(); ++i) {
+                int reg = read(ops[i], 16);
+                emit("str", { xreg(reg), "[sp, #" + std::to_string((i - 8) * 8) + "]" });
+            }
+            for (size_t i = 0; i < ops.size() && i < 8; ++i) {
+                read_into(ops[i], static_cast<int>(i));
+            }
+            const auto& instrs = instr.parent->instrs;
+            const ir::Instruction* after = nullptr;
+            for (size_t i = 0; i + 1 < instrs.size(); ++i) {
+                if (instrs[i].get() == &instr) after = instrs[i + 1].get();
+            }
+            // Stack arguments would have to overwrite those of our caller.
+            if (instr.tail_call && after && after->op == Opcode::Ret && ops.size() <= 8) {
+                // Sibling call: drop this frame and let the callee return to our caller.
+                emit_epilogue();
+                emit("b", { "_" + instr.name });
+                m_skipped.insert(after);
+                return;
+            }
+            emit("bl", { "_" + instr.name });
+            if (instr.has_result()) write_result(instr, 0);
+            return;
+        }
+        case Opcode::Print:
+            read_into(ops[0], 1);
+            emit("adrp", { "x0", "fmt@PAGE" });
+            emit("add", { "x0", "x0", "fmt@PAGEOFF" });
+            emit("bl", { "_printf" });
+            return;
+        case Opcode::Br:
+            emit_branch(*instr.parent, *instr.blocks[0], next);
+            return;
+        case Opcode::CondBr: {
+            const ir::BasicBlock& from = *instr.parent;
+            const ir::BasicBlock& if_true = *instr.blocks[0];
+            const ir::BasicBlock& if_false = *instr.blocks[1];
+            // Phi copies for the false edge go in a stub after the function body,
+            // so that the true edge neither runs them nor jumps over them.
+            bool false_copies = !if_false.instrs.empty() && if_false.instrs.front()->op == Opcode::Phi;
+            // When the false target follows and the true edge has no copies,
+            // branch on the condition itself and fall through, as at the
+            // bottom of a rotated loop.
+            bool true_copies = !if_true.instrs.empty() && if_true.instrs.front()->op == Opcode::Phi;
+            bool on_true = &if_false == next && !false_copies && !true_copies;
+            std::string target = on_true ? m_labels.at(&if_true) : false_copies ? create_label() : m_labels.at(&if_false);
+            // A covered comparison branches on its flags, or on its operand
+            // when it compares with zero; any other condition is tested
+            // against zero.
+            const auto* cmp = m_selector->covered(ops[0]) ? static_cast<const ir::Instruction*>(ops[0]) : nullptr;
+            const ir::Value* zero_tested = cmp ? nullptr : ops[0];
+            bool branch_if_zero = true;
+            if (cmp && (cmp->op == Opcode::CmpEq || cmp->op == Opcode::CmpNe)) {
+                for (int side = 0; side < 2 && !zero_tested; ++side) {
+                    const ir::Value* zero = cmp->operands[side];
+                    if (!is_constant(zero) || constant_value(zero) != 0) continue;
+                    zero_tested = cmp->operands[1 - side];
+                    branch_if_zero = cmp->op == Opcode::CmpNe;
+                }
+            }
+            if (zero_tested) {
+                int reg = read(zero_tested, 16);
+                emit(branch_if_zero != on_true ? "cbz" : "cbnz", { xreg(reg), target });
+            } else {
+                Opcode op = emit_compare(*cmp);
+                emit(std::string("b.") + (on_true ? condition(op) : inverse_condition(op)), { target });
+            }
+            emit_branch(from, on_true ? if_false : if_true, next);
+            if (false_copies) m_stubs.push_back({ target, &from, &if_false });
+            return;
+        }
+        case Opcode::Ret:
+            if (!ops.empty()) read_into(ops[0], 0);
+            emit_epilogue();
+            emit("ret");
+            return;
+        default:
+            break;
+    }
+    if (dead) return;
+
+    // Additions and subtractions covering a multiplication or a shift.
+    if (const ir::Instruction* tile = m_selector->covered_operand(instr)) {
+        const ir::Value* other = ops[0] == tile ? ops[1] : ops[0];
+        int dst = result_reg(instr);
+        bool add = instr.op == Opcode::Add;
+        if (tile->op == Opcode::Mul) {
+            int lhs = read(tile->operands[0], 16);
+            int rhs = read(tile->operands[1], 17);
+            int addend = read(other, 8);
+            emit(add ? "madd" : "msub", { xreg(dst), xreg(lhs), xreg(rhs), xreg(addend) });
         } else {
-            std::cerr << "Error: Cannot take address of this expression." << std::endl;
-            exit(1);
+            int lhs = read(other, 16);
+            int rhs = read(tile->operands[0], 17);
+            emit(add ? "add" : "sub", { xreg(dst), xreg(lhs), xreg(rhs), "lsl #" + std::to_string(constant_value(tile->operands[1])) });
         }
+        narrow(instr, dst);
+        write_result(instr, dst);
+        return;
+    }
+
+    if (ir::is_compare(instr.op)) {
+        int dst = result_reg(instr);
+        emit("cset", { xreg(dst), condition(emit_compare(instr)) });
+        write_result(instr, dst);
+        return;
     }
-}
 
-void Generator::visit(const BinaryExpr* node) {
-    if (node->op == TokenType::amp_amp) {
-        std::string label_false = create_label();
-        std::string label_end = create_label();
-        node->lhs->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    b.eq " << label_false << "\n";
-        node->rhs->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    b.eq " << label_false << "\n";
-        m_output << "    mov x0, #1\n";
-        m_output << "    b " << label_end << "\n";
-        m_output << label_false << ":\n";
-        m_output << "    mov x0, #0\n";
-        m_output << label_end << ":\n";
-    } else if (node->op == TokenType::pipe_pipe) {
-        std::string label_true = create_label();
-        std::string label_end = create_label();
-        node->lhs->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    b.ne " << label_true << "\n";
-        node->rhs->accept(this);
-        m_output << "    cmp x0, #0\n";
-        m_output << "    b.ne " << label_true << "\n";
-        m_output << "    mov x0, #0\n";
-        m_output << "    b " << label_end << "\n";
-        m_output << label_true << ":\n";
-        m_output << "    mov x0, #1\n";
-        m_output << label_end << ":\n";
-    } else {
-        node->rhs->accept(this);
-        m_output << "    str x0, [sp, #-16]!\n";
-        node->lhs->accept(this);
-        m_output << "    ldr x1, [sp], #16\n";
-        if (node->op == TokenType::plus) m_output << "    add x0, x0, x1\n";
-        else if (node->op == TokenType::minus) m_output << "    sub x0, x0, x1\n";
-        else if (node->op == TokenType::star) m_output << "    mul x0, x0, x1\n";
-        else if (node->op == TokenType::slash) m_output << "    sdiv x0, x0, x1\n";
-        else if (node->op == TokenType::eq_eq) { m_output << "    cmp x0, x1\n"; m_output << "    cset x0, eq\n"; }
-        else if (node->op == TokenType::neq) { m_output << "    cmp x0, x1\n"; m_output << "    cset x0, ne\n"; }
-        else if (node->op == TokenType::lt) { m_output << "    cmp x0, x1\n"; m_output << "    cset x0, lt\n"; }
-        else if (node->op == TokenType::gt) { m_output << "    cmp x0, x1\n"; m_output << "    cset x0, gt\n"; }
+    // Binary operators. Literal operands become immediates where the
+    // instruction has a form for them; additions first move a literal to the
+    // right.
+    Opcode op = instr.op;
+    const ir::Value* left = ops[0];
+    const ir::Value* right = ops[1];
+    if (is_constant(left) && !is_constant(right) && op == Opcode::Add) std::swap(left, right);
+    int dst = result_reg(instr);
+    std::string d = xreg(dst);
+    if (op == Opcode::Sub && is_constant(left) && constant_value(left) == 0) {
+        int operand = read(right, 17);
+        emit("neg", { d, xreg(operand) });
+        narrow(instr, dst);
+        write_result(instr, dst);
+        return;
+    }
+    int lhs = read(left, 16);
+    std::string a = xreg(lhs);
+    if (is_constant(right)) {
+        long long imm = constant_value(right);
+        bool shift = op == Opcode::Shl || op == Opcode::AShr || op == Opcode::LShr;
+        std::vector<std::string> encoded = arithmetic_immediate(imm < 0 ? -imm : imm);
+        if (shift) {
+            // Shift amounts introduced by the simplifier are constants.
+            std::string amount = "#" + std::to_string(imm);
+            if (op == Opcode::Shl) emit("lsl", { d, a, amount });
+            else if (op == Opcode::AShr) emit("asr", { d, a, amount });
+            else emit("lsr", { wreg(dst), wreg(lhs), amount });
+            if (op == Opcode::Shl) narrow(instr, dst);
+            write_result(instr, dst);
+            return;
+        }
+        if (!encoded.empty() && (op == Opcode::Add || op == Opcode::Sub)) {
+            bool add = (op == Opcode::Add) == (imm >= 0);
+            encoded.insert(encoded.begin(), { d, a });
+            emit(add ? "add" : "sub", encoded);
+            narrow(instr, dst);
+            write_result(instr, dst);
+            return;
+        }
+    }
+    int rhs = read(right, 17);
+    std::string b = xreg(rhs);
+    switch (op) {
+        case Opcode::Add: emit("add", { d, a, b }); break;
+        case Opcode::Sub: emit("sub", { d, a, b }); break;
+        case Opcode::Mul: emit("mul", { d, a, b }); break;
+        case Opcode::SDiv: emit("sdiv", { d, a, b }); break;
+        case Opcode::Shl: emit("lsl", { d, a, b }); break;
+        case Opcode::AShr: emit("asr", { d, a, b }); break;
+        case Opcode::LShr: emit("lsr", { wreg(dst), wreg(lhs), wreg(rhs) }); break;
+        case Opcode::MulHi:
+            emit("smull", { d, wreg(lhs), wreg(rhs) });
+            emit("asr", { d, d, "#32" });
+            break;
+        default: break;
     }
+    // asr, lsr and the high half of a product stay in range.
+    if (op == Opcode::Add || op == Opcode::Sub || op == Opcode::Mul || op == Opcode::SDiv || op == Opcode::Shl) narrow(instr, dst);
+    write_result(instr, dst);
 }
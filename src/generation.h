@@ -1,54 +1,125 @@
 #pragma once
-#include "parser.h"
+#include "elf_object.h"
+#include "instruction_selection.h"
+#include "ir.h"
+#include "peephole.h"
+#include "register_allocator.h"
+#include <map>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-struct VarInfo {
-    size_t stack_offset;
-};
-
-class Generator : public Visitor {
+// ARM64 (Apple) assembly generation from the IR.
+//
+// Values live where the RegisterAllocator put them: in a register, or in an
+// 8-byte frame slot below x29 when spilled. Allocas that stay in memory hold
+// their elements at natural size (4-byte ints, 1-byte bools, 8-byte
+// pointers). Both are packed below the save area of the callee-saved
+// registers the function uses, sharing space when their lifetimes are
+// disjoint, and the frame is allocated once in the prologue. Leaf functions
+// that need no frame get no prologue at all. Arguments beyond the eighth are
+// passed on the stack, in 8-byte slots as in AAPCS64.
+//
+// An int is 32 bits wide: in an x register it is kept sign-extended, as
+// ldrsw loads it, and results that can leave that range (add, sub, mul,
+// sdiv, lsl) are sign-extended again from their low half, so a value wraps
+// the same way in a register as in its 4-byte slot.
+//
+// x16/x17 hold operands that are not in registers (spilled values,
+// constants, frame addresses) and results that are spilled, and x8 addresses
+// frame slots beyond the reach of an immediate offset, or holds the third
+// operand of a madd or a register-offset store. Phi nodes are resolved by
+// parallel copies at the end of each predecessor.
+//
+// Instructions are selected by covering trees of the IR (InstructionSelector),
+// so that element addresses fold into the addressing modes of loads and
+// stores, multiplications and shifts into the adds and subs using them, and
+// comparisons into the conditional branches and selects testing them (cbz/cbnz
+// for comparisons with zero). Literals become immediates wherever an
+// instruction has a form for them.
+//
+// Each function's code is collected as a list of AsmInstr and, when enabled,
+// run through the Peephole optimiser before it is printed. The same lists are
+// encoded into an ELF object by generate_object().
+class Generator {
 public:
-    explicit Generator(const Program* root);
+    explicit Generator(const ir::Module* module, bool peephole = true);
     std::string generate();
-
-    // Visitor Implementation
-    void visit(const IntLitExpr* node) override;
-    void visit(const BoolLitExpr* node) override;
-    void visit(const IdentifierExpr* node) override;
-    void visit(const ArrayAccessExpr* node) override;
-    void visit(const CallExpr* node) override;
-    void visit(const UnaryExpr* node) override;
-    void visit(const BinaryExpr* node) override;
-    void visit(const ReturnStmt* node) override;
-    void visit(const ExprStmt* node) override;
-    void visit(const VarDecl* node) override;
-    void visit(const AssignStmt* node) override;
-    void visit(const ArrayAssignStmt* node) override;
-    void visit(const PointerAssignStmt* node) override;
-    void visit(const ScopeStmt* node) override;
-    void visit(const IfStmt* node) override;
-    void visit(const WhileStmt* node) override;
-    void visit(const ForStmt* node) override;
-    void visit(const Function* node) override;
-    void visit(const Layer* node) override;
-    void visit(const Program* node) override;
+    // The code of generate() as an ELF relocatable object for AArch64 Linux;
+    // `listing` receives the encoded instructions with their offsets.
+    ElfObject generate_object(std::string& listing) const;
+    // How often each peephole rule fired, over all functions.
+    const std::map<std::string, int>& peephole_fired() const { return m_peephole_fired; }
 
 private:
-    const Program* m_root;
+    const ir::Module* m_module;
     std::stringstream m_output;
-    size_t m_stack_ptr = 0;
     int m_label_count = 0;
-    
-    // Stack of scopes. Each scope is a map of variable names to their info.
-    std::vector<std::unordered_map<std::string, VarInfo>> m_scopes;
-    
+    bool m_peephole;
+    std::map<std::string, int> m_peephole_fired;
+    std::vector<AsmInstr> m_code;   // Code of the function being generated
+    std::vector<std::vector<AsmInstr>> m_functions;   // Final code of each function
+
+    // Function being generated: its register assignment, the frame offsets
+    // (below x29) of memory allocas and spilled values, and block labels.
+    const ir::Function* m_func = nullptr;
+    std::unique_ptr<InstructionSelector> m_selector;
+    std::unique_ptr<RegisterAllocator> m_alloc;
+    std::unordered_map<const ir::Value*, size_t> m_slots;
+    std::unordered_map<const ir::BasicBlock*, std::string> m_labels;
+    std::unordered_set<const ir::Instruction*> m_skipped;
+    size_t m_frame_size = 0;
+    bool m_frameless = false;     // Leaf function without prologue and epilogue
+
+    // Edges whose phi copies are emitted after the function body.
+    struct EdgeStub {
+        std::string label;
+        const ir::BasicBlock* from;
+        const ir::BasicBlock* to;
+    };
+    std::vector<EdgeStub> m_stubs;
+
+    // Where a value is copied from or to: a register, or a frame slot when
+    // `reg` is -1.
+    struct Location {
+        int reg;
+        size_t slot;
+        bool operator==(const Location& other) const { return reg == other.reg && (reg >= 0 || slot == other.slot); }
+    };
+
     // Helpers
+    void emit(const std::string& op, std::vector<std::string> operands = {});
+    void emit_label(const std::string& label);
     std::string create_label();
-    void push_scope();
-    void pop_scope();
-    void declare_var(const std::string& name, std::optional<int> array_size = std::nullopt);
-    std::optional<VarInfo> find_var(const std::string& name);
+    void emit_function(const ir::Function& func);
+    void layout_frame(const ir::Function& func);
+    void emit_instruction(const ir::Instruction& instr, const ir::BasicBlock* next);
+    void emit_branch(const ir::BasicBlock& from, const ir::BasicBlock& to, const ir::BasicBlock* next);
+    void emit_phi_copies(const ir::BasicBlock& from, const ir::BasicBlock& to);
+    void emit_move(const Location& dst, const Location& src);
+    void emit_epilogue();
+    void emit_load(Type type, int reg, const std::string& address);
+    void emit_store(Type type, int reg, const std::string& address);
+
+    // Memory operand addressing what `pointer` points to, reading its parts
+    // into the scratch registers where they are not in registers already.
+    std::string address(const ir::Value* pointer, int base_scratch, int index_scratch);
+    // Sets the flags for comparison `cmp`; returns the comparison that holds
+    // on them, which has its operands swapped when the left one was a literal.
+    ir::Opcode emit_compare(const ir::Instruction& cmp);
+    int read(const ir::Value* value, int scratch);
+    void read_into(const ir::Value* value, int reg);
+    int result_reg(const ir::Instruction& instr);
+    void write_result(const ir::Instruction& instr, int reg);
+    // Sign-extends an int result computed in 64 bits back from its low 32.
+    void narrow(const ir::Instruction& instr, int reg);
+    Location location(const ir::Value* vreg);
+    std::string frame_slot(size_t stack_offset);
+    // Memory operand of incoming argument `index` (8 or more).
+    std::string stack_argument(size_t index);
+    void frame_address(size_t stack_offset, const std::string& reg);
+    void move_immediate(const std::string& reg, long long value);
 };
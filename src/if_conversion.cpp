@@ -0,0 +1,209 @@
+#include "if_conversion.h"
+#include "ir_analysis.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ir {
+
+namespace {
+
+// An arm of a conditional: a block (nullptr for the empty arm of a triangle),
+// the instructions that move out of it, and the last value it stores to each
+// variable.
+struct Arm {
+    BasicBlock* block = nullptr;
+    std::vector<Instruction*> hoisted;
+    std::vector<std::pair<Value*, Value*>> stores;
+
+    Value* stored(const Value* var) const {
+        for (const auto& [v, value] : stores) {
+            if (v == var) return value;
+        }
+        return nullptr;
+    }
+};
+
+// Fills `arm` if the instructions of `block` before its terminator can run
+// unconditionally.
+bool analyse_arm(BasicBlock* block, const std::unordered_set<const Value*>& vars, Arm& arm) {
+    if (block->preds.size() != 1) return false;
+    arm.block = block;
+    size_t size = 0;
+    for (size_t i = 0; i + 1 < block->instrs.size(); ++i) {
+        Instruction* instr = block->instrs[i].get();
+        if (++size > max_arm_size) return false;
+        switch (instr->op) {
+            case Opcode::Store: {
+                Value* var = instr->operands[1];
+                if (!vars.count(var)) return false;
+                auto it = std::find_if(arm.stores.begin(), arm.stores.end(), [var](const auto& store) { return store.first == var; });
+                if (it != arm.stores.end()) it->second = instr->operands[0];
+                else arm.stores.push_back({ var, instr->operands[0] });
+                continue;
+            }
+            case Opcode::Load:
+                // Loads move above the stores, so they must not read one.
+                if (!vars.count(instr->operands[0]) || arm.stored(instr->operands[0])) return false;
+                break;
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Mul:
+            case Opcode::Shl:
+            case Opcode::AShr:
+            case Opcode::LShr:
+            case Opcode::MulHi:
+            case Opcode::CmpEq:
+            case Opcode::CmpNe:
+            case Opcode::CmpLt:
+            case Opcode::CmpGt:
+            case Opcode::Not:
+            case Opcode::Select:
+                break;
+            default:
+                return false;
+        }
+        arm.hoisted.push_back(instr);
+    }
+    return true;
+}
+
+Instruction* append(BasicBlock* block, Opcode op, Type type, std::vector<Value*> operands) {
+    return block->append(std::make_unique<Instruction>(op, type, std::move(operands)));
+}
+
+Value* select(BasicBlock* block, Value* cond, Value* if_true, Value* if_false) {
+    if (if_true == if_false) return if_true;
+    return append(block, Opcode::Select, if_true->type, { cond, if_true, if_false });
+}
+
+// Replaces the conditional branch ending `block` by its arms, which both
+// continue at `join` (or return, when `join` is null).
+void convert(Function& func, BasicBlock* block, Arm& on_true, Arm& on_false, BasicBlock* join) {
+    Value* cond = block->instrs.back()->operands[0];
+    block->instrs.pop_back();
+
+    for (Arm* arm : { &on_true, &on_false }) {
+        if (!arm->block) continue;
+        auto& instrs = arm->block->instrs;
+        for (Instruction* instr : arm->hoisted) {
+            auto it = std::find_if(instrs.begin(), instrs.end(), [instr](const auto& owned) { return owned.get() == instr; });
+            instr->parent = block;
+            block->instrs.push_back(std::move(*it));
+        }
+    }
+
+    if (!join) {
+        Value* result = select(block, cond, on_true.block->terminator()->operands[0], on_false.block->terminator()->operands[0]);
+        append(block, Opcode::Ret, Type::Void(), { result });
+    } else {
+        // Each assigned variable keeps its current value on the arm that
+        // does not assign it.
+        std::vector<Value*> vars;
+        for (const Arm* arm : { &on_true, &on_false }) {
+            for (const auto& [var, value] : arm->stores) {
+                if (std::find(vars.begin(), vars.end(), var) == vars.end()) vars.push_back(var);
+            }
+        }
+        for (Value* var : vars) {
+            Value* if_true = on_true.stored(var);
+            Value* if_false = on_false.stored(var);
+            if (!if_true || !if_false) {
+                Type type = { var->type.base, var->type.ptr_level - 1 };
+                Value* current = append(block, Opcode::Load, type, { var });
+                if (!if_true) if_true = current;
+                if (!if_false) if_false = current;
+            }
+            append(block, Opcode::Store, Type::Void(), { select(block, cond, if_true, if_false), var });
+        }
+
+        BasicBlock* from_true = on_true.block ? on_true.block : block;
+        BasicBlock* from_false = on_false.block ? on_false.block : block;
+        for (const auto& phi : join->instrs) {
+            if (phi->op != Opcode::Phi) break;
+            Value* if_true = nullptr;
+            Value* if_false = nullptr;
+            for (size_t i = phi->blocks.size(); i-- > 0;) {
+                if (phi->blocks[i] != from_true && phi->blocks[i] != from_false) continue;
+                if (phi->blocks[i] == from_true) if_true = phi->operands[i];
+                if (phi->blocks[i] == from_false) if_false = phi->operands[i];
+                phi->blocks.erase(phi->blocks.begin() + i);
+                phi->operands.erase(phi->operands.begin() + i);
+            }
+            phi->operands.push_back(select(block, cond, if_true, if_false));
+            phi->blocks.push_back(block);
+        }
+        append(block, Opcode::Br, Type::Void(), {})->blocks = { join };
+    }
+
+    auto& blocks = func.blocks;
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](const std::unique_ptr<BasicBlock>& b) {
+        return b.get() == on_true.block || b.get() == on_false.block;
+    }), blocks.end());
+    compute_cfg(func);
+}
+
+// Converts the conditional ending `block`, if it has one of the shapes
+// described in the header.
+bool try_convert(Function& func, BasicBlock* block, const std::unordered_set<const Value*>& vars) {
+    Instruction* branch = block->terminator();
+    if (!branch || branch->op != Opcode::CondBr) return false;
+    BasicBlock* if_true = branch->blocks[0];
+    BasicBlock* if_false = branch->blocks[1];
+    if (if_true == if_false || if_true == block || if_false == block) return false;
+    Instruction* true_end = if_true->terminator();
+    Instruction* false_end = if_false->terminator();
+    auto jumps_to = [](const Instruction* end, const BasicBlock* target) { return end->op == Opcode::Br && end->blocks[0] == target; };
+
+    Arm on_true;
+    Arm on_false;
+    if (true_end->op == Opcode::Ret && false_end->op == Opcode::Ret && !true_end->operands.empty()) {
+        if (!analyse_arm(if_true, vars, on_true) || !analyse_arm(if_false, vars, on_false)) return false;
+        // Stores before a return are dead; leave them to the branches.
+        if (!on_true.stores.empty() || !on_false.stores.empty()) return false;
+        convert(func, block, on_true, on_false, nullptr);
+        return true;
+    }
+    if (true_end->op == Opcode::Br && false_end->op == Opcode::Br && true_end->blocks[0] == false_end->blocks[0]) {
+        BasicBlock* join = true_end->blocks[0];
+        if (join == block || join == if_true || join == if_false) return false;
+        if (!analyse_arm(if_true, vars, on_true) || !analyse_arm(if_false, vars, on_false)) return false;
+        convert(func, block, on_true, on_false, join);
+        return true;
+    }
+    if (jumps_to(true_end, if_false)) {
+        if (!analyse_arm(if_true, vars, on_true)) return false;
+        convert(func, block, on_true, on_false, if_false);
+        return true;
+    }
+    if (jumps_to(false_end, if_true)) {
+        if (!analyse_arm(if_false, vars, on_false)) return false;
+        convert(func, block, on_true, on_false, if_true);
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int convert_ifs(Function& func) {
+    compute_cfg(func);
+    auto vars = local_variables(func);
+    int converted = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // Converting changes the block list; start over after each one.
+        for (const auto& block : func.blocks) {
+            if (try_convert(func, block.get(), vars)) {
+                ++converted;
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (converted > 0) func.renumber();
+    return converted;
+}
+
+} // namespace ir
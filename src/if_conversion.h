@@ -0,0 +1,26 @@
+#pragma once
+#include "ir.h"
+
+namespace ir {
+
+// If-conversion: replaces short conditionals by selects.
+//
+// A conditional branch whose arms are blocks of their own that only compute
+// values and assign local variables (scalar allocas that are only loaded and
+// stored directly) is removed, and its arms run unconditionally:
+//
+//   diamond    if c: x = a  else: x = b        x = select c, a, b
+//   triangle   if c: x = a                     x = select c, a, x
+//   returns    if c: return a  else: return b  return select c, a, b
+//
+// Values the arms pass to a phi where they join become selects as well. Arms
+// may not divide (which can trap), call, print or access memory through a
+// pointer, and are limited to `max_arm_size` instructions each, so that
+// executing both costs less than a mispredicted branch.
+//
+// Returns the number of conditionals converted.
+int convert_ifs(Function& func);
+
+constexpr size_t max_arm_size = 4;
+
+} // namespace ir
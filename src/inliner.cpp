@@ -0,0 +1,439 @@
+#include "inliner.h"
+#include "ast_utils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+void collect_calls(const Expr* expr, std::vector<std::string>& callees) {
+    if (!expr) return;
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        for (const auto& arg : call->args) collect_calls(arg.get(), callees);
+        callees.push_back(call->callee);
+    } else if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        collect_calls(arr->index.get(), callees);
+    } else if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        collect_calls(unary->operand.get(), callees);
+    } else if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        collect_calls(bin->lhs.get(), callees);
+        collect_calls(bin->rhs.get(), callees);
+    }
+}
+
+std::vector<std::string> calls_in(Stmt* stmt) {
+    std::vector<std::string> callees;
+    for_each_expr(stmt, [&callees](std::unique_ptr<Expr>& expr) { collect_calls(expr.get(), callees); });
+    return callees;
+}
+
+// There is no break/goto in the language, so a return inside a loop cannot be
+// turned into straight-line code.
+bool has_return_in_loop(const Stmt* stmt) {
+    if (!stmt) return false;
+    if (const auto* scope = dynamic_cast<const ScopeStmt*>(stmt)) {
+        return std::any_of(scope->stmts.begin(), scope->stmts.end(),
+                           [](const std::unique_ptr<Stmt>& s) { return has_return_in_loop(s.get()); });
+    }
+    if (const auto* if_stmt = dynamic_cast<const IfStmt*>(stmt)) {
+        return has_return_in_loop(if_stmt->then_stmt.get()) || has_return_in_loop(if_stmt->else_stmt.get());
+    }
+    if (const auto* while_stmt = dynamic_cast<const WhileStmt*>(stmt)) return contains_return(while_stmt->body.get());
+    if (const auto* for_stmt = dynamic_cast<const ForStmt*>(stmt)) return contains_return(for_stmt->body.get());
+    return false;
+}
+
+// Gives every parameter and local of an inlined body a fresh name, so the
+// body can be spliced into the caller without capturing or shadowing names.
+class Renamer {
+public:
+    explicit Renamer(int id) : m_prefix("__inl" + std::to_string(id) + "_") {}
+
+    std::string declare(const std::string& name) {
+        int count = m_counts[name]++;
+        std::string fresh = m_prefix + name + (count > 0 ? std::to_string(count) : "");
+        m_scopes.back()[name] = fresh;
+        return fresh;
+    }
+
+    void push() { m_scopes.push_back({}); }
+    void pop() { m_scopes.pop_back(); }
+
+    void rename_stmt(Stmt* stmt) {
+        if (!stmt) return;
+        if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+            rename_expr(ret->expr.get());
+        } else if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+            rename_expr(expr_stmt->expr.get());
+        } else if (auto* decl = dynamic_cast<VarDecl*>(stmt)) {
+            rename_expr(decl->init.get());
+            decl->name = declare(decl->name);
+        } else if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+            assign->name = lookup(assign->name);
+            rename_expr(assign->value.get());
+        } else if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+            arr_assign->name = lookup(arr_assign->name);
+            rename_expr(arr_assign->index.get());
+            rename_expr(arr_assign->value.get());
+        } else if (auto* ptr_assign = dynamic_cast<PointerAssignStmt*>(stmt)) {
+            rename_expr(ptr_assign->ptr_expr.get());
+            rename_expr(ptr_assign->value.get());
+        } else if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+            push();
+            for (auto& s : scope->stmts) rename_stmt(s.get());
+            pop();
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+            rename_expr(if_stmt->condition.get());
+            rename_stmt(if_stmt->then_stmt.get());
+            rename_stmt(if_stmt->else_stmt.get());
+        } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+            rename_expr(while_stmt->condition.get());
+            rename_stmt(while_stmt->body.get());
+        } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+            push();
+            rename_stmt(for_stmt->init.get());
+            rename_expr(for_stmt->condition.get());
+            rename_stmt(for_stmt->increment.get());
+            rename_stmt(for_stmt->body.get());
+            pop();
+        }
+    }
+
+    void rename_expr(Expr* expr) {
+        if (!expr) return;
+        if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
+            ident->name = lookup(ident->name);
+        } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+            arr->name = lookup(arr->name);
+            rename_expr(arr->index.get());
+        } else if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+            for (auto& arg : call->args) rename_expr(arg.get());
+        } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+            rename_expr(unary->operand.get());
+        } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+            rename_expr(bin->lhs.get());
+            rename_expr(bin->rhs.get());
+        }
+    }
+
+private:
+    std::string m_prefix;
+    std::vector<std::unordered_map<std::string, std::string>> m_scopes;
+    std::unordered_map<std::string, int> m_counts;
+
+    std::string lookup(const std::string& name) const {
+        for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
+            auto found = it->find(name);
+            if (found != it->end()) return found->second;
+        }
+        return name;
+    }
+};
+
+std::vector<std::unique_ptr<Stmt>> take_stmts(std::unique_ptr<Stmt> stmt) {
+    std::vector<std::unique_ptr<Stmt>> stmts;
+    if (!stmt) return stmts;
+    if (auto* scope = dynamic_cast<ScopeStmt*>(stmt.get())) return std::move(scope->stmts);
+    stmts.push_back(std::move(stmt));
+    return stmts;
+}
+
+// Rewrites `stmts` so that no statement follows a return on any path, then
+// replaces each `return e` with `result = e`. Statements after an `if` that
+// returns on one branch are moved into the branches that fall through.
+// Relies on has_return_in_loop() having been checked by the caller.
+void lower_returns(std::vector<std::unique_ptr<Stmt>>& stmts, const std::string* result) {
+    std::vector<std::unique_ptr<Stmt>> lowered;
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        auto& stmt = stmts[i];
+        if (auto* ret = dynamic_cast<ReturnStmt*>(stmt.get())) {
+            if (result) {
+                lowered.push_back(std::make_unique<AssignStmt>(*result, std::move(ret->expr), ret->line, ret->col));
+            } else if (!is_pure(ret->expr.get())) {
+                lowered.push_back(std::make_unique<ExprStmt>(std::move(ret->expr), ret->line, ret->col));
+            }
+            stmts = std::move(lowered);
+            return;
+        }
+        if (!contains_return(stmt.get())) {
+            lowered.push_back(std::move(stmt));
+            continue;
+        }
+
+        std::vector<std::unique_ptr<Stmt>> rest;
+        for (size_t j = i + 1; j < stmts.size(); ++j) rest.push_back(std::move(stmts[j]));
+
+        if (auto* scope = dynamic_cast<ScopeStmt*>(stmt.get())) {
+            for (auto& s : rest) scope->stmts.push_back(std::move(s));
+            lower_returns(scope->stmts, result);
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt.get())) {
+            auto then_stmts = take_stmts(std::move(if_stmt->then_stmt));
+            auto else_stmts = take_stmts(std::move(if_stmt->else_stmt));
+            for (const auto& s : rest) then_stmts.push_back(clone_stmt(s.get()));
+            for (auto& s : rest) else_stmts.push_back(std::move(s));
+            lower_returns(then_stmts, result);
+            lower_returns(else_stmts, result);
+            if_stmt->then_stmt = std::make_unique<ScopeStmt>(std::move(then_stmts), if_stmt->line, if_stmt->col);
+            if_stmt->else_stmt = std::make_unique<ScopeStmt>(std::move(else_stmts), if_stmt->line, if_stmt->col);
+        }
+        lowered.push_back(std::move(stmt));
+        stmts = std::move(lowered);
+        return;
+    }
+    stmts = std::move(lowered);
+}
+
+} // namespace
+
+Inliner::Inliner(Program* program, int threshold) : m_prog(program), m_threshold(threshold) {
+}
+
+void Inliner::remark(const std::string& message) const {
+    std::cout << "Remark [inline]: " << message << std::endl;
+}
+
+void Inliner::run() {
+    build_call_graph();
+
+    // Bottom-up over the call graph, so callees are already simplified by the
+    // time their bodies are copied into callers.
+    std::unordered_set<std::string> visited;
+    std::vector<Function*> order;
+    for (const auto& func : m_prog->functions) {
+        post_order(func->name, visited, order);
+    }
+    for (Function* func : order) {
+        m_address_taken = address_taken_vars(func->body->stmts);
+        inline_in_list(func->body->stmts, func->name);
+    }
+    m_address_taken = address_taken_vars(m_prog->globals);
+    inline_in_list(m_prog->globals, "main");
+
+    remove_dead_functions();
+}
+
+void Inliner::build_call_graph() {
+    for (const auto& func : m_prog->functions) {
+        m_functions[func->name] = func.get();
+    }
+    auto count = [this](const std::vector<std::string>& callees) {
+        for (const auto& callee : callees) {
+            if (m_functions.count(callee)) m_call_counts[callee]++;
+        }
+    };
+    for (const auto& func : m_prog->functions) {
+        auto callees = calls_in(func->body.get());
+        count(callees);
+        m_call_graph[func->name] = std::move(callees);
+    }
+    for (const auto& global : m_prog->globals) {
+        count(calls_in(global.get()));
+    }
+}
+
+void Inliner::post_order(const std::string& name, std::unordered_set<std::string>& visited, std::vector<Function*>& order) {
+    if (!m_functions.count(name) || !visited.insert(name).second) return;
+    for (const auto& callee : m_call_graph[name]) {
+        post_order(callee, visited, order);
+    }
+    order.push_back(m_functions[name]);
+}
+
+bool Inliner::is_recursive(const std::string& name) const {
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> worklist = { name };
+    while (!worklist.empty()) {
+        std::string current = worklist.back();
+        worklist.pop_back();
+        auto it = m_call_graph.find(current);
+        if (it == m_call_graph.end()) continue;
+        for (const auto& callee : it->second) {
+            if (callee == name) return true;
+            if (seen.insert(callee).second) worklist.push_back(callee);
+        }
+    }
+    return false;
+}
+
+void Inliner::inline_in_list(std::vector<std::unique_ptr<Stmt>>& stmts, const std::string& caller) {
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        Stmt* stmt = stmts[i].get();
+
+        // Nested statement lists first.
+        if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+            inline_in_list(scope->stmts, caller);
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+            if (auto* then_scope = dynamic_cast<ScopeStmt*>(if_stmt->then_stmt.get())) inline_in_list(then_scope->stmts, caller);
+            if (auto* else_scope = dynamic_cast<ScopeStmt*>(if_stmt->else_stmt.get())) inline_in_list(else_scope->stmts, caller);
+        } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+            if (auto* body = dynamic_cast<ScopeStmt*>(while_stmt->body.get())) inline_in_list(body->stmts, caller);
+        } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+            if (auto* body = dynamic_cast<ScopeStmt*>(for_stmt->body.get())) inline_in_list(body->stmts, caller);
+        }
+
+        // Then the expressions evaluated exactly once, before the statement
+        // runs. Loop conditions and increments are re-evaluated on every
+        // iteration, so calls there stay in place.
+        std::vector<std::unique_ptr<Stmt>> prefix;
+        m_blocked = false;
+        m_reads_memory = false;
+        if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+            inline_calls(ret->expr, prefix, caller);
+        } else if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+            inline_calls(expr_stmt->expr, prefix, caller);
+        } else if (auto* decl = dynamic_cast<VarDecl*>(stmt)) {
+            if (decl->init) inline_calls(decl->init, prefix, caller);
+        } else if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+            inline_calls(assign->value, prefix, caller);
+        } else if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+            inline_calls(arr_assign->index, prefix, caller);
+            inline_calls(arr_assign->value, prefix, caller);
+        } else if (auto* ptr_assign = dynamic_cast<PointerAssignStmt*>(stmt)) {
+            inline_calls(ptr_assign->ptr_expr, prefix, caller);
+            inline_calls(ptr_assign->value, prefix, caller);
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+            inline_calls(if_stmt->condition, prefix, caller);
+        }
+        if (prefix.empty()) continue;
+
+        // A call statement whose whole value was inlined leaves nothing to do.
+        bool keep = true;
+        if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+            keep = expr_stmt->expr && !dynamic_cast<IdentifierExpr*>(expr_stmt->expr.get());
+        }
+        if (!keep) stmts.erase(stmts.begin() + i);
+        size_t count = prefix.size();
+        stmts.insert(stmts.begin() + i, std::make_move_iterator(prefix.begin()), std::make_move_iterator(prefix.end()));
+        i += keep ? count : count - 1;
+    }
+}
+
+void Inliner::inline_calls(std::unique_ptr<Expr>& expr, std::vector<std::unique_ptr<Stmt>>& prefix, const std::string& caller) {
+    if (!expr) return;
+    if (auto* call = dynamic_cast<CallExpr*>(expr.get())) {
+        // The arguments of an inlined call move into the prefix ahead of its
+        // body, so their reads stay before its stores.
+        bool reads_memory = m_reads_memory;
+        for (auto& arg : call->args) inline_calls(arg, prefix, caller);
+        if (!m_blocked && should_inline(call, caller, reads_memory)) {
+            m_reads_memory = reads_memory;
+            std::string result = expand(call, prefix);
+            if (result.empty()) {
+                expr.reset();
+            } else {
+                expr = std::make_unique<IdentifierExpr>(result, call->line, call->col);
+            }
+        } else {
+            m_blocked = true;
+        }
+    } else if (auto* ident = dynamic_cast<IdentifierExpr*>(expr.get())) {
+        m_reads_memory = m_reads_memory || m_address_taken.count(ident->name);
+    } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr.get())) {
+        inline_calls(arr->index, prefix, caller);
+        m_reads_memory = m_reads_memory || m_address_taken.count(arr->name);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr.get())) {
+        if (unary->op != TokenType::amp) {
+            inline_calls(unary->operand, prefix, caller);
+            m_reads_memory = m_reads_memory || unary->op == TokenType::star;
+        } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(unary->operand.get())) {
+            // Taking an address reads nothing but the index.
+            inline_calls(arr->index, prefix, caller);
+        }
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr.get())) {
+        inline_calls(bin->lhs, prefix, caller);
+        // The right operand of && and || is only evaluated conditionally.
+        if (bin->op != TokenType::amp_amp && bin->op != TokenType::pipe_pipe) {
+            inline_calls(bin->rhs, prefix, caller);
+        } else {
+            m_blocked = m_blocked || !is_pure(bin->rhs.get());
+        }
+    }
+}
+
+bool Inliner::should_inline(const CallExpr* call, const std::string& caller, bool after_memory_read) {
+    auto it = m_functions.find(call->callee);
+    if (it == m_functions.end()) return false; // Builtins such as print.
+    const Function* callee = it->second;
+
+    std::string site = "'" + callee->name + "' into '" + caller + "'";
+    // Without pointers the callee cannot reach the caller's memory.
+    bool takes_pointer = std::any_of(callee->args.begin(), callee->args.end(),
+                                     [](const Arg& arg) { return arg.type.ptr_level > 0; });
+    if (after_memory_read && takes_pointer) {
+        remark("not inlining " + site + ": an operand read before the call may be stored to by the callee");
+        return false;
+    }
+    if (callee->name == caller || is_recursive(callee->name)) {
+        remark("not inlining " + site + ": callee is recursive");
+        return false;
+    }
+    if (has_return_in_loop(callee->body.get())) {
+        remark("not inlining " + site + ": callee returns from inside a loop");
+        return false;
+    }
+
+    // Inlining the only call of a function also lets the original go away, so
+    // it gets a much larger budget than a copy that adds code.
+    int cost = stmt_size(callee->body.get());
+    bool single_site = m_call_counts[callee->name] == 1;
+    int limit = single_site ? m_threshold * 10 : m_threshold;
+    if (cost > limit) {
+        remark("not inlining " + site + ": cost " + std::to_string(cost) + " exceeds threshold " + std::to_string(limit));
+        return false;
+    }
+    remark("inlined " + site + " (cost " + std::to_string(cost) + ", threshold " + std::to_string(limit) +
+           (single_site ? ", single call site)" : ")"));
+    return true;
+}
+
+// Emits the inlined body into `prefix` and returns the name of the variable
+// holding the call's result (empty for void callees).
+std::string Inliner::expand(CallExpr* call, std::vector<std::unique_ptr<Stmt>>& prefix) {
+    const Function* callee = m_functions[call->callee];
+    int id = m_next_id++;
+    int line = call->line;
+    int col = call->col;
+
+    auto body = clone_stmt(callee->body.get());
+    auto* body_scope = static_cast<ScopeStmt*>(body.get());
+
+    Renamer renamer(id);
+    renamer.push();
+    std::vector<std::unique_ptr<Stmt>> stmts;
+    for (size_t i = 0; i < callee->args.size(); ++i) {
+        std::string name = renamer.declare(callee->args[i].name);
+        stmts.push_back(std::make_unique<VarDecl>(name, callee->args[i].type, std::move(call->args[i]), line, col));
+    }
+    renamer.rename_stmt(body_scope);
+    renamer.pop();
+
+    std::string result;
+    Type ret_type = callee->return_type;
+    if (ret_type.base != Type::Base::Void) {
+        result = "__ret" + std::to_string(id);
+        // Falling off the end of a function returns 0, as in the backends.
+        std::unique_ptr<Expr> init;
+        if (ret_type == Type::Int()) init = std::make_unique<IntLitExpr>(0, line, col);
+        else if (ret_type == Type::Bool()) init = std::make_unique<BoolLitExpr>(false, line, col);
+        prefix.push_back(std::make_unique<VarDecl>(result, ret_type, std::move(init), line, col));
+    }
+    lower_returns(body_scope->stmts, result.empty() ? nullptr : &result);
+
+    for (const auto& callee_name : calls_in(body_scope)) {
+        if (m_functions.count(callee_name)) m_call_counts[callee_name]++;
+    }
+    m_call_counts[callee->name]--;
+    m_inlined.insert(callee->name);
+
+    stmts.push_back(std::move(body));
+    prefix.push_back(std::make_unique<ScopeStmt>(std::move(stmts), line, col));
+    return result;
+}
+
+void Inliner::remove_dead_functions() {
+    auto& functions = m_prog->functions;
+    functions.erase(std::remove_if(functions.begin(), functions.end(), [this](const std::unique_ptr<Function>& func) {
+        bool dead = func->name != "main" && m_inlined.count(func->name) && m_call_counts[func->name] == 0;
+        if (dead) remark("removed '" + func->name + "': every call site was inlined");
+        return dead;
+    }), functions.end());
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "parser.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Inlines calls to small functions, and to functions with a single call site,
+// directly into their callers.
+//
+// The callee body is cloned, its parameters and locals are renamed to fresh
+// compiler-internal names, and every `return e` is rewritten into an
+// assignment to a result temporary. The expanded body is then placed in front
+// of the statement that contained the call, and the call itself is replaced by
+// the temporary. Each decision is reported as a remark. Hoisting the body
+// moves the callee's stores ahead of the operands evaluated before the call,
+// so a callee taking pointers is not inlined once such an operand has read
+// memory it could write (a dereference or an address-taken variable).
+class Inliner {
+public:
+    static constexpr int default_threshold = 50;
+
+    explicit Inliner(Program* program, int threshold = default_threshold);
+    void run();
+
+private:
+    Program* m_prog;
+    int m_threshold;
+    int m_next_id = 0;
+
+    std::unordered_map<std::string, Function*> m_functions;
+    std::unordered_map<std::string, std::vector<std::string>> m_call_graph;
+    std::unordered_map<std::string, int> m_call_counts;
+    std::unordered_set<std::string> m_inlined;
+
+    // Set once a call that stays in place has been seen in the current
+    // statement, so later calls are not hoisted above it.
+    bool m_blocked = false;
+    // Set once an operand that stays in place has read memory a callee could
+    // store to through a pointer.
+    bool m_reads_memory = false;
+    // Variables and arrays of the current caller whose address is taken.
+    std::unordered_set<std::string> m_address_taken;
+
+    void build_call_graph();
+    void post_order(const std::string& name, std::unordered_set<std::string>& visited, std::vector<Function*>& order);
+    bool is_recursive(const std::string& name) const;
+
+    void inline_in_list(std::vector<std::unique_ptr<Stmt>>& stmts, const std::string& caller);
+    void inline_calls(std::unique_ptr<Expr>& expr, std::vector<std::unique_ptr<Stmt>>& prefix, const std::string& caller);
+    bool should_inline(const CallExpr* call, const std::string& caller, bool after_memory_read);
+    std::string expand(CallExpr* call, std::vector<std::unique_ptr<Stmt>>& prefix);
+    void remove_dead_functions();
+
+    void remark(const std::string& message) const;
+};
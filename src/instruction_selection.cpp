@@ -0,0 +1,105 @@
+#include "instruction_selection.h"
+#include <unordered_map>
+
+using ir::Opcode;
+
+namespace {
+
+bool is_constant(const ir::Value* value) {
+    return value->kind == ir::Value::Kind::Constant;
+}
+
+long long constant_value(const ir::Value* value) {
+    return static_cast<const ir::Constant*>(value)->value;
+}
+
+// True if `instr` is a tree a load or store can take as its addressing mode.
+bool is_address_tile(const ir::Instruction& instr) {
+    if (instr.op != Opcode::ElementAddr) return false;
+    // Constant indices become unsigned scaled offsets, up to 4095 elements.
+    const ir::Value* index = instr.operands[1];
+    return !is_constant(index) || (constant_value(index) >= 0 && constant_value(index) <= 4095);
+}
+
+// True if `instr` is an increment csinc can take.
+bool is_increment(const ir::Instruction& instr) {
+    return instr.op == Opcode::Add && !is_constant(instr.operands[0]) && is_constant(instr.operands[1]) && constant_value(instr.operands[1]) == 1;
+}
+
+// True if `instr` is a tree an add or sub can take as its second operand.
+bool is_operand_tile(const ir::Instruction& instr) {
+    if (instr.op == Opcode::Mul) return true;
+    if (instr.op != Opcode::Shl || is_constant(instr.operands[0]) || !is_constant(instr.operands[1])) return false;
+    long long amount = constant_value(instr.operands[1]);
+    return amount >= 0 && amount <= 63;
+}
+
+} // namespace
+
+InstructionSelector::InstructionSelector(const ir::Function& func, Target target) {
+    bool aarch64 = target == Target::AArch64;
+    std::unordered_map<const ir::Value*, int> uses;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            for (const ir::Value* operand : instr->operands) ++uses[operand];
+        }
+    }
+    // An operand can only be covered by its single user, in its own block.
+    auto coverable = [&uses](const ir::Instruction& user, const ir::Value* operand) -> const ir::Instruction* {
+        if (operand->kind != ir::Value::Kind::Instruction || uses[operand] != 1) return nullptr;
+        const auto* instr = static_cast<const ir::Instruction*>(operand);
+        return instr->parent == user.parent ? instr : nullptr;
+    };
+
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            const auto& ops = instr->operands;
+            const ir::Instruction* tile = nullptr;
+            if (instr->op == Opcode::Load || instr->op == Opcode::Store) {
+                tile = coverable(*instr, ops[instr->op == Opcode::Load ? 0 : 1]);
+                if (tile && !is_address_tile(*tile)) tile = nullptr;
+            } else if (instr->op == Opcode::CondBr) {
+                // Branches test the flags of their comparison.
+                tile = coverable(*instr, ops[0]);
+                if (tile && !ir::is_compare(tile->op)) tile = nullptr;
+            } else if (instr->op == Opcode::Select) {
+                const ir::Instruction* cmp = coverable(*instr, ops[0]);
+                if (cmp && ir::is_compare(cmp->op)) m_covered.insert(cmp);
+                // At most one arm of a select can be an increment.
+                for (int arm = 2; aarch64 && arm >= 1 && !tile; --arm) {
+                    tile = coverable(*instr, ops[arm]);
+                    if (tile && !is_increment(*tile)) tile = nullptr;
+                }
+            } else if (aarch64 && (instr->op == Opcode::Add || instr->op == Opcode::Sub)) {
+                if (is_constant(ops[0]) || is_constant(ops[1])) continue;
+                tile = coverable(*instr, ops[1]);
+                if (tile && !is_operand_tile(*tile)) tile = nullptr;
+                // Addition commutes, so the tree may also be on the left.
+                if (!tile && instr->op == Opcode::Add) {
+                    tile = coverable(*instr, ops[0]);
+                    if (tile && !is_operand_tile(*tile)) tile = nullptr;
+                }
+            }
+            if (tile) m_covered.insert(tile);
+        }
+    }
+}
+
+const ir::Instruction* InstructionSelector::covered_operand(const ir::Instruction& instr) const {
+    for (const ir::Value* operand : instr.operands) {
+        if (covered(operand)) return static_cast<const ir::Instruction*>(operand);
+    }
+    return nullptr;
+}
+
+std::vector<const ir::Value*> InstructionSelector::leaves(const ir::Instruction& instr) const {
+    std::vector<const ir::Value*> result;
+    for (const ir::Value* operand : instr.operands) {
+        if (!covered(operand)) {
+            result.push_back(operand);
+            continue;
+        }
+        for (const ir::Value* inner : static_cast<const ir::Instruction*>(operand)->operands) result.push_back(inner);
+    }
+    return result;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "ir.h"
+#include "target.h"
+#include <unordered_set>
+#include <vector>
+
+// Tree-covering instruction selection for the ARM64 backend.
+//
+// The IR is one operation per instruction, but ARM64 instructions cover
+// small trees of them. An instruction whose only use follows it in the same
+// block is covered by that user when a tile takes both:
+//
+//   load/store of element_addr(b, i)    ldrsw x, [b, i, lsl #2]
+//                                       ldrsw x, [b, #4*c]   (constant index)
+//   add(a, mul(b, c)), sub(a, mul(b, c)) madd/msub x, b, c, a
+//   add(a, shl(b, #k)), sub(a, shl(b, #k))
+//                                       add/sub x, a, b, lsl #k
+//   condbr(cmp(a, b))                   cmp a, b; b.<cond>
+//   select(cmp(a, b), x, y)             cmp a, b; csel d, x, y, <cond>
+//   select(c, x, add(y, #1))            csinc d, x, y, <cond>
+//
+// A covered instruction gets no register and generates no code of its own;
+// its operands are read by the user instead, so they have to stay live until
+// the user. An add or sub with a literal operand keeps its immediate form
+// instead of covering a tree.
+//
+// x86-64 has no multiply-add, shifted operands or conditional increment, so
+// for it only addresses and comparisons are covered.
+class InstructionSelector {
+public:
+    explicit InstructionSelector(const ir::Function& func, Target target = Target::AArch64);
+
+    // True for an instruction generated as part of its user.
+    bool covered(const ir::Value* value) const { return m_covered.count(value) > 0; }
+    // The operand of `instr` it covers, or nullptr.
+    const ir::Instruction* covered_operand(const ir::Instruction& instr) const;
+    // The values `instr` reads: its operands, with the operands of a covered
+    // one in its place.
+    std::vector<const ir::Value*> leaves(const ir::Instruction& instr) const;
+
+private:
+    std::unordered_set<const ir::Value*> m_covered;
+};
@@ -0,0 +1,204 @@
+#include "ir.h"
+
+namespace ir {
+
+const char* opcode_name(Opcode op) {
+    switch (op) {
+        case Opcode::Alloca: return "alloca";
+        case Opcode::Load: return "load";
+        case Opcode::Store: return "store";
+        case Opcode::ElementAddr: return "elementaddr";
+        case Opcode::LifetimeStart: return "lifetime.start";
+        case Opcode::LifetimeEnd: return "lifetime.end";
+        case Opcode::Add: return "add";
+        case Opcode::Sub: return "sub";
+        case Opcode::Mul: return "mul";
+        case Opcode::SDiv: return "sdiv";
+        case Opcode::Shl: return "shl";
+        case Opcode::AShr: return "ashr";
+        case Opcode::LShr: return "lshr";
+        case Opcode::MulHi: return "mulhi";
+        case Opcode::CmpEq: return "cmp eq";
+        case Opcode::CmpNe: return "cmp ne";
+        case Opcode::CmpLt: return "cmp lt";
+        case Opcode::CmpGt: return "cmp gt";
+        case Opcode::Not: return "not";
+        case Opcode::Select: return "select";
+        case Opcode::Call: return "call";
+        case Opcode::Print: return "print";
+        case Opcode::Phi: return "phi";
+        case Opcode::Br: return "br";
+        case Opcode::CondBr: return "condbr";
+        case Opcode::Ret: return "ret";
+    }
+    return "?";
+}
+
+bool is_terminator(Opcode op) {
+    return op == Opcode::Br || op == Opcode::CondBr || op == Opcode::Ret;
+}
+
+bool is_binary(Opcode op) {
+    switch (op) {
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::SDiv:
+        case Opcode::Shl:
+        case Opcode::AShr:
+        case Opcode::LShr:
+        case Opcode::MulHi:
+            return true;
+        default:
+            return is_compare(op);
+    }
+}
+
+bool is_compare(Opcode op) {
+    return op == Opcode::CmpEq || op == Opcode::CmpNe || op == Opcode::CmpLt || op == Opcode::CmpGt;
+}
+
+Instruction* BasicBlock::terminator() const {
+    if (instrs.empty() || !is_terminator(instrs.back()->op)) return nullptr;
+    return instrs.back().get();
+}
+
+Instruction* BasicBlock::append(std::unique_ptr<Instruction> instr) {
+    instr->parent = this;
+    instrs.push_back(std::move(instr));
+    return instrs.back().get();
+}
+
+BasicBlock* Function::add_block(const std::string& hint) {
+    auto block = std::make_unique<BasicBlock>();
+    block->name = blocks.empty() ? hint : hint + std::to_string(++m_next_block);
+    block->parent = this;
+    blocks.push_back(std::move(block));
+    return blocks.back().get();
+}
+
+Constant* Function::constant(Type type, int value) {
+    for (const auto& c : m_constants) {
+        if (c->type == type && c->value == value) return c.get();
+    }
+    m_constants.push_back(std::make_unique<Constant>(type, value));
+    return m_constants.back().get();
+}
+
+void Function::renumber() {
+    int next = 0;
+    for (const auto& block : blocks) {
+        for (const auto& instr : block->instrs) {
+            instr->id = instr->has_result() ? next++ : -1;
+        }
+    }
+}
+
+Function* Module::find(const std::string& name) const {
+    for (const auto& func : functions) {
+        if (func->name == name) return func.get();
+    }
+    return nullptr;
+}
+
+std::string type_name(Type type) {
+    std::string base;
+    switch (type.base) {
+        case Type::Base::Int: base = "int"; break;
+        case Type::Base::Bool: base = "bool"; break;
+        case Type::Base::Void: base = "void"; break;
+    }
+    return base + std::string(type.ptr_level, '*');
+}
+
+std::string value_name(const Value* value) {
+    switch (value->kind) {
+        case Value::Kind::Constant: {
+            const auto* c = static_cast<const Constant*>(value);
+            if (c->type == Type::Bool()) return c->value ? "true" : "false";
+            return std::to_string(c->value);
+        }
+        case Value::Kind::Argument:
+            return "%" + static_cast<const Argument*>(value)->name;
+        case Value::Kind::Instruction:
+            return "%" + std::to_string(static_cast<const Instruction*>(value)->id);
+    }
+    return "?";
+}
+
+namespace {
+
+void print_instruction(const Instruction& instr, std::ostream& out) {
+    out << "  ";
+    if (instr.has_result()) out << value_name(&instr) << " = ";
+    out << opcode_name(instr.op);
+    switch (instr.op) {
+        case Opcode::Alloca:
+            out << " " << type_name({ instr.type.base, instr.type.ptr_level - 1 });
+            if (instr.count > 1) out << ", " << instr.count;
+            out << "  ; " << instr.name;
+            break;
+        case Opcode::Call:
+            out << " " << type_name(instr.type) << " @" << instr.name << "(";
+            for (size_t i = 0; i < instr.operands.size(); ++i) {
+                if (i > 0) out << ", ";
+                out << value_name(instr.operands[i]);
+            }
+            out << ")";
+            if (instr.tail_call) out << " tail";
+            break;
+        case Opcode::Phi:
+            out << " " << type_name(instr.type);
+            for (size_t i = 0; i < instr.operands.size(); ++i) {
+                out << (i > 0 ? ", [" : " [") << value_name(instr.operands[i]) << ", " << instr.blocks[i]->name << "]";
+            }
+            break;
+        case Opcode::Br:
+            out << " " << instr.blocks[0]->name;
+            break;
+        case Opcode::CondBr:
+            out << " " << value_name(instr.operands[0]) << ", " << instr.blocks[0]->name << ", " << instr.blocks[1]->name;
+            break;
+        default:
+            if (instr.has_result()) out << " " << type_name(instr.type);
+            for (size_t i = 0; i < instr.operands.size(); ++i) {
+                out << (i > 0 ? ", " : " ") << value_name(instr.operands[i]);
+            }
+            break;
+    }
+    out << "\n";
+}
+
+} // namespace
+
+void print(const Function& func, std::ostream& out) {
+    out << "fn " << func.name << "(";
+    for (size_t i = 0; i < func.args.size(); ++i) {
+        if (i > 0) out << ", ";
+        out << type_name(func.args[i]->type) << " " << value_name(func.args[i].get());
+    }
+    out << ") -> " << type_name(func.return_type) << " {\n";
+    for (const auto& block : func.blocks) {
+        out << block->name << ":";
+        if (!block->preds.empty()) {
+            out << "  ; preds =";
+            for (size_t i = 0; i < block->preds.size(); ++i) {
+                out << (i > 0 ? ", " : " ") << block->preds[i]->name;
+            }
+        }
+        out << "\n";
+        for (const auto& instr : block->instrs) {
+            print_instruction(*instr, out);
+        }
+    }
+    out << "}\n";
+}
+
+void print(const Module& module, std::ostream& out) {
+    for (size_t i = 0; i < module.functions.size(); ++i) {
+        if (i > 0) out << "\n";
+        print(*module.functions[i], out);
+    }
+}
+
+} // namespace ir
@@ -0,0 +1,130 @@
+#pragma once
+#include "parser.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Mid-level SSA intermediate representation shared by the backends.
+//
+// A Module holds one Function per source function. A Function is a list of
+// basic blocks, the first of which is the entry block, and every block ends
+// in exactly one terminator (br, condbr or ret). Values carry the source
+// `Type`: int, bool, or a pointer to one of them.
+//
+// Source variables live in `alloca` slots that are read and written with
+// load/store; every other value is defined exactly once, before its uses, and
+// phi nodes at the start of a block merge values flowing in from its
+// predecessors.
+namespace ir {
+
+struct BasicBlock;
+struct Function;
+
+enum class Opcode {
+    // Memory
+    Alloca,      // Stack slot for a variable or array; the value is its address
+    Load,        // load ptr
+    Store,       // store value, ptr
+    ElementAddr, // Address of element `index` of the array at `base`
+    LifetimeStart, // The alloca operand's scope is entered: its contents start out undefined
+    LifetimeEnd,   // The alloca operand's scope is left: its slot may be reused
+    // Integer arithmetic
+    Add, Sub, Mul, SDiv, Shl, AShr, LShr,
+    MulHi,       // High 32 bits of the signed product
+    // Comparisons, producing bool
+    CmpEq, CmpNe, CmpLt, CmpGt,
+    Not,
+    Select,      // select cond, if_true, if_false
+    Call,
+    Print,
+    Phi,
+    // Terminators
+    Br,
+    CondBr,
+    Ret,
+};
+
+const char* opcode_name(Opcode op);
+bool is_terminator(Opcode op);
+bool is_binary(Opcode op);
+bool is_compare(Opcode op);
+
+struct Value {
+    enum class Kind { Constant, Argument, Instruction };
+    Kind kind;
+    Type type;
+    Value(Kind k, Type t) : kind(k), type(t) {}
+    virtual ~Value() = default;
+};
+
+// Integer or bool literal; interned per function.
+struct Constant : public Value {
+    int value;
+    Constant(Type t, int v) : Value(Kind::Constant, t), value(v) {}
+};
+
+struct Argument : public Value {
+    std::string name;
+    size_t index;
+    Argument(std::string n, Type t, size_t i) : Value(Kind::Argument, t), name(std::move(n)), index(i) {}
+};
+
+struct Instruction : public Value {
+    Opcode op;
+    std::vector<Value*> operands;
+    // Successors of br/condbr (true target first). For a phi, the block each
+    // operand flows in from.
+    std::vector<BasicBlock*> blocks;
+    BasicBlock* parent = nullptr;
+    int id = -1;              // Number of the value in dumps, set by Function::renumber()
+
+    std::string name;         // Alloca: source variable. Call: callee.
+    int count = 1;            // Alloca: number of elements
+    bool tail_call = false;   // Call: returned directly, may reuse the caller's frame
+
+    Instruction(Opcode o, Type t, std::vector<Value*> ops = {}) : Value(Kind::Instruction, t), op(o), operands(std::move(ops)) {}
+    bool has_result() const { return type.base != Type::Base::Void; }
+};
+
+struct BasicBlock {
+    std::string name;
+    Function* parent = nullptr;
+    std::vector<std::unique_ptr<Instruction>> instrs;
+    // Control-flow edges, maintained by compute_cfg().
+    std::vector<BasicBlock*> preds;
+    std::vector<BasicBlock*> succs;
+
+    Instruction* terminator() const;
+    Instruction* append(std::unique_ptr<Instruction> instr);
+};
+
+struct Function {
+    std::string name;
+    Type return_type;
+    std::vector<std::unique_ptr<Argument>> args;
+    std::vector<std::unique_ptr<BasicBlock>> blocks;
+
+    Function(std::string n, Type rt) : name(std::move(n)), return_type(rt) {}
+    BasicBlock* entry() const { return blocks.front().get(); }
+    // Appends a block named `hint` plus a number unique in this function.
+    BasicBlock* add_block(const std::string& hint);
+    Constant* constant(Type type, int value);
+    void renumber();
+
+private:
+    std::vector<std::unique_ptr<Constant>> m_constants;
+    int m_next_block = 0;
+};
+
+struct Module {
+    std::vector<std::unique_ptr<Function>> functions;
+    Function* find(const std::string& name) const;
+};
+
+std::string type_name(Type type);
+std::string value_name(const Value* value);
+void print(const Module& module, std::ostream& out);
+void print(const Function& func, std::ostream& out);
+
+} // namespace ir
@@ -0,0 +1,254 @@
+#include "ir_analysis.h"
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+namespace ir {
+
+void compute_cfg(Function& func) {
+    for (auto& block : func.blocks) {
+        block->preds.clear();
+        block->succs.clear();
+    }
+    for (auto& block : func.blocks) {
+        Instruction* term = block->terminator();
+        if (!term) continue;
+        for (BasicBlock* succ : term->blocks) {
+            // condbr x, b, b has a single edge.
+            if (std::find(block->succs.begin(), block->succs.end(), succ) != block->succs.end()) continue;
+            block->succs.push_back(succ);
+            succ->preds.push_back(block.get());
+        }
+    }
+}
+
+std::vector<BasicBlock*> reverse_post_order(const Function& func) {
+    std::vector<BasicBlock*> order;
+    std::unordered_set<const BasicBlock*> visited;
+    // Iterative DFS: each stack entry is a block and the next successor to visit.
+    std::vector<std::pair<BasicBlock*, size_t>> stack;
+    stack.push_back({ func.entry(), 0 });
+    visited.insert(func.entry());
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        if (next < block->succs.size()) {
+            BasicBlock* succ = block->succs[next++];
+            if (visited.insert(succ).second) stack.push_back({ succ, 0 });
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+void remove_unreachable_blocks(Function& func) {
+    compute_cfg(func);
+    auto reachable_list = reverse_post_order(func);
+    std::unordered_set<const BasicBlock*> reachable(reachable_list.begin(), reachable_list.end());
+    if (reachable.size() == func.blocks.size()) return;
+
+    for (auto& block : func.blocks) {
+        if (!reachable.count(block.get())) continue;
+        for (auto& instr : block->instrs) {
+            if (instr->op != Opcode::Phi) continue;
+            for (size_t i = instr->blocks.size(); i-- > 0;) {
+                if (reachable.count(instr->blocks[i])) continue;
+                instr->blocks.erase(instr->blocks.begin() + i);
+                instr->operands.erase(instr->operands.begin() + i);
+            }
+        }
+    }
+    func.blocks.erase(std::remove_if(func.blocks.begin(), func.blocks.end(),
+                                     [&reachable](const std::unique_ptr<BasicBlock>& b) { return !reachable.count(b.get()); }),
+                      func.blocks.end());
+    compute_cfg(func);
+}
+
+std::vector<Loop> natural_loops(const Function& func) {
+    DominatorTree dom(func);
+    std::vector<Loop> loops;
+    for (const auto& header : func.blocks) {
+        Loop loop { header.get(), { header.get() } };
+        for (const BasicBlock* latch : header->preds) {
+            if (!dom.dominates(header.get(), latch)) continue;
+            // Loop body: the header plus every block reaching the latch without passing through it.
+            std::vector<const BasicBlock*> worklist = { latch };
+            while (!worklist.empty()) {
+                const BasicBlock* b = worklist.back();
+                worklist.pop_back();
+                if (!loop.blocks.insert(b).second) continue;
+                for (const BasicBlock* pred : b->preds) worklist.push_back(pred);
+            }
+        }
+        if (loop.blocks.size() > 1 || std::count(header->preds.begin(), header->preds.end(), header.get())) loops.push_back(std::move(loop));
+    }
+    return loops;
+}
+
+std::unordered_map<const BasicBlock*, int> loop_depths(const Function& func) {
+    std::unordered_map<const BasicBlock*, int> depths;
+    for (const auto& block : func.blocks) depths[block.get()] = 0;
+    for (const Loop& loop : natural_loops(func)) {
+        for (const BasicBlock* b : loop.blocks) ++depths[b];
+    }
+    return depths;
+}
+
+std::unordered_set<const Value*> local_variables(const Function& func) {
+    std::unordered_set<const Value*> vars;
+    std::unordered_set<const Value*> escaped;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op == Opcode::Alloca && instr->count == 1) vars.insert(instr.get());
+            for (size_t i = 0; i < instr->operands.size(); ++i) {
+                bool direct = (instr->op == Opcode::Load && i == 0) || (instr->op == Opcode::Store && i == 1) ||
+                              instr->op == Opcode::LifetimeStart || instr->op == Opcode::LifetimeEnd;
+                if (!direct) escaped.insert(instr->operands[i]);
+            }
+        }
+    }
+    for (const Value* value : escaped) vars.erase(value);
+    return vars;
+}
+
+DominatorTree::DominatorTree(const Function& func, bool post) : m_func(func), m_post(post) {
+    if (func.blocks.empty()) return;
+    // Blocks are numbered by position; in the post-dominator case number
+    // `count` is the virtual exit.
+    size_t count = func.blocks.size();
+    std::unordered_map<const BasicBlock*, int> index;
+    for (size_t i = 0; i < count; ++i) index[func.blocks[i].get()] = static_cast<int>(i);
+
+    auto is_exit = [](const BasicBlock* b) {
+        const Instruction* term = b->terminator();
+        return term && term->op == Opcode::Ret;
+    };
+    // Edges of the graph being walked: the CFG, or the reversed CFG plus the exit.
+    auto forward = [&](int node) {
+        std::vector<int> out;
+        if (post && node == static_cast<int>(count)) {
+            for (size_t i = 0; i < count; ++i) {
+                if (is_exit(func.blocks[i].get())) out.push_back(static_cast<int>(i));
+            }
+            return out;
+        }
+        for (BasicBlock* b : post ? func.blocks[node]->preds : func.blocks[node]->succs) out.push_back(index[b]);
+        return out;
+    };
+    auto backward = [&](int node) {
+        std::vector<int> in;
+        for (BasicBlock* b : post ? func.blocks[node]->succs : func.blocks[node]->preds) in.push_back(index[b]);
+        if (post && is_exit(func.blocks[node].get())) in.push_back(static_cast<int>(count));
+        return in;
+    };
+
+    int root = post ? static_cast<int>(count) : 0;
+    std::vector<int> post_number(count + 1, -1);
+    std::vector<int> order;
+    std::function<void(int)> dfs = [&](int node) {
+        post_number[node] = -2;
+        for (int next : forward(node)) {
+            if (post_number[next] == -1) dfs(next);
+        }
+        post_number[node] = static_cast<int>(order.size());
+        order.push_back(node);
+    };
+    dfs(root);
+    std::reverse(order.begin(), order.end());
+
+    std::vector<int> idom(count + 1, -1);
+    idom[root] = root;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (post_number[a] < post_number[b]) a = idom[a];
+            while (post_number[b] < post_number[a]) b = idom[b];
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int node : order) {
+            if (node == root) continue;
+            int new_idom = -1;
+            for (int pred : backward(node)) {
+                if (post_number[pred] < 0 || idom[pred] == -1) continue;
+                new_idom = new_idom == -1 ? pred : intersect(pred, new_idom);
+            }
+            if (new_idom != idom[node]) {
+                idom[node] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int node : order) {
+        if (node == static_cast<int>(count)) continue;
+        BasicBlock* block = func.blocks[node].get();
+        if (node == root || idom[node] == static_cast<int>(count)) {
+            m_roots.push_back(block);
+            m_idom[block] = nullptr;
+        } else {
+            BasicBlock* parent = func.blocks[idom[node]].get();
+            m_idom[block] = parent;
+            m_children[parent].push_back(block);
+        }
+    }
+    std::function<void(BasicBlock*, int)> set_depth = [&](BasicBlock* block, int depth) {
+        m_depth[block] = depth;
+        for (BasicBlock* child : children(block)) set_depth(child, depth + 1);
+    };
+    for (BasicBlock* r : m_roots) set_depth(r, 0);
+}
+
+BasicBlock* DominatorTree::idom(const BasicBlock* block) const {
+    auto it = m_idom.find(block);
+    return it == m_idom.end() ? nullptr : it->second;
+}
+
+const std::vector<BasicBlock*>& DominatorTree::children(const BasicBlock* block) const {
+    static const std::vector<BasicBlock*> none;
+    auto it = m_children.find(block);
+    return it == m_children.end() ? none : it->second;
+}
+
+bool DominatorTree::contains(const BasicBlock* block) const {
+    return m_depth.count(block) > 0;
+}
+
+bool DominatorTree::dominates(const BasicBlock* a, const BasicBlock* b) const {
+    if (!contains(a) || !contains(b)) return false;
+    int depth_a = m_depth.at(a);
+    while (b && m_depth.at(b) > depth_a) b = idom(b);
+    return b == a;
+}
+
+std::vector<BasicBlock*> DominatorTree::frontier(const BasicBlock* block) const {
+    std::vector<BasicBlock*> result;
+    for (const auto& join : m_func.blocks) {
+        if (!contains(join.get())) continue;
+        const auto& preds = m_post ? join->succs : join->preds;
+        for (BasicBlock* pred : preds) {
+            for (const BasicBlock* runner = pred; runner && contains(runner) && runner != idom(join.get()); runner = idom(runner)) {
+                if (runner == block) {
+                    if (std::find(result.begin(), result.end(), join.get()) == result.end()) result.push_back(join.get());
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void DominatorTree::print(std::ostream& out) const {
+    out << (m_post ? "post-dominators of " : "dominators of ") << m_func.name << ":\n";
+    for (const auto& block : m_func.blocks) {
+        if (!contains(block.get())) continue;
+        BasicBlock* parent = idom(block.get());
+        out << "  " << block->name << " <- " << (parent ? parent->name : (m_post ? "exit" : "-")) << "\n";
+    }
+}
+
+} // namespace ir
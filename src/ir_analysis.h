@@ -0,0 +1,72 @@
+#pragma once
+#include "ir.h"
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Control-flow analyses over the IR.
+namespace ir {
+
+// Recomputes the preds/succs edges of every block from its terminator.
+void compute_cfg(Function& func);
+
+// Blocks reachable from the entry, in reverse post-order.
+std::vector<BasicBlock*> reverse_post_order(const Function& func);
+
+// Deletes blocks that cannot be reached from the entry (e.g. code following a
+// `return`), drops their phi operands and recomputes the CFG.
+void remove_unreachable_blocks(Function& func);
+
+// A natural loop: its header and every block that reaches one of its back
+// edges (edges to a block that dominates their source) without passing
+// through the header. Back edges sharing a header form a single loop.
+struct Loop {
+    BasicBlock* header;
+    std::unordered_set<const BasicBlock*> blocks;
+};
+
+// The natural loops of a function, in the order of their headers.
+std::vector<Loop> natural_loops(const Function& func);
+
+// Number of natural loops each block belongs to (0 outside loops).
+std::unordered_map<const BasicBlock*, int> loop_depths(const Function& func);
+
+// Scalar allocas whose address is only used directly by loads, stores and
+// lifetime markers, i.e. local variables that nothing can access indirectly.
+std::unordered_set<const Value*> local_variables(const Function& func);
+
+// Dominator tree of a function, or its post-dominator tree when `post` is set.
+//
+// Built with the iterative algorithm of Cooper, Harvey and Kennedy over the
+// reverse post-order. Post-dominance is computed on the reversed CFG from a
+// virtual exit that every `ret` block flows into, so blocks that never reach a
+// return (infinite loops) are not part of the post-dominator tree.
+class DominatorTree {
+public:
+    DominatorTree(const Function& func, bool post = false);
+
+    // Immediate (post-)dominator; nullptr for the root and for blocks outside the tree.
+    BasicBlock* idom(const BasicBlock* block) const;
+    const std::vector<BasicBlock*>& children(const BasicBlock* block) const;
+    // True if every path from the root to `b` passes through `a` (a block
+    // dominates itself).
+    bool dominates(const BasicBlock* a, const BasicBlock* b) const;
+    bool contains(const BasicBlock* block) const;
+    // Blocks where the dominance of `block` ends.
+    std::vector<BasicBlock*> frontier(const BasicBlock* block) const;
+    // Roots: the entry block, or every block whose only post-dominator is the exit.
+    const std::vector<BasicBlock*>& roots() const { return m_roots; }
+
+    void print(std::ostream& out) const;
+
+private:
+    const Function& m_func;
+    bool m_post;
+    std::vector<BasicBlock*> m_roots;
+    std::unordered_map<const BasicBlock*, BasicBlock*> m_idom;
+    std::unordered_map<const BasicBlock*, std::vector<BasicBlock*>> m_children;
+    std::unordered_map<const BasicBlock*, int> m_depth;
+};
+
+} // namespace ir
@@ -0,0 +1,472 @@
+#include "ir_lowering.h"
+#include "ast_utils.h"
+#include "ir_analysis.h"
+#include <algorithm>
+#include <iostream>
+
+using ir::Opcode;
+
+namespace {
+
+Type pointee(Type type) {
+    return { type.base, type.ptr_level - 1 };
+}
+
+Type pointer_to(Type type) {
+    return { type.base, type.ptr_level + 1 };
+}
+
+// Sethi-Ullman number: registers needed to evaluate `expr` without keeping
+// anything in memory. Literals need none, since the backends use them as
+// immediate operands.
+int register_need(const Expr* expr) {
+    if (dynamic_cast<const IntLitExpr*>(expr) || dynamic_cast<const BoolLitExpr*>(expr)) return 0;
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return std::max(1, register_need(unary->operand.get()));
+    if (const auto* access = dynamic_cast<const ArrayAccessExpr*>(expr)) return std::max(1, register_need(access->index.get()));
+    if (const auto* binary = dynamic_cast<const BinaryExpr*>(expr)) {
+        int lhs = register_need(binary->lhs.get());
+        int rhs = register_need(binary->rhs.get());
+        return lhs == rhs ? lhs + 1 : std::max(lhs, rhs);
+    }
+    return 1;
+}
+
+} // namespace
+
+IRLowering::IRLowering(const Program* root) : m_root(root) {
+}
+
+std::unique_ptr<ir::Module> IRLowering::lower() {
+    m_module = std::make_unique<ir::Module>();
+    m_root->accept(this);
+    return std::move(m_module);
+}
+
+void IRLowering::visit(const Program* node) {
+    bool has_main = false;
+    for (const auto& func : node->functions) {
+        if (func->name == "main") has_main = true;
+        func->accept(this);
+    }
+
+    if (!has_main && !node->globals.empty()) {
+        begin_function("main", Type::Int());
+        for (const auto& stmt : node->globals) {
+            stmt->accept(this);
+        }
+        emit(Opcode::Ret, Type::Void(), { m_func->constant(Type::Int(), 0) });
+        finish_function();
+    }
+}
+
+void IRLowering::visit(const Function* node) {
+    begin_function(node->name, node->return_type);
+    for (size_t i = 0; i < node->args.size(); ++i) {
+        const Arg& arg = node->args[i];
+        m_func->args.push_back(std::make_unique<ir::Argument>(arg.name, arg.type, i));
+        ir::Instruction* slot = emit_alloca(arg.name, arg.type);
+        emit(Opcode::Store, Type::Void(), { m_func->args.back().get(), slot });
+        m_scopes.back()[arg.name] = slot;
+        m_param_slots.push_back(slot);
+    }
+
+    bool self_tail_call = false;
+    for_each_stmt(static_cast<const Stmt*>(node->body.get()), [&](const Stmt* stmt) {
+        const auto* ret = dynamic_cast<const ReturnStmt*>(stmt);
+        const auto* call = ret && ret->tail_call ? dynamic_cast<const CallExpr*>(ret->expr.get()) : nullptr;
+        if (call && call->callee == node->name) {
+            self_tail_call = true;
+        }
+    });
+    if (self_tail_call) {
+        m_tail_target = m_func->add_block("tailrecurse");
+        emit_branch(m_tail_target);
+        set_block(m_tail_target);
+    }
+
+    node->body->accept(this);
+    finish_function();
+}
+
+void IRLowering::visit(const Layer*) {
+    // Layers only describe the compute graph; they have no lowering yet.
+}
+
+void IRLowering::begin_function(const std::string& name, Type return_type) {
+    m_module->functions.push_back(std::make_unique<ir::Function>(name, return_type));
+    m_func = m_module->functions.back().get();
+    m_block = m_func->add_block("entry");
+    m_alloca_count = 0;
+    m_param_slots.clear();
+    m_tail_target = nullptr;
+    m_scopes.clear();
+    m_scopes.push_back({});
+}
+
+void IRLowering::finish_function() {
+    // Falling off the end returns zero, as it always has.
+    if (!m_block->terminator()) {
+        if (m_func->return_type == Type::Void()) {
+            emit(Opcode::Ret, Type::Void());
+        } else {
+            emit(Opcode::Ret, Type::Void(), { m_func->constant(m_func->return_type, 0) });
+        }
+    }
+    ir::remove_unreachable_blocks(*m_func);
+    // Variables kept in registers need no markers.
+    auto vars = ir::local_variables(*m_func);
+    for (const auto& block : m_func->blocks) {
+        auto& instrs = block->instrs;
+        instrs.erase(std::remove_if(instrs.begin(), instrs.end(), [&vars](const auto& instr) {
+            return (instr->op == Opcode::LifetimeStart || instr->op == Opcode::LifetimeEnd) && vars.count(instr->operands[0]);
+        }), instrs.end());
+    }
+    m_func->renumber();
+    m_scopes.clear();
+}
+
+ir::Instruction* IRLowering::emit(Opcode op, Type type, std::vector<ir::Value*> operands) {
+    // Code after a return or tail call is unreachable; give it a block of its own.
+    if (m_block->terminator()) set_block(m_func->add_block("dead"));
+    return m_block->append(std::make_unique<ir::Instruction>(op, type, std::move(operands)));
+}
+
+ir::Instruction* IRLowering::emit_alloca(const std::string& name, Type type, int count) {
+    auto instr = std::make_unique<ir::Instruction>(Opcode::Alloca, pointer_to(type));
+    instr->name = name;
+    instr->count = count;
+    instr->parent = m_func->entry();
+    auto& entry = m_func->entry()->instrs;
+    auto it = entry.insert(entry.begin() + m_alloca_count++, std::move(instr));
+    return it->get();
+}
+
+void IRLowering::end_scopes(size_t depth) {
+    if (m_block->terminator()) return;
+    for (size_t scope = m_scopes.size(); scope-- > depth;) {
+        std::vector<ir::Instruction*> slots;
+        for (const auto& [name, slot] : m_scopes[scope]) slots.push_back(slot);
+        // Latest declaration first; its alloca is the latest in the entry block.
+        const auto& entry = m_func->entry()->instrs;
+        auto position = [&entry](const ir::Instruction* slot) {
+            return std::find_if(entry.begin(), entry.end(), [slot](const auto& instr) { return instr.get() == slot; }) - entry.begin();
+        };
+        std::sort(slots.begin(), slots.end(), [&](const ir::Instruction* a, const ir::Instruction* b) { return position(a) > position(b); });
+        for (ir::Instruction* slot : slots) emit(Opcode::LifetimeEnd, Type::Void(), { slot });
+    }
+}
+
+void IRLowering::emit_branch(ir::BasicBlock* target) {
+    emit(Opcode::Br, Type::Void())->blocks = { target };
+}
+
+void IRLowering::emit_cond_branch(ir::Value* cond, ir::BasicBlock* if_true, ir::BasicBlock* if_false) {
+    emit(Opcode::CondBr, Type::Void(), { cond })->blocks = { if_true, if_false };
+}
+
+void IRLowering::lower_condition(const Expr* cond, ir::BasicBlock* if_true, ir::BasicBlock* if_false) {
+    // a && b:  (a ? rhs : false);  rhs: (b ? true : false)
+    const auto* binary = dynamic_cast<const BinaryExpr*>(cond);
+    if (binary && (binary->op == TokenType::amp_amp || binary->op == TokenType::pipe_pipe)) {
+        bool is_and = binary->op == TokenType::amp_amp;
+        ir::BasicBlock* rhs_block = m_func->add_block(is_and ? "and.rhs" : "or.rhs");
+        if (is_and) lower_condition(binary->lhs.get(), rhs_block, if_false);
+        else lower_condition(binary->lhs.get(), if_true, rhs_block);
+        set_block(rhs_block);
+        lower_condition(binary->rhs.get(), if_true, if_false);
+        return;
+    }
+    const auto* unary = dynamic_cast<const UnaryExpr*>(cond);
+    if (unary && unary->op == TokenType::bang) {
+        lower_condition(unary->operand.get(), if_false, if_true);
+        return;
+    }
+    if (const auto* literal = dynamic_cast<const BoolLitExpr*>(cond)) {
+        emit_branch(literal->value ? if_true : if_false);
+        return;
+    }
+    emit_cond_branch(lower_expr(cond), if_true, if_false);
+}
+
+void IRLowering::set_block(ir::BasicBlock* block) {
+    // Keep the block list in the order code is emitted, so that layout
+    // follows the source.
+    auto& blocks = m_func->blocks;
+    auto it = std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<ir::BasicBlock>& b) { return b.get() == block; });
+    auto owned = std::move(*it);
+    blocks.erase(it);
+    blocks.push_back(std::move(owned));
+    m_block = block;
+}
+
+ir::Value* IRLowering::lower_expr(const Expr* expr) {
+    expr->accept(this);
+    return m_last;
+}
+
+ir::Instruction* IRLowering::find_var(const std::string& name) {
+    for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
+        auto found = it->find(name);
+        if (found != it->end()) return found->second;
+    }
+    std::cerr << "Error: Undeclared variable: " << name << std::endl;
+    exit(1);
+}
+
+ir::Value* IRLowering::element_addr(const std::string& name, const Expr* index_expr) {
+    ir::Instruction* slot = find_var(name);
+    ir::Value* index = lower_expr(index_expr);
+    return emit(Opcode::ElementAddr, slot->type, { slot, index });
+}
+
+void IRLowering::visit(const IntLitExpr* node) {
+    m_last = m_func->constant(Type::Int(), node->value);
+}
+
+void IRLowering::visit(const BoolLitExpr* node) {
+    m_last = m_func->constant(Type::Bool(), node->value ? 1 : 0);
+}
+
+void IRLowering::visit(const IdentifierExpr* node) {
+    ir::Instruction* slot = find_var(node->name);
+    m_last = emit(Opcode::Load, pointee(slot->type), { slot });
+}
+
+void IRLowering::visit(const ArrayAccessExpr* node) {
+    ir::Value* addr = element_addr(node->name, node->index.get());
+    m_last = emit(Opcode::Load, pointee(addr->type), { addr });
+}
+
+void IRLowering::visit(const CallExpr* node) {
+    std::vector<ir::Value*> args;
+    for (const auto& arg : node->args) {
+        args.push_back(lower_expr(arg.get()));
+    }
+    if (node->callee == "print") {
+        emit(Opcode::Print, Type::Void(), args);
+        m_last = nullptr;
+        return;
+    }
+    Type return_type = Type::Int();
+    for (const auto& func : m_root->functions) {
+        if (func->name == node->callee) return_type = func->return_type;
+    }
+    ir::Instruction* call = emit(Opcode::Call, return_type, args);
+    call->name = node->callee;
+    m_last = call;
+}
+
+void IRLowering::visit(const UnaryExpr* node) {
+    if (node->op == TokenType::amp) {
+        if (const auto* ident = dynamic_cast<const IdentifierExpr*>(node->operand.get())) {
+            m_last = find_var(ident->name);
+        } else if (const auto* arr_access = dynamic_cast<const ArrayAccessExpr*>(node->operand.get())) {
+            m_last = element_addr(arr_access->name, arr_access->index.get());
+        } else {
+            std::cerr << "Error: Cannot take address of this expression." << std::endl;
+            exit(1);
+        }
+        return;
+    }
+    ir::Value* operand = lower_expr(node->operand.get());
+    if (node->op == TokenType::bang) {
+        m_last = emit(Opcode::Not, Type::Bool(), { operand });
+    } else if (node->op == TokenType::star) {
+        m_last = emit(Opcode::Load, pointee(operand->type), { operand });
+    }
+}
+
+void IRLowering::visit(const BinaryExpr* node) {
+    if (node->op == TokenType::amp_amp || node->op == TokenType::pipe_pipe) {
+        // a && b:  condbr a, rhs, end;  rhs: br end;  end: phi [false, a's block], [b, rhs]
+        bool is_and = node->op == TokenType::amp_amp;
+        ir::Value* lhs = lower_expr(node->lhs.get());
+        ir::BasicBlock* lhs_end = m_block;
+        ir::BasicBlock* rhs_block = m_func->add_block(is_and ? "and.rhs" : "or.rhs");
+        ir::BasicBlock* end_block = m_func->add_block(is_and ? "and.end" : "or.end");
+        if (is_and) emit_cond_branch(lhs, rhs_block, end_block);
+        else emit_cond_branch(lhs, end_block, rhs_block);
+
+        set_block(rhs_block);
+        ir::Value* rhs = lower_expr(node->rhs.get());
+        ir::BasicBlock* rhs_end = m_block;
+        emit_branch(end_block);
+
+        set_block(end_block);
+        ir::Instruction* phi = emit(Opcode::Phi, Type::Bool(), { m_func->constant(Type::Bool(), is_and ? 0 : 1), rhs });
+        phi->blocks = { lhs_end, rhs_end };
+        m_last = phi;
+        return;
+    }
+
+    // Evaluate the operand needing more registers first, so that the other
+    // one is computed while only a single value is held. Calls keep their
+    // source order.
+    ir::Value* lhs = nullptr;
+    ir::Value* rhs = nullptr;
+    bool rhs_first = is_pure(node->lhs.get()) && is_pure(node->rhs.get()) &&
+                     register_need(node->rhs.get()) > register_need(node->lhs.get());
+    if (rhs_first) {
+        rhs = lower_expr(node->rhs.get());
+        lhs = lower_expr(node->lhs.get());
+    } else {
+        lhs = lower_expr(node->lhs.get());
+        rhs = lower_expr(node->rhs.get());
+    }
+    Opcode op;
+    switch (node->op) {
+        case TokenType::plus: op = Opcode::Add; break;
+        case TokenType::minus: op = Opcode::Sub; break;
+        case TokenType::star: op = Opcode::Mul; break;
+        case TokenType::slash: op = Opcode::SDiv; break;
+        case TokenType::shl: op = Opcode::Shl; break;
+        case TokenType::ashr: op = Opcode::AShr; break;
+        case TokenType::lshr: op = Opcode::LShr; break;
+        case TokenType::mulhi: op = Opcode::MulHi; break;
+        case TokenType::eq_eq: op = Opcode::CmpEq; break;
+        case TokenType::neq: op = Opcode::CmpNe; break;
+        case TokenType::lt: op = Opcode::CmpLt; break;
+        case TokenType::gt: op = Opcode::CmpGt; break;
+        default:
+            std::cerr << "Error: Unsupported binary operator." << std::endl;
+            exit(1);
+    }
+    m_last = emit(op, ir::is_compare(op) ? Type::Bool() : Type::Int(), { lhs, rhs });
+}
+
+void IRLowering::visit(const ReturnStmt* node) {
+    // A pass that rewrote the returned expression may have left the flag
+    // behind, so it is only honoured for calls.
+    const auto* call = node->tail_call ? dynamic_cast<const CallExpr*>(node->expr.get()) : nullptr;
+    if (call) {
+        if (call->callee == m_func->name && m_tail_target) {
+            // Evaluate every argument before overwriting any parameter.
+            std::vector<ir::Value*> args;
+            for (const auto& arg : call->args) {
+                args.push_back(lower_expr(arg.get()));
+            }
+            for (size_t i = 0; i < args.size(); ++i) {
+                emit(Opcode::Store, Type::Void(), { args[i], m_param_slots[i] });
+            }
+            end_scopes(1);
+            emit_branch(m_tail_target);
+            return;
+        }
+    }
+    ir::Value* value = lower_expr(node->expr.get());
+    auto* instr = call && value && value->kind == ir::Value::Kind::Instruction ? static_cast<ir::Instruction*>(value) : nullptr;
+    if (instr && instr->op == Opcode::Call) {
+        instr->tail_call = true;
+    }
+    if (m_func->return_type == Type::Void()) {
+        emit(Opcode::Ret, Type::Void());
+    } else {
+        emit(Opcode::Ret, Type::Void(), { value });
+    }
+}
+
+void IRLowering::visit(const ExprStmt* node) {
+    lower_expr(node->expr.get());
+}
+
+void IRLowering::visit(const VarDecl* node) {
+    ir::Value* init = node->init ? lower_expr(node->init.get()) : nullptr;
+    ir::Instruction* slot = emit_alloca(node->name, node->type, node->array_size.value_or(1));
+    m_scopes.back()[node->name] = slot;
+    if (m_scopes.size() > 1) emit(Opcode::LifetimeStart, Type::Void(), { slot });
+    if (init) {
+        emit(Opcode::Store, Type::Void(), { init, slot });
+    }
+}
+
+void IRLowering::visit(const AssignStmt* node) {
+    ir::Instruction* slot = find_var(node->name);
+    ir::Value* value = lower_expr(node->value.get());
+    emit(Opcode::Store, Type::Void(), { value, slot });
+}
+
+void IRLowering::visit(const ArrayAssignStmt* node) {
+    ir::Value* addr = element_addr(node->name, node->index.get());
+    ir::Value* value = lower_expr(node->value.get());
+    emit(Opcode::Store, Type::Void(), { value, addr });
+}
+
+void IRLowering::visit(const PointerAssignStmt* node) {
+    ir::Value* ptr = lower_expr(node->ptr_expr.get());
+    ir::Value* value = lower_expr(node->value.get());
+    emit(Opcode::Store, Type::Void(), { value, ptr });
+}
+
+void IRLowering::visit(const ScopeStmt* node) {
+    m_scopes.push_back({});
+    for (const auto& stmt : node->stmts) {
+        stmt->accept(this);
+    }
+    end_scopes(m_scopes.size() - 1);
+    m_scopes.pop_back();
+}
+
+void IRLowering::visit(const IfStmt* node) {
+    ir::BasicBlock* then_block = m_func->add_block("if.then");
+    ir::BasicBlock* else_block = node->else_stmt ? m_func->add_block("if.else") : nullptr;
+    ir::BasicBlock* end_block = m_func->add_block("if.end");
+    lower_condition(node->condition.get(), then_block, else_block ? else_block : end_block);
+
+    set_block(then_block);
+    node->then_stmt->accept(this);
+    emit_branch(end_block);
+
+    if (else_block) {
+        set_block(else_block);
+        node->else_stmt->accept(this);
+        emit_branch(end_block);
+    }
+    set_block(end_block);
+}
+
+void IRLowering::visit(const WhileStmt* node) {
+    ir::BasicBlock* body_block = m_func->add_block("while.body");
+    ir::BasicBlock* cond_block = m_func->add_block("while.cond");
+    ir::BasicBlock* end_block = m_func->add_block("while.end");
+    lower_condition(node->condition.get(), body_block, end_block);
+
+    set_block(body_block);
+    node->body->accept(this);
+    emit_branch(cond_block);
+
+    set_block(cond_block);
+    lower_condition(node->condition.get(), body_block, end_block);
+
+    set_block(end_block);
+}
+
+void IRLowering::visit(const ForStmt* node) {
+    m_scopes.push_back({});
+    if (node->init) node->init->accept(this);
+
+    ir::BasicBlock* body_block = m_func->add_block("for.body");
+    ir::BasicBlock* inc_block = m_func->add_block("for.inc");
+    ir::BasicBlock* end_block = m_func->add_block("for.end");
+    if (node->condition) {
+        lower_condition(node->condition.get(), body_block, end_block);
+    } else {
+        emit_branch(body_block);
+    }
+
+    set_block(body_block);
+    node->body->accept(this);
+    emit_branch(inc_block);
+
+    // The increment and the test share the latch.
+    set_block(inc_block);
+    if (node->increment) node->increment->accept(this);
+    if (node->condition) {
+        lower_condition(node->condition.get(), body_block, end_block);
+    } else {
+        emit_branch(body_block);
+    }
+
+    set_block(end_block);
+    end_scopes(m_scopes.size() - 1);
+    m_scopes.pop_back();
+}
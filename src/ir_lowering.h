@@ -0,0 +1,86 @@
+#pragma once
+#include "ir.h"
+#include "parser.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lowers the (optimised) AST into the IR.
+//
+// Every variable, parameter and array gets an `alloca` in the entry block and
+// is accessed with load/store. Slots declared in inner scopes are bracketed
+// by lifetime.start at the declaration and lifetime.end where the scope
+// closes, so that slots of disjoint scopes can share stack; the markers are
+// dropped again for variables that never leave registers. `&&` and `||` become branches joined by a phi;
+// in the condition of an if, while or for they (and `!`) branch straight to
+// the statement's targets instead. Loops are rotated: the condition guards
+// the first iteration and is tested again at the bottom of the body, so that
+// an iteration takes one branch rather than a jump to the test and a jump
+// back. A self tail call (ReturnStmt::tail_call) stores the new arguments
+// and branches back to the block after the parameter stores. Top-level
+// statements become `main` when the program does not define one.
+class IRLowering : public Visitor {
+public:
+    explicit IRLowering(const Program* root);
+    std::unique_ptr<ir::Module> lower();
+
+    // Visitor Implementation
+    void visit(const IntLitExpr* node) override;
+    void visit(const BoolLitExpr* node) override;
+    void visit(const IdentifierExpr* node) override;
+    void visit(const ArrayAccessExpr* node) override;
+    void visit(const CallExpr* node) override;
+    void visit(const UnaryExpr* node) override;
+    void visit(const BinaryExpr* node) override;
+    void visit(const ReturnStmt* node) override;
+    void visit(const ExprStmt* node) override;
+    void visit(const VarDecl* node) override;
+    void visit(const AssignStmt* node) override;
+    void visit(const ArrayAssignStmt* node) override;
+    void visit(const PointerAssignStmt* node) override;
+    void visit(const ScopeStmt* node) override;
+    void visit(const IfStmt* node) override;
+    void visit(const WhileStmt* node) override;
+    void visit(const ForStmt* node) override;
+    void visit(const Function* node) override;
+    void visit(const Layer* node) override;
+    void visit(const Program* node) override;
+
+private:
+    const Program* m_root;
+    std::unique_ptr<ir::Module> m_module;
+
+    // Function being lowered, the block new instructions go to, and the
+    // number of allocas at the start of the entry block.
+    ir::Function* m_func = nullptr;
+    ir::BasicBlock* m_block = nullptr;
+    size_t m_alloca_count = 0;
+
+    // Parameter slots and the block self tail calls branch back to.
+    std::vector<ir::Instruction*> m_param_slots;
+    ir::BasicBlock* m_tail_target = nullptr;
+
+    // Stack of scopes mapping variable names to their alloca.
+    std::vector<std::unordered_map<std::string, ir::Instruction*>> m_scopes;
+
+    // Value of the last expression visited.
+    ir::Value* m_last = nullptr;
+
+    void begin_function(const std::string& name, Type return_type);
+    void finish_function();
+    ir::Instruction* emit(ir::Opcode op, Type type, std::vector<ir::Value*> operands = {});
+    ir::Instruction* emit_alloca(const std::string& name, Type type, int count = 1);
+    // Ends the lifetime of the slots of the scopes above `depth`, innermost
+    // first, unless the current block has already left them.
+    void end_scopes(size_t depth);
+    void emit_branch(ir::BasicBlock* target);
+    void emit_cond_branch(ir::Value* cond, ir::BasicBlock* if_true, ir::BasicBlock* if_false);
+    // Branches to `if_true` or `if_false` depending on `cond`.
+    void lower_condition(const Expr* cond, ir::BasicBlock* if_true, ir::BasicBlock* if_false);
+    void set_block(ir::BasicBlock* block);
+
+    ir::Value* lower_expr(const Expr* expr);
+    ir::Instruction* find_var(const std::string& name);
+    ir::Value* element_addr(const std::string& name, const Expr* index);
+};
@@ -0,0 +1,229 @@
+#include "ir_verifier.h"
+#include "ir_analysis.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ir {
+
+namespace {
+
+class Verifier {
+public:
+    Verifier(const Module& module, const Function& func, std::vector<std::string>& errors)
+        : m_module(module), m_func(func), m_errors(errors), m_dom(func) {
+        for (const auto& block : func.blocks) {
+            for (size_t i = 0; i < block->instrs.size(); ++i) {
+                m_position[block->instrs[i].get()] = i;
+            }
+        }
+    }
+
+    void run() {
+        if (m_func.blocks.empty()) {
+            m_errors.push_back("function '" + m_func.name + "' has no blocks");
+            return;
+        }
+        for (const auto& block : m_func.blocks) {
+            check_block(*block);
+        }
+    }
+
+private:
+    const Module& m_module;
+    const Function& m_func;
+    std::vector<std::string>& m_errors;
+    DominatorTree m_dom;
+    std::unordered_map<const Instruction*, size_t> m_position;
+
+    void error(const BasicBlock& block, const std::string& message) {
+        m_errors.push_back("in '" + m_func.name + "', block '" + block.name + "': " + message);
+    }
+
+    void error(const Instruction& instr, const std::string& message) {
+        std::string what = opcode_name(instr.op);
+        if (instr.has_result()) what = value_name(&instr) + " (" + what + ")";
+        error(*instr.parent, what + ": " + message);
+    }
+
+    void check_block(const BasicBlock& block) {
+        if (!block.terminator()) {
+            error(block, "does not end in a terminator");
+        }
+        std::vector<BasicBlock*> succs;
+        bool leading_phis = true;
+        for (const auto& instr : block.instrs) {
+            if (instr->parent != &block) error(*instr, "parent is not its block");
+            if (is_terminator(instr->op) && instr.get() != block.instrs.back().get()) {
+                error(*instr, "terminator in the middle of the block");
+            }
+            if (instr->op == Opcode::Phi && !leading_phis) error(*instr, "phi after a non-phi instruction");
+            leading_phis = leading_phis && instr->op == Opcode::Phi;
+            check_operands(*instr);
+            check_types(*instr);
+        }
+        if (const Instruction* term = block.terminator()) {
+            for (BasicBlock* succ : term->blocks) {
+                if (std::find(succs.begin(), succs.end(), succ) == succs.end()) succs.push_back(succ);
+            }
+        }
+        if (succs != block.succs) error(block, "successor list is out of date");
+        for (BasicBlock* succ : block.succs) {
+            if (std::find(succ->preds.begin(), succ->preds.end(), &block) == succ->preds.end()) {
+                error(block, "missing from the predecessors of '" + succ->name + "'");
+            }
+        }
+    }
+
+    void check_operands(const Instruction& instr) {
+        for (size_t i = 0; i < instr.operands.size(); ++i) {
+            const Value* operand = instr.operands[i];
+            if (!operand) {
+                error(instr, "null operand");
+                continue;
+            }
+            if (operand->kind == Value::Kind::Argument) {
+                const auto* arg = static_cast<const Argument*>(operand);
+                if (arg->index >= m_func.args.size() || m_func.args[arg->index].get() != arg) {
+                    error(instr, "argument of another function");
+                }
+                continue;
+            }
+            if (operand->kind != Value::Kind::Instruction) continue;
+            const auto* def = static_cast<const Instruction*>(operand);
+            if (!m_position.count(def)) {
+                error(instr, "operand is not defined in this function");
+            } else if (!def->has_result()) {
+                error(instr, "operand has no value");
+            } else if (instr.op == Opcode::Phi) {
+                // The value must be available at the end of the incoming block.
+                if (i < instr.blocks.size() && m_dom.contains(instr.blocks[i]) && !m_dom.dominates(def->parent, instr.blocks[i])) {
+                    error(instr, value_name(def) + " does not dominate the edge from '" + instr.blocks[i]->name + "'");
+                }
+            } else if (!m_dom.contains(instr.parent)) {
+                continue;
+            } else if (def->parent == instr.parent ? m_position[def] >= m_position[&instr] : !m_dom.dominates(def->parent, instr.parent)) {
+                error(instr, value_name(def) + " does not dominate this use");
+            }
+        }
+    }
+
+    void expect(const Instruction& instr, bool ok, const std::string& message) {
+        if (!ok) error(instr, message);
+    }
+
+    bool operand_count(const Instruction& instr, size_t count) {
+        if (instr.operands.size() == count) return true;
+        error(instr, "expected " + std::to_string(count) + " operand(s)");
+        return false;
+    }
+
+    static Type pointee(Type type) {
+        return { type.base, type.ptr_level - 1 };
+    }
+
+    void check_types(const Instruction& instr) {
+        const auto& ops = instr.operands;
+        if (std::find(ops.begin(), ops.end(), nullptr) != ops.end()) return;
+        const Type int_type = Type::Int();
+        const Type bool_type = Type::Bool();
+        switch (instr.op) {
+            case Opcode::Alloca:
+                expect(instr, ops.empty() && instr.type.ptr_level > 0 && instr.count > 0, "must be a pointer to at least one element");
+                // Elsewhere it would take more stack every time it runs.
+                expect(instr, instr.parent == m_func.entry(), "outside the entry block");
+                break;
+            case Opcode::LifetimeStart:
+            case Opcode::LifetimeEnd:
+                if (!operand_count(instr, 1)) break;
+                expect(instr, ops[0]->kind == Value::Kind::Instruction && static_cast<const Instruction*>(ops[0])->op == Opcode::Alloca, "expects an alloca");
+                break;
+            case Opcode::Load:
+                if (!operand_count(instr, 1)) break;
+                expect(instr, ops[0]->type.ptr_level > 0 && instr.type == pointee(ops[0]->type), "loads " + type_name(instr.type) + " through " + type_name(ops[0]->type));
+                break;
+            case Opcode::Store:
+                if (!operand_count(instr, 2)) break;
+                expect(instr, ops[1]->type.ptr_level > 0 && ops[0]->type == pointee(ops[1]->type), "stores " + type_name(ops[0]->type) + " through " + type_name(ops[1]->type));
+                break;
+            case Opcode::ElementAddr:
+                if (!operand_count(instr, 2)) break;
+                expect(instr, ops[0]->type.ptr_level > 0 && instr.type == ops[0]->type && ops[1]->type == int_type, "expects a pointer base and an int index");
+                break;
+            case Opcode::CmpEq:
+            case Opcode::CmpNe:
+            case Opcode::CmpLt:
+            case Opcode::CmpGt:
+                if (!operand_count(instr, 2)) break;
+                expect(instr, ops[0]->type == ops[1]->type && instr.type == bool_type, "compares " + type_name(ops[0]->type) + " with " + type_name(ops[1]->type));
+                break;
+            case Opcode::Not:
+                if (!operand_count(instr, 1)) break;
+                expect(instr, ops[0]->type == bool_type && instr.type == bool_type, "expects a bool");
+                break;
+            case Opcode::Select:
+                if (!operand_count(instr, 3)) break;
+                expect(instr, ops[0]->type == bool_type && ops[1]->type == instr.type && ops[2]->type == instr.type, "expects a bool and two values of its type");
+                break;
+            case Opcode::Call: {
+                const Function* callee = m_module.find(instr.name);
+                if (!callee) {
+                    error(instr, "unknown function '" + instr.name + "'");
+                    break;
+                }
+                if (!operand_count(instr, callee->args.size())) break;
+                for (size_t i = 0; i < ops.size(); ++i) {
+                    expect(instr, ops[i]->type == callee->args[i]->type, "argument " + std::to_string(i + 1) + " has type " + type_name(ops[i]->type));
+                }
+                expect(instr, instr.type == callee->return_type, "result type differs from '" + callee->name + "'");
+                break;
+            }
+            case Opcode::Print:
+                if (!operand_count(instr, 1)) break;
+                expect(instr, ops[0]->type == int_type, "expects an int");
+                break;
+            case Opcode::Phi: {
+                const auto& preds = instr.parent->preds;
+                expect(instr, instr.blocks.size() == ops.size(), "operand and block lists differ in length");
+                bool matches = instr.blocks.size() == preds.size();
+                for (BasicBlock* pred : preds) {
+                    matches = matches && std::count(instr.blocks.begin(), instr.blocks.end(), pred) == 1;
+                }
+                expect(instr, matches, "incoming blocks differ from the predecessors");
+                for (const Value* op : ops) {
+                    expect(instr, op->type == instr.type, "incoming value of type " + type_name(op->type));
+                }
+                break;
+            }
+            case Opcode::Br:
+                expect(instr, ops.empty() && instr.blocks.size() == 1, "expects one target");
+                break;
+            case Opcode::CondBr:
+                expect(instr, ops.size() == 1 && ops[0]->type == bool_type && instr.blocks.size() == 2, "expects a bool and two targets");
+                break;
+            case Opcode::Ret:
+                if (m_func.return_type == Type::Void()) {
+                    expect(instr, ops.empty(), "returns a value from a void function");
+                } else {
+                    expect(instr, ops.size() == 1 && ops[0]->type == m_func.return_type, "returns the wrong type");
+                }
+                break;
+            default:
+                if (!is_binary(instr.op) || !operand_count(instr, 2)) break;
+                expect(instr, ops[0]->type == int_type && ops[1]->type == int_type && instr.type == int_type, "expects int operands");
+                break;
+        }
+    }
+};
+
+} // namespace
+
+std::vector<std::string> verify(const Module& module) {
+    std::vector<std::string> errors;
+    for (const auto& func : module.functions) {
+        Verifier(module, *func, errors).run();
+    }
+    return errors;
+}
+
+} // namespace ir
@@ -0,0 +1,14 @@
+#pragma once
+#include "ir.h"
+#include <string>
+#include <vector>
+
+namespace ir {
+
+// Checks the structural invariants the backends rely on: every block ends in
+// exactly one terminator, phis come first and have one operand per
+// predecessor, operand types match their opcode, and every value is defined
+// in a block that dominates its uses. Returns one message per violation.
+std::vector<std::string> verify(const Module& module);
+
+} // namespace ir
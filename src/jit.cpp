@@ -0,0 +1,168 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void cannot_load(const std::string& what) {
+    std::cerr << "Error: Cannot run the generated code: " << what << std::endl;
+    exit(1);
+}
+
+// print(x), which the generated code passes to printf with the format "%d\n".
+void runtime_print(const char* format, long long value) {
+    std::printf(format, static_cast<int>(value));
+}
+
+// Functions of the runtime by the names the generated code calls them.
+const std::unordered_map<std::string, uint64_t>& runtime() {
+    static const std::unordered_map<std::string, uint64_t> functions = {
+        { "printf", reinterpret_cast<uint64_t>(&runtime_print) },
+    };
+    return functions;
+}
+
+constexpr size_t stub_size = 16;
+
+// A jump to the absolute address `target`, padded to stub_size bytes.
+void write_stub(uint8_t* stub, uint64_t target, Target arch) {
+    if (arch == Target::X86_64) {
+        const uint8_t code[] = {
+            0x49, 0xBB, 0, 0, 0, 0, 0, 0, 0, 0,   // movabsq $target, %r11
+            0x41, 0xFF, 0xE3,                     // jmpq *%r11
+            0xCC, 0xCC, 0xCC,                     // int3
+        };
+        std::memcpy(stub, code, sizeof(code));
+        std::memcpy(stub + 2, &target, 8);
+    } else {
+        const uint32_t code[] = {
+            0x58000050,   // ldr x16, #8
+            0xD61F0200,   // br x16
+        };
+        std::memcpy(stub, code, sizeof(code));
+        std::memcpy(stub + 8, &target, 8);
+    }
+}
+
+size_t align_to(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t read32(const uint8_t* at) {
+    uint32_t value;
+    std::memcpy(&value, at, 4);
+    return value;
+}
+
+void write32(uint8_t* at, uint32_t value) {
+    std::memcpy(at, &value, 4);
+}
+
+} // namespace
+
+std::optional<Target> Jit::host() {
+#if defined(__x86_64__)
+    return Target::X86_64;
+#elif defined(__aarch64__)
+    return Target::AArch64;
+#else
+    return std::nullopt;
+#endif
+}
+
+Jit::Jit(const ElfObject& object) {
+    const std::vector<uint8_t>& text = object.contents(ElfObject::Section::Text);
+    const std::vector<uint8_t>& rodata = object.contents(ElfObject::Section::Rodata);
+    const std::vector<uint8_t>& data = object.contents(ElfObject::Section::Data);
+
+    // Code, stubs and read-only data share the pages that become executable;
+    // .data follows on pages of its own, which stay writable.
+    std::vector<std::string> undefined;
+    for (const ElfObject::Relocation& reloc : object.relocations()) {
+        bool defined = false;
+        for (const ElfObject::Symbol& symbol : object.symbols()) defined = defined || symbol.name == reloc.symbol;
+        if (defined || m_symbols.count(reloc.symbol)) continue;
+        if (!runtime().count(reloc.symbol)) cannot_load("undefined symbol " + reloc.symbol);
+        m_symbols[reloc.symbol] = 0;
+        undefined.push_back(reloc.symbol);
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t stubs_offset = align_to(text.size(), stub_size);
+    size_t rodata_offset = align_to(stubs_offset + undefined.size() * stub_size, 16);
+    size_t data_offset = align_to(rodata_offset + rodata.size(), page);
+    m_size = data_offset + align_to(data.size(), page);
+
+    void* memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) cannot_load("out of memory");
+    m_memory = static_cast<uint8_t*>(memory);
+    uint64_t base = reinterpret_cast<uint64_t>(m_memory);
+    std::copy(text.begin(), text.end(), m_memory);
+    std::copy(rodata.begin(), rodata.end(), m_memory + rodata_offset);
+    std::copy(data.begin(), data.end(), m_memory + data_offset);
+    for (size_t i = 0; i < undefined.size(); ++i) {
+        size_t offset = stubs_offset + i * stub_size;
+        write_stub(m_memory + offset, runtime().at(undefined[i]), object.target());
+        m_symbols[undefined[i]] = base + offset;
+    }
+    for (const ElfObject::Symbol& symbol : object.symbols()) {
+        size_t section = symbol.section == ElfObject::Section::Rodata ? rodata_offset : symbol.section == ElfObject::Section::Data ? data_offset : 0;
+        m_symbols[symbol.name] = base + section + symbol.offset;
+    }
+    for (const ElfObject::Relocation& reloc : object.relocations()) relocate(reloc, m_memory, object.target());
+
+    if (mprotect(m_memory, data_offset, PROT_READ | PROT_EXEC) != 0) cannot_load("cannot make the code executable");
+    __builtin___clear_cache(reinterpret_cast<char*>(m_memory), reinterpret_cast<char*>(m_memory + data_offset));
+}
+
+Jit::~Jit() {
+    if (m_memory) munmap(m_memory, m_size);
+}
+
+void Jit::relocate(const ElfObject::Relocation& reloc, uint8_t* text, Target target) {
+    uint8_t* at = text + reloc.offset;
+    uint64_t place = reinterpret_cast<uint64_t>(at);
+    uint64_t value = m_symbols.at(reloc.symbol) + static_cast<uint64_t>(reloc.addend);
+    int64_t relative = static_cast<int64_t>(value - place);
+    auto out_of_range = [&reloc]() { cannot_load("relocation against " + reloc.symbol + " out of range"); };
+
+    if (target == Target::X86_64) {
+        if (reloc.type != ElfObject::R_X86_64_PC32 && reloc.type != ElfObject::R_X86_64_PLT32) cannot_load("relocation type " + std::to_string(reloc.type));
+        if (relative < INT32_MIN || relative > INT32_MAX) out_of_range();
+        write32(at, static_cast<uint32_t>(relative));
+        return;
+    }
+    uint32_t instr = read32(at);
+    switch (reloc.type) {
+        case ElfObject::R_AARCH64_CALL26:
+        case ElfObject::R_AARCH64_JUMP26:
+            if (relative < -(1LL << 27) || relative >= (1LL << 27)) out_of_range();
+            instr = (instr & 0xFC000000) | (static_cast<uint32_t>(relative >> 2) & 0x03FFFFFF);
+            break;
+        case ElfObject::R_AARCH64_ADR_PREL_PG_HI21: {
+            int64_t pages = static_cast<int64_t>((value & ~0xFFFULL) - (place & ~0xFFFULL)) >> 12;
+            if (pages < -(1LL << 20) || pages >= (1LL << 20)) out_of_range();
+            uint32_t imm = static_cast<uint32_t>(pages) & 0x1FFFFF;
+            instr = (instr & 0x9F00001F) | (imm & 3) << 29 | (imm >> 2) << 5;
+            break;
+        }
+        case ElfObject::R_AARCH64_ADD_ABS_LO12_NC:
+            instr = (instr & 0xFFC003FF) | static_cast<uint32_t>(value & 0xFFF) << 10;
+            break;
+        default:
+            cannot_load("relocation type " + std::to_string(reloc.type));
+    }
+    write32(at, instr);
+}
+
+int Jit::run_main() {
+    auto entry = m_symbols.find("main");
+    if (entry == m_symbols.end()) cannot_load("no main function");
+    int result = reinterpret_cast<int (*)()>(entry->second)();
+    std::fflush(stdout);
+    return result;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "elf_object.h"
+#include "target.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Runs the code of an ElfObject in this process, for `compiler run`.
+//
+// The sections are copied into memory mapped read-write and relocated for
+// the addresses they landed at; then the code and read-only data are made
+// read-execute, so no page is ever writable and executable at once. The
+// symbols the object leaves undefined are resolved against the runtime:
+// printf, which the generated code calls for print, goes to an in-process
+// function printing the value. Calls to the runtime go through stubs placed
+// after the code, which jump to its absolute address, as the runtime is
+// generally out of reach of a direct branch.
+class Jit {
+public:
+    // Loads `object`; exits with an error if it refers to symbols the
+    // runtime does not provide.
+    explicit Jit(const ElfObject& object);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // The architecture of this process, if code for it can be generated.
+    static std::optional<Target> host();
+    // Calls `main` and returns its result. The object must be for host().
+    int run_main();
+
+private:
+    uint8_t* m_memory = nullptr;
+    size_t m_size = 0;
+    std::unordered_map<std::string, uint64_t> m_symbols;   // Loaded addresses
+
+    void relocate(const ElfObject::Relocation& reloc, uint8_t* text, Target target);
+};
@@ -117,6 +117,18 @@ std::string token_to_string(const Token &token) {
   case TokenType::colon:
     s = "COLON";
     break;
+  case TokenType::shl:
+    s = "SHL";
+    break;
+  case TokenType::ashr:
+    s = "ASHR";
+    break;
+  case TokenType::lshr:
+    s = "LSHR";
+    break;
+  case TokenType::mulhi:
+    s = "MULHI";
+    break;
   case TokenType::int_lit:
     s = "INT_LIT(" + std::to_string(std::get<int>(token.value)) + ")";
     break;
@@ -43,7 +43,12 @@ enum class TokenType {
   dedent,
   newline,
   colon,
-  pipe
+  pipe,
+  // Internal operators introduced by the optimizer; they have no source syntax.
+  shl,
+  ashr,
+  lshr,
+  mulhi
 };
 
 struct Token {
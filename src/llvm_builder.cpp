@@ -0,0 +1,381 @@
+#include "llvm_builder.h"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using ir::Opcode;
+
+namespace {
+
+// Translates one function of the IR, whose declaration is already in the
+// module, into LLVM instructions.
+class FunctionBuilder {
+public:
+    FunctionBuilder(const ir::Module& module, const ir::Function& func, llvm::Module& llvm_module)
+        : m_module(module), m_func(func), m_llvm_module(llvm_module), m_context(llvm_module.getContext()),
+          m_builder(m_context), m_llvm_func(llvm_module.getFunction(func.name)) {}
+
+    void build();
+
+private:
+    const ir::Module& m_module;
+    const ir::Function& m_func;
+    llvm::Module& m_llvm_module;
+    llvm::LLVMContext& m_context;
+    llvm::IRBuilder<> m_builder;
+    llvm::Function* m_llvm_func;
+    std::unordered_map<const ir::BasicBlock*, llvm::BasicBlock*> m_blocks;
+    std::unordered_map<const ir::Value*, llvm::Value*> m_values;
+    std::vector<const ir::Instruction*> m_phis;
+
+    std::vector<const ir::BasicBlock*> reverse_post_order() const;
+    llvm::Value* value(const ir::Value* value);
+    void emit_instruction(const ir::Instruction& instr);
+};
+
+llvm::Type* to_llvm_type(llvm::LLVMContext& context, Type type) {
+    llvm::Type* base = nullptr;
+    switch (type.base) {
+        case Type::Base::Int: base = llvm::Type::getInt32Ty(context); break;
+        case Type::Base::Bool: base = llvm::Type::getInt1Ty(context); break;
+        case Type::Base::Void: base = llvm::Type::getVoidTy(context); break;
+    }
+    for (int i = 0; i < type.ptr_level; ++i) {
+        base = llvm::PointerType::getUnqual(base);
+    }
+    return base;
+}
+
+// Blocks reachable from the entry, each after the blocks dominating it, so
+// the values an instruction uses exist when it is built. Unreachable blocks
+// are left out: they cannot run, and LLVM would drop them anyway.
+std::vector<const ir::BasicBlock*> FunctionBuilder::reverse_post_order() const {
+    std::vector<const ir::BasicBlock*> order;
+    std::unordered_set<const ir::BasicBlock*> visited = { m_func.entry() };
+    std::vector<std::pair<const ir::BasicBlock*, size_t>> stack = { { m_func.entry(), 0 } };
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        const ir::Instruction* term = block->terminator();
+        if (term && next < term->blocks.size()) {
+            const ir::BasicBlock* succ = term->blocks[next++];
+            if (visited.insert(succ).second) stack.push_back({ succ, 0 });
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    return { order.rbegin(), order.rend() };
+}
+
+llvm::Value* FunctionBuilder::value(const ir::Value* value) {
+    switch (value->kind) {
+        case ir::Value::Kind::Constant: {
+            const auto* c = static_cast<const ir::Constant*>(value);
+            llvm::Type* type = to_llvm_type(m_context, c->type);
+            if (c->type.ptr_level > 0) return llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(type));
+            return llvm::ConstantInt::get(type, c->value, true);
+        }
+        case ir::Value::Kind::Argument:
+            return m_llvm_func->getArg(static_cast<unsigned>(static_cast<const ir::Argument*>(value)->index));
+        case ir::Value::Kind::Instruction:
+            break;
+    }
+    return m_values.at(value);
+}
+
+void FunctionBuilder::build() {
+    std::vector<const ir::BasicBlock*> order = reverse_post_order();
+    for (const ir::BasicBlock* block : order) {
+        m_blocks[block] = llvm::BasicBlock::Create(m_context, block->name, m_llvm_func);
+    }
+    for (const ir::BasicBlock* block : order) {
+        m_builder.SetInsertPoint(m_blocks.at(block));
+        for (const auto& instr : block->instrs) {
+            emit_instruction(*instr);
+        }
+    }
+    // Phi operands may flow in over back edges, from values built later.
+    for (const ir::Instruction* phi : m_phis) {
+        auto* llvm_phi = llvm::cast<llvm::PHINode>(m_values.at(phi));
+        for (size_t i = 0; i < phi->operands.size(); ++i) {
+            auto block = m_blocks.find(phi->blocks[i]);
+            if (block != m_blocks.end()) llvm_phi->addIncoming(value(phi->operands[i]), block->second);
+        }
+    }
+}
+
+void FunctionBuilder::emit_instruction(const ir::Instruction& instr) {
+    const auto& ops = instr.operands;
+    llvm::Type* type = to_llvm_type(m_context, instr.type);
+    llvm::Value* result = nullptr;
+
+    switch (instr.op) {
+        case Opcode::Alloca: {
+            llvm::Type* element = to_llvm_type(m_context, { instr.type.base, instr.type.ptr_level - 1 });
+            llvm::Value* count = instr.count > 1 ? m_builder.getInt32(instr.count) : nullptr;
+            result = m_builder.CreateAlloca(element, count, instr.name);
+            break;
+        }
+        case Opcode::Load:
+            result = m_builder.CreateLoad(type, value(ops[0]));
+            break;
+        case Opcode::Store:
+            m_builder.CreateStore(value(ops[0]), value(ops[1]));
+            break;
+        case Opcode::ElementAddr: {
+            llvm::Type* element = to_llvm_type(m_context, { instr.type.base, instr.type.ptr_level - 1 });
+            result = m_builder.CreateInBoundsGEP(element, value(ops[0]), value(ops[1]));
+            break;
+        }
+        case Opcode::LifetimeStart:
+        case Opcode::LifetimeEnd: {
+            const auto* slot = static_cast<const ir::Instruction*>(ops[0]);
+            Type element = { slot->type.base, slot->type.ptr_level - 1 };
+            int size = element.ptr_level > 0 ? 8 : element.base == Type::Base::Bool ? 1 : 4;
+            llvm::ConstantInt* bytes = m_builder.getInt64(static_cast<uint64_t>(size) * slot->count);
+            if (instr.op == Opcode::LifetimeStart) m_builder.CreateLifetimeStart(value(slot), bytes);
+            else m_builder.CreateLifetimeEnd(value(slot), bytes);
+            break;
+        }
+        case Opcode::Not:
+            result = m_builder.CreateNot(value(ops[0]));
+            break;
+        case Opcode::Select:
+            result = m_builder.CreateSelect(value(ops[0]), value(ops[1]), value(ops[2]));
+            break;
+        case Opcode::Call: {
+            llvm::Function* callee = m_llvm_module.getFunction(instr.name);
+            std::vector<llvm::Value*> args;
+            for (const ir::Value* op : ops) {
+                args.push_back(value(op));
+            }
+            llvm::CallInst* call = m_builder.CreateCall(callee, args);
+            if (instr.tail_call) {
+                // musttail additionally requires the caller and callee prototypes to match.
+                const ir::Function* target = m_module.find(instr.name);
+                bool same_prototype = target && target->return_type == m_func.return_type && target->args.size() == m_func.args.size();
+                for (size_t i = 0; same_prototype && i < target->args.size(); ++i) {
+                    same_prototype = target->args[i]->type == m_func.args[i]->type;
+                }
+                call->setTailCallKind(same_prototype ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+            }
+            result = call;
+            break;
+        }
+        case Opcode::Print: {
+            llvm::GlobalVariable* format = m_llvm_module.getGlobalVariable(".str", true);
+            llvm::Value* format_ptr = m_builder.CreateConstInBoundsGEP2_32(format->getValueType(), format, 0, 0);
+            m_builder.CreateCall(m_llvm_module.getFunction("printf"), { format_ptr, value(ops[0]) });
+            break;
+        }
+        case Opcode::Phi:
+            result = m_builder.CreatePHI(type, static_cast<unsigned>(ops.size()));
+            m_phis.push_back(&instr);
+            break;
+        case Opcode::Br:
+            m_builder.CreateBr(m_blocks.at(instr.blocks[0]));
+            break;
+        case Opcode::CondBr:
+            m_builder.CreateCondBr(value(ops[0]), m_blocks.at(instr.blocks[0]), m_blocks.at(instr.blocks[1]));
+            break;
+        case Opcode::Ret:
+            if (ops.empty()) m_builder.CreateRetVoid();
+            else m_builder.CreateRet(value(ops[0]));
+            break;
+        case Opcode::MulHi: {
+            // High 32 bits of the 64-bit signed product.
+            llvm::Value* lhs = m_builder.CreateSExt(value(ops[0]), m_builder.getInt64Ty());
+            llvm::Value* rhs = m_builder.CreateSExt(value(ops[1]), m_builder.getInt64Ty());
+            llvm::Value* high = m_builder.CreateAShr(m_builder.CreateMul(lhs, rhs), 32);
+            result = m_builder.CreateTrunc(high, type);
+            break;
+        }
+        default: {
+            llvm::Value* lhs = value(ops[0]);
+            llvm::Value* rhs = value(ops[1]);
+            switch (instr.op) {
+                // Wrapping, as in LLVMGenerator.
+                case Opcode::Add: result = m_builder.CreateAdd(lhs, rhs); break;
+                case Opcode::Sub: result = m_builder.CreateSub(lhs, rhs); break;
+                case Opcode::Mul: result = m_builder.CreateMul(lhs, rhs); break;
+                case Opcode::SDiv: result = m_builder.CreateSDiv(lhs, rhs); break;
+                case Opcode::Shl: result = m_builder.CreateShl(lhs, rhs); break;
+                case Opcode::AShr: result = m_builder.CreateAShr(lhs, rhs); break;
+                case Opcode::LShr: result = m_builder.CreateLShr(lhs, rhs); break;
+                case Opcode::CmpEq: result = m_builder.CreateICmpEQ(lhs, rhs); break;
+                case Opcode::CmpNe: result = m_builder.CreateICmpNE(lhs, rhs); break;
+                case Opcode::CmpLt: result = m_builder.CreateICmpSLT(lhs, rhs); break;
+                case Opcode::CmpGt: result = m_builder.CreateICmpSGT(lhs, rhs); break;
+                default: break;
+            }
+            break;
+        }
+    }
+    if (result) m_values[&instr] = result;
+}
+
+// "+feature" for every feature of this machine's CPU, "-feature" for the rest.
+std::string host_features() {
+    llvm::StringMap<bool> features;
+    std::string list;
+    if (!llvm::sys::getHostCPUFeatures(features)) return list;
+    for (const auto& feature : features) {
+        if (!list.empty()) list += ",";
+        list += (feature.getValue() ? "+" : "-") + feature.getKey().str();
+    }
+    return list;
+}
+
+} // namespace
+
+LLVMBuilder::LLVMBuilder(const ir::Module* module, Target target, LLVMBuildOptions options)
+    : m_module(module), m_target(target), m_options(std::move(options)), m_context(std::make_unique<llvm::LLVMContext>()) {
+}
+
+LLVMBuilder::~LLVMBuilder() = default;
+
+std::string LLVMBuilder::create_machine() {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmPrinters();
+
+    // The objects are ELF, like out.o, so both targets use Linux triples.
+    llvm::Triple triple(m_target == Target::X86_64 ? "x86_64-unknown-linux-gnu" : "aarch64-unknown-linux-gnu");
+    std::string error;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple.str(), error);
+    if (!target) return error;
+
+    std::string cpu = m_options.cpu.empty() ? "generic" : m_options.cpu;
+    std::string features;
+    if (cpu == "native") {
+        if (llvm::Triple(llvm::sys::getProcessTriple()).getArch() != triple.getArch()) {
+            return "-march=native needs --target to select this machine";
+        }
+        cpu = llvm::sys::getHostCPUName().str();
+        features = host_features();
+    }
+    if (!m_options.features.empty()) {
+        features += (features.empty() ? "" : ",") + m_options.features;
+    }
+    std::unique_ptr<llvm::MCSubtargetInfo> subtarget(target->createMCSubtargetInfo(triple.str(), "", ""));
+    if (!subtarget->isCPUStringValid(cpu)) {
+        return "unknown CPU '" + cpu + "' for " + triple.str();
+    }
+
+    auto level = m_options.opt_level >= 3 ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::Default;
+    // PIC, as cc links position-independent executables by default.
+    m_machine.reset(target->createTargetMachine(triple.str(), cpu, features, llvm::TargetOptions(), llvm::Reloc::PIC_, llvm::None, level));
+    if (!m_machine) return "cannot generate code for " + triple.str();
+    return "";
+}
+
+std::string LLVMBuilder::build() {
+    m_llvm_module = std::make_unique<llvm::Module>("hy", *m_context);
+    llvm::Module& module = *m_llvm_module;
+    module.setTargetTriple(m_machine->getTargetTriple().str());
+    module.setDataLayout(m_machine->createDataLayout());
+
+    llvm::IRBuilder<> builder(*m_context);
+    auto* printf_type = llvm::FunctionType::get(builder.getInt32Ty(), { builder.getInt8PtrTy() }, true);
+    auto* print_func = llvm::Function::Create(printf_type, llvm::Function::ExternalLinkage, "printf", module);
+    print_func->addFnAttr(llvm::Attribute::NoUnwind);
+    print_func->addParamAttr(0, llvm::Attribute::NoCapture);
+    print_func->addParamAttr(0, llvm::Attribute::ReadOnly);
+    llvm::Constant* format = llvm::ConstantDataArray::getString(*m_context, "%d\n");
+    auto* str = new llvm::GlobalVariable(module, format->getType(), true, llvm::GlobalValue::PrivateLinkage, format, ".str");
+    str->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+
+    // Declarations first, as calls may go to functions defined further down.
+    // Attributes beyond nounwind (norecurse, readnone, ...) are left to the
+    // pipeline's function-attrs pass, which infers them from the same facts.
+    for (const auto& func : m_module->functions) {
+        std::vector<llvm::Type*> params;
+        for (const auto& arg : func->args) {
+            params.push_back(to_llvm_type(*m_context, arg->type));
+        }
+        auto* type = llvm::FunctionType::get(to_llvm_type(*m_context, func->return_type), params, false);
+        // Only main is called from outside, so LLVM may drop or specialise the rest.
+        auto linkage = func->name == "main" ? llvm::Function::ExternalLinkage : llvm::Function::InternalLinkage;
+        auto* llvm_func = llvm::Function::Create(type, linkage, func->name, module);
+        for (size_t i = 0; i < func->args.size(); ++i) {
+            llvm_func->getArg(static_cast<unsigned>(i))->setName(func->args[i]->name);
+        }
+        llvm_func->addFnAttr(llvm::Attribute::NoUnwind);
+        llvm_func->addFnAttr("target-cpu", m_machine->getTargetCPU());
+        if (!m_machine->getTargetFeatureString().empty()) {
+            llvm_func->addFnAttr("target-features", m_machine->getTargetFeatureString());
+        }
+    }
+    for (const auto& func : m_module->functions) {
+        FunctionBuilder(*m_module, *func, module).build();
+    }
+
+    std::string error;
+    llvm::raw_string_ostream errors(error);
+    if (llvm::verifyModule(module, &errors)) return "invalid LLVM IR: " + errors.str();
+    return "";
+}
+
+void LLVMBuilder::optimize() {
+    // Declared in this order so that they are destroyed in the reverse one.
+    llvm::LoopAnalysisManager loop_analyses;
+    llvm::FunctionAnalysisManager function_analyses;
+    llvm::CGSCCAnalysisManager cgscc_analyses;
+    llvm::ModuleAnalysisManager module_analyses;
+
+    llvm::PassBuilder passes(m_machine.get());
+    passes.registerModuleAnalyses(module_analyses);
+    passes.registerCGSCCAnalyses(cgscc_analyses);
+    passes.registerFunctionAnalyses(function_analyses);
+    passes.registerLoopAnalyses(loop_analyses);
+    passes.crossRegisterProxies(loop_analyses, function_analyses, cgscc_analyses, module_analyses);
+
+    auto level = m_options.opt_level >= 3 ? llvm::OptimizationLevel::O3 : llvm::OptimizationLevel::O2;
+    llvm::ModulePassManager pipeline = passes.buildPerModuleDefaultPipeline(level);
+    pipeline.run(*m_llvm_module, module_analyses);
+}
+
+std::string LLVMBuilder::emit(const std::string& path) {
+    std::string error = create_machine();
+    if (error.empty()) error = build();
+    if (!error.empty()) return error;
+    optimize();
+
+    std::error_code ec;
+    llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::OF_None);
+    if (ec) return "cannot write " + path + ": " + ec.message();
+    if (m_options.output == LLVMBuildOptions::Output::Bitcode) {
+        llvm::WriteBitcodeToFile(*m_llvm_module, out);
+        return "";
+    }
+    // Code generation still runs on the legacy pass manager.
+    llvm::legacy::PassManager codegen;
+    if (m_machine->addPassesToEmitFile(codegen, out, nullptr, llvm::CGFT_ObjectFile)) {
+        return "cannot emit an object file for " + m_machine->getTargetTriple().str();
+    }
+    codegen.run(*m_llvm_module);
+    return "";
+}
+
+std::string LLVMBuilder::describe() const {
+    if (!m_machine) return "";
+    return m_machine->getTargetTriple().str() + " (" + m_machine->getTargetCPU().str() + ")";
+}
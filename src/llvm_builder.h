@@ -0,0 +1,54 @@
+#pragma once
+#include "ir.h"
+#include "target.h"
+#include <memory>
+#include <string>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+class TargetMachine;
+}
+
+// In-process LLVM backend, built when CMake finds an LLVM installation.
+//
+// The IR is handed to LLVM through its C++ API instead of as text: every
+// instruction maps onto one IRBuilder call, allocas included, and SROA in
+// the optimisation pipeline promotes them as it does for clang's output.
+// The module then runs through the new pass manager's O2 or O3 pipeline,
+// tuned for the selected CPU, and is written as an object file or bitcode
+// without leaving the process. The text emitted by LLVMGenerator stays the
+// fallback for builds without LLVM.
+struct LLVMBuildOptions {
+    enum class Output { Object, Bitcode };
+    Output output = Output::Object;
+    int opt_level = 2;      // 2 or 3
+    std::string cpu;        // "" for the generic CPU, "native" for this machine
+    std::string features;   // Added to the CPU's, e.g. "+avx2,-fma"
+};
+
+class LLVMBuilder {
+public:
+    LLVMBuilder(const ir::Module* module, Target target, LLVMBuildOptions options);
+    ~LLVMBuilder();
+    LLVMBuilder(const LLVMBuilder&) = delete;
+    LLVMBuilder& operator=(const LLVMBuilder&) = delete;
+
+    // Builds, optimises and writes the module to `path`. Returns an error
+    // message, empty on success.
+    std::string emit(const std::string& path);
+    // Target triple and CPU the code is generated for, once emit() ran.
+    std::string describe() const;
+
+private:
+    const ir::Module* m_module;
+    Target m_target;
+    LLVMBuildOptions m_options;
+    std::unique_ptr<llvm::LLVMContext> m_context;
+    std::unique_ptr<llvm::Module> m_llvm_module;
+    std::unique_ptr<llvm::TargetMachine> m_machine;
+
+    std::string create_machine();
+    std::string build();
+    void optimize();
+};
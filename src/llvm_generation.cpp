@@ -1,36 +1,10 @@
 #include "llvm_generation.h"
-#include <iostream>
+#include "ir_analysis.h"
+#include <algorithm>
 
-LLVMGenerator::LLVMGenerator(const Program* root) : m_root(root) {
-}
-
-std::string LLVMGenerator::new_reg() {
-    return "%r" + std::to_string(m_reg_count++);
-}
-
-std::string LLVMGenerator::new_label() {
-    return "L" + std::to_string(m_label_count++);
-}
-
-void LLVMGenerator::push_scope() {
-    m_scopes.push_back({});
-}
-
-void LLVMGenerator::pop_scope() {
-    m_scopes.pop_back();
-}
+using ir::Opcode;
 
-void LLVMGenerator::declare_var(const std::string& name, Type type) {
-    m_scopes.back()[name] = { "%" + name + ".addr", type };
-}
-
-std::optional<LLVMVarInfo> LLVMGenerator::find_var(const std::string& name) {
-    for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
-        if (it->count(name)) {
-            return it->at(name);
-        }
-    }
-    return std::nullopt;
+LLVMGenerator::LLVMGenerator(const ir::Module* module) : m_module(module) {
 }
 
 std::string LLVMGenerator::to_llvm_type(Type type) {
@@ -46,320 +20,405 @@ std::string LLVMGenerator::to_llvm_type(Type type) {
     return base;
 }
 
-std::string LLVMGenerator::generate() {
-    m_root->accept(this);
-    return m_output.str();
+std::string LLVMGenerator::name(const ir::Value* value) const {
+    if (value->kind != ir::Value::Kind::Instruction) return ir::value_name(value);
+    // Loads and stores of promoted variables take no numbers, so values are
+    // renumbered to keep LLVM's numbering sequential.
+    return "%" + std::to_string(m_numbers.at(value));
 }
 
-void LLVMGenerator::visit(const Program* node) {
-    m_output << "declare i32 @printf(i8*, ...)\n";
-    m_output << "@.str = private unnamed_addr constant [4 x i8] [i8 37, i8 100, i8 10, i8 0]\n\n";
-
-    bool has_main = false;
-    for (const auto& func : node->functions) {
-        if (func->name == "main") has_main = true;
-        func->accept(this);
+std::string LLVMGenerator::operand(const ir::Value* value) {
+    value = resolve(value);
+    if (value->kind == ir::Value::Kind::Constant) {
+        const auto* c = static_cast<const ir::Constant*>(value);
+        if (c->type.ptr_level > 0) return "null";
+        return std::to_string(c->value);
     }
+    // A phi without operands stands for a variable read before any store.
+    const auto* instr = static_cast<const ir::Instruction*>(value);
+    if (value->kind == ir::Value::Kind::Instruction && instr->op == Opcode::Phi && instr->operands.empty()) return "undef";
+    return name(value);
+}
 
-    if (!has_main && !node->globals.empty()) {
-        m_output << "define i32 @main() {\n";
-        m_output << "entry:\n";
-        m_reg_count = 0;
-        push_scope();
-        for (const auto& stmt : node->globals) {
-            stmt->accept(this);
-        }
-        m_output << "  ret i32 0\n";
-        m_output << "}\n\n";
-        pop_scope();
-    }
+std::string LLVMGenerator::typed(const ir::Value* value) {
+    return to_llvm_type(value->type) + " " + operand(value);
 }
 
-void LLVMGenerator::visit(const Function* node) {
-    m_reg_count = 0;
-    m_output << "define " << to_llvm_type(node->return_type) << " @" << node->name << "(";
-    for (size_t i = 0; i < node->args.size(); ++i) {
-        m_output << to_llvm_type(node->args[i].type) << " %" << node->args[i].name;
-        if (i < node->args.size() - 1) m_output << ", ";
-    }
-    m_output << ") {\n";
-    m_output << "entry:\n";
-    
-    push_scope();
-    
-    // Alloca and store arguments
-    for (const auto& arg : node->args) {
-        std::string addr = "%" + arg.name + ".addr";
-        m_output << "  " << addr << " = alloca " << to_llvm_type(arg.type) << "\n";
-        m_output << "  store " << to_llvm_type(arg.type) << " %" << arg.name << ", " << to_llvm_type(arg.type) << "* " << addr << "\n";
-        declare_var(arg.name, arg.type);
-    }
-    
-    node->body->accept(this);
-    
-    if (node->return_type.base == Type::Base::Void) {
-        m_output << "  ret void\n";
-    } else {
-        // Find if last instruction was a return
-        m_output << "  ret " << to_llvm_type(node->return_type) << " 0\n";
+std::string LLVMGenerator::generate() {
+    m_output << "declare i32 @printf(i8* nocapture readonly, ...) nounwind\n";
+    m_output << "declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture)\n";
+    m_output << "declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture)\n";
+    m_output << "@.str = private unnamed_addr constant [4 x i8] [i8 37, i8 100, i8 10, i8 0]\n\n";
+    infer_attributes();
+    for (const auto& func : m_module->functions) {
+        emit_function(*func);
     }
-    
-    m_output << "}\n\n";
-    pop_scope();
+    return m_output.str();
 }
 
-void LLVMGenerator::visit(const IntLitExpr* node) {
-    m_last_reg = std::to_string(node->value);
-}
+ir::Value* LLVMGenerator::read_variable(const ir::Value* var, ir::BasicBlock* block) {
+    auto& defs = m_defs[var];
+    auto it = defs.find(block);
+    if (it != defs.end()) return it->second;
 
-void LLVMGenerator::visit(const BoolLitExpr* node) {
-    m_last_reg = node->value ? "1" : "0";
+    Type type = { var->type.base, var->type.ptr_level - 1 };
+    const std::vector<ir::BasicBlock*>& preds = m_preds[block];
+    ir::Value* value;
+    if (preds.size() == 1 && m_sealed.count(block)) {
+        value = read_variable(var, preds.front());
+    } else {
+        auto phi = std::make_unique<ir::Instruction>(Opcode::Phi, type);
+        phi->parent = block;
+        ir::Instruction* created = phi.get();
+        m_new_phis.push_back(std::move(phi));
+        m_phis[block].push_back(created);
+        // The phi is recorded first, so that reads through a loop back to
+        // this block find it instead of recursing forever.
+        defs[block] = created;
+        if (m_sealed.count(block)) add_phi_operands(var, created);
+        else m_incomplete[block].push_back({ var, created });
+        value = created;
+    }
+    m_defs[var][block] = value;
+    return value;
 }
 
-void LLVMGenerator::visit(const IdentifierExpr* node) {
-    auto var = find_var(node->name);
-    m_last_reg = new_reg();
-    m_output << "  " << m_last_reg << " = load " << to_llvm_type(var->type) << ", " << to_llvm_type(var->type) << "* " << var->name << "\n";
+void LLVMGenerator::add_phi_operands(const ir::Value* var, ir::Instruction* phi) {
+    for (ir::BasicBlock* pred : m_preds[phi->parent]) {
+        ir::Value* value = read_variable(var, pred);
+        phi->operands.push_back(value);
+        phi->blocks.push_back(pred);
+    }
 }
 
-void LLVMGenerator::visit(const ArrayAccessExpr* node) {
-    auto var = find_var(node->name);
-    node->index->accept(this);
-    std::string index_reg = m_last_reg;
-    
-    std::string ptr_reg = new_reg();
-    Type elem_type = var->type; 
-    m_output << "  " << ptr_reg << " = getelementptr inbounds " << to_llvm_type(elem_type) << ", " << to_llvm_type(elem_type) << "* " << var->name << ", i32 " << index_reg << "\n";
-    
-    m_last_reg = new_reg();
-    m_output << "  " << m_last_reg << " = load " << to_llvm_type(elem_type) << ", " << to_llvm_type(elem_type) << "* " << ptr_reg << "\n";
+void LLVMGenerator::seal(ir::BasicBlock* block) {
+    m_sealed.insert(block);
+    auto incomplete = std::move(m_incomplete[block]);
+    m_incomplete.erase(block);
+    for (const auto& [var, phi] : incomplete) add_phi_operands(var, phi);
 }
 
-void LLVMGenerator::visit(const CallExpr* node) {
-    if (node->callee == "print") {
-        node->args[0]->accept(this);
-        std::string val_reg = m_last_reg;
-        std::string call_reg = new_reg();
-        m_output << "  " << call_reg << " = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 " << val_reg << ")\n";
-        m_last_reg = call_reg;
-    } else {
-        std::vector<std::string> arg_regs;
-        for (const auto& arg : node->args) {
-            arg->accept(this);
-            arg_regs.push_back(m_last_reg);
-        }
-        m_last_reg = new_reg();
-        m_output << "  " << m_last_reg << " = call i32 @" << node->callee << "(";
-        for (size_t i = 0; i < arg_regs.size(); ++i) {
-            m_output << "i32 " << arg_regs[i]; 
-            if (i < arg_regs.size() - 1) m_output << ", ";
-        }
-        m_output << ")\n";
+void LLVMGenerator::build_ssa(const ir::Function& func) {
+    m_promoted.clear();
+    m_defs.clear();
+    m_preds.clear();
+    m_sealed.clear();
+    m_incomplete.clear();
+    m_phis.clear();
+    m_new_phis.clear();
+    m_replaced.clear();
+    m_live_phis.clear();
+    m_numbers.clear();
+
+    for (const auto& block : func.blocks) {
+        const ir::Instruction* term = block->terminator();
+        if (!term) continue;
+        for (ir::BasicBlock* succ : term->blocks) m_preds[succ].push_back(block.get());
+    }
+    for (const ir::Value* var : ir::local_variables(func)) {
+        // Element pointers stay in memory; every other scalar becomes a value.
+        if (static_cast<const ir::Instruction*>(var)->count == 1) m_promoted.insert(var);
     }
-}
 
-void LLVMGenerator::visit(const UnaryExpr* node) {
-    node->operand->accept(this);
-    std::string op_reg = m_last_reg;
-    m_last_reg = new_reg();
-    if (node->op == TokenType::bang) {
-        m_output << "  " << m_last_reg << " = xor i1 " << op_reg << ", 1\n";
-    } else if (node->op == TokenType::star) {
-        m_output << "  " << m_last_reg << " = load i32, i32* " << op_reg << "\n";
-    } else if (node->op == TokenType::amp) {
-        if (const auto* ident = dynamic_cast<const IdentifierExpr*>(node->operand.get())) {
-            auto var = find_var(ident->name);
-            m_last_reg = var->name;
+    // A block is sealed once all its predecessors have been filled, i.e.
+    // their stores recorded; reads in an unsealed block get phis whose
+    // operands are added when it is sealed.
+    std::unordered_set<const ir::BasicBlock*> filled;
+    auto try_seal = [&](ir::BasicBlock* block) {
+        if (m_sealed.count(block)) return;
+        const auto& preds = m_preds[block];
+        if (std::all_of(preds.begin(), preds.end(), [&](const ir::BasicBlock* pred) { return filled.count(pred) > 0; })) seal(block);
+    };
+    for (const auto& block : func.blocks) {
+        try_seal(block.get());
+        for (const auto& instr : block->instrs) {
+            if (instr->op == Opcode::Load && m_promoted.count(instr->operands[0])) {
+                m_replaced[instr.get()] = read_variable(instr->operands[0], block.get());
+            } else if (instr->op == Opcode::Store && m_promoted.count(instr->operands[1])) {
+                m_defs[instr->operands[1]][block.get()] = instr->operands[0];
+            }
+        }
+        filled.insert(block.get());
+        const ir::Instruction* term = block->terminator();
+        if (term) {
+            for (ir::BasicBlock* succ : term->blocks) try_seal(succ);
         }
     }
-}
-
-void LLVMGenerator::visit(const BinaryExpr* node) {
-    if (node->op == TokenType::amp_amp) {
-        std::string label_check_rhs = new_label();
-        std::string label_end = new_label();
-        
-        node->lhs->accept(this);
-        std::string lhs_reg = m_last_reg;
-        
-        // Ensure lhs is i1. If it looks like a register (starts with %), assumes it is i1 or we need to check type.
-        // For simplicity, assuming i1 if coming from bool context. 
-        // Realistically we should check the expression type or cast. 
-        // But simpler: just compare ne 0 if we suspect i32? 
-        // Let's rely on the fact that logical ops usually take boolean/comparison results (i1).
-        
-        std::string res_addr = "%and_res" + std::to_string(m_reg_count++); // Ensure unique name
-        m_output << "  " << res_addr << " = alloca i1\n";
-        m_output << "  store i1 0, i1* " << res_addr << "\n"; // Default false
-        
-        m_output << "  br i1 " << lhs_reg << ", label %" << label_check_rhs << ", label %" << label_end << "\n";
-        
-        m_output << label_check_rhs << ":\n";
-        node->rhs->accept(this);
-        m_output << "  store i1 " << m_last_reg << ", i1* " << res_addr << "\n";
-        m_output << "  br label %" << label_end << "\n";
-        
-        m_output << label_end << ":\n";
-        m_last_reg = new_reg();
-        m_output << "  " << m_last_reg << " = load i1, i1* " << res_addr << "\n";
-
-    } else if (node->op == TokenType::pipe_pipe) {
-        std::string label_check_rhs = new_label();
-        std::string label_end = new_label();
-        
-        node->lhs->accept(this);
-        std::string lhs_reg = m_last_reg;
-        
-        std::string res_addr = "%or_res" + std::to_string(m_reg_count++);
-        m_output << "  " << res_addr << " = alloca i1\n";
-        m_output << "  store i1 1, i1* " << res_addr << "\n"; // Default true
-        
-        m_output << "  br i1 " << lhs_reg << ", label %" << label_end << ", label %" << label_check_rhs << "\n";
-        
-        m_output << label_check_rhs << ":\n";
-        node->rhs->accept(this);
-        m_output << "  store i1 " << m_last_reg << ", i1* " << res_addr << "\n";
-        m_output << "  br label %" << label_end << "\n";
-        
-        m_output << label_end << ":\n";
-        m_last_reg = new_reg();
-        m_output << "  " << m_last_reg << " = load i1, i1* " << res_addr << "\n";
-
-    } else {
-        node->lhs->accept(this);
-        std::string lhs_reg = m_last_reg;
-        node->rhs->accept(this);
-        std::string rhs_reg = m_last_reg;
-        
-        m_last_reg = new_reg();
-        if (node->op == TokenType::plus) m_output << "  " << m_last_reg << " = add i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::minus) m_output << "  " << m_last_reg << " = sub i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::star) m_output << "  " << m_last_reg << " = mul i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::slash) m_output << "  " << m_last_reg << " = sdiv i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::eq_eq) m_output << "  " << m_last_reg << " = icmp eq i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::neq) m_output << "  " << m_last_reg << " = icmp ne i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::lt) m_output << "  " << m_last_reg << " = icmp slt i32 " << lhs_reg << ", " << rhs_reg << "\n";
-        else if (node->op == TokenType::gt) m_output << "  " << m_last_reg << " = icmp sgt i32 " << lhs_reg << ", " << rhs_reg << "\n";
+    for (const auto& block : func.blocks) {
+        if (!m_sealed.count(block.get())) seal(block.get());
     }
+    remove_trivial_phis();
+    mark_live_phis(func);
+    number_values(func);
 }
 
-void LLVMGenerator::visit(const ReturnStmt* node) {
-    node->expr->accept(this);
-    m_output << "  ret i32 " << m_last_reg << "\n";
-}
-
-void LLVMGenerator::visit(const ExprStmt* node) {
-    node->expr->accept(this);
+const ir::Value* LLVMGenerator::resolve(const ir::Value* value) const {
+    for (auto it = m_replaced.find(value); it != m_replaced.end(); it = m_replaced.find(value)) value = it->second;
+    return value;
 }
 
-void LLVMGenerator::visit(const VarDecl* node) {
-    std::string addr = "%" + node->name + ".addr";
-    m_output << "  " << addr << " = alloca " << to_llvm_type(node->type) << "\n";
-    declare_var(node->name, node->type);
-    if (node->init) {
-        node->init->accept(this);
-        m_output << "  store " << to_llvm_type(node->type) << " " << m_last_reg << ", " << to_llvm_type(node->type) << "* " << addr << "\n";
+void LLVMGenerator::remove_trivial_phis() {
+    // A phi merging a single value besides itself is that value. Replacing
+    // one can make the phis reading it trivial in turn.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& phi : m_new_phis) {
+            if (m_replaced.count(phi.get())) continue;
+            const ir::Value* same = nullptr;
+            bool trivial = true;
+            for (ir::Value* op : phi->operands) {
+                const ir::Value* value = resolve(op);
+                if (value == phi.get() || value == same) continue;
+                if (same) trivial = false;
+                same = value;
+            }
+            if (!trivial || !same) continue;
+            m_replaced[phi.get()] = const_cast<ir::Value*>(same);
+            changed = true;
+        }
     }
 }
 
-void LLVMGenerator::visit(const AssignStmt* node) {
-    auto var = find_var(node->name);
-    node->value->accept(this);
-    m_output << "  store " << to_llvm_type(var->type) << " " << m_last_reg << ", " << to_llvm_type(var->type) << "* " << var->name << "\n";
+bool LLVMGenerator::skipped(const ir::Instruction& instr) const {
+    if (instr.op == Opcode::Alloca) return m_promoted.count(&instr) > 0;
+    if (instr.op == Opcode::Load) return m_promoted.count(instr.operands[0]) > 0;
+    if (instr.op == Opcode::Store) return m_promoted.count(instr.operands[1]) > 0;
+    if (instr.op == Opcode::LifetimeStart || instr.op == Opcode::LifetimeEnd) return m_promoted.count(instr.operands[0]) > 0;
+    return false;
 }
 
-void LLVMGenerator::visit(const ArrayAssignStmt* node) {
-    auto var = find_var(node->name);
-    node->index->accept(this);
-    std::string index_reg = m_last_reg;
-    node->value->accept(this);
-    std::string val_reg = m_last_reg;
-    
-    std::string ptr_reg = new_reg();
-    m_output << "  " << ptr_reg << " = getelementptr inbounds " << to_llvm_type(var->type) << ", " << to_llvm_type(var->type) << "* " << var->name << ", i32 " << index_reg << "\n";
-    m_output << "  store i32 " << val_reg << ", i32* " << ptr_reg << "\n";
+void LLVMGenerator::mark_live_phis(const ir::Function& func) {
+    std::vector<const ir::Instruction*> work;
+    auto use = [&](const ir::Value* value) {
+        value = resolve(value);
+        if (value->kind != ir::Value::Kind::Instruction) return;
+        const auto* phi = static_cast<const ir::Instruction*>(value);
+        if (phi->op != Opcode::Phi || m_live_phis.count(phi)) return;
+        m_live_phis.insert(phi);
+        work.push_back(phi);
+    };
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (skipped(*instr)) continue;
+            for (const ir::Value* op : instr->operands) use(op);
+        }
+    }
+    while (!work.empty()) {
+        const ir::Instruction* phi = work.back();
+        work.pop_back();
+        for (const ir::Value* op : phi->operands) use(op);
+    }
 }
 
-void LLVMGenerator::visit(const PointerAssignStmt* node) {
-    node->ptr_expr->accept(this);
-    std::string ptr_reg = m_last_reg;
-    node->value->accept(this);
-    std::string val_reg = m_last_reg;
-    m_output << "  store i32 " << val_reg << ", i32* " << ptr_reg << "\n";
+void LLVMGenerator::number_values(const ir::Function& func) {
+    int next = 0;
+    for (const auto& block : func.blocks) {
+        for (const ir::Instruction* phi : m_phis[block.get()]) {
+            if (m_live_phis.count(phi) && !m_replaced.count(phi) && !phi->operands.empty()) m_numbers[phi] = next++;
+        }
+        for (const auto& instr : block->instrs) {
+            if (!skipped(*instr) && instr->has_result() && instr->op != Opcode::Print) m_numbers[instr.get()] = next++;
+        }
+    }
 }
 
-void LLVMGenerator::visit(const ScopeStmt* node) {
-    push_scope();
-    for (const auto& stmt : node->stmts) {
-        stmt->accept(this);
+void LLVMGenerator::emit_phi(const ir::Instruction& phi) {
+    m_output << "  " << name(&phi) << " = phi " << to_llvm_type(phi.type);
+    for (size_t i = 0; i < phi.operands.size(); ++i) {
+        m_output << (i > 0 ? ", [ " : " [ ") << operand(phi.operands[i]) << ", %" << phi.blocks[i]->name << " ]";
     }
-    pop_scope();
+    m_output << "\n";
 }
 
-void LLVMGenerator::visit(const IfStmt* node) {
-    std::string label_then = new_label();
-    std::string label_else = new_label();
-    std::string label_end = new_label();
-    
-    node->condition->accept(this);
-    m_output << "  br i1 " << m_last_reg << ", label %" << label_then << ", label %" << label_else << "\n";
-    
-    m_output << label_then << ":\n";
-    node->then_stmt->accept(this);
-    m_output << "  br label %" << label_end << "\n";
-    
-    m_output << label_else << ":\n";
-    if (node->else_stmt) {
-        node->else_stmt->accept(this);
+void LLVMGenerator::infer_attributes() {
+    m_attributes.clear();
+    std::unordered_map<const ir::Function*, std::vector<const ir::Function*>> callees;
+    std::unordered_set<const ir::Function*> readnone;
+    for (const auto& func : m_module->functions) {
+        // Without pointer arguments or calls returning pointers, every
+        // pointer the function handles is to its own allocas.
+        bool local = std::none_of(func->args.begin(), func->args.end(), [](const auto& arg) { return arg->type.ptr_level > 0; });
+        for (const auto& block : func->blocks) {
+            for (const auto& instr : block->instrs) {
+                if (instr->op == Opcode::Print) local = false;
+                if (instr->op != Opcode::Call) continue;
+                const ir::Function* callee = m_module->find(instr->name);
+                if (!callee || instr->type.ptr_level > 0) local = false;
+                if (callee) callees[func.get()].push_back(callee);
+            }
+        }
+        if (local) readnone.insert(func.get());
+    }
+    // A function reads no memory if the functions it calls read none either.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& func : m_module->functions) {
+            if (!readnone.count(func.get())) continue;
+            const auto& called = callees[func.get()];
+            if (std::all_of(called.begin(), called.end(), [&](const ir::Function* callee) { return readnone.count(callee) > 0; })) continue;
+            readnone.erase(func.get());
+            changed = true;
+        }
+    }
+
+    for (const auto& func : m_module->functions) {
+        // Recursive if it can reach itself through calls.
+        std::unordered_set<const ir::Function*> reached;
+        std::vector<const ir::Function*> work = callees[func.get()];
+        while (!work.empty()) {
+            const ir::Function* callee = work.back();
+            work.pop_back();
+            if (!reached.insert(callee).second) continue;
+            for (const ir::Function* next : callees[callee]) work.push_back(next);
+        }
+        // Nothing the generated code calls can throw.
+        std::string attributes = " nounwind";
+        if (!reached.count(func.get())) attributes += " norecurse";
+        if (readnone.count(func.get())) attributes += " readnone";
+        m_attributes[func.get()] = attributes;
     }
-    m_output << "  br label %" << label_end << "\n";
-    
-    m_output << label_end << ":\n";
 }
 
-void LLVMGenerator::visit(const WhileStmt* node) {
-    std::string label_cond = new_label();
-    std::string label_body = new_label();
-    std::string label_end = new_label();
-    
-    m_output << "  br label %" << label_cond << "\n";
-    m_output << label_cond << ":\n";
-    node->condition->accept(this);
-    m_output << "  br i1 " << m_last_reg << ", label %" << label_body << ", label %" << label_end << "\n";
-    
-    m_output << label_body << ":\n";
-    node->body->accept(this);
-    m_output << "  br label %" << label_cond << "\n";
-    
-    m_output << label_end << ":\n";
+void LLVMGenerator::emit_function(const ir::Function& func) {
+    m_func = &func;
+    m_print_count = 0;
+    m_marker_count = 0;
+    build_ssa(func);
+    // Only main is called from outside, so LLVM may drop or specialise the rest.
+    m_output << "define " << (func.name == "main" ? "" : "internal ") << to_llvm_type(func.return_type) << " @" << func.name << "(";
+    for (size_t i = 0; i < func.args.size(); ++i) {
+        if (i > 0) m_output << ", ";
+        m_output << typed(func.args[i].get());
+    }
+    m_output << ")" << m_attributes.at(&func) << " {\n";
+    for (const auto& block : func.blocks) {
+        if (block.get() != func.entry()) m_output << "\n";
+        m_output << block->name << ":\n";
+        for (const ir::Instruction* phi : m_phis[block.get()]) {
+            if (m_numbers.count(phi)) emit_phi(*phi);
+        }
+        for (const auto& instr : block->instrs) {
+            if (!skipped(*instr)) emit_instruction(*instr);
+        }
+    }
+    m_output << "}\n\n";
 }
 
-void LLVMGenerator::visit(const ForStmt* node) {
-    push_scope();
-    if (node->init) node->init->accept(this);
-    
-    std::string label_cond = new_label();
-    std::string label_body = new_label();
-    std::string label_inc = new_label();
-    std::string label_end = new_label();
-    
-    m_output << "  br label %" << label_cond << "\n";
-    m_output << label_cond << ":\n";
-    if (node->condition) {
-        node->condition->accept(this);
-        m_output << "  br i1 " << m_last_reg << ", label %" << label_body << ", label %" << label_end << "\n";
-    } else {
-        m_output << "  br label %" << label_body << "\n";
+void LLVMGenerator::emit_instruction(const ir::Instruction& instr) {
+    const auto& ops = instr.operands;
+    std::string result = instr.has_result() && instr.op != Opcode::Print ? name(&instr) : "";
+    std::string type = to_llvm_type(instr.type);
+    m_output << "  ";
+
+    switch (instr.op) {
+        case Opcode::Alloca: {
+            m_output << result << " = alloca " << to_llvm_type({ instr.type.base, instr.type.ptr_level - 1 });
+            if (instr.count > 1) m_output << ", i32 " << instr.count;
+            break;
+        }
+        case Opcode::Load:
+            m_output << result << " = load " << type << ", " << typed(ops[0]);
+            break;
+        case Opcode::Store:
+            m_output << "store " << typed(ops[0]) << ", " << typed(ops[1]);
+            break;
+        case Opcode::ElementAddr:
+            m_output << result << " = getelementptr inbounds " << to_llvm_type({ instr.type.base, instr.type.ptr_level - 1 }) << ", "
+                     << typed(ops[0]) << ", " << typed(ops[1]);
+            break;
+        case Opcode::LifetimeStart:
+        case Opcode::LifetimeEnd: {
+            // The intrinsics take the slot as an i8* and its size in bytes.
+            const auto* slot = static_cast<const ir::Instruction*>(ops[0]);
+            Type element = { slot->type.base, slot->type.ptr_level - 1 };
+            int size = element.ptr_level > 0 ? 8 : element.base == Type::Base::Bool ? 1 : 4;
+            std::string bytes = "%lifetime." + std::to_string(m_marker_count++);
+            m_output << bytes << " = bitcast " << typed(slot) << " to i8*\n";
+            m_output << "  call void @llvm." << (instr.op == Opcode::LifetimeStart ? "lifetime.start" : "lifetime.end") << ".p0i8(i64 "
+                     << size * slot->count << ", i8* " << bytes << ")";
+            break;
+        }
+        case Opcode::Not:
+            m_output << result << " = xor " << typed(ops[0]) << ", 1";
+            break;
+        case Opcode::Select:
+            m_output << result << " = select " << typed(ops[0]) << ", " << typed(ops[1]) << ", " << typed(ops[2]);
+            break;
+        case Opcode::Call: {
+            const ir::Function* callee = m_module->find(instr.name);
+            std::string marker;
+            if (instr.tail_call) {
+                // musttail additionally requires the caller and callee prototypes to match.
+                bool same_prototype = callee && callee->return_type == m_func->return_type && callee->args.size() == m_func->args.size();
+                for (size_t i = 0; same_prototype && i < callee->args.size(); ++i) {
+                    same_prototype = callee->args[i]->type == m_func->args[i]->type;
+                }
+                marker = same_prototype ? "musttail " : "tail ";
+            }
+            if (instr.has_result()) m_output << result << " = ";
+            m_output << marker << "call " << type << " @" << instr.name << "(";
+            for (size_t i = 0; i < ops.size(); ++i) {
+                if (i > 0) m_output << ", ";
+                m_output << typed(ops[i]);
+            }
+            m_output << ")";
+            break;
+        }
+        case Opcode::Print:
+            // printf's result is named so it doesn't take one of the numbers of the IR values.
+            m_output << "%print." << m_print_count++ << " = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), "
+                     << typed(ops[0]) << ")";
+            break;
+        case Opcode::Phi:
+            emit_phi(instr);
+            return;
+        case Opcode::Br:
+            m_output << "br label %" << instr.blocks[0]->name;
+            break;
+        case Opcode::CondBr:
+            m_output << "br " << typed(ops[0]) << ", label %" << instr.blocks[0]->name << ", label %" << instr.blocks[1]->name;
+            break;
+        case Opcode::Ret:
+            if (ops.empty()) m_output << "ret void";
+            else m_output << "ret " << typed(ops[0]);
+            break;
+        case Opcode::MulHi: {
+            // High 32 bits of the 64-bit signed product.
+            std::string prefix = "%mulhi" + result.substr(1);
+            std::string lhs_wide = prefix + ".lhs";
+            std::string rhs_wide = prefix + ".rhs";
+            std::string product = prefix + ".product";
+            std::string high = prefix + ".high";
+            m_output << lhs_wide << " = sext " << typed(ops[0]) << " to i64\n";
+            m_output << "  " << rhs_wide << " = sext " << typed(ops[1]) << " to i64\n";
+            m_output << "  " << product << " = mul i64 " << lhs_wide << ", " << rhs_wide << "\n";
+            m_output << "  " << high << " = ashr i64 " << product << ", 32\n";
+            m_output << "  " << result << " = trunc i64 " << high << " to i32";
+            break;
+        }
+        default: {
+            const char* name = "";
+            switch (instr.op) {
+                // No nsw: the native backends compute int in 32 bits and
+                // wrap on overflow, and so does the AST optimizer's folding.
+                case Opcode::Add: name = "add"; break;
+                case Opcode::Sub: name = "sub"; break;
+                case Opcode::Mul: name = "mul"; break;
+                case Opcode::SDiv: name = "sdiv"; break;
+                case Opcode::Shl: name = "shl"; break;
+                case Opcode::AShr: name = "ashr"; break;
+                case Opcode::LShr: name = "lshr"; break;
+                case Opcode::CmpEq: name = "icmp eq"; break;
+                case Opcode::CmpNe: name = "icmp ne"; break;
+                case Opcode::CmpLt: name = "icmp slt"; break;
+                case Opcode::CmpGt: name = "icmp sgt"; break;
+                default: break;
+            }
+            m_output << result << " = " << name << " " << typed(ops[0]) << ", " << operand(ops[1]);
+            break;
+        }
     }
-    
-    m_output << label_body << ":\n";
-    node->body->accept(this);
-    m_output << "  br label %" << label_inc << "\n";
-    
-    m_output << label_inc << ":\n";
-    if (node->increment) node->increment->accept(this);
-    m_output << "  br label %" << label_cond << "\n";
-    
-    m_output << label_end << ":\n";
-    pop_scope();
-}
\ No newline at end of file
+    m_output << "\n";
+}
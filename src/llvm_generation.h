@@ -1,60 +1,74 @@
 #pragma once
-#include "parser.h"
+#include "ir.h"
+#include <memory>
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-struct LLVMVarInfo {
-    std::string name;
-    Type type;
-};
-
-class LLVMGenerator : public Visitor {
+// LLVM IR text generation from the IR. Blocks and phis map one to one onto
+// their LLVM counterparts; `int` is i32 and `bool` is i1. Functions other
+// than main are internal, and all are nounwind; norecurse is added for those
+// outside call cycles and readnone for those that only touch their own
+// stack (no pointer arguments, no print, and only readnone callees).
+// Integer add, sub and mul carry no nsw: int wraps at 32 bits, as in the
+// native backends, so overflow is defined.
+//
+// Variables whose address is never taken (see ir::local_variables()) leave
+// their allocas behind: their loads and stores are turned into SSA values on
+// the fly, following Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form". A read looks for the variable's last store
+// in its block, then in the predecessors, placing a phi where several
+// definitions meet; phis found to merge a single value are replaced by it and
+// phis nothing reads are dropped, so the output is pruned SSA and needs no
+// mem2reg. Arrays and address-taken variables keep their allocas, all in the
+// entry block, and their lifetime markers become llvm.lifetime.start/end.
+class LLVMGenerator {
 public:
-    explicit LLVMGenerator(const Program* root);
+    explicit LLVMGenerator(const ir::Module* module);
     std::string generate();
 
-    // Visitor Implementation
-    void visit(const IntLitExpr* node) override;
-    void visit(const BoolLitExpr* node) override;
-    void visit(const IdentifierExpr* node) override;
-    void visit(const ArrayAccessExpr* node) override;
-    void visit(const CallExpr* node) override;
-    void visit(const UnaryExpr* node) override;
-    void visit(const BinaryExpr* node) override;
-    void visit(const ReturnStmt* node) override;
-    void visit(const ExprStmt* node) override;
-    void visit(const VarDecl* node) override;
-    void visit(const AssignStmt* node) override;
-    void visit(const ArrayAssignStmt* node) override;
-    void visit(const PointerAssignStmt* node) override;
-    void visit(const ScopeStmt* node) override;
-    void visit(const IfStmt* node) override;
-    void visit(const WhileStmt* node) override;
-    void visit(const ForStmt* node) override;
-    void visit(const Function* node) override;
-    void visit(const Layer* node) override;
-    void visit(const Program* node) override;
-
 private:
-    const Program* m_root;
+    const ir::Module* m_module;
     std::stringstream m_output;
-    int m_reg_count = 0;
-    int m_label_count = 0;
-    
-    // Stack of scopes. Each scope is a map of variable names to their LLVM register name.
-    std::vector<std::unordered_map<std::string, LLVMVarInfo>> m_scopes;
-    
-    // Last generated register
-    std::string m_last_reg;
+    const ir::Function* m_func = nullptr;
+    int m_print_count = 0;
+    int m_marker_count = 0;
+    // Function attributes, e.g. " nounwind norecurse readnone".
+    std::unordered_map<const ir::Function*, std::string> m_attributes;
+
+    // SSA construction for the function being emitted.
+    std::unordered_set<const ir::Value*> m_promoted;        // Allocas turned into values
+    std::unordered_map<const ir::Value*, std::unordered_map<const ir::BasicBlock*, ir::Value*>> m_defs;
+    std::unordered_map<const ir::BasicBlock*, std::vector<ir::BasicBlock*>> m_preds;
+    std::unordered_set<const ir::BasicBlock*> m_sealed;     // Blocks whose predecessors are all filled
+    std::unordered_map<const ir::BasicBlock*, std::vector<std::pair<const ir::Value*, ir::Instruction*>>> m_incomplete;
+    std::unordered_map<const ir::BasicBlock*, std::vector<ir::Instruction*>> m_phis;
+    std::vector<std::unique_ptr<ir::Instruction>> m_new_phis;
+    std::unordered_map<const ir::Value*, ir::Value*> m_replaced;   // Promoted loads and trivial phis
+    std::unordered_set<const ir::Value*> m_live_phis;
+    std::unordered_map<const ir::Value*, int> m_numbers;
+
+    void build_ssa(const ir::Function& func);
+    ir::Value* read_variable(const ir::Value* var, ir::BasicBlock* block);
+    void add_phi_operands(const ir::Value* var, ir::Instruction* phi);
+    void seal(ir::BasicBlock* block);
+    void remove_trivial_phis();
+    void mark_live_phis(const ir::Function& func);
+    void number_values(const ir::Function& func);
+    // The value `value` stands for once loads and trivial phis are gone.
+    const ir::Value* resolve(const ir::Value* value) const;
+    bool skipped(const ir::Instruction& instr) const;
+
+    void infer_attributes();
 
     // Helpers
-    std::string new_reg();
-    std::string new_label();
-    void push_scope();
-    void pop_scope();
-    void declare_var(const std::string& name, Type type);
-    std::optional<LLVMVarInfo> find_var(const std::string& name);
+    void emit_function(const ir::Function& func);
+    void emit_instruction(const ir::Instruction& instr);
+    void emit_phi(const ir::Instruction& phi);
     std::string to_llvm_type(Type type);
+    std::string name(const ir::Value* value) const;
+    std::string operand(const ir::Value* value);
+    std::string typed(const ir::Value* value);
 };
@@ -0,0 +1,271 @@
+#include "loop_invariant_motion.h"
+#include "ast_utils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+bool worth_hoisting(const Expr* expr) {
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return unary->op != TokenType::amp;
+    return dynamic_cast<const BinaryExpr*>(expr) || dynamic_cast<const ArrayAccessExpr*>(expr) ||
+           dynamic_cast<const CallExpr*>(expr);
+}
+
+bool is_always_true(const Expr* expr) {
+    const auto* lit = dynamic_cast<const BoolLitExpr*>(expr);
+    return !expr || (lit && lit->value);
+}
+
+} // namespace
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(Program* program, AnalysisManager& analyses) : m_prog(program), m_analyses(analyses) {
+}
+
+void LoopInvariantCodeMotion::remark(const std::string& message) const {
+    std::cout << "Remark [licm]: " << message << std::endl;
+}
+
+void LoopInvariantCodeMotion::run() {
+    m_side_effect_free = m_analyses.side_effect_free();
+    m_pure = m_analyses.pure();
+
+    for (const auto& func : m_prog->functions) {
+        process_body(func->body->stmts, func->args);
+    }
+    process_body(m_prog->globals, {});
+}
+
+void LoopInvariantCodeMotion::process_body(std::vector<std::unique_ptr<Stmt>>& stmts, const std::vector<Arg>& params) {
+    m_address_taken = address_taken_vars(stmts);
+    m_var_types = collect_var_types(stmts, params);
+    process_list(stmts);
+}
+
+void LoopInvariantCodeMotion::process_list(std::vector<std::unique_ptr<Stmt>>& stmts) {
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        Stmt* stmt = stmts[i].get();
+
+        // Inner loops first, so their preheaders can be hoisted further.
+        auto visit_child = [this](Stmt* child) {
+            if (auto* scope = dynamic_cast<ScopeStmt*>(child)) process_list(scope->stmts);
+        };
+        if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+            process_list(scope->stmts);
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+            visit_child(if_stmt->then_stmt.get());
+            visit_child(if_stmt->else_stmt.get());
+        } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+            visit_child(while_stmt->body.get());
+            i += hoist_loop(stmts, i);
+        } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+            visit_child(for_stmt->body.get());
+            i += hoist_loop(stmts, i);
+        }
+    }
+}
+
+LoopInvariantCodeMotion::LoopInfo LoopInvariantCodeMotion::analyze_loop(Stmt* loop) const {
+    LoopInfo info;
+    for_each_stmt(loop, [&info](Stmt* stmt) {
+        if (auto* decl = dynamic_cast<VarDecl*>(stmt)) info.written.insert(decl->name);
+        if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) info.written.insert(assign->name);
+        if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) info.written.insert(arr_assign->name);
+        if (dynamic_cast<PointerAssignStmt*>(stmt)) info.clobbers_memory = true;
+    });
+    for_each_expr(loop, [this, &info](std::unique_ptr<Expr>& expr) {
+        for_each_subexpr(expr.get(), [this, &info](const Expr* e) {
+            const auto* call = dynamic_cast<const CallExpr*>(e);
+            // print writes no memory; user functions may store through pointers.
+            if (call && call->callee != "print" && !m_side_effect_free.count(call->callee)) info.clobbers_memory = true;
+        });
+    });
+    return info;
+}
+
+bool LoopInvariantCodeMotion::is_invariant(const Expr* expr, const LoopInfo& loop) const {
+    auto stable = [this, &loop](const std::string& name) {
+        return !loop.written.count(name) && !(loop.clobbers_memory && m_address_taken.count(name));
+    };
+    if (dynamic_cast<const IntLitExpr*>(expr) || dynamic_cast<const BoolLitExpr*>(expr)) return true;
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) return stable(ident->name);
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) {
+        return stable(arr->name) && is_invariant(arr->index.get(), loop);
+    }
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        return m_pure.count(call->callee) &&
+               std::all_of(call->args.begin(), call->args.end(),
+                           [this, &loop](const std::unique_ptr<Expr>& arg) { return is_invariant(arg.get(), loop); });
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        if (unary->op == TokenType::amp) {
+            // The address of a variable never changes; only an index can.
+            const auto* arr = dynamic_cast<const ArrayAccessExpr*>(unary->operand.get());
+            return !arr || is_invariant(arr->index.get(), loop);
+        }
+        if (unary->op == TokenType::star && loop.clobbers_memory) return false;
+        return is_invariant(unary->operand.get(), loop);
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        return is_invariant(bin->lhs.get(), loop) && is_invariant(bin->rhs.get(), loop);
+    }
+    return false;
+}
+
+// True if evaluating the expression early, on a path that would not have
+// evaluated it, can neither fault nor diverge.
+bool LoopInvariantCodeMotion::is_speculatable(const Expr* expr) const {
+    bool safe = true;
+    for_each_subexpr(expr, [&safe](const Expr* e) {
+        if (dynamic_cast<const CallExpr*>(e) || dynamic_cast<const ArrayAccessExpr*>(e)) safe = false;
+        if (const auto* unary = dynamic_cast<const UnaryExpr*>(e)) {
+            if (unary->op == TokenType::star) safe = false;
+        }
+        if (const auto* bin = dynamic_cast<const BinaryExpr*>(e)) {
+            auto divisor = int_value(bin->rhs.get());
+            if (bin->op == TokenType::slash && (!divisor || *divisor == 0 || *divisor == -1)) safe = false;
+        }
+    });
+    return safe;
+}
+
+// `always` is true when the slot is evaluated on every iteration of the loop
+// being processed, so hoisting it cannot introduce a fault or a call.
+void LoopInvariantCodeMotion::collect_expr(std::unique_ptr<Expr>& slot, bool always, const LoopInfo& loop,
+                                           std::vector<Hoisted>& hoisted) {
+    Expr* expr = slot.get();
+    if (!expr) return;
+    if (worth_hoisting(expr) && is_invariant(expr, loop) && (always || is_speculatable(expr))) {
+        if (auto type = infer_type(expr, m_var_types, m_prog)) {
+            int line = expr->line;
+            int col = expr->col;
+            auto same = std::find_if(hoisted.begin(), hoisted.end(),
+                                     [expr](const Hoisted& h) { return exprs_equal(h.expr.get(), expr); });
+            std::string name;
+            if (same != hoisted.end()) {
+                name = same->name;
+            } else {
+                name = "__licm" + std::to_string(m_next_id++);
+                hoisted.push_back({ name, *type, std::move(slot) });
+            }
+            slot = std::make_unique<IdentifierExpr>(name, line, col);
+            return;
+        }
+    }
+
+    if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->args) collect_expr(arg, always, loop, hoisted);
+    } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+        collect_expr(arr->index, always, loop, hoisted);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        if (unary->op != TokenType::amp) {
+            collect_expr(unary->operand, always, loop, hoisted);
+        } else if (auto* target = dynamic_cast<ArrayAccessExpr*>(unary->operand.get())) {
+            collect_expr(target->index, always, loop, hoisted);
+        }
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+        collect_expr(bin->lhs, always, loop, hoisted);
+        bool short_circuit = bin->op == TokenType::amp_amp || bin->op == TokenType::pipe_pipe;
+        collect_expr(bin->rhs, always && !short_circuit, loop, hoisted);
+    }
+}
+
+void LoopInvariantCodeMotion::collect_stmt(Stmt* stmt, bool always, const LoopInfo& loop, std::vector<Hoisted>& hoisted) {
+    if (!stmt) return;
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        collect_expr(ret->expr, always, loop, hoisted);
+    } else if (auto* expr_stmt = dynamic_cast<ExprStmt*>(stmt)) {
+        // The value of a call statement is discarded; only its arguments matter.
+        if (auto* call = dynamic_cast<CallExpr*>(expr_stmt->expr.get())) {
+            for (auto& arg : call->args) collect_expr(arg, always, loop, hoisted);
+        } else {
+            collect_expr(expr_stmt->expr, always, loop, hoisted);
+        }
+    } else if (auto* decl = dynamic_cast<VarDecl*>(stmt)) {
+        collect_expr(decl->init, always, loop, hoisted);
+    } else if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+        collect_expr(assign->value, always, loop, hoisted);
+    } else if (auto* arr_assign = dynamic_cast<ArrayAssignStmt*>(stmt)) {
+        collect_expr(arr_assign->index, always, loop, hoisted);
+        collect_expr(arr_assign->value, always, loop, hoisted);
+    } else if (auto* ptr_assign = dynamic_cast<PointerAssignStmt*>(stmt)) {
+        collect_expr(ptr_assign->ptr_expr, always, loop, hoisted);
+        collect_expr(ptr_assign->value, always, loop, hoisted);
+    } else if (auto* scope = dynamic_cast<ScopeStmt*>(stmt)) {
+        // Statements after one that may return do not run on every iteration.
+        for (auto& s : scope->stmts) {
+            collect_stmt(s.get(), always, loop, hoisted);
+            always = always && !contains_return(s.get());
+        }
+    } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt)) {
+        collect_expr(if_stmt->condition, always, loop, hoisted);
+        collect_stmt(if_stmt->then_stmt.get(), false, loop, hoisted);
+        collect_stmt(if_stmt->else_stmt.get(), false, loop, hoisted);
+    } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt)) {
+        collect_expr(while_stmt->condition, always, loop, hoisted);
+        collect_stmt(while_stmt->body.get(), false, loop, hoisted);
+    } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt)) {
+        collect_stmt(for_stmt->init.get(), always, loop, hoisted);
+        collect_expr(for_stmt->condition, always, loop, hoisted);
+        collect_stmt(for_stmt->increment.get(), false, loop, hoisted);
+        collect_stmt(for_stmt->body.get(), false, loop, hoisted);
+    }
+}
+
+// Hoists the invariant expressions of the loop at `stmts[index]` and returns
+// the number of statements inserted in front of it.
+size_t LoopInvariantCodeMotion::hoist_loop(std::vector<std::unique_ptr<Stmt>>& stmts, size_t index) {
+    Stmt* loop = stmts[index].get();
+    auto* while_stmt = dynamic_cast<WhileStmt*>(loop);
+    auto* for_stmt = dynamic_cast<ForStmt*>(loop);
+    std::unique_ptr<Expr>& condition = while_stmt ? while_stmt->condition : for_stmt->condition;
+    Stmt* body = while_stmt ? while_stmt->body.get() : for_stmt->body.get();
+
+    LoopInfo info = analyze_loop(loop);
+
+    // The body only runs on every iteration once the loop is known to run at
+    // least once: either the condition is trivially true, or we can test it
+    // up front. A condition with calls must not be evaluated an extra time.
+    bool runs_once = is_always_true(condition.get());
+    std::unique_ptr<Expr> guard = runs_once || !is_pure(condition.get()) ? nullptr : clone_expr(condition.get());
+    bool body_always = runs_once || guard;
+
+    std::vector<Hoisted> hoisted;
+    collect_expr(condition, true, info, hoisted);
+    collect_stmt(body, body_always, info, hoisted);
+    if (for_stmt) collect_stmt(for_stmt->increment.get(), body_always && !contains_return(body), info, hoisted);
+    if (hoisted.empty()) return 0;
+
+    bool needs_guard = guard && std::any_of(hoisted.begin(), hoisted.end(),
+                                            [this](const Hoisted& h) { return !is_speculatable(h.expr.get()); });
+    remark("hoisted " + std::to_string(hoisted.size()) + " invariant expression(s) out of the loop at line " +
+           std::to_string(loop->line) + (needs_guard ? " behind a guard" : ""));
+
+    int line = loop->line;
+    int col = loop->col;
+    std::vector<std::unique_ptr<Stmt>> preheader;
+    for (auto& h : hoisted) {
+        preheader.push_back(std::make_unique<VarDecl>(h.name, h.type, std::move(h.expr), line, col));
+    }
+
+    if (!needs_guard) {
+        size_t count = preheader.size();
+        stmts.insert(stmts.begin() + index, std::make_move_iterator(preheader.begin()), std::make_move_iterator(preheader.end()));
+        return count;
+    }
+
+    // `init; if cond: { preheader; loop }`, with the for-init moved out so the
+    // guard sees the variables it declares.
+    std::unique_ptr<Stmt> init = for_stmt ? std::move(for_stmt->init) : nullptr;
+    preheader.push_back(std::move(stmts[index]));
+    auto guarded = std::make_unique<IfStmt>(std::move(guard), std::make_unique<ScopeStmt>(std::move(preheader), line, col),
+                                            nullptr, line, col);
+    if (!init) {
+        stmts[index] = std::move(guarded);
+        return 0;
+    }
+    std::vector<std::unique_ptr<Stmt>> wrapper;
+    wrapper.push_back(std::move(init));
+    wrapper.push_back(std::move(guarded));
+    stmts[index] = std::make_unique<ScopeStmt>(std::move(wrapper), line, col);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "analysis_manager.h"
+#include "parser.h"
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Loop-invariant code motion for `while` and `for` loops.
+//
+// Expressions in a loop that read nothing the loop writes are computed once
+// into a `__licm<N>` temporary in front of the loop. Address-taken variables
+// and loads through pointers only count as invariant when the loop has no
+// pointer stores and no calls that may have side effects.
+//
+// Arithmetic that cannot fault is hoisted from anywhere in the loop. Loads,
+// calls to pure functions and divisions are only hoisted from code that runs
+// on every iteration, and the loop is then guarded by a copy of its condition
+// so that they are never evaluated for a loop that runs zero times.
+class LoopInvariantCodeMotion {
+public:
+    LoopInvariantCodeMotion(Program* program, AnalysisManager& analyses);
+    void run();
+
+private:
+    struct LoopInfo {
+        std::unordered_set<std::string> written;
+        bool clobbers_memory = false;
+    };
+
+    struct Hoisted {
+        std::string name;
+        Type type;
+        std::unique_ptr<Expr> expr;
+    };
+
+    Program* m_prog;
+    AnalysisManager& m_analyses;
+    std::unordered_set<std::string> m_side_effect_free;
+    std::unordered_set<std::string> m_pure;
+    int m_next_id = 0;
+
+    // Per function (or the top-level statements): variables whose address is
+    // taken, and the declared type of every variable (nullopt when the same
+    // name is declared with different types).
+    std::unordered_set<std::string> m_address_taken;
+    std::unordered_map<std::string, std::optional<Type>> m_var_types;
+
+    void process_body(std::vector<std::unique_ptr<Stmt>>& stmts, const std::vector<Arg>& params);
+    void process_list(std::vector<std::unique_ptr<Stmt>>& stmts);
+    size_t hoist_loop(std::vector<std::unique_ptr<Stmt>>& stmts, size_t index);
+
+    LoopInfo analyze_loop(Stmt* loop) const;
+    bool is_invariant(const Expr* expr, const LoopInfo& loop) const;
+    bool is_speculatable(const Expr* expr) const;
+
+    void collect_stmt(Stmt* stmt, bool always, const LoopInfo& loop, std::vector<Hoisted>& hoisted);
+    void collect_expr(std::unique_ptr<Expr>& slot, bool always, const LoopInfo& loop, std::vector<Hoisted>& hoisted);
+
+    void remark(const std::string& message) const;
+};
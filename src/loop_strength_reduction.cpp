@@ -0,0 +1,188 @@
+#include "loop_strength_reduction.h"
+#include "ir_analysis.h"
+#include <algorithm>
+#include <climits>
+
+namespace ir {
+
+namespace {
+
+bool is_constant(const Value* value) {
+    return value->kind == Value::Kind::Constant;
+}
+
+int constant_value(const Value* value) {
+    return static_cast<const Constant*>(value)->value;
+}
+
+Instruction* as_instruction(Value* value) {
+    return value->kind == Value::Kind::Instruction ? static_cast<Instruction*>(value) : nullptr;
+}
+
+size_t position(const Instruction* instr) {
+    const auto& instrs = instr->parent->instrs;
+    auto it = std::find_if(instrs.begin(), instrs.end(), [instr](const auto& owned) { return owned.get() == instr; });
+    return static_cast<size_t>(it - instrs.begin());
+}
+
+Instruction* insert(BasicBlock* block, size_t index, Opcode op, Type type, std::vector<Value*> operands) {
+    auto instr = std::make_unique<Instruction>(op, type, std::move(operands));
+    instr->parent = block;
+    return block->instrs.insert(block->instrs.begin() + static_cast<std::ptrdiff_t>(index), std::move(instr))->get();
+}
+
+// `value` as a load of a local variable plus a constant `offset`, returning
+// the load; nullptr for anything else.
+Instruction* variable_plus_constant(Value* value, const std::unordered_set<const Value*>& vars, int& offset) {
+    offset = 0;
+    Instruction* instr = as_instruction(value);
+    if (instr && (instr->op == Opcode::Add || instr->op == Opcode::Sub)) {
+        Value* lhs = instr->operands[0];
+        Value* rhs = instr->operands[1];
+        if (is_constant(rhs) && constant_value(rhs) != INT_MIN) {
+            offset = instr->op == Opcode::Add ? constant_value(rhs) : -constant_value(rhs);
+            instr = as_instruction(lhs);
+        } else if (instr->op == Opcode::Add && is_constant(lhs)) {
+            offset = constant_value(lhs);
+            instr = as_instruction(rhs);
+        } else {
+            return nullptr;
+        }
+    }
+    if (!instr || instr->op != Opcode::Load || !vars.count(instr->operands[0])) return nullptr;
+    return instr;
+}
+
+// True if `user` follows the load `load` in its block, with no store to the
+// variable it read in between.
+bool reads_same_value(const Instruction* load, const Instruction* user) {
+    if (load->parent != user->parent) return false;
+    size_t first = position(load);
+    size_t last = position(user);
+    if (first > last) return false;
+    for (size_t i = first + 1; i < last; ++i) {
+        const Instruction* instr = user->parent->instrs[i].get();
+        if (instr->op == Opcode::Store && instr->operands[1] == load->operands[0]) return false;
+    }
+    return true;
+}
+
+// A pointer variable replacing the addresses of element `var + offset` of
+// `base`.
+struct Pointer {
+    const Value* var;
+    Value* base;
+    int offset;
+    Type type;
+    std::vector<Instruction*> addresses;
+};
+
+std::string pointer_name(const Pointer& pointer) {
+    auto name = [](const Value* value) { return value->kind == Value::Kind::Instruction ? static_cast<const Instruction*>(value)->name : ""; };
+    std::string array = name(pointer.base).empty() ? "ptr" : name(pointer.base);
+    std::string index = name(pointer.var);
+    if (pointer.offset > 0) index += "+" + std::to_string(pointer.offset);
+    if (pointer.offset < 0) index += std::to_string(pointer.offset);
+    return "&" + array + "[" + index + "]";
+}
+
+int reduce(Function& func, const Loop& loop, const std::unordered_set<const Value*>& vars, const DominatorTree& dom) {
+    // Induction variables, with the stores stepping them. A variable stored
+    // any other way in the loop is not one.
+    std::unordered_map<const Value*, std::vector<std::pair<Instruction*, int>>> steps;
+    std::unordered_set<const Value*> varying;
+    for (const auto& block : func.blocks) {
+        if (!loop.blocks.count(block.get())) continue;
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::Store || !vars.count(instr->operands[1])) continue;
+            const Value* var = instr->operands[1];
+            int step = 0;
+            Instruction* load = variable_plus_constant(instr->operands[0], vars, step);
+            if (load && load->operands[0] == var && step != 0 && reads_same_value(load, instr.get())) {
+                steps[var].push_back({ instr.get(), step });
+            } else {
+                varying.insert(var);
+            }
+        }
+    }
+    for (const Value* var : varying) steps.erase(var);
+    if (steps.empty()) return 0;
+
+    auto invariant = [&](Value* base) {
+        if (base->kind == Value::Kind::Argument) return true;
+        Instruction* instr = as_instruction(base);
+        return instr && !loop.blocks.count(instr->parent) && dom.dominates(instr->parent, loop.header);
+    };
+    std::vector<Pointer> pointers;
+    for (const auto& block : func.blocks) {
+        if (!loop.blocks.count(block.get())) continue;
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::ElementAddr || !invariant(instr->operands[0])) continue;
+            int offset = 0;
+            Instruction* load = variable_plus_constant(instr->operands[1], vars, offset);
+            if (!load || !steps.count(load->operands[0]) || !reads_same_value(load, instr.get())) continue;
+            const Value* var = load->operands[0];
+            auto same = [&](const Pointer& p) { return p.var == var && p.base == instr->operands[0] && p.offset == offset && p.type == instr->type; };
+            auto it = std::find_if(pointers.begin(), pointers.end(), same);
+            if (it == pointers.end()) {
+                if (pointers.size() == max_loop_pointers) continue;
+                it = pointers.insert(pointers.end(), { var, instr->operands[0], offset, instr->type, {} });
+            }
+            it->addresses.push_back(instr.get());
+        }
+    }
+
+    int replaced = 0;
+    BasicBlock* entry = func.entry();
+    for (const Pointer& pointer : pointers) {
+        size_t allocas = 0;
+        while (entry->instrs[allocas]->op == Opcode::Alloca) ++allocas;
+        Instruction* slot = insert(entry, allocas, Opcode::Alloca, { pointer.type.base, pointer.type.ptr_level + 1 }, {});
+        slot->name = pointer_name(pointer);
+        Value* var = const_cast<Value*>(pointer.var);
+
+        // Set on entry to the loop...
+        for (BasicBlock* pred : loop.header->preds) {
+            if (loop.blocks.count(pred)) continue;
+            size_t at = pred->instrs.size() - 1;
+            Value* index = insert(pred, at++, Opcode::Load, Type::Int(), { var });
+            if (pointer.offset != 0) index = insert(pred, at++, Opcode::Add, Type::Int(), { index, func.constant(Type::Int(), pointer.offset) });
+            Value* address = insert(pred, at++, Opcode::ElementAddr, pointer.type, { pointer.base, index });
+            insert(pred, at, Opcode::Store, Type::Void(), { address, slot });
+        }
+        // ...and advanced with the variable.
+        for (const auto& [store, step] : steps.at(pointer.var)) {
+            BasicBlock* block = store->parent;
+            size_t at = position(store) + 1;
+            Value* current = insert(block, at++, Opcode::Load, pointer.type, { slot });
+            Value* next = insert(block, at++, Opcode::ElementAddr, pointer.type, { current, func.constant(Type::Int(), step) });
+            insert(block, at, Opcode::Store, Type::Void(), { next, slot });
+        }
+        for (Instruction* address : pointer.addresses) {
+            BasicBlock* block = address->parent;
+            Value* value = insert(block, position(address), Opcode::Load, pointer.type, { slot });
+            for (const auto& b : func.blocks) {
+                for (const auto& instr : b->instrs) std::replace(instr->operands.begin(), instr->operands.end(), static_cast<Value*>(address), value);
+            }
+            block->instrs.erase(block->instrs.begin() + static_cast<std::ptrdiff_t>(position(address)));
+            ++replaced;
+        }
+    }
+    return replaced;
+}
+
+} // namespace
+
+int reduce_loop_addresses(Function& func) {
+    compute_cfg(func);
+    auto vars = local_variables(func);
+    DominatorTree dom(func);
+    int replaced = 0;
+    for (const Loop& loop : natural_loops(func)) {
+        if (loop.header != func.entry()) replaced += reduce(func, loop, vars, dom);
+    }
+    if (replaced > 0) func.renumber();
+    return replaced;
+}
+
+} // namespace ir
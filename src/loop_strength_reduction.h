@@ -0,0 +1,30 @@
+#pragma once
+#include "ir.h"
+
+namespace ir {
+
+// Loop strength reduction of element addresses.
+//
+// An induction variable is a local variable (see local_variables()) that a
+// loop changes only by adding constants to it. An element address inside the
+// loop whose index is an induction variable, plus or minus a constant, and
+// whose array is the same on every iteration becomes a pointer variable
+// stepping through the array with the index:
+//
+//   for i: ... a[i + 1] ...             p = &a[i + 1]
+//                                       for i: ... *p ...; i = i + 1; p = p + 1
+//
+// The pointer is set on every edge entering the loop and advanced right after
+// each update of the variable, so it always holds the address it replaces.
+// The backends then read the element through a register holding the pointer
+// instead of recomputing base + index * size, and the ARM64 peephole
+// optimiser folds the pointer's increment into the access as a post-indexed
+// load or store. At most `max_loop_pointers` pointers are made per loop, as
+// each takes a register for the whole loop.
+//
+// Returns the number of element addresses replaced.
+int reduce_loop_addresses(Function& func);
+
+constexpr size_t max_loop_pointers = 4;
+
+} // namespace ir
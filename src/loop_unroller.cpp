@@ -0,0 +1,209 @@
+#include "loop_unroller.h"
+#include "ast_utils.h"
+#include <functional>
+#include <iostream>
+
+namespace {
+
+void replace_ident(std::unique_ptr<Expr>& slot, const std::string& name, const std::function<std::unique_ptr<Expr>()>& make) {
+    Expr* expr = slot.get();
+    if (!expr) return;
+    if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
+        if (ident->name == name) slot = make();
+    } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+        replace_ident(arr->index, name, make);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->args) replace_ident(arg, name, make);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        replace_ident(unary->operand, name, make);
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+        replace_ident(bin->lhs, name, make);
+        replace_ident(bin->rhs, name, make);
+    }
+}
+
+// A copy of `body` that evaluates `make()` wherever it read the variable `name`.
+std::unique_ptr<Stmt> body_copy(const Stmt* body, const std::string& name, const std::function<std::unique_ptr<Expr>()>& make) {
+    auto copy = clone_stmt(body);
+    for_each_expr(copy.get(), [&](std::unique_ptr<Expr>& slot) { replace_ident(slot, name, make); });
+    return copy;
+}
+
+bool is_ident(const Expr* expr, const std::string& name) {
+    const auto* ident = dynamic_cast<const IdentifierExpr*>(expr);
+    return ident && ident->name == name;
+}
+
+} // namespace
+
+LoopUnroller::LoopUnroller(Program* program, int factor) : m_prog(program), m_factor(factor) {
+}
+
+void LoopUnroller::remark(const std::string& message) const {
+    std::cout << "Remark [unroll]: " << message << std::endl;
+}
+
+void LoopUnroller::run() {
+    for (const auto& func : m_prog->functions) {
+        m_address_taken = address_taken_vars(func->body->stmts);
+        process_list(func->body->stmts);
+    }
+    m_address_taken = address_taken_vars(m_prog->globals);
+    process_list(m_prog->globals);
+}
+
+void LoopUnroller::process_list(std::vector<std::unique_ptr<Stmt>>& stmts) {
+    for (auto& stmt : stmts) {
+        // Inner loops first: once unrolled, they count towards the outer body.
+        auto visit_child = [this](Stmt* child) {
+            if (auto* scope = dynamic_cast<ScopeStmt*>(child)) process_list(scope->stmts);
+        };
+        if (auto* scope = dynamic_cast<ScopeStmt*>(stmt.get())) {
+            process_list(scope->stmts);
+        } else if (auto* if_stmt = dynamic_cast<IfStmt*>(stmt.get())) {
+            visit_child(if_stmt->then_stmt.get());
+            visit_child(if_stmt->else_stmt.get());
+        } else if (auto* while_stmt = dynamic_cast<WhileStmt*>(stmt.get())) {
+            visit_child(while_stmt->body.get());
+        } else if (auto* for_stmt = dynamic_cast<ForStmt*>(stmt.get())) {
+            visit_child(for_stmt->body.get());
+            if (auto iv = recognize(for_stmt)) {
+                stmt = unroll(std::move(stmt), *iv);
+            }
+        }
+    }
+}
+
+std::optional<LoopUnroller::InductionVar> LoopUnroller::recognize(ForStmt* loop) const {
+    InductionVar iv;
+
+    // init: `int i = c` or `i = c`
+    std::optional<int> start;
+    if (auto* decl = dynamic_cast<VarDecl*>(loop->init.get())) {
+        if (decl->type != Type::Int() || decl->array_size) return std::nullopt;
+        iv.name = decl->name;
+        iv.declared = true;
+        start = int_value(decl->init.get());
+    } else if (auto* assign = dynamic_cast<AssignStmt*>(loop->init.get())) {
+        iv.name = assign->name;
+        iv.declared = false;
+        start = int_value(assign->value.get());
+    }
+    if (!start) return std::nullopt;
+    iv.start = *start;
+
+    // cond: `i < n`, `i > n` or `i != n`, in either order
+    auto* cond = dynamic_cast<BinaryExpr*>(loop->condition.get());
+    if (!cond || (cond->op != TokenType::lt && cond->op != TokenType::gt && cond->op != TokenType::neq)) return std::nullopt;
+    iv.cmp = cond->op;
+    std::optional<int> bound;
+    if (is_ident(cond->lhs.get(), iv.name)) {
+        bound = int_value(cond->rhs.get());
+    } else if (is_ident(cond->rhs.get(), iv.name)) {
+        bound = int_value(cond->lhs.get());
+        if (iv.cmp == TokenType::lt) iv.cmp = TokenType::gt;
+        else if (iv.cmp == TokenType::gt) iv.cmp = TokenType::lt;
+    }
+    if (!bound) return std::nullopt;
+    iv.bound = *bound;
+
+    // increment: `i = i + s`, `i = s + i` or `i = i - s`
+    auto* inc = dynamic_cast<AssignStmt*>(loop->increment.get());
+    auto* step_expr = inc && inc->name == iv.name ? dynamic_cast<BinaryExpr*>(inc->value.get()) : nullptr;
+    if (!step_expr) return std::nullopt;
+    std::optional<int> step;
+    if (step_expr->op == TokenType::plus && is_ident(step_expr->lhs.get(), iv.name)) step = int_value(step_expr->rhs.get());
+    else if (step_expr->op == TokenType::plus && is_ident(step_expr->rhs.get(), iv.name)) step = int_value(step_expr->lhs.get());
+    else if (step_expr->op == TokenType::minus && is_ident(step_expr->lhs.get(), iv.name)) {
+        step = int_value(step_expr->rhs.get());
+        if (step) step = -*step;
+    }
+    if (!step || *step == 0) return std::nullopt;
+    iv.step = *step;
+
+    // The body may only read the induction variable, and no pointer may reach
+    // it: one taken before the loop could still be stored through inside it.
+    bool modified = m_address_taken.count(iv.name) > 0;
+    for_each_stmt(loop->body.get(), [&](Stmt* stmt) {
+        if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) modified = modified || assign->name == iv.name;
+        if (auto* decl = dynamic_cast<VarDecl*>(stmt)) modified = modified || decl->name == iv.name;
+    });
+    if (modified) return std::nullopt;
+
+    long long distance = static_cast<long long>(iv.bound) - iv.start;
+    long long step_ll = iv.step;
+    if (iv.cmp == TokenType::lt) {
+        if (iv.step < 0) return std::nullopt;
+        iv.trip_count = distance <= 0 ? 0 : (distance + step_ll - 1) / step_ll;
+    } else if (iv.cmp == TokenType::gt) {
+        if (iv.step > 0) return std::nullopt;
+        iv.trip_count = distance >= 0 ? 0 : (-distance + -step_ll - 1) / -step_ll;
+    } else {
+        if (distance % step_ll != 0 || distance / step_ll < 0) return std::nullopt;
+        iv.trip_count = distance / step_ll;
+    }
+    return iv;
+}
+
+std::unique_ptr<Stmt> LoopUnroller::unroll(std::unique_ptr<Stmt> stmt, const InductionVar& iv) {
+    auto* loop = static_cast<ForStmt*>(stmt.get());
+    int line = loop->line;
+    int col = loop->col;
+    int body_size = stmt_size(loop->body.get());
+    std::string where = "loop at line " + std::to_string(line);
+    std::vector<std::unique_ptr<Stmt>> result;
+
+    auto literal = [line, col](long long value) { return std::make_unique<IntLitExpr>(static_cast<int>(value), line, col); };
+    auto ident = [&iv, line, col]() { return std::make_unique<IdentifierExpr>(iv.name, line, col); };
+
+    if (iv.trip_count <= max_full_trip_count && body_size * iv.trip_count <= size_budget) {
+        for (long long k = 0; k < iv.trip_count; ++k) {
+            long long value = iv.start + k * iv.step;
+            result.push_back(body_copy(loop->body.get(), iv.name, [&]() { return literal(value); }));
+        }
+        // An induction variable declared outside the loop keeps its final value.
+        if (!iv.declared) {
+            result.push_back(std::make_unique<AssignStmt>(iv.name, literal(iv.start + iv.trip_count * iv.step), line, col));
+        }
+        remark("fully unrolled " + where + " (" + std::to_string(iv.trip_count) + " iterations)");
+        return std::make_unique<ScopeStmt>(std::move(result), line, col);
+    }
+
+    if (m_factor < 2 || iv.trip_count < m_factor) return stmt;
+    if (body_size * m_factor > size_budget) {
+        remark("not unrolling " + where + ": body of size " + std::to_string(body_size) + " exceeds the budget");
+        return stmt;
+    }
+
+    // for (i = start; i cmp main_end; i = i + factor * step) { body(i) ... body(i + (factor-1) * step) }
+    // for (; i cmp bound; i = i + step) body(i)
+    long long main_trips = iv.trip_count / m_factor;
+    long long main_end = iv.start + main_trips * m_factor * iv.step;
+    std::vector<std::unique_ptr<Stmt>> copies;
+    for (int k = 0; k < m_factor; ++k) {
+        if (k == 0) {
+            copies.push_back(clone_stmt(loop->body.get()));
+            continue;
+        }
+        long long offset = static_cast<long long>(k) * iv.step;
+        copies.push_back(body_copy(loop->body.get(), iv.name, [&]() {
+            return std::make_unique<BinaryExpr>(ident(), literal(offset), TokenType::plus, line, col);
+        }));
+    }
+    auto main_cond = std::make_unique<BinaryExpr>(ident(), literal(main_end), iv.cmp, line, col);
+    auto main_inc = std::make_unique<AssignStmt>(
+        iv.name, std::make_unique<BinaryExpr>(ident(), literal(static_cast<long long>(m_factor) * iv.step), TokenType::plus, line, col),
+        line, col);
+    auto main_loop = std::make_unique<ForStmt>(nullptr, std::move(main_cond), std::move(main_inc),
+                                               std::make_unique<ScopeStmt>(std::move(copies), line, col), line, col);
+
+    result.push_back(std::move(loop->init));
+    result.push_back(std::move(main_loop));
+    long long remainder = iv.trip_count % m_factor;
+    if (remainder > 0) {
+        result.push_back(std::move(stmt));
+    }
+    remark("unrolled " + where + " by " + std::to_string(m_factor) + " (" + std::to_string(iv.trip_count) +
+           " iterations, remainder " + std::to_string(remainder) + ")");
+    return std::make_unique<ScopeStmt>(std::move(result), line, col);
+}
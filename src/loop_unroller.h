@@ -0,0 +1,49 @@
+#pragma once
+#include "parser.h"
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Unrolls `for` loops whose trip count is known at compile time.
+//
+// A loop is recognised when its induction variable starts at a literal, is
+// compared against a literal bound (`<`, `>` or `!=`) and is stepped by a
+// literal in the increment, the body does not assign it, and its address is
+// taken nowhere in the function (a pointer could otherwise change it).
+// Small loops are unrolled completely, with the induction variable replaced
+// by a constant in each copy. Larger ones are unrolled by `factor` and
+// followed by a remainder loop for the leftover iterations. Nothing is
+// unrolled past `size_budget` statement-tree nodes.
+class LoopUnroller {
+public:
+    static constexpr int default_factor = 4;
+    static constexpr int size_budget = 128;
+    static constexpr int max_full_trip_count = 16;
+
+    explicit LoopUnroller(Program* program, int factor = default_factor);
+    void run();
+
+private:
+    struct InductionVar {
+        std::string name;
+        bool declared;   // `int i = c` in the init, rather than `i = c`
+        int start;
+        int step;
+        TokenType cmp;   // i `cmp` bound
+        int bound;
+        long long trip_count;
+    };
+
+    Program* m_prog;
+    int m_factor;
+    // Variables of the current function whose address is taken.
+    std::unordered_set<std::string> m_address_taken;
+
+    void process_list(std::vector<std::unique_ptr<Stmt>>& stmts);
+    std::optional<InductionVar> recognize(ForStmt* loop) const;
+    std::unique_ptr<Stmt> unroll(std::unique_ptr<Stmt> loop, const InductionVar& iv);
+
+    void remark(const std::string& message) const;
+};
@@ -1,32 +1,133 @@
 #include "generation.h"
+#include "if_conversion.h"
+#include "jit.h"
+#include "ir_analysis.h"
+#include "ir_lowering.h"
+#include "ir_verifier.h"
 #include "llvm_generation.h"
+#ifdef HY_WITH_LLVM
+#include "llvm_builder.h"
+#endif
+#include "loop_strength_reduction.h"
 #include "lexer.h"
 #include "parser.h"
 #include "semantic_analysis.h"
-#include "optimizer.h"
+#include "pass_manager.h"
+#include "x86_generation.h"
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  auto startup = std::chrono::steady_clock::now();
+  const char *input_path = nullptr;
+  PassOptions pass_options;
+  // `compiler run` compiles for this machine and executes the code in process.
+  bool run = argc > 1 && std::string(argv[1]) == "run";
+  Target target = run && Jit::host() ? *Jit::host() : Target::AArch64;
+  // --llvm-emit hands the IR to LLVM in process instead of only writing out.ll.
+  std::optional<std::string> llvm_emit;
+  std::optional<int> llvm_opt;
+  std::string llvm_cpu, llvm_features;
+  bool usage_error = false;
+  // Parses `--name=N` into `value`; returns false if `arg` is a different option.
+  auto int_option = [&usage_error](const std::string &arg, const std::string &name, std::optional<int> &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.rfind(prefix, 0) != 0) return false;
+    try {
+      value = std::stoi(arg.substr(prefix.size()));
+    } catch (const std::exception &) {
+      usage_error = true;
+    }
+    return true;
+  };
+  // Parses `-f<pass>` and `-fno-<pass>`.
+  auto pass_flag = [&pass_options](const std::string &arg) {
+    if (arg.rfind("-f", 0) != 0) return false;
+    bool enable = arg.rfind("-fno-", 0) != 0;
+    std::string name = arg.substr(enable ? 2 : 5);
+    if (!PassManager::is_pass(name)) return false;
+    pass_options.overrides[name] = enable;
+    return true;
+  };
+  for (int i = run ? 2 : 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (int_option(arg, "inline-threshold", pass_options.inline_threshold) ||
+        int_option(arg, "unroll-factor", pass_options.unroll_factor) || int_option(arg, "llvm-opt", llvm_opt) ||
+        pass_flag(arg)) {
+      continue;
+    } else if (auto level = PassManager::parse_level(arg)) {
+      pass_options.level = *level;
+    } else if (arg == "-ftime-passes") {
+      pass_options.time_passes = true;
+    } else if (arg == "--target=aarch64-apple") {
+      target = Target::AArch64;
+    } else if (arg == "--target=x86_64-linux") {
+      target = Target::X86_64;
+    } else if (arg == "--llvm-emit=object" || arg == "--llvm-emit=bitcode") {
+      llvm_emit = arg.substr(arg.find('=') + 1);
+    } else if (arg.rfind("-march=", 0) == 0) {
+      llvm_cpu = arg.substr(7);
+    } else if (arg.rfind("-mattr=", 0) == 0) {
+      llvm_features = arg.substr(7);
+    } else if (!input_path && arg.rfind("-", 0) != 0) {
+      input_path = argv[i];
+    } else {
+      usage_error = true;
+    }
+  }
+  if (run && !Jit::host()) {
+    std::cerr << "Error: run needs an x86-64 or AArch64 machine" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (run && target != *Jit::host()) {
+    std::cerr << "Error: run executes the code on this machine, so --target cannot select another" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (llvm_opt && *llvm_opt != 2 && *llvm_opt != 3) {
+    usage_error = true;
+  }
+  if (!llvm_emit && (llvm_opt || !llvm_cpu.empty() || !llvm_features.empty())) {
+    std::cerr << "Error: --llvm-opt, -march and -mattr apply to the code of --llvm-emit" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (run && llvm_emit) {
+    std::cerr << "Error: run writes no files, so --llvm-emit cannot be used with it" << std::endl;
+    return EXIT_FAILURE;
+  }
+#ifndef HY_WITH_LLVM
+  if (llvm_emit) {
+    std::cerr << "Error: --llvm-emit needs a compiler built with LLVM; out.ll can be compiled with clang instead" << std::endl;
+    return EXIT_FAILURE;
+  }
+#endif
+  if (!input_path || usage_error) {
     std::cerr << "Incorrect usage. Correct usage is..." << std::endl;
-    std::cerr << "compiler <input.hy>" << std::endl;
+    std::cerr << "compiler [run] [-O0|-O1|-O2|-Os] [-f<pass>|-fno-<pass>] [-ftime-passes] [--inline-threshold=N] [--unroll-factor=N] [--target=aarch64-apple|x86_64-linux] [--llvm-emit=object|bitcode [--llvm-opt=2|3] [-march=<cpu>|native] [-mattr=<features>]] <input.hy>" << std::endl;
+    std::cerr << "passes:";
+    for (const auto &name : PassManager::pass_names()) {
+      std::cerr << " " << name;
+    }
+    std::cerr << std::endl;
     return EXIT_FAILURE;
   }
 
   std::string contents;
   {
     std::stringstream contents_stream;
-    std::fstream input(argv[1], std::ios::in);
+    std::fstream input(input_path, std::ios::in);
     if (!input.is_open()) {
-      std::cerr << "Could not open file: " << argv[1] << std::endl;
+      std::cerr << "Could not open file: " << input_path << std::endl;
       return EXIT_FAILURE;
     }
     contents_stream << input.rdbuf();
     contents = contents_stream.str();
   }
 
+  // The output of the steps is not shown when running the program.
+  std::streambuf *stdout_buffer = run ? std::cout.rdbuf(nullptr) : nullptr;
+
   // 1. Lexing
   std::cout << "--- Tokenization Step ---" << std::endl;
   std::vector<Token> tokens = tokenize(contents);
@@ -56,26 +157,97 @@ int main(int argc, char *argv[]) {
 
   // 4. Optimization
   std::cout << "\n--- Optimization Step ---" << std::endl;
-  Optimizer optimizer;
-  program = optimizer.optimize(std::move(program));
+  PassManager pass_manager(pass_options);
+  std::cout << "Pipeline " << pass_manager.describe_pipeline() << std::endl;
+  program = pass_manager.run(std::move(program));
   program->print();
+  if (pass_options.time_passes) {
+    pass_manager.print_timings(std::cout);
+  }
   std::cout << "-------------------------" << std::endl;
 
-  // 5. ARM64 Generation
-  std::cout << "\n--- ARM64 Generation Step ---" << std::endl;
-  Generator generator(program.get());
-  std::string assembly = generator.generate();
-  std::cout << assembly << std::endl; 
+  // 5. IR Lowering
+  std::cout << "\n--- IR Lowering Step ---" << std::endl;
+  IRLowering lowering(program.get());
+  std::unique_ptr<ir::Module> module = lowering.lower();
+  if (pass_manager.enabled("if-convert")) {
+    int converted = 0;
+    for (const auto &func : module->functions) {
+      converted += ir::convert_ifs(*func);
+    }
+    if (converted > 0) {
+      std::cout << "Remark [if-convert]: " << converted << " conditional(s) replaced by selects" << std::endl;
+    }
+  }
+  if (pass_manager.enabled("lsr")) {
+    int reduced = 0;
+    for (const auto &func : module->functions) {
+      reduced += ir::reduce_loop_addresses(*func);
+    }
+    if (reduced > 0) {
+      std::cout << "Remark [lsr]: " << reduced << " element address(es) replaced by pointer increments" << std::endl;
+    }
+  }
+  ir::print(*module, std::cout);
+  for (const auto &func : module->functions) {
+    ir::DominatorTree(*func).print(std::cout);
+    ir::DominatorTree(*func, true).print(std::cout);
+  }
+  std::vector<std::string> ir_errors = ir::verify(*module);
+  for (const auto &error : ir_errors) {
+    std::cerr << "IR Error: " << error << std::endl;
+  }
+  if (!ir_errors.empty()) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "IR Verified" << std::endl;
+  std::cout << "------------------------" << std::endl;
+
+  // 6. Native Code Generation
+  std::string assembly;
+  ElfObject object;
+  if (target == Target::X86_64) {
+    std::cout << "\n--- x86-64 Generation Step ---" << std::endl;
+    X86Generator generator(module.get());
+    assembly = generator.generate();
+    std::string listing;
+    object = generator.generate_object(listing);
+    std::cout << listing << std::endl;
+  } else {
+    std::cout << "\n--- ARM64 Generation Step ---" << std::endl;
+    Generator generator(module.get(), pass_manager.enabled("peephole"));
+    assembly = generator.generate();
+    std::string listing;
+    object = generator.generate_object(listing);
+    std::cout << listing << std::endl;
+    for (const auto &[rule, count] : generator.peephole_fired()) {
+      std::cout << "Remark [peephole]: " << rule << " fired " << count << " time(s)" << std::endl;
+    }
+  }
   std::cout << "-----------------------" << std::endl;
 
+  if (run) {
+    std::cout.rdbuf(stdout_buffer);
+    std::cout.clear();
+    Jit jit(object);
+    std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - startup;
+    std::cerr << "Remark [jit]: " << latency.count() << " ms from startup to the first instruction" << std::endl;
+    return jit.run_main();
+  }
+
   {
     std::fstream file("out.s", std::ios::out);
     file << assembly;
   }
+  {
+    std::vector<uint8_t> bytes = object.write();
+    std::fstream file("out.o", std::ios::out | std::ios::binary);
+    file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  }
 
-  // 6. LLVM IR Generation
+  // 7. LLVM IR Generation
   std::cout << "\n--- LLVM IR Generation Step ---" << std::endl;
-  LLVMGenerator llvm_generator(program.get());
+  LLVMGenerator llvm_generator(module.get());
   std::string llvm_ir = llvm_generator.generate();
   std::cout << llvm_ir << std::endl;
   std::cout << "------------------------------" << std::endl;
@@ -85,5 +257,29 @@ int main(int argc, char *argv[]) {
     file << llvm_ir;
   }
 
+#ifdef HY_WITH_LLVM
+  // 8. In-process LLVM Backend
+  if (llvm_emit) {
+    std::cout << "\n--- LLVM Backend Step ---" << std::endl;
+    LLVMBuildOptions options;
+    options.output = *llvm_emit == "bitcode" ? LLVMBuildOptions::Output::Bitcode : LLVMBuildOptions::Output::Object;
+    options.opt_level = llvm_opt.value_or(2);
+    options.cpu = llvm_cpu;
+    options.features = llvm_features;
+    std::string path = options.output == LLVMBuildOptions::Output::Bitcode ? "out.bc" : "out.llvm.o";
+    auto start = std::chrono::steady_clock::now();
+    LLVMBuilder builder(module.get(), target, options);
+    std::string error = builder.emit(path);
+    if (!error.empty()) {
+      std::cerr << "Error: LLVM backend: " << error << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Remark [llvm]: O" << options.opt_level << " " << *llvm_emit << " for " << builder.describe() << " written to "
+              << path << " in " << elapsed.count() << " ms" << std::endl;
+    std::cout << "------------------------------" << std::endl;
+  }
+#endif
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -105,7 +105,9 @@ void Optimizer::visit(const BinaryExpr* node) {
 }
 
 void Optimizer::visit(const ReturnStmt* node) {
-    m_last_node = std::make_unique<ReturnStmt>(transform_expr(node->expr.get()), node->line, node->col);
+    auto ret = std::make_unique<ReturnStmt>(transform_expr(node->expr.get()), node->line, node->col);
+    ret->tail_call = node->tail_call;
+    m_last_node = std::move(ret);
 }
 
 void Optimizer::visit(const ExprStmt* node) {
@@ -176,8 +178,16 @@ void Optimizer::visit(const Function* node) {
     m_last_node = std::make_unique<Function>(node->name, node->args, std::move(body), node->return_type, node->line, node->col);
 }
 
+void Optimizer::visit(const Layer* node) {
+    auto body = std::unique_ptr<ScopeStmt>(static_cast<ScopeStmt*>(transform_stmt(node->body.get()).release()));
+    m_last_node = std::make_unique<Layer>(node->name, node->args, std::move(body), node->return_type, node->sizes, node->line, node->col);
+}
+
 void Optimizer::visit(const Program* node) {
     auto folded_prog = std::make_unique<Program>();
+    for (const auto& layer : node->layers) {
+        folded_prog->layers.push_back(std::unique_ptr<Layer>(static_cast<Layer*>(transform(layer.get()).release())));
+    }
     for (const auto& func : node->functions) {
         folded_prog->functions.push_back(std::unique_ptr<Function>(static_cast<Function*>(transform(func.get()).release())));
     }
@@ -85,6 +85,18 @@ void BinaryExpr::print(int indent) const {
   case TokenType::pipe_pipe:
     op_char = "||";
     break;
+  case TokenType::shl:
+    op_char = "<<";
+    break;
+  case TokenType::ashr:
+    op_char = ">>";
+    break;
+  case TokenType::lshr:
+    op_char = ">>>";
+    break;
+  case TokenType::mulhi:
+    op_char = "mulhi";
+    break;
   default:
     op_char = "?";
     break;
@@ -98,7 +110,7 @@ ReturnStmt::ReturnStmt(std::unique_ptr<Expr> e, int l, int c) : Stmt(l, c), expr
 
 void ReturnStmt::print(int indent) const {
   print_indent(indent);
-  std::cout << "ReturnStmt at " << line << ":" << col << ":" << std::endl;
+  std::cout << "ReturnStmt" << (tail_call ? " (tail call)" : "") << " at " << line << ":" << col << ":" << std::endl;
   expr->print(indent + 1);
 }
 
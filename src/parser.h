@@ -159,6 +159,7 @@ struct Stmt : public Node {
 // Return statement (e.g., return 0;)
 struct ReturnStmt : public Stmt {
   std::unique_ptr<Expr> expr;
+  bool tail_call = false; // Set by TailCallOptimizer when `expr` is a call that may reuse this frame
   ReturnStmt(std::unique_ptr<Expr> e, int l, int c);
   void print(int indent = 0) const override;
   void accept(Visitor* visitor) const override { visitor->visit(this); }
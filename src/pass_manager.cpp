@@ -0,0 +1,214 @@
+#include "pass_manager.h"
+#include "algebraic_simplifier.h"
+#include "ast_utils.h"
+#include "common_subexpression.h"
+#include "constant_evaluator.h"
+#include "inliner.h"
+#include "loop_invariant_motion.h"
+#include "loop_unroller.h"
+#include "optimizer.h"
+#include "tail_call_optimizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <malloc.h>
+
+namespace {
+
+// Which passes each level enables.
+const std::unordered_map<std::string, std::vector<OptLevel>> level_passes = {
+    { "fold", { OptLevel::O1, OptLevel::O2, OptLevel::Os } },
+    { "eval", { OptLevel::O1, OptLevel::O2, OptLevel::Os } },
+    { "inline", { OptLevel::O2, OptLevel::Os } },
+    { "tail-call", { OptLevel::O2, OptLevel::Os } },
+    { "unroll", { OptLevel::O2 } },
+    { "simplify", { OptLevel::O1, OptLevel::O2, OptLevel::Os } },
+    { "licm", { OptLevel::O2 } },
+    { "cse", { OptLevel::O1, OptLevel::O2, OptLevel::Os } },
+    { "if-convert", { OptLevel::O2, OptLevel::Os } },
+    { "lsr", { OptLevel::O2 } },
+    { "peephole", { OptLevel::O1, OptLevel::O2, OptLevel::Os } },
+};
+
+// Heap bytes in use according to the allocator's own statistics, so that
+// measuring a pass costs nothing when -ftime-passes is off.
+long long heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return static_cast<long long>(info.uordblks + info.hblkhd);
+}
+
+int program_size(const Program* program) {
+    int size = 1;
+    for (const auto& layer : program->layers) size += 1 + stmt_size(layer->body.get());
+    for (const auto& func : program->functions) size += 1 + stmt_size(func->body.get());
+    for (const auto& global : program->globals) size += stmt_size(global.get());
+    return size;
+}
+
+size_t program_hash(const Program* program) {
+    auto combine = [](size_t seed, size_t value) { return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2)); };
+    size_t seed = 0;
+    for (const auto& layer : program->layers) seed = combine(seed, stmt_hash(layer->body.get()));
+    for (const auto& func : program->functions) {
+        seed = combine(combine(seed, std::hash<std::string>()(func->name)), func->args.size());
+        seed = combine(seed, stmt_hash(func->body.get()));
+    }
+    for (const auto& global : program->globals) seed = combine(seed, stmt_hash(global.get()));
+    return seed;
+}
+
+} // namespace
+
+PassManager::PassManager(PassOptions options) : m_options(std::move(options)) {
+    int inline_threshold = m_options.inline_threshold.value_or(
+        m_options.level == OptLevel::Os ? size_inline_threshold : Inliner::default_threshold);
+    int unroll_factor = m_options.unroll_factor.value_or(LoopUnroller::default_factor);
+
+    Pass fold { "fold", false, [](std::unique_ptr<Program>& program, AnalysisManager&) {
+        Optimizer optimizer;
+        program = optimizer.optimize(std::move(program));
+    } };
+    Pass eval { "eval", true, [](std::unique_ptr<Program>& program, AnalysisManager& analyses) {
+        ConstantEvaluator(program.get(), analyses).run();
+    } };
+    Pass inline_pass { "inline", false, [inline_threshold](std::unique_ptr<Program>& program, AnalysisManager&) {
+        Inliner(program.get(), inline_threshold).run();
+    } };
+    Pass tail_call { "tail-call", false, [](std::unique_ptr<Program>& program, AnalysisManager& analyses) {
+        TailCallOptimizer(program.get(), analyses).run();
+    } };
+    Pass unroll { "unroll", true, [unroll_factor](std::unique_ptr<Program>& program, AnalysisManager&) {
+        LoopUnroller(program.get(), unroll_factor).run();
+    } };
+    Pass simplify { "simplify", true, [](std::unique_ptr<Program>& program, AnalysisManager&) {
+        AlgebraicSimplifier(program.get()).simplify();
+    } };
+    Pass licm { "licm", true, [](std::unique_ptr<Program>& program, AnalysisManager& analyses) {
+        LoopInvariantCodeMotion(program.get(), analyses).run();
+    } };
+    Pass cse { "cse", true, [](std::unique_ptr<Program>& program, AnalysisManager& analyses) {
+        CommonSubexpressionEliminator(program.get(), analyses).run();
+    } };
+
+    m_pipeline = {
+        { { fold, eval }, false },
+        { { inline_pass }, false },
+        { { tail_call }, false },
+        { { unroll }, false },
+        { { fold, simplify, eval }, true },
+        { { licm }, false },
+        { { cse }, false },
+    };
+}
+
+std::optional<OptLevel> PassManager::parse_level(const std::string& arg) {
+    if (arg == "-O0") return OptLevel::O0;
+    if (arg == "-O1") return OptLevel::O1;
+    if (arg == "-O2") return OptLevel::O2;
+    if (arg == "-Os") return OptLevel::Os;
+    return std::nullopt;
+}
+
+std::string PassManager::level_name(OptLevel level) {
+    switch (level) {
+        case OptLevel::O0: return "-O0";
+        case OptLevel::O1: return "-O1";
+        case OptLevel::O2: return "-O2";
+        case OptLevel::Os: return "-Os";
+    }
+    return "";
+}
+
+bool PassManager::is_pass(const std::string& name) {
+    return level_passes.count(name) > 0;
+}
+
+std::vector<std::string> PassManager::pass_names() {
+    return { "fold", "eval", "inline", "tail-call", "unroll", "simplify", "licm", "cse", "if-convert", "lsr", "peephole" };
+}
+
+bool PassManager::enabled(const std::string& name) const {
+    auto it = m_options.overrides.find(name);
+    if (it != m_options.overrides.end()) return it->second;
+    const auto& levels = level_passes.at(name);
+    return std::find(levels.begin(), levels.end(), m_options.level) != levels.end();
+}
+
+std::string PassManager::describe_pipeline() const {
+    std::string result;
+    for (const auto& stage : m_pipeline) {
+        std::string names;
+        for (const auto& pass : stage.passes) {
+            if (!enabled(pass.name)) continue;
+            names += (names.empty() ? "" : ", ") + pass.name;
+        }
+        if (names.empty()) continue;
+        if (stage.fixed_point) names = "(" + names + ")*";
+        result += (result.empty() ? "" : ", ") + names;
+    }
+    if (enabled("if-convert")) result += (result.empty() ? "" : ", ") + std::string("if-convert");
+    if (enabled("lsr")) result += (result.empty() ? "" : ", ") + std::string("lsr");
+    if (enabled("peephole")) result += (result.empty() ? "" : ", ") + std::string("peephole");
+    return level_name(m_options.level) + ": " + (result.empty() ? "(no passes)" : result);
+}
+
+std::unique_ptr<Program> PassManager::run(std::unique_ptr<Program> program) {
+    AnalysisManager analyses(program.get());
+    for (const auto& stage : m_pipeline) {
+        int iteration = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            ++iteration;
+            for (const auto& pass : stage.passes) {
+                if (!enabled(pass.name)) continue;
+                bool pass_changed = run_pass(pass, program, analyses, stage.fixed_point ? iteration : 0);
+                changed = changed || pass_changed;
+            }
+            if (!stage.fixed_point || iteration >= max_cleanup_iterations) break;
+        }
+    }
+    m_analysis_hits = analyses.hits();
+    m_analysis_misses = analyses.misses();
+    return program;
+}
+
+bool PassManager::run_pass(const Pass& pass, std::unique_ptr<Program>& program, AnalysisManager& analyses, int iteration) {
+    size_t hash_before = program_hash(program.get());
+    int nodes_before = m_options.time_passes ? program_size(program.get()) : 0;
+    long long heap_before = m_options.time_passes ? heap_in_use() : 0;
+    auto start = std::chrono::steady_clock::now();
+
+    pass.run(program, analyses);
+
+    auto end = std::chrono::steady_clock::now();
+    analyses.set_program(program.get());
+    bool changed = program_hash(program.get()) != hash_before;
+    if (changed && !pass.preserves_analyses) analyses.invalidate();
+
+    if (m_options.time_passes) {
+        m_timings.push_back({ pass.name, iteration, std::chrono::duration<double, std::milli>(end - start).count(),
+                              nodes_before, program_size(program.get()), heap_in_use() - heap_before });
+    }
+    return changed;
+}
+
+void PassManager::print_timings(std::ostream& out) const {
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-14s %10s %8s %8s %12s\n", "pass", "time (ms)", "nodes", "-> nodes", "heap delta");
+    out << line;
+    double total_millis = 0;
+    long long total_heap_delta = 0;
+    for (const auto& timing : m_timings) {
+        std::string name = timing.name;
+        if (timing.iteration > 0) name += " #" + std::to_string(timing.iteration);
+        std::snprintf(line, sizeof(line), "%-14s %10.3f %8d %8d %12lld\n", name.c_str(), timing.millis,
+                      timing.nodes_before, timing.nodes_after, timing.heap_delta);
+        out << line;
+        total_millis += timing.millis;
+        total_heap_delta += timing.heap_delta;
+    }
+    std::snprintf(line, sizeof(line), "%-14s %10.3f %8s %8s %12lld\n", "total", total_millis, "", "", total_heap_delta);
+    out << line;
+    out << "analysis cache: " << m_analysis_hits << " hit(s), " << m_analysis_misses << " miss(es)" << std::endl;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "analysis_manager.h"
+#include "parser.h"
+#include <functional>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class OptLevel { O0, O1, O2, Os };
+
+struct PassOptions {
+    OptLevel level = OptLevel::O2;
+    std::optional<int> inline_threshold;   // Defaults depend on the level
+    std::optional<int> unroll_factor;
+    std::unordered_map<std::string, bool> overrides; // -f<pass> / -fno-<pass>
+    bool time_passes = false;
+};
+
+// Runs the AST optimisation pipeline selected by the optimisation level.
+//
+// Every pass has a fixed position in the pipeline; the level decides which
+// of them are enabled and per-pass flags override that. The cleanup passes
+// (constant folding, algebraic simplification and compile-time evaluation of
+// calls) are repeated as a group until the program stops changing. Changes
+// are detected by comparing a structural hash of the program before and after
+// each pass, which is also what decides whether the cached analyses have to
+// be recomputed.
+//
+// With time_passes set, every pass execution is recorded with its wall time,
+// the number of AST nodes before and after it and the change in heap bytes
+// in use across it (from mallinfo2()), and print_timings() reports them.
+class PassManager {
+public:
+    static constexpr int max_cleanup_iterations = 4;
+    static constexpr int size_inline_threshold = 10;
+
+    explicit PassManager(PassOptions options);
+
+    // Parses "-O0", "-O1", "-O2" or "-Os".
+    static std::optional<OptLevel> parse_level(const std::string& arg);
+    static std::string level_name(OptLevel level);
+    static bool is_pass(const std::string& name);
+    static std::vector<std::string> pass_names();
+
+    // Also answers for the backend passes (if-convert, lsr, peephole), which run
+    // after the AST pipeline.
+    bool enabled(const std::string& name) const;
+    std::unique_ptr<Program> run(std::unique_ptr<Program> program);
+    std::string describe_pipeline() const;
+    void print_timings(std::ostream& out) const;
+
+private:
+    struct Pass {
+        std::string name;
+        bool preserves_analyses;  // Leaves the cached analyses valid
+        std::function<void(std::unique_ptr<Program>&, AnalysisManager&)> run;
+    };
+
+    // Passes run in order, repeated until none of them changes the program
+    // when `fixed_point` is set.
+    struct Stage {
+        std::vector<Pass> passes;
+        bool fixed_point;
+    };
+
+    struct Timing {
+        std::string name;
+        int iteration;            // Fixed-point iteration, 0 outside a fixed-point stage
+        double millis;
+        int nodes_before;
+        int nodes_after;
+        long long heap_delta;     // Heap bytes in use after the pass minus before
+    };
+
+    PassOptions m_options;
+    std::vector<Stage> m_pipeline;
+    std::vector<Timing> m_timings;
+    int m_analysis_hits = 0;
+    int m_analysis_misses = 0;
+
+    // Runs one pass; returns true if it changed the program.
+    bool run_pass(const Pass& pass, std::unique_ptr<Program>& program, AnalysisManager& analyses, int iteration);
+};
@@ -0,0 +1,495 @@
+#include "peephole.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+// Register number of an operand such as "x9" or "w9"; -1 for anything else
+// (sp, xzr, immediates, labels).
+int reg_number(const std::string& operand) {
+    if (operand.size() < 2 || (operand[0] != 'x' && operand[0] != 'w')) return -1;
+    if (!std::all_of(operand.begin() + 1, operand.end(), [](char c) { return c >= '0' && c <= '9'; })) return -1;
+    int reg = std::stoi(operand.substr(1));
+    return reg <= 30 ? reg : -1;
+}
+
+std::string rename(const std::string& operand, int reg) {
+    return operand.substr(0, 1) + std::to_string(reg);
+}
+
+bool is_memory(const std::string& operand) {
+    return !operand.empty() && operand[0] == '[';
+}
+
+// Splits "[x16, x17, lsl #2]" into "x16", "x17", "lsl #2".
+std::vector<std::string> memory_parts(const std::string& operand) {
+    std::vector<std::string> parts;
+    size_t end = operand.find(']');
+    std::string inner = operand.substr(1, end - 1);
+    size_t start = 0;
+    while (start <= inner.size()) {
+        size_t comma = inner.find(", ", start);
+        if (comma == std::string::npos) comma = inner.size();
+        parts.push_back(inner.substr(start, comma - start));
+        start = comma + 2;
+    }
+    return parts;
+}
+
+std::string join_memory(const std::vector<std::string>& parts) {
+    std::string result = "[";
+    for (size_t i = 0; i < parts.size(); ++i) result += (i ? ", " : "") + parts[i];
+    return result + "]";
+}
+
+bool is_store(const std::string& op) {
+    return op == "str" || op == "strb" || op == "strh" || op == "stp";
+}
+
+bool is_load(const std::string& op) {
+    return op == "ldr" || op == "ldrb" || op == "ldrsw" || op == "ldrh" || op == "ldp";
+}
+
+bool is_branch(const std::string& op) {
+    return op == "b" || op.rfind("b.", 0) == 0 || op == "cbz" || op == "cbnz" || op == "ret" || op == "bl";
+}
+
+bool is_compare(const std::string& op) {
+    return op == "cmp" || op == "cmn" || op == "tst";
+}
+
+// The memory operand of a load or store that also updates its base
+// register: pre-indexed "[x9, #8]!" or post-indexed "[x9], #8". Empty if
+// there is none.
+std::string writeback(const AsmInstr& instr) {
+    for (size_t i = 0; i < instr.operands.size(); ++i) {
+        const std::string& operand = instr.operands[i];
+        if (!is_memory(operand)) continue;
+        bool post = i + 1 < instr.operands.size() && instr.operands[i + 1][0] == '#';
+        if (operand.back() == '!' || post) return operand;
+    }
+    return "";
+}
+
+// Registers the instruction defines; empty for compares and branches, and
+// for stores unless they write back their base.
+std::vector<int> defs(const AsmInstr& instr) {
+    if (instr.op.empty() || is_compare(instr.op) || is_branch(instr.op)) return {};
+    std::vector<int> result;
+    std::string updated = writeback(instr);
+    if (!updated.empty() && reg_number(memory_parts(updated)[0]) >= 0) result.push_back(reg_number(memory_parts(updated)[0]));
+    if (is_store(instr.op)) return result;
+    size_t count = instr.op == "ldp" ? 2 : 1;
+    for (size_t i = 0; i < count && i < instr.operands.size(); ++i) {
+        int reg = reg_number(instr.operands[i]);
+        if (reg >= 0) result.push_back(reg);
+    }
+    return result;
+}
+
+// Registers the instruction reads explicitly (calls and returns read more).
+std::vector<int> uses(const AsmInstr& instr) {
+    std::vector<int> result;
+    size_t first = 0;
+    if (!is_store(instr.op) && !is_compare(instr.op) && !is_branch(instr.op)) first = instr.op == "ldp" ? 2 : 1;
+    if (instr.op == "movk") first = 0;
+    for (size_t i = first; i < instr.operands.size(); ++i) {
+        const std::string& operand = instr.operands[i];
+        if (is_memory(operand)) {
+            for (const std::string& part : memory_parts(operand)) {
+                int reg = reg_number(part);
+                if (reg >= 0) result.push_back(reg);
+            }
+        } else if (reg_number(operand) >= 0) {
+            result.push_back(reg_number(operand));
+        }
+    }
+    return result;
+}
+
+uint64_t bit(int reg) {
+    return uint64_t(1) << reg;
+}
+
+uint64_t range(int first, int last) {
+    uint64_t set = 0;
+    for (int reg = first; reg <= last; ++reg) set |= bit(reg);
+    return set;
+}
+
+// Registers that must hold their values when the function is left: the
+// result, callee-saved registers, frame pointer and link register. A sibling
+// call also passes its arguments.
+const uint64_t live_at_exit = range(0, 7) | range(19, 30);
+
+// An instruction that can be deleted when the registers it defines are dead.
+bool removable(const AsmInstr& instr) {
+    if (instr.op.empty() || is_store(instr.op) || is_compare(instr.op) || is_branch(instr.op)) return false;
+    // Writeback addressing modifies the base register.
+    if (!writeback(instr).empty()) return false;
+    for (const std::string& operand : instr.operands) {
+        if (operand == "sp") return false;
+    }
+    auto regs = defs(instr);
+    if (regs.empty()) return false;
+    return std::none_of(regs.begin(), regs.end(), [](int reg) { return reg >= 29; });
+}
+
+// A plain instruction reading only its explicit operands and defining only
+// its first one.
+bool plain(const AsmInstr& instr) {
+    return !instr.op.empty() && !is_branch(instr.op) && instr.op != "ldp" && instr.op != "stp" && instr.op != "movk" &&
+           writeback(instr).empty() &&
+           std::none_of(instr.operands.begin(), instr.operands.end(), [](const std::string& operand) { return operand == "sp"; });
+}
+
+// Condition code that holds when `cond` does not.
+std::string invert(const std::string& cond) {
+    static const std::unordered_map<std::string, std::string> inverse = {
+        { "eq", "ne" }, { "ne", "eq" }, { "lt", "ge" }, { "ge", "lt" }, { "gt", "le" }, { "le", "gt" },
+    };
+    return inverse.at(cond);
+}
+
+// Bytes a load or store moves, for the scaled register-offset form.
+int access_size(const AsmInstr& instr) {
+    if (instr.op == "ldrb" || instr.op == "strb") return 1;
+    if (instr.op == "ldrsw") return 4;
+    return instr.operands[0][0] == 'w' ? 4 : 8;
+}
+
+} // namespace
+
+std::string AsmInstr::print() const {
+    if (op.empty()) return label + ":";
+    std::string line = "    " + op;
+    for (size_t i = 0; i < operands.size(); ++i) line += (i ? ", " : " ") + operands[i];
+    return line;
+}
+
+Peephole::Peephole(std::vector<AsmInstr>& code) : m_code(code) {
+}
+
+void Peephole::run() {
+    static const std::vector<Rule> rules = {
+        { "redundant-move", &Peephole::redundant_move },
+        { "dead-def", &Peephole::dead_def },
+        { "coalesce-move", &Peephole::coalesce_move },
+        { "forward-copy", &Peephole::forward_copy },
+        { "store-load-forward", &Peephole::store_load_forward },
+        { "fold-address", &Peephole::fold_address },
+        { "post-index", &Peephole::post_index },
+        { "redundant-compare", &Peephole::redundant_compare },
+        { "fuse-condition", &Peephole::fuse_condition },
+        { "branch-to-next", &Peephole::branch_to_next },
+        { "dead-label", &Peephole::dead_label },
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        compute_liveness();
+        // Liveness is only valid until the first rewrite.
+        for (size_t i = 0; i < m_code.size() && !changed; ++i) {
+            for (const Rule& rule : rules) {
+                if ((this->*rule.apply)(i)) {
+                    ++m_fired[rule.name];
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void Peephole::compute_liveness() {
+    size_t count = m_code.size();
+    std::unordered_map<std::string, size_t> labels;
+    for (size_t i = 0; i < count; ++i) {
+        if (m_code[i].op.empty()) labels[m_code[i].label] = i;
+    }
+    // Successor instructions of each instruction; SIZE_MAX leaves the function.
+    auto successors = [&](size_t i) {
+        const AsmInstr& instr = m_code[i];
+        std::vector<size_t> result;
+        bool falls_through = instr.op != "b" && instr.op != "ret";
+        if (falls_through && i + 1 < count) result.push_back(i + 1);
+        if (instr.op == "b" || instr.op.rfind("b.", 0) == 0 || instr.op == "cbz" || instr.op == "cbnz") {
+            auto target = labels.find(instr.operands.back());
+            result.push_back(target == labels.end() ? SIZE_MAX : target->second);
+        }
+        return result;
+    };
+
+    std::vector<RegSet> live_before(count, 0);
+    m_live_after.assign(count, 0);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = count; i-- > 0;) {
+            const AsmInstr& instr = m_code[i];
+            RegSet after = 0;
+            for (size_t succ : successors(i)) after |= succ == SIZE_MAX ? live_at_exit : live_before[succ];
+            if (instr.op == "ret") after = live_at_exit;
+            RegSet before = after;
+            if (instr.op == "bl") {
+                // Calls clobber x0-x18 and x30, and read their arguments.
+                before = (before & ~(range(0, 18) | bit(30))) | range(0, 7);
+            } else {
+                for (int reg : defs(instr)) before &= ~bit(reg);
+                for (int reg : uses(instr)) before |= bit(reg);
+            }
+            if (after != m_live_after[i] || before != live_before[i]) changed = true;
+            m_live_after[i] = after;
+            live_before[i] = before;
+        }
+    }
+}
+
+bool Peephole::redundant_move(size_t i) {
+    const AsmInstr& instr = m_code[i];
+    if (instr.op != "mov" || instr.operands.size() != 2 || instr.operands[0] != instr.operands[1]) return false;
+    if (instr.operands[0][0] != 'x') return false;  // mov w9, w9 clears the upper half
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::dead_def(size_t i) {
+    if (!removable(m_code[i])) return false;
+    for (int reg : defs(m_code[i])) {
+        if (live_after(i, reg)) return false;
+    }
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::coalesce_move(size_t i) {
+    AsmInstr& def = m_code[i];
+    if (!removable(def) || !plain(def)) return false;
+    int temp = reg_number(def.operands[0]);
+    if (temp < 0) return false;
+    // The copy of the result may come later in the block, as long as nothing
+    // in between touches either register.
+    for (size_t j = i + 1; j < m_code.size() && plain(m_code[j]); ++j) {
+        const AsmInstr& move = m_code[j];
+        bool copies = move.op == "mov" && move.operands.size() == 2 && reg_number(move.operands[1]) == temp &&
+                      move.operands[0][0] == 'x';
+        if (copies) {
+            int dst = reg_number(move.operands[0]);
+            if (dst < 0 || dst >= 29 || live_after(j, temp)) return false;
+            if (j > i + 1 && reads_or_writes(i + 1, j, dst)) return false;
+            // A w-register result is zero-extended, so it can be retargeted as is.
+            def.operands[0] = rename(def.operands[0], dst);
+            m_code.erase(m_code.begin() + j);
+            return true;
+        }
+        if (reads_or_writes(j, j + 1, temp)) return false;
+    }
+    return false;
+}
+
+bool Peephole::forward_copy(size_t i) {
+    const AsmInstr& move = m_code[i];
+    if (move.op != "mov" || move.operands.size() != 2 || move.operands[0][0] != 'x') return false;
+    int temp = reg_number(move.operands[0]);
+    int src = reg_number(move.operands[1]);
+    if (temp < 0 || src < 0 || temp >= 29) return false;
+    // Find the first reader of the copy in the block; the source must keep
+    // its value until then.
+    size_t j = i + 1;
+    for (; j < m_code.size() && plain(m_code[j]); ++j) {
+        auto user_uses = uses(m_code[j]);
+        if (std::find(user_uses.begin(), user_uses.end(), temp) != user_uses.end()) break;
+        auto user_defs = defs(m_code[j]);
+        bool clobbers = std::find_if(user_defs.begin(), user_defs.end(), [&](int reg) { return reg == temp || reg == src; }) != user_defs.end();
+        if (clobbers) return false;
+    }
+    if (j >= m_code.size() || !plain(m_code[j])) return false;
+    AsmInstr& user = m_code[j];
+    auto user_defs = defs(user);
+    bool redefined = std::find(user_defs.begin(), user_defs.end(), temp) != user_defs.end();
+    if (live_after(j, temp) && !redefined) return false;
+
+    size_t first = user_defs.empty() ? 0 : 1;
+    for (size_t k = first; k < user.operands.size(); ++k) {
+        std::string& operand = user.operands[k];
+        if (is_memory(operand)) {
+            auto parts = memory_parts(operand);
+            for (std::string& part : parts) {
+                if (reg_number(part) == temp) part = rename(part, src);
+            }
+            operand = join_memory(parts) + operand.substr(operand.find(']') + 1);
+        } else if (reg_number(operand) == temp) {
+            operand = rename(operand, src);
+        }
+    }
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::reads_or_writes(size_t first, size_t last, int reg) const {
+    for (size_t k = first; k < last; ++k) {
+        auto regs = uses(m_code[k]);
+        auto written = defs(m_code[k]);
+        regs.insert(regs.end(), written.begin(), written.end());
+        if (std::find(regs.begin(), regs.end(), reg) != regs.end()) return true;
+    }
+    return false;
+}
+
+bool Peephole::store_load_forward(size_t i) {
+    if (i + 1 >= m_code.size()) return false;
+    const AsmInstr& store = m_code[i];
+    AsmInstr& load = m_code[i + 1];
+    if (store.op != "str" && store.op != "strb") return false;
+    if (load.op != "ldr" && load.op != "ldrsw" && load.op != "ldrb") return false;
+    if (store.operands.size() != 2 || load.operands.size() != 2 || store.operands[1] != load.operands[1]) return false;
+    if (store.operands[1].back() == '!') return false;
+    int value = reg_number(store.operands[0]);
+    int dst = reg_number(load.operands[0]);
+    if (value < 0 || dst < 0) return false;
+
+    // The load yields the stored bits, extended the way the load extends them.
+    bool wide = store.op == "str" && store.operands[0][0] == 'x';
+    if (wide && load.op == "ldr" && load.operands[0][0] == 'x') {
+        load = { "mov", { load.operands[0], store.operands[0] }, "" };
+    } else if (store.op == "str" && !wide && load.op == "ldrsw") {
+        load = { "sxtw", { load.operands[0], rename(store.operands[0], value) }, "" };
+    } else if (store.op == "strb" && load.op == "ldrb") {
+        load = { "and", { load.operands[0], store.operands[0], "#255" }, "" };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool Peephole::fold_address(size_t i) {
+    if (i + 1 >= m_code.size()) return false;
+    const AsmInstr& add = m_code[i];
+    AsmInstr& access = m_code[i + 1];
+    if (add.op != "add" || (!is_load(access.op) && !is_store(access.op)) || access.op == "ldp" || access.op == "stp") return false;
+    if (access.operands.size() != 2) return false;
+    int temp = reg_number(add.operands[0]);
+    if (temp < 0 || temp >= 29 || access.operands[1] != "[" + add.operands[0] + "]") return false;
+    // A load may overwrite the address it reads; anything else needs the address dead.
+    bool reloaded = is_load(access.op) && reg_number(access.operands[0]) == temp;
+    if (!reloaded && (reg_number(access.operands[0]) == temp || live_after(i + 1, temp))) return false;
+
+    std::vector<std::string> parts(add.operands.begin() + 1, add.operands.end());
+    if (parts.size() == 2 && parts[1][0] == '#') {
+        // [base, #imm]: unsigned offsets must be a multiple of the access size.
+        long long offset = std::stoll(parts[1].substr(1));
+        if (offset < 0 || offset % access_size(access) != 0 || offset / access_size(access) > 4095) return false;
+    } else if (parts.size() == 3) {
+        int scale = access_size(access) == 8 ? 3 : access_size(access) == 4 ? 2 : 0;
+        if (parts[2] != "lsl #" + std::to_string(scale) || scale == 0) return false;
+    } else if (parts.size() != 2 || reg_number(parts[1]) < 0) {
+        return false;
+    }
+    if (reg_number(parts[0]) < 0) return false;
+    access.operands[1] = join_memory(parts);
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::post_index(size_t i) {
+    AsmInstr& access = m_code[i];
+    if ((!is_load(access.op) && !is_store(access.op)) || access.op == "ldp" || access.op == "stp") return false;
+    if (access.operands.size() != 2 || !is_memory(access.operands[1])) return false;
+    auto parts = memory_parts(access.operands[1]);
+    int base = reg_number(parts[0]);
+    if (parts.size() != 1 || access.operands[1].back() != ']' || base < 0 || parts[0][0] != 'x') return false;
+    if (reg_number(access.operands[0]) == base) return false;
+    // The increment of the base may come later in the block, as long as
+    // nothing in between touches the base.
+    for (size_t j = i + 1; j < m_code.size() && plain(m_code[j]); ++j) {
+        const AsmInstr& add = m_code[j];
+        bool increments = (add.op == "add" || add.op == "sub") && add.operands.size() == 3 && add.operands[0] == parts[0] &&
+                          add.operands[1] == parts[0] && add.operands[2][0] == '#';
+        if (increments) {
+            long long step = std::stoll(add.operands[2].substr(1));
+            if (add.op == "sub") step = -step;
+            if (step < -256 || step > 255) return false;
+            access.operands.push_back("#" + std::to_string(step));
+            m_code.erase(m_code.begin() + j);
+            return true;
+        }
+        if (reads_or_writes(j, j + 1, base)) return false;
+    }
+    return false;
+}
+
+bool Peephole::redundant_compare(size_t i) {
+    const AsmInstr& cmp = m_code[i];
+    if (!is_compare(cmp.op)) return false;
+    // The flags stay valid while neither they nor the compared registers change.
+    auto compared = uses(cmp);
+    for (size_t j = i + 1; j < m_code.size() && plain(m_code[j]); ++j) {
+        const AsmInstr& instr = m_code[j];
+        if (is_compare(instr.op)) {
+            if (instr.op != cmp.op || instr.operands != cmp.operands) return false;
+            m_code.erase(m_code.begin() + j);
+            return true;
+        }
+        for (int reg : defs(instr)) {
+            if (std::find(compared.begin(), compared.end(), reg) != compared.end()) return false;
+        }
+    }
+    return false;
+}
+
+bool Peephole::fuse_condition(size_t i) {
+    const AsmInstr& cset = m_code[i];
+    if (cset.op != "cset") return false;
+    int reg = reg_number(cset.operands[0]);
+    // Find the test of the materialised condition; the flags it was computed
+    // from must survive until then.
+    size_t test = i + 1;
+    for (; test < m_code.size() && plain(m_code[test]); ++test) {
+        const AsmInstr& instr = m_code[test];
+        if (instr.op == "cmp" && instr.operands.size() == 2 && reg_number(instr.operands[0]) == reg && instr.operands[1] == "#0") break;
+        if (is_compare(instr.op) || reads_or_writes(test, test + 1, reg)) return false;
+    }
+    if (test >= m_code.size() || !plain(m_code[test]) || live_after(test, reg)) return false;
+
+    // Its readers (up to the next compare, label or branch) test eq or ne,
+    // i.e. whether the original condition failed or held.
+    std::vector<std::string*> conditions;
+    for (size_t j = test + 1; j < m_code.size(); ++j) {
+        AsmInstr& instr = m_code[j];
+        if (instr.op == "b.eq" || instr.op == "b.ne") {
+            conditions.push_back(&instr.op);
+            break;
+        }
+        if (!plain(instr) || is_compare(instr.op)) break;
+        if (instr.op == "csel" || instr.op == "csinc" || instr.op == "cset") conditions.push_back(&instr.operands.back());
+    }
+    auto code = [](const std::string* condition) { return (*condition)[0] == 'b' ? condition->substr(2) : *condition; };
+    for (const std::string* condition : conditions) {
+        if (code(condition) != "eq" && code(condition) != "ne") return false;
+    }
+    const std::string cond = cset.operands[1];
+    for (std::string* condition : conditions) {
+        std::string fused = code(condition) == "ne" ? cond : invert(cond);
+        *condition = (*condition)[0] == 'b' ? "b." + fused : fused;
+    }
+    m_code.erase(m_code.begin() + test);
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::branch_to_next(size_t i) {
+    if (i + 1 >= m_code.size()) return false;
+    if (m_code[i].op != "b" || !m_code[i + 1].op.empty() || m_code[i + 1].label != m_code[i].operands[0]) return false;
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
+
+bool Peephole::dead_label(size_t i) {
+    // The function's own label comes first and is always kept.
+    if (i == 0 || !m_code[i].op.empty()) return false;
+    for (const AsmInstr& instr : m_code) {
+        if (std::find(instr.operands.begin(), instr.operands.end(), m_code[i].label) != instr.operands.end()) return false;
+    }
+    m_code.erase(m_code.begin() + i);
+    return true;
+}
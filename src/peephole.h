@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// One line of ARM64 assembly: an instruction, or a label when `op` is empty.
+// Operands are kept as they are printed ("x9", "#16", "[x29, #-8]",
+// "lsl #2"), so the generator builds them the same way it used to write
+// text, and print() joins them back with ", ".
+struct AsmInstr {
+    std::string op;
+    std::vector<std::string> operands;
+    std::string label;
+
+    std::string print() const;
+};
+
+// Peephole optimisation of the code of one function.
+//
+// The rules are a table of patterns over a window of adjacent instructions,
+// guarded by register liveness, which is computed over the function's own
+// branches and labels:
+//
+//   redundant-move      mov x9, x9                       -> (removed)
+//   dead-def            a computation or load whose result is never read
+//   coalesce-move       add x9, x10, #1; ...; mov x15, x9
+//                                                        -> add x15, x10, #1; ...
+//   forward-copy        mov x9, x0; ...; add x10, x9, #1 -> ...; add x10, x0, #1
+//   store-load-forward  str x16, [m]; ldr x9, [m]        -> str x16, [m]; mov x9, x16
+//   fold-address        add x9, x16, x17, lsl #2; ldrsw x10, [x9]
+//                                                        -> ldrsw x10, [x16, x17, lsl #2]
+//   post-index          ldr w10, [x9]; ...; add x9, x9, #4
+//                                                        -> ldr w10, [x9], #4; ...
+//   redundant-compare   cmp x9, x10; csel ...; cmp x9, x10
+//                                                        -> cmp x9, x10; csel ...
+//   fuse-condition      cset x9, lt; ...; cmp x9, #0; b.eq L
+//                                                        -> ...; b.ge L
+//                       (also for csel, csinc and cset reading the flags)
+//   branch-to-next      b L; L:                          -> L:
+//   dead-label          a label no branch refers to, so that the rules above
+//                       see through it
+//
+// Rules that drop a register's value only apply when it is dead afterwards;
+// the copy and compare rules look ahead within a straight-line run of
+// instructions. The generator never leaves the flags live across a label or
+// a branch, so the compare rules only follow them up to the next one.
+// The rules run until none applies; fired() counts every application.
+class Peephole {
+public:
+    explicit Peephole(std::vector<AsmInstr>& code);
+    void run();
+    const std::map<std::string, int>& fired() const { return m_fired; }
+
+private:
+    using RegSet = uint64_t;
+
+    struct Rule {
+        std::string name;
+        // Tries the rule at instruction `i`; returns true if it rewrote the code.
+        bool (Peephole::*apply)(size_t i);
+    };
+
+    std::vector<AsmInstr>& m_code;
+    std::map<std::string, int> m_fired;
+    // Registers live after each instruction.
+    std::vector<RegSet> m_live_after;
+
+    void compute_liveness();
+    bool live_after(size_t i, int reg) const { return (m_live_after[i] >> reg) & 1; }
+    // True if an instruction in [first, last) reads or writes `reg`.
+    bool reads_or_writes(size_t first, size_t last, int reg) const;
+
+    bool redundant_move(size_t i);
+    bool dead_def(size_t i);
+    bool coalesce_move(size_t i);
+    bool forward_copy(size_t i);
+    bool store_load_forward(size_t i);
+    bool fold_address(size_t i);
+    bool post_index(size_t i);
+    bool redundant_compare(size_t i);
+    bool fuse_condition(size_t i);
+    bool branch_to_next(size_t i);
+    bool dead_label(size_t i);
+};
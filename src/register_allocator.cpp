@@ -0,0 +1,380 @@
+#include "register_allocator.h"
+#include "ir_analysis.h"
+#include <algorithm>
+#include <cmath>
+
+using ir::Opcode;
+
+const std::vector<int>& RegisterAllocator::caller_saved(Target target) {
+    static const std::vector<int> aarch64 = { 9, 10, 11, 12, 13, 14, 15 };
+    static const std::vector<int> x86_64 = { 6, 7, 8, 9 };
+    return target == Target::AArch64 ? aarch64 : x86_64;
+}
+
+const std::vector<int>& RegisterAllocator::callee_saved(Target target) {
+    static const std::vector<int> aarch64 = { 19, 20, 21, 22, 23, 24, 25, 26, 27, 28 };
+    static const std::vector<int> x86_64 = { 3, 12, 13, 14, 15 };
+    return target == Target::AArch64 ? aarch64 : x86_64;
+}
+
+RegisterAllocator::RegisterAllocator(const ir::Function& func, const InstructionSelector& selector, Target target)
+    : m_func(func), m_selector(selector), m_target(target) {
+}
+
+void RegisterAllocator::run() {
+    find_promotable();
+    find_folded_loads();
+    build_intervals();
+    allocate();
+    build_lifetimes();
+}
+
+const ir::Value* RegisterAllocator::vreg(const ir::Value* value) const {
+    if (value->kind == ir::Value::Kind::Constant) return nullptr;
+    if (value->kind == ir::Value::Kind::Argument) return value;
+    const auto* instr = static_cast<const ir::Instruction*>(value);
+    if (instr->op == Opcode::Alloca) return promoted(instr) ? instr : nullptr;
+    if (m_selector.covered(instr)) return nullptr;
+    if (folded(instr)) return instr->operands[0];
+    return instr;
+}
+
+int RegisterAllocator::reg(const ir::Value* vreg) const {
+    auto it = m_intervals.find(vreg);
+    return it == m_intervals.end() ? -1 : it->second.reg;
+}
+
+std::pair<int, int> RegisterAllocator::lifetime(const ir::Value* object) const {
+    auto it = m_lifetimes.find(object);
+    return it == m_lifetimes.end() ? std::make_pair(0, -1) : it->second;
+}
+
+// Scalar allocas whose address is only used directly by loads, stores and
+// lifetime markers.
+void RegisterAllocator::find_promotable() {
+    std::unordered_set<const ir::Value*> escaped;
+    for (const auto& block : m_func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op == Opcode::Alloca && instr->count == 1) m_promoted.insert(instr.get());
+            for (size_t i = 0; i < instr->operands.size(); ++i) {
+                bool direct = (instr->op == Opcode::Load && i == 0) || (instr->op == Opcode::Store && i == 1) ||
+                              instr->op == Opcode::LifetimeStart || instr->op == Opcode::LifetimeEnd;
+                if (!direct) escaped.insert(instr->operands[i]);
+            }
+        }
+    }
+    for (const ir::Value* value : escaped) m_promoted.erase(value);
+}
+
+void RegisterAllocator::find_folded_loads() {
+    // Users of every value, as (block, index) pairs; a covered instruction's
+    // operands are used by the instruction covering it.
+    std::unordered_map<const ir::Value*, std::vector<std::pair<const ir::BasicBlock*, size_t>>> users;
+    for (const auto& block : m_func.blocks) {
+        for (size_t i = 0; i < block->instrs.size(); ++i) {
+            const ir::Instruction& instr = *block->instrs[i];
+            if (m_selector.covered(&instr)) continue;
+            for (const ir::Value* operand : m_selector.leaves(instr)) {
+                if (instr.op == Opcode::Phi) users[operand].push_back({ nullptr, 0 });
+                else users[operand].push_back({ block.get(), i });
+            }
+        }
+    }
+    for (const auto& block : m_func.blocks) {
+        const auto& instrs = block->instrs;
+        for (size_t i = 0; i < instrs.size(); ++i) {
+            const ir::Instruction& load = *instrs[i];
+            if (load.op != Opcode::Load || !promoted(load.operands[0])) continue;
+            size_t last = i;
+            bool local = true;
+            for (const auto& [user_block, index] : users[&load]) {
+                local = local && user_block == block.get() && index > i;
+                last = std::max(last, index);
+            }
+            if (!local) continue;
+            bool stored = false;
+            for (size_t j = i + 1; j < last; ++j) {
+                stored = stored || (instrs[j]->op == Opcode::Store && instrs[j]->operands[1] == load.operands[0]);
+            }
+            if (!stored) m_folded.insert(&load);
+        }
+    }
+}
+
+void RegisterAllocator::build_intervals() {
+    // Number the virtual registers, and give every instruction an even
+    // position; each block also has a start and an end position around them.
+    std::unordered_map<const ir::Value*, size_t> index;
+    std::vector<const ir::Value*> vregs;
+    auto add_vreg = [&](const ir::Value* value) {
+        if (index.emplace(value, vregs.size()).second) vregs.push_back(value);
+    };
+    for (const auto& arg : m_func.args) add_vreg(arg.get());
+    auto& extent = m_extents;
+    auto& position = m_positions;
+    std::vector<int> calls;
+    int pos = 0;
+    for (const auto& block : m_func.blocks) {
+        int start = pos++;
+        for (const auto& instr : block->instrs) {
+            pos += 2;
+            position[instr.get()] = pos;
+            if (instr->op == Opcode::Call || instr->op == Opcode::Print) calls.push_back(pos);
+            if (instr->has_result() && vreg(instr.get()) == instr.get()) add_vreg(instr.get());
+        }
+        extent[block.get()] = { start, ++pos };
+        ++pos;
+    }
+    m_last_position = pos;
+    size_t count = vregs.size();
+
+    // Per-block liveness: upward-exposed uses, definitions, and the values
+    // flowing into successor phis along each edge.
+    std::unordered_map<const ir::BasicBlock*, std::vector<char>> gen, kill, live_in, live_out, phi_uses;
+    std::vector<char> read(count, 0);
+    for (const auto& block : m_func.blocks) {
+        auto& block_gen = gen[block.get()] = std::vector<char>(count, 0);
+        auto& block_kill = kill[block.get()] = std::vector<char>(count, 0);
+        live_in[block.get()] = std::vector<char>(count, 0);
+        live_out[block.get()] = std::vector<char>(count, 0);
+        auto& edge_uses = phi_uses[block.get()] = std::vector<char>(count, 0);
+        for (const auto& instr : block->instrs) {
+            if (instr->op == Opcode::Phi) {
+                block_kill[index.at(instr.get())] = 1;
+                continue;
+            }
+            if (m_selector.covered(instr.get())) continue;
+            bool stores_var = instr->op == Opcode::Store && promoted(instr->operands[1]);
+            for (const ir::Value* operand : m_selector.leaves(*instr)) {
+                if (stores_var && operand == instr->operands[1]) continue;
+                const ir::Value* v = vreg(operand);
+                if (!v) continue;
+                read[index.at(v)] = 1;
+                if (!block_kill[index.at(v)]) block_gen[index.at(v)] = 1;
+            }
+            if (stores_var) block_kill[index.at(instr->operands[1])] = 1;
+            const ir::Value* def = instr->has_result() ? vreg(instr.get()) : nullptr;
+            if (def == instr.get()) block_kill[index.at(def)] = 1;
+        }
+        for (const ir::BasicBlock* succ : block->succs) {
+            for (const auto& instr : succ->instrs) {
+                if (instr->op != Opcode::Phi) break;
+                for (size_t i = 0; i < instr->blocks.size(); ++i) {
+                    const ir::Value* v = instr->blocks[i] == block.get() ? vreg(instr->operands[i]) : nullptr;
+                    if (!v) continue;
+                    edge_uses[index.at(v)] = 1;
+                    read[index.at(v)] = 1;
+                }
+            }
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = m_func.blocks.rbegin(); it != m_func.blocks.rend(); ++it) {
+            const ir::BasicBlock* block = it->get();
+            auto& out = live_out[block];
+            auto& in = live_in[block];
+            for (size_t v = 0; v < count; ++v) {
+                bool live = phi_uses[block][v];
+                for (const ir::BasicBlock* succ : block->succs) live = live || live_in[succ][v];
+                bool live_entry = gen[block][v] || (live && !kill[block][v]);
+                if (live != static_cast<bool>(out[v]) || live_entry != static_cast<bool>(in[v])) changed = true;
+                out[v] = live;
+                in[v] = live_entry;
+            }
+        }
+    }
+
+    // Intervals of the virtual registers that are read somewhere.
+    auto depths = ir::loop_depths(m_func);
+    auto touch = [&](const ir::Value* v, int at, const ir::BasicBlock* block, bool occurrence) {
+        if (!v || !read[index.at(v)]) return;
+        auto [it, inserted] = m_intervals.try_emplace(v, Interval { v, index.at(v), at, at });
+        Interval& interval = it->second;
+        interval.start = std::min(interval.start, at);
+        interval.end = std::max(interval.end, at);
+        if (occurrence) interval.weight += std::pow(10.0, std::min(depths[block], 3));
+    };
+    for (const auto& arg : m_func.args) touch(arg.get(), 0, m_func.entry(), true);
+    for (const auto& block : m_func.blocks) {
+        auto [start, end] = extent.at(block.get());
+        for (size_t v = 0; v < count; ++v) {
+            if (live_in[block.get()][v]) touch(vregs[v], start, block.get(), false);
+            if (live_out[block.get()][v]) touch(vregs[v], end, block.get(), false);
+            if (phi_uses[block.get()][v]) touch(vregs[v], end, block.get(), true);
+        }
+        for (const auto& instr : block->instrs) {
+            int at = position.at(instr.get());
+            if (instr->op == Opcode::Phi) {
+                touch(instr.get(), start, block.get(), true);
+                for (const ir::BasicBlock* pred : instr->blocks) touch(instr.get(), extent.at(pred).second, pred, false);
+                continue;
+            }
+            if (m_selector.covered(instr.get())) continue;
+            for (const ir::Value* operand : m_selector.leaves(*instr)) touch(vreg(operand), at, block.get(), true);
+            // A variable is defined by its stores, not by its alloca.
+            bool defines = instr->has_result() && instr->op != Opcode::Alloca && vreg(instr.get()) == instr.get();
+            if (defines) touch(instr.get(), at, block.get(), true);
+        }
+    }
+    for (auto& [v, interval] : m_intervals) {
+        interval.weight /= interval.end - interval.start + 1;
+        auto call = std::upper_bound(calls.begin(), calls.end(), interval.start);
+        interval.crosses_call = call != calls.end() && *call < interval.end;
+    }
+}
+
+void RegisterAllocator::allocate() {
+    std::vector<Interval*> order;
+    for (auto& [v, interval] : m_intervals) order.push_back(&interval);
+    std::sort(order.begin(), order.end(), [](const Interval* a, const Interval* b) {
+        if (a->start != b->start) return a->start < b->start;
+        if (a->end != b->end) return a->end < b->end;
+        return a->index < b->index;
+    });
+
+    std::vector<bool> is_free(32, true);
+    const auto& caller = caller_saved(m_target);
+    const auto& callee = callee_saved(m_target);
+    auto is_callee_saved = [&callee](int reg) {
+        return std::find(callee.begin(), callee.end(), reg) != callee.end();
+    };
+    std::vector<Interval*> active;
+    for (Interval* current : order) {
+        // A value whose last use is the instruction defining `current` can
+        // share its register: the instruction reads its operands first.
+        for (auto it = active.begin(); it != active.end();) {
+            if ((*it)->end <= current->start) {
+                is_free[(*it)->reg] = true;
+                it = active.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        std::vector<int> candidates = callee;
+        if (!current->crosses_call) candidates.insert(candidates.begin(), caller.begin(), caller.end());
+        auto free_reg = std::find_if(candidates.begin(), candidates.end(), [&is_free](int reg) { return is_free[reg]; });
+        if (free_reg != candidates.end()) {
+            current->reg = *free_reg;
+            is_free[*free_reg] = false;
+            active.push_back(current);
+            continue;
+        }
+
+        // Spill whichever of `current` and the intervals holding a usable register is cheapest.
+        Interval* victim = nullptr;
+        for (Interval* other : active) {
+            if (current->crosses_call && !is_callee_saved(other->reg)) continue;
+            if (!victim || other->weight < victim->weight) victim = other;
+        }
+        if (victim && victim->weight < current->weight) {
+            current->reg = victim->reg;
+            victim->reg = -1;
+            m_spilled.push_back(victim->vreg);
+            active.erase(std::find(active.begin(), active.end(), victim));
+            active.push_back(current);
+        } else {
+            m_spilled.push_back(current->vreg);
+        }
+    }
+
+    for (int reg : callee) {
+        bool used = std::any_of(m_intervals.begin(), m_intervals.end(), [reg](const auto& entry) { return entry.second.reg == reg; });
+        if (used) m_used_callee_saved.push_back(reg);
+    }
+}
+
+void RegisterAllocator::build_lifetimes() {
+    for (const ir::Value* value : m_spilled) {
+        const Interval& interval = m_intervals.at(value);
+        m_lifetimes[value] = { interval.start, interval.end };
+    }
+
+    // Addresses derived from an alloca kept in memory (element addresses, and
+    // phis merging them) stand for that alloca. Storing or returning one lets
+    // the address escape, and the alloca is then live throughout.
+    std::unordered_map<const ir::Value*, const ir::Value*> object_of;
+    std::unordered_set<const ir::Value*> escaped;
+    for (const auto& block : m_func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op == Opcode::Alloca && !promoted(instr.get())) object_of[instr.get()] = instr.get();
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& block : m_func.blocks) {
+            for (const auto& instr : block->instrs) {
+                if (instr->op != Opcode::ElementAddr && instr->op != Opcode::Phi) continue;
+                for (const ir::Value* operand : instr->operands) {
+                    auto source = object_of.find(operand);
+                    if (source == object_of.end()) continue;
+                    auto [it, inserted] = object_of.try_emplace(instr.get(), source->second);
+                    changed = changed || inserted;
+                    if (it->second != source->second) {
+                        escaped.insert(it->second);
+                        escaped.insert(source->second);
+                    }
+                }
+            }
+        }
+    }
+
+    // Blocks and positions at which every alloca is accessed.
+    std::unordered_map<const ir::BasicBlock*, size_t> block_index;
+    for (const auto& block : m_func.blocks) block_index.emplace(block.get(), block_index.size());
+    std::unordered_map<const ir::Value*, std::vector<char>> accessed;
+    for (const auto& block : m_func.blocks) {
+        for (const auto& instr : block->instrs) {
+            // Scope markers are not accesses; the span found here can be shorter.
+            if (instr->op == Opcode::LifetimeStart || instr->op == Opcode::LifetimeEnd) continue;
+            for (size_t i = 0; i < instr->operands.size(); ++i) {
+                auto object = object_of.find(instr->operands[i]);
+                if (object == object_of.end()) continue;
+                bool escapes = (instr->op == Opcode::Store && i == 0) || instr->op == Opcode::Ret;
+                if (escapes) escaped.insert(object->second);
+                auto& blocks = accessed[object->second];
+                if (blocks.empty()) blocks.assign(m_func.blocks.size(), 0);
+                blocks[block_index.at(block.get())] = 1;
+                auto [it, inserted] = m_lifetimes.try_emplace(object->second, m_positions.at(instr.get()), m_positions.at(instr.get()));
+                it->second.first = std::min(it->second.first, m_positions.at(instr.get()));
+                it->second.second = std::max(it->second.second, m_positions.at(instr.get()));
+            }
+        }
+    }
+
+    // An alloca holds a value wherever an access has happened before and
+    // another one can still follow.
+    size_t count = m_func.blocks.size();
+    for (auto& [object, blocks] : accessed) {
+        auto& span = m_lifetimes.at(object);
+        if (escaped.count(object)) {
+            span = { 0, m_last_position };
+            continue;
+        }
+        std::vector<char> live_in(blocks), reached_out(blocks);
+        bool updated = true;
+        while (updated) {
+            updated = false;
+            for (size_t b = count; b-- > 0;) {
+                const ir::BasicBlock* block = m_func.blocks[b].get();
+                for (const ir::BasicBlock* succ : block->succs) {
+                    if (live_in[block_index.at(succ)] && !live_in[b]) live_in[b] = updated = true;
+                }
+                for (const ir::BasicBlock* pred : block->preds) {
+                    if (reached_out[block_index.at(pred)] && !reached_out[b]) reached_out[b] = updated = true;
+                }
+            }
+        }
+        for (size_t b = 0; b < count; ++b) {
+            const ir::BasicBlock* block = m_func.blocks[b].get();
+            bool live_out = std::any_of(block->succs.begin(), block->succs.end(), [&](const ir::BasicBlock* succ) { return live_in[block_index.at(succ)]; });
+            bool reached_in = std::any_of(block->preds.begin(), block->preds.end(), [&](const ir::BasicBlock* pred) { return reached_out[block_index.at(pred)]; });
+            auto [start, end] = m_extents.at(block);
+            if (live_in[b] && reached_in) span.first = std::min(span.first, start);
+            if (live_out && reached_out[b]) span.second = std::max(span.second, end);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "instruction_selection.h"
+#include "ir.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Linear-scan register allocation for the native backends.
+//
+// Allocation works on virtual registers: every IR value with a result, the
+// function arguments, and every scalar alloca that is only ever loaded and
+// stored directly, so that local variables (loop induction variables in
+// particular) live in registers. A load from such a variable whose uses all
+// follow it in the same block, before the variable is stored again, reads the
+// variable's register directly instead of getting one of its own.
+//
+// Liveness is solved per block and every virtual register gets a single
+// interval spanning its definitions, its uses and the blocks it is live
+// through; a phi's interval also covers the copies at the end of its
+// predecessors. Intervals that cross a call can only get callee-saved
+// registers, the others prefer caller-saved ones. When no register is free
+// the interval with the lowest spill weight (uses weighted by loop depth, per
+// position covered) lives in a frame slot instead. Constants and the
+// addresses of allocas that stay in memory are never allocated; the code
+// generator rematerialises them at every use. Neither are instructions the
+// InstructionSelector covered: their operands are read by the covering user,
+// and are live until it.
+//
+// The allocator also reports the lifetimes of the objects the generator puts
+// in the frame, so that objects which are never live at the same time can
+// share stack space.
+class RegisterAllocator {
+public:
+    // ARM64: x9-x15 and x19-x28. x8 and x16/x17 are scratch registers of the
+    // code generator, x18 is reserved by the platform.
+    // x86-64: %rsi, %rdi, %r8, %r9 and %rbx, %r12-%r15, by hardware number.
+    // %rax, %rcx, %rdx, %r10 and %r11 are scratch registers of the code
+    // generator.
+    static const std::vector<int>& caller_saved(Target target);
+    static const std::vector<int>& callee_saved(Target target);
+
+    RegisterAllocator(const ir::Function& func, const InstructionSelector& selector, Target target = Target::AArch64);
+    void run();
+
+    // True for an alloca that became a virtual register.
+    bool promoted(const ir::Value* value) const { return m_promoted.count(value) > 0; }
+    // True for a load that reads its variable's register directly.
+    bool folded(const ir::Value* value) const { return m_folded.count(value) > 0; }
+    // Virtual register holding `value`: the variable for a folded load, and
+    // nullptr for constants, covered instructions and allocas that stay in
+    // memory.
+    const ir::Value* vreg(const ir::Value* value) const;
+    // False for a virtual register that is never read.
+    bool live(const ir::Value* vreg) const { return m_intervals.count(vreg) > 0; }
+    // Assigned register, or -1 for a spilled virtual register.
+    int reg(const ir::Value* vreg) const;
+
+    const std::vector<const ir::Value*>& spilled() const { return m_spilled; }
+    const std::vector<int>& used_callee_saved() const { return m_used_callee_saved; }
+
+    // Positions between which a frame object (an alloca kept in memory, or a
+    // spilled virtual register) holds a value; objects whose lifetimes are
+    // disjoint can share a slot. Empty (start > end) for an unused alloca.
+    std::pair<int, int> lifetime(const ir::Value* object) const;
+
+private:
+    struct Interval {
+        const ir::Value* vreg;
+        size_t index;             // Numbering of the virtual registers, for a deterministic order
+        int start;
+        int end;
+        double weight = 0;
+        bool crosses_call = false;
+        int reg = -1;
+    };
+
+    const ir::Function& m_func;
+    const InstructionSelector& m_selector;
+    Target m_target;
+    std::unordered_set<const ir::Value*> m_promoted;
+    std::unordered_set<const ir::Value*> m_folded;
+    std::unordered_map<const ir::Value*, Interval> m_intervals;
+    std::vector<const ir::Value*> m_spilled;
+    std::vector<int> m_used_callee_saved;
+    std::unordered_map<const ir::Value*, std::pair<int, int>> m_lifetimes;
+
+    // Positions of the instructions and of the start and end of each block.
+    std::unordered_map<const ir::Instruction*, int> m_positions;
+    std::unordered_map<const ir::BasicBlock*, std::pair<int, int>> m_extents;
+    int m_last_position = 0;
+
+    void find_promotable();
+    void find_folded_loads();
+    void build_intervals();
+    void allocate();
+    void build_lifetimes();
+};
@@ -0,0 +1,204 @@
+#include "tail_call_optimizer.h"
+#include "ast_utils.h"
+#include <iostream>
+
+namespace {
+
+bool calls(const Expr* expr, const std::string& name) {
+    if (!expr) return false;
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        if (call->callee == name) return true;
+        for (const auto& arg : call->args) {
+            if (calls(arg.get(), name)) return true;
+        }
+        return false;
+    }
+    if (const auto* arr = dynamic_cast<const ArrayAccessExpr*>(expr)) return calls(arr->index.get(), name);
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) return calls(unary->operand.get(), name);
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        return calls(bin->lhs.get(), name) || calls(bin->rhs.get(), name);
+    }
+    return false;
+}
+
+CallExpr* as_call_to(Expr* expr, const std::string& name) {
+    auto* call = dynamic_cast<CallExpr*>(expr);
+    return call && call->callee == name ? call : nullptr;
+}
+
+// Points every remaining call of `from` at `to`, passing the identity as the
+// starting accumulator.
+void redirect_calls(Expr* expr, const std::string& from, const std::string& to, int identity) {
+    if (!expr) return;
+    if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->args) redirect_calls(arg.get(), from, to, identity);
+        if (call->callee == from) {
+            call->callee = to;
+            call->args.push_back(std::make_unique<IntLitExpr>(identity, call->line, call->col));
+        }
+    } else if (auto* arr = dynamic_cast<ArrayAccessExpr*>(expr)) {
+        redirect_calls(arr->index.get(), from, to, identity);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        redirect_calls(unary->operand.get(), from, to, identity);
+    } else if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+        redirect_calls(bin->lhs.get(), from, to, identity);
+        redirect_calls(bin->rhs.get(), from, to, identity);
+    }
+}
+
+// True if `expr` reads memory a call could change: a dereference, an array
+// element, or a variable whose address is taken.
+bool reads_memory(const Expr* expr, const std::unordered_set<std::string>& address_taken) {
+    if (const auto* ident = dynamic_cast<const IdentifierExpr*>(expr)) return address_taken.count(ident->name) > 0;
+    if (dynamic_cast<const ArrayAccessExpr*>(expr)) return true;
+    if (const auto* call = dynamic_cast<const CallExpr*>(expr)) {
+        for (const auto& arg : call->args) {
+            if (reads_memory(arg.get(), address_taken)) return true;
+        }
+        return false;
+    }
+    if (const auto* unary = dynamic_cast<const UnaryExpr*>(expr)) {
+        return unary->op == TokenType::star || reads_memory(unary->operand.get(), address_taken);
+    }
+    if (const auto* bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        return reads_memory(bin->lhs.get(), address_taken) || reads_memory(bin->rhs.get(), address_taken);
+    }
+    return false;
+}
+
+const char* const acc_name = "__acc";
+
+} // namespace
+
+TailCallOptimizer::TailCallOptimizer(Program* program, AnalysisManager& analyses) : m_prog(program), m_analyses(analyses) {
+}
+
+void TailCallOptimizer::remark(const std::string& message) const {
+    std::cout << "Remark [tail-call]: " << message << std::endl;
+}
+
+void TailCallOptimizer::run() {
+    m_side_effect_free = m_analyses.side_effect_free();
+    for (const auto& func : m_prog->functions) {
+        m_functions[func->name] = func.get();
+    }
+
+    auto& functions = m_prog->functions;
+    for (size_t i = 0; i < functions.size(); ++i) {
+        if (auto helper = introduce_accumulator(functions[i].get())) {
+            m_functions[helper->name] = helper.get();
+            functions.insert(functions.begin() + i + 1, std::move(helper));
+            ++i;
+        }
+    }
+
+    for (const auto& func : functions) {
+        mark_tail_calls(func.get());
+    }
+}
+
+std::unique_ptr<Function> TailCallOptimizer::introduce_accumulator(Function* func) {
+    const std::string& name = func->name;
+    std::string helper_name = "__acc_" + name;
+    // The helper needs one more argument register than `func`.
+    if (func->return_type != Type::Int() || func->args.size() >= 8 || m_functions.count(helper_name)) return nullptr;
+
+    // Every return must be a base case (no recursion), a plain tail call, or
+    // `f(...) op k` with the same associative, commutative op throughout.
+    std::optional<TokenType> op;
+    bool ok = true;
+    std::unordered_set<std::string> address_taken = address_taken_vars(func->body->stmts);
+    for_each_stmt(func->body.get(), [&](Stmt* stmt) {
+        auto* ret = dynamic_cast<ReturnStmt*>(stmt);
+        if (!ret || !ok || !calls(ret->expr.get(), name) || as_call_to(ret->expr.get(), name)) return;
+        auto* bin = dynamic_cast<BinaryExpr*>(ret->expr.get());
+        if (!bin || (bin->op != TokenType::plus && bin->op != TokenType::star) || (op && *op != bin->op)) {
+            ok = false;
+            return;
+        }
+        bool rec_on_left = as_call_to(bin->lhs.get(), name) != nullptr;
+        const Expr* rest = rec_on_left ? bin->rhs.get() : bin->lhs.get();
+        if (!rec_on_left && !as_call_to(bin->rhs.get(), name)) {
+            ok = false;
+            return;
+        }
+        // `k` now runs before the recursive call instead of after it, so it
+        // must neither have effects nor read memory the call may store to.
+        if ((!is_pure(rest) || reads_memory(rest, address_taken)) && !m_side_effect_free.count(name)) {
+            ok = false;
+            return;
+        }
+        op = bin->op;
+    });
+    if (!ok || !op) return nullptr;
+
+    int identity = *op == TokenType::plus ? 0 : 1;
+    int line = func->line;
+    int col = func->col;
+    auto acc = [line, col]() { return std::make_unique<IdentifierExpr>(acc_name, line, col); };
+
+    std::unique_ptr<ScopeStmt> body(static_cast<ScopeStmt*>(clone_stmt(func->body.get()).release()));
+    for_each_stmt(body.get(), [&](Stmt* stmt) {
+        auto* ret = dynamic_cast<ReturnStmt*>(stmt);
+        if (!ret) return;
+        if (auto* call = as_call_to(ret->expr.get(), name)) {
+            call->callee = helper_name;
+            call->args.push_back(acc());
+        } else if (!calls(ret->expr.get(), name)) {
+            ret->expr = std::make_unique<BinaryExpr>(acc(), std::move(ret->expr), *op, ret->line, ret->col);
+        } else {
+            auto* bin = static_cast<BinaryExpr*>(ret->expr.get());
+            bool rec_on_left = as_call_to(bin->lhs.get(), name) != nullptr;
+            std::unique_ptr<Expr> rec = std::move(rec_on_left ? bin->lhs : bin->rhs);
+            std::unique_ptr<Expr> rest = std::move(rec_on_left ? bin->rhs : bin->lhs);
+            auto* call = static_cast<CallExpr*>(rec.get());
+            call->callee = helper_name;
+            call->args.push_back(std::make_unique<BinaryExpr>(acc(), std::move(rest), *op, bin->line, bin->col));
+            ret->expr = std::move(rec);
+        }
+    });
+    for_each_expr(body.get(), [&](std::unique_ptr<Expr>& expr) {
+        redirect_calls(expr.get(), name, helper_name, identity);
+    });
+    // Falling off the end returns 0 from `func`.
+    body->stmts.push_back(std::make_unique<ReturnStmt>(
+        std::make_unique<BinaryExpr>(acc(), std::make_unique<IntLitExpr>(0, line, col), *op, line, col), line, col));
+
+    std::vector<Arg> args = func->args;
+    args.push_back({ acc_name, Type::Int() });
+    auto helper = std::make_unique<Function>(helper_name, std::move(args), std::move(body), Type::Int(), line, col);
+
+    std::vector<std::unique_ptr<Expr>> call_args;
+    for (const auto& arg : func->args) {
+        call_args.push_back(std::make_unique<IdentifierExpr>(arg.name, line, col));
+    }
+    call_args.push_back(std::make_unique<IntLitExpr>(identity, line, col));
+    std::vector<std::unique_ptr<Stmt>> wrapper;
+    wrapper.push_back(std::make_unique<ReturnStmt>(
+        std::make_unique<CallExpr>(helper_name, std::move(call_args), line, col), line, col));
+    func->body = std::make_unique<ScopeStmt>(std::move(wrapper), line, col);
+
+    remark("introduced accumulator for '" + name + "' in '" + helper_name + "'");
+    return helper;
+}
+
+void TailCallOptimizer::mark_tail_calls(Function* func) {
+    bool escapes = takes_address(func);
+    for_each_stmt(func->body.get(), [&](Stmt* stmt) {
+        auto* ret = dynamic_cast<ReturnStmt*>(stmt);
+        auto* call = ret ? dynamic_cast<CallExpr*>(ret->expr.get()) : nullptr;
+        if (!call || !m_functions.count(call->callee)) return;
+
+        std::string site = "'" + func->name + "' -> '" + call->callee + "'";
+        if (escapes) {
+            remark("kept call " + site + ": '" + func->name + "' takes the address of a local");
+            return;
+        }
+        ret->tail_call = true;
+        if (call->callee == func->name) {
+            remark("self tail call in '" + func->name + "' becomes a loop");
+        } else {
+            remark("sibling call " + site);
+        }
+    });
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "analysis_manager.h"
+#include "parser.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Removes stack growth from recursive functions.
+//
+// Linear recursion of the form `return f(...) + k` (or `*`) is rewritten into
+// a helper `__acc_f` that carries the pending operation in an extra
+// accumulator argument, so that its recursive call becomes a tail call; `f`
+// itself just calls the helper with the identity value.
+//
+// Every `return g(...)` is then marked as a tail call, unless the function
+// takes the address of a local (a pointer into its frame could reach the
+// callee). The backends lower a marked self call as a jump back to the
+// function entry, and a marked call to another function as a sibling call.
+class TailCallOptimizer {
+public:
+    TailCallOptimizer(Program* program, AnalysisManager& analyses);
+    void run();
+
+private:
+    Program* m_prog;
+    AnalysisManager& m_analyses;
+    std::unordered_map<std::string, Function*> m_functions;
+    std::unordered_set<std::string> m_side_effect_free;
+
+    std::unique_ptr<Function> introduce_accumulator(Function* func);
+    void mark_tail_calls(Function* func);
+
+    void remark(const std::string& message) const;
+};
@@ -0,0 +1,5 @@
+#pragma once
+
+// Machine the native backend generates code for: ARM64 with Apple
+// conventions, or x86-64 Linux (System V).
+enum class Target { AArch64, X86_64 };
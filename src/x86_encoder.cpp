@@ -0,0 +1,434 @@
+#include "x86_encoder.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+[[noreturn]] void cannot_encode(const std::string& what) {
+    std::cerr << "Error: Cannot encode x86-64 instruction: " << what << std::endl;
+    exit(1);
+}
+
+// An operand in AT&T syntax: "%reg", "$imm", or a memory reference
+// "disp(%base)", "(%base, %index, scale)" or "sym(%rip)".
+struct Operand {
+    enum class Kind { Register, Immediate, Memory } kind = Kind::Register;
+    int reg = 0;
+    int size = 64;            // Register width in bits
+    long long imm = 0;
+    int base = -1;
+    int index = -1;
+    int scale = 1;
+    long long disp = 0;
+    std::string symbol;       // RIP-relative reference
+};
+
+int parse_register(const std::string& text, int& size) {
+    static const std::unordered_map<std::string, std::pair<int, int>> registers = [] {
+        std::unordered_map<std::string, std::pair<int, int>> table;
+        const char* const names64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" };
+        const char* const names32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+        const char* const names8[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" };
+        for (int i = 0; i < 8; ++i) {
+            table[names64[i]] = { i, 64 };
+            table[names32[i]] = { i, 32 };
+            table[names8[i]] = { i, 8 };
+        }
+        for (int i = 8; i < 16; ++i) {
+            std::string name = "r" + std::to_string(i);
+            table[name] = { i, 64 };
+            table[name + "d"] = { i, 32 };
+            table[name + "b"] = { i, 8 };
+        }
+        return table;
+    }();
+    auto it = text.size() > 1 && text[0] == '%' ? registers.find(text.substr(1)) : registers.end();
+    if (it == registers.end()) cannot_encode("register " + text);
+    size = it->second.second;
+    return it->second.first;
+}
+
+Operand parse_operand(const std::string& text) {
+    Operand operand;
+    if (text.empty()) cannot_encode("empty operand");
+    if (text[0] == '%') {
+        operand.reg = parse_register(text, operand.size);
+        return operand;
+    }
+    if (text[0] == '$') {
+        operand.kind = Operand::Kind::Immediate;
+        operand.imm = std::stoll(text.substr(1));
+        return operand;
+    }
+    operand.kind = Operand::Kind::Memory;
+    size_t open = text.find('(');
+    if (open == std::string::npos || text.back() != ')') cannot_encode("operand " + text);
+    std::string disp = text.substr(0, open);
+    std::vector<std::string> parts;
+    std::string inner = text.substr(open + 1, text.size() - open - 2);
+    for (size_t start = 0;;) {
+        size_t comma = inner.find(", ", start);
+        parts.push_back(inner.substr(start, comma - start));
+        if (comma == std::string::npos) break;
+        start = comma + 2;
+    }
+    if (parts[0] == "%rip") {
+        if (parts.size() != 1 || disp.empty()) cannot_encode("operand " + text);
+        operand.symbol = disp;
+        return operand;
+    }
+    if (!disp.empty()) operand.disp = std::stoll(disp);
+    int size = 0;
+    operand.base = parse_register(parts[0], size);
+    if (parts.size() == 3) {
+        operand.index = parse_register(parts[1], size);
+        operand.scale = std::stoi(parts[2]);
+        if (operand.index == 4 || (operand.scale != 1 && operand.scale != 2 && operand.scale != 4 && operand.scale != 8)) cannot_encode("operand " + text);
+    } else if (parts.size() != 1) {
+        cannot_encode("operand " + text);
+    }
+    return operand;
+}
+
+bool fits8(long long value) {
+    return value >= -128 && value <= 127;
+}
+
+bool fits32(long long value) {
+    return value >= -2147483648LL && value <= 2147483647LL;
+}
+
+void put(std::vector<uint8_t>& out, long long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+}
+
+// Condition code of a jcc / setcc / cmovcc suffix.
+int condition_code(const std::string& cond) {
+    static const std::unordered_map<std::string, int> codes = {
+        { "o", 0 }, { "no", 1 }, { "b", 2 }, { "ae", 3 }, { "e", 4 }, { "ne", 5 }, { "be", 6 }, { "a", 7 },
+        { "s", 8 }, { "ns", 9 }, { "p", 10 }, { "np", 11 }, { "l", 12 }, { "ge", 13 }, { "le", 14 }, { "g", 15 },
+    };
+    auto it = codes.find(cond);
+    if (it == codes.end()) cannot_encode("condition " + cond);
+    return it->second;
+}
+
+bool is_jump(const std::string& op) {
+    return op == "jmp" || (op.size() > 1 && op[0] == 'j' && op != "jmp");
+}
+
+} // namespace
+
+X86Encoder::X86Encoder(ElfObject& object)
+    : m_object(object), m_text(object.contents(ElfObject::Section::Text)) {
+}
+
+X86Encoder::Encoded X86Encoder::encode(const AsmInstr& instr) const {
+    const std::string& op = instr.op;
+    if (op == "call" || op == "jmp") {
+        // Calls and jumps to functions, through the PLT for external ones.
+        if (instr.operands.size() != 1) cannot_encode(instr.print());
+        std::string symbol = instr.operands[0];
+        size_t plt = symbol.find("@PLT");
+        if (plt != std::string::npos) symbol = symbol.substr(0, plt);
+        Encoded result;
+        result.bytes.push_back(op == "call" ? 0xE8 : 0xE9);
+        result.symbol = symbol;
+        result.type = ElfObject::R_X86_64_PLT32;
+        result.field = 1;
+        result.addend = -4;
+        put(result.bytes, 0, 4);
+        return result;
+    }
+
+    std::vector<Operand> ops;
+    for (const std::string& text : instr.operands) ops.push_back(parse_operand(text));
+    auto expect = [&](size_t count) {
+        if (ops.size() != count) cannot_encode(instr.print());
+    };
+    auto is_reg = [&](size_t i, int size) { return ops[i].kind == Operand::Kind::Register && ops[i].size == size; };
+    auto is_mem = [&](size_t i) { return ops[i].kind == Operand::Kind::Memory; };
+    auto is_imm = [&](size_t i) { return ops[i].kind == Operand::Kind::Immediate; };
+
+    Encoded result;
+    std::vector<uint8_t>& out = result.bytes;
+    // [REX] opcode ModRM [SIB] [disp] [imm]: `reg` is the ModRM reg field (a
+    // register or an opcode extension), `rm` the register or memory operand.
+    // `imm_size` bytes of immediate follow, which a RIP-relative
+    // displacement has to account for.
+    auto modrm = [&](std::vector<uint8_t> opcode, bool wide, int reg, bool reg_is_byte, const Operand& rm, int imm_size = 0) {
+        int rex = wide ? 0x48 : 0;
+        if (reg & 8) rex |= 0x44;
+        // spl, bpl, sil and dil exist only with a REX prefix.
+        bool byte_rex = (reg_is_byte && reg >= 4) || (rm.kind == Operand::Kind::Register && rm.size == 8 && rm.reg >= 4);
+        if (rm.kind == Operand::Kind::Register) {
+            if (rm.reg & 8) rex |= 0x41;
+        } else if (rm.symbol.empty()) {
+            if (rm.base & 8) rex |= 0x41;
+            if (rm.index >= 0 && (rm.index & 8)) rex |= 0x42;
+        }
+        if (rex || byte_rex) out.push_back(static_cast<uint8_t>(rex | 0x40));
+        out.insert(out.end(), opcode.begin(), opcode.end());
+        int r = (reg & 7) << 3;
+        if (rm.kind == Operand::Kind::Register) {
+            out.push_back(static_cast<uint8_t>(0xC0 | r | (rm.reg & 7)));
+            return;
+        }
+        if (!rm.symbol.empty()) {
+            out.push_back(static_cast<uint8_t>(0x05 | r));
+            result.symbol = rm.symbol;
+            result.type = ElfObject::R_X86_64_PC32;
+            result.field = out.size();
+            result.addend = -4 - imm_size;
+            put(out, 0, 4);
+            return;
+        }
+        int base = rm.base & 7;
+        // rbp and r13 as a base always take a displacement.
+        int mod = rm.disp == 0 && base != 5 ? 0 : fits8(rm.disp) ? 1 : 2;
+        if (!fits32(rm.disp)) cannot_encode(instr.print());
+        if (rm.index >= 0 || base == 4) {
+            static const int scale_bits[] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+            int index = rm.index >= 0 ? rm.index & 7 : 4;
+            out.push_back(static_cast<uint8_t>(mod << 6 | r | 4));
+            out.push_back(static_cast<uint8_t>(scale_bits[rm.scale] << 6 | index << 3 | base));
+        } else {
+            out.push_back(static_cast<uint8_t>(mod << 6 | r | base));
+        }
+        if (mod == 1) put(out, rm.disp, 1);
+        if (mod == 2) put(out, rm.disp, 4);
+    };
+
+    if (op == "movq" || op == "movl") {
+        expect(2);
+        bool wide = op == "movq";
+        int size = wide ? 64 : 32;
+        if (is_imm(0) && is_reg(1, size)) {
+            if (!fits32(ops[0].imm)) cannot_encode(instr.print());
+            if (!wide) {
+                if (ops[1].reg & 8) out.push_back(0x41);
+                out.push_back(static_cast<uint8_t>(0xB8 + (ops[1].reg & 7)));
+            } else {
+                modrm({ 0xC7 }, true, 0, false, ops[1], 4);
+            }
+            put(out, ops[0].imm, 4);
+        } else if (is_reg(0, size) && (is_reg(1, size) || is_mem(1))) {
+            modrm({ 0x89 }, wide, ops[0].reg, false, ops[1]);
+        } else if (is_mem(0) && is_reg(1, size)) {
+            modrm({ 0x8B }, wide, ops[1].reg, false, ops[0]);
+        } else {
+            cannot_encode(instr.print());
+        }
+        return result;
+    }
+    if (op == "movabsq") {
+        expect(2);
+        if (!is_imm(0) || !is_reg(1, 64)) cannot_encode(instr.print());
+        out.push_back(static_cast<uint8_t>(0x48 | (ops[1].reg & 8 ? 1 : 0)));
+        out.push_back(static_cast<uint8_t>(0xB8 + (ops[1].reg & 7)));
+        put(out, ops[0].imm, 8);
+        return result;
+    }
+    if (op == "movb") {
+        expect(2);
+        if (!is_reg(0, 8) || !is_mem(1)) cannot_encode(instr.print());
+        modrm({ 0x88 }, false, ops[0].reg, true, ops[1]);
+        return result;
+    }
+    if (op == "movslq" || op == "movzbq" || op == "leaq") {
+        expect(2);
+        bool source_ok = op == "movslq" ? is_reg(0, 32) || is_mem(0) : op == "movzbq" ? is_reg(0, 8) || is_mem(0) : is_mem(0);
+        if (!source_ok || !is_reg(1, 64)) cannot_encode(instr.print());
+        std::vector<uint8_t> opcode = op == "movslq" ? std::vector<uint8_t> { 0x63 } : op == "movzbq" ? std::vector<uint8_t> { 0x0F, 0xB6 } : std::vector<uint8_t> { 0x8D };
+        modrm(opcode, true, ops[1].reg, false, ops[0]);
+        return result;
+    }
+    if (op == "addq" || op == "subq" || op == "cmpq" || op == "addl" || op == "subl" || op == "xorl") {
+        expect(2);
+        bool wide = op.back() == 'q';
+        int size = wide ? 64 : 32;
+        std::string base = op.substr(0, 3);
+        int digit = base == "add" ? 0 : base == "sub" ? 5 : base == "cmp" ? 7 : 6;
+        if (is_imm(0) && is_reg(1, size)) {
+            long long imm = ops[0].imm;
+            if (!fits32(imm)) cannot_encode(instr.print());
+            if (fits8(imm)) {
+                modrm({ 0x83 }, wide, digit, false, ops[1], 1);
+                put(out, imm, 1);
+            } else if (ops[1].reg == 0) {
+                // The short form for the accumulator.
+                if (wide) out.push_back(0x48);
+                out.push_back(static_cast<uint8_t>(digit * 8 + 5));
+                put(out, imm, 4);
+            } else {
+                modrm({ 0x81 }, wide, digit, false, ops[1], 4);
+                put(out, imm, 4);
+            }
+        } else if (is_reg(0, size) && is_reg(1, size)) {
+            modrm({ static_cast<uint8_t>(digit * 8 + 1) }, wide, ops[0].reg, false, ops[1]);
+        } else {
+            cannot_encode(instr.print());
+        }
+        return result;
+    }
+    if (op == "testq") {
+        expect(2);
+        if (!is_reg(0, 64) || !is_reg(1, 64)) cannot_encode(instr.print());
+        modrm({ 0x85 }, true, ops[0].reg, false, ops[1]);
+        return result;
+    }
+    if (op == "imulq" || op == "imull") {
+        bool wide = op == "imulq";
+        int size = wide ? 64 : 32;
+        if (ops.size() == 2 && is_reg(0, size) && is_reg(1, size)) {
+            modrm({ 0x0F, 0xAF }, wide, ops[1].reg, false, ops[0]);
+        } else if (ops.size() == 3 && is_imm(0) && is_reg(1, size) && is_reg(2, size) && fits32(ops[0].imm)) {
+            bool short_imm = fits8(ops[0].imm);
+            modrm({ static_cast<uint8_t>(short_imm ? 0x6B : 0x69) }, wide, ops[2].reg, false, ops[1], short_imm ? 1 : 4);
+            put(out, ops[0].imm, short_imm ? 1 : 4);
+        } else {
+            cannot_encode(instr.print());
+        }
+        return result;
+    }
+    if (op == "shlq" || op == "sarq" || op == "shll" || op == "shrl") {
+        expect(2);
+        bool wide = op.back() == 'q';
+        int digit = op.rfind("shl", 0) == 0 ? 4 : op == "shrl" ? 5 : 7;
+        if (!is_reg(1, wide ? 64 : 32)) cannot_encode(instr.print());
+        if (is_reg(0, 8) && ops[0].reg == 1) {
+            modrm({ 0xD3 }, wide, digit, false, ops[1]);
+        } else if (is_imm(0) && ops[0].imm == 1) {
+            modrm({ 0xD1 }, wide, digit, false, ops[1]);
+        } else if (is_imm(0) && ops[0].imm >= 0 && ops[0].imm < 64) {
+            modrm({ 0xC1 }, wide, digit, false, ops[1], 1);
+            put(out, ops[0].imm, 1);
+        } else {
+            cannot_encode(instr.print());
+        }
+        return result;
+    }
+    if (op == "negq" || op == "idivq" || op == "negl" || op == "idivl") {
+        expect(1);
+        bool wide = op.back() == 'q';
+        if (!is_reg(0, wide ? 64 : 32)) cannot_encode(instr.print());
+        modrm({ 0xF7 }, wide, op.rfind("neg", 0) == 0 ? 3 : 7, false, ops[0]);
+        return result;
+    }
+    if (op == "cqto" || op == "cltd") {
+        expect(0);
+        if (op == "cltd") return { { 0x99 }, "" };
+        return { { 0x48, 0x99 }, "" };
+    }
+    if (op == "ret") {
+        expect(0);
+        return { { 0xC3 }, "" };
+    }
+    if (op == "pushq" || op == "popq") {
+        expect(1);
+        if (!is_reg(0, 64)) cannot_encode(instr.print());
+        if (ops[0].reg & 8) out.push_back(0x41);
+        out.push_back(static_cast<uint8_t>((op == "pushq" ? 0x50 : 0x58) + (ops[0].reg & 7)));
+        return result;
+    }
+    if (op.rfind("set", 0) == 0) {
+        expect(1);
+        if (!is_reg(0, 8)) cannot_encode(instr.print());
+        modrm({ 0x0F, static_cast<uint8_t>(0x90 + condition_code(op.substr(3))) }, false, 0, false, ops[0]);
+        return result;
+    }
+    if (op.rfind("cmov", 0) == 0 && op.back() == 'q') {
+        expect(2);
+        if (!is_reg(0, 64) || !is_reg(1, 64)) cannot_encode(instr.print());
+        int cc = condition_code(op.substr(4, op.size() - 5));
+        modrm({ 0x0F, static_cast<uint8_t>(0x40 + cc) }, true, ops[1].reg, false, ops[0]);
+        return result;
+    }
+    cannot_encode(instr.print());
+}
+
+void X86Encoder::add_function(const std::vector<AsmInstr>& code) {
+    if (code.empty() || !code[0].op.empty()) cannot_encode("function without a label");
+
+    // Everything but jumps to local labels has a fixed encoding.
+    struct Item {
+        const AsmInstr* instr;
+        Encoded encoded;
+        bool jump = false;
+        bool near = false;      // rel32 rather than rel8
+        uint64_t offset = 0;
+    };
+    std::unordered_map<std::string, size_t> label_items;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (code[i].op.empty()) label_items[code[i].label] = i;
+    }
+    std::vector<Item> items;
+    for (const AsmInstr& instr : code) {
+        Item item { &instr, {} };
+        if (!instr.op.empty()) {
+            item.jump = is_jump(instr.op) && instr.operands.size() == 1 && label_items.count(instr.operands[0]);
+            if (!item.jump) item.encoded = encode(instr);
+        }
+        items.push_back(std::move(item));
+    }
+
+    uint64_t start = m_text.size();
+    auto size = [](const Item& item) -> uint64_t {
+        if (!item.jump) return item.encoded.bytes.size();
+        if (!item.near) return 2;
+        return item.instr->op == "jmp" ? 5 : 6;
+    };
+    auto displacement = [&](const Item& item) {
+        int64_t target = static_cast<int64_t>(items[label_items.at(item.instr->operands[0])].offset);
+        return target - static_cast<int64_t>(item.offset + size(item));
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        uint64_t offset = start;
+        for (Item& item : items) {
+            item.offset = offset;
+            if (!item.instr->op.empty()) offset += size(item);
+        }
+        for (Item& item : items) {
+            if (item.jump && !item.near && !fits8(displacement(item))) {
+                item.near = true;
+                changed = true;
+            }
+        }
+    }
+
+    m_listing << code[0].label << ":\n";
+    for (size_t i = 1; i < items.size(); ++i) {
+        Item& item = items[i];
+        if (item.instr->op.empty()) {
+            m_listing << item.instr->label << ":\n";
+            continue;
+        }
+        if (item.jump) {
+            std::vector<uint8_t>& out = item.encoded.bytes;
+            const std::string& op = item.instr->op;
+            int64_t disp = displacement(item);
+            if (op == "jmp") {
+                out.push_back(item.near ? 0xE9 : 0xEB);
+            } else if (item.near) {
+                out.push_back(0x0F);
+                out.push_back(static_cast<uint8_t>(0x80 + condition_code(op.substr(1))));
+            } else {
+                out.push_back(static_cast<uint8_t>(0x70 + condition_code(op.substr(1))));
+            }
+            put(out, disp, item.near ? 4 : 1);
+        }
+        const Encoded& encoded = item.encoded;
+        if (!encoded.symbol.empty()) m_object.add_relocation(item.offset + encoded.field, encoded.symbol, encoded.type, encoded.addend);
+        m_text.insert(m_text.end(), encoded.bytes.begin(), encoded.bytes.end());
+
+        std::stringstream bytes;
+        for (uint8_t byte : encoded.bytes) bytes << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(byte) << " ";
+        m_listing << std::setw(8) << std::setfill('0') << std::hex << item.offset << std::dec << std::setfill(' ') << ":  "
+                  << std::left << std::setw(33) << bytes.str() << std::right << item.instr->print().substr(4) << "\n";
+    }
+    m_object.define_symbol(code[0].label, ElfObject::Section::Text, start, m_text.size() - start, true, true);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "elf_object.h"
+#include "peephole.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+// x86-64 machine code for the instructions the X86Generator emits.
+//
+// Works like the AArch64Encoder: each function's AsmInstr list is appended
+// to the .text of an ElfObject, and its label becomes a global function
+// symbol. Jumps to local labels are resolved here, as short (8-bit
+// displacement) jumps where the target is in reach and near ones elsewhere:
+// all jumps start short and those that do not reach grow until the layout is
+// stable, as an assembler relaxes them. Calls and jumps to functions and
+// RIP-relative references to data ("fmt(%rip)") are left to the linker as
+// relocations.
+//
+// Only the forms the X86Generator produces are supported; any other
+// instruction is an internal error.
+class X86Encoder {
+public:
+    explicit X86Encoder(ElfObject& object);
+    void add_function(const std::vector<AsmInstr>& code);
+    std::string listing() const { return m_listing.str(); }
+
+private:
+    // An instruction's bytes, with at most one relocated field.
+    struct Encoded {
+        std::vector<uint8_t> bytes;
+        std::string symbol;       // Relocated symbol, empty for none
+        uint32_t type = 0;
+        size_t field = 0;         // Offset of the relocated field in `bytes`
+        int64_t addend = 0;
+    };
+
+    ElfObject& m_object;
+    std::vector<uint8_t>& m_text;
+    std::stringstream m_listing;
+
+    Encoded encode(const AsmInstr& instr) const;
+};
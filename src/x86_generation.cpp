@@ -0,0 +1,698 @@
+#include "x86_generation.h"
+#include "x86_encoder.h"
+#include <algorithm>
+#include <climits>
+
+using ir::Opcode;
+
+namespace {
+
+// Hardware register numbers.
+enum : int { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+const int argument_regs[] = { RDI, RSI, RDX, RCX, R8, R9 };
+constexpr size_t register_args = 6;
+
+std::string reg64(int reg) {
+    static const char* const names[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+    return std::string("%") + names[reg];
+}
+
+std::string reg32(int reg) {
+    static const char* const names[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+    return std::string("%") + names[reg];
+}
+
+std::string reg8(int reg) {
+    static const char* const names[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+    return std::string("%") + names[reg];
+}
+
+std::string immediate(long long value) {
+    return "$" + std::to_string(value);
+}
+
+bool is_memory_alloca(const ir::Value* value) {
+    return value->kind == ir::Value::Kind::Instruction && static_cast<const ir::Instruction*>(value)->op == Opcode::Alloca;
+}
+
+bool is_constant(const ir::Value* value) {
+    return value->kind == ir::Value::Kind::Constant;
+}
+
+long long constant_value(const ir::Value* value) {
+    return static_cast<const ir::Constant*>(value)->value;
+}
+
+// True for a literal an instruction can take as a sign-extended 32-bit
+// immediate.
+bool is_imm32(const ir::Value* value) {
+    return is_constant(value) && constant_value(value) >= INT_MIN && constant_value(value) <= INT_MAX;
+}
+
+// Condition code suffix under which a comparison holds.
+const char* condition(Opcode op) {
+    switch (op) {
+        case Opcode::CmpEq: return "e";
+        case Opcode::CmpNe: return "ne";
+        case Opcode::CmpLt: return "l";
+        default: return "g";
+    }
+}
+
+// Condition code suffix under which a comparison fails.
+const char* inverse_condition(Opcode op) {
+    switch (op) {
+        case Opcode::CmpEq: return "ne";
+        case Opcode::CmpNe: return "e";
+        case Opcode::CmpLt: return "ge";
+        default: return "le";
+    }
+}
+
+Type element_type(Type pointer) {
+    return { pointer.base, pointer.ptr_level - 1 };
+}
+
+// Bytes a value of `type` takes in memory, as in the ARM64 backend.
+size_t type_size(Type type) {
+    if (type.ptr_level > 0) return 8;
+    return type.base == Type::Base::Bool ? 1 : 4;
+}
+
+} // namespace
+
+X86Generator::X86Generator(const ir::Module* module) : m_module(module) {
+}
+
+void X86Generator::emit(const std::string& op, std::vector<std::string> operands) {
+    m_code.push_back({ op, std::move(operands), "" });
+}
+
+void X86Generator::emit_label(const std::string& label) {
+    m_code.push_back({ "", {}, label });
+}
+
+std::string X86Generator::create_label() {
+    return ".L" + std::to_string(m_label_count++);
+}
+
+std::string X86Generator::frame_slot(size_t stack_offset) {
+    return "-" + std::to_string(stack_offset) + "(%rbp)";
+}
+
+std::string X86Generator::stack_argument(size_t index) {
+    // Arguments beyond the sixth are in 8-byte slots above the return
+    // address, and above the saved %rbp once the frame is set up.
+    size_t offset = (index - register_args) * 8;
+    if (m_frameless) return std::to_string(offset + 8) + "(%rsp)";
+    return std::to_string(offset + 16) + "(%rbp)";
+}
+
+void X86Generator::move_immediate(int reg, long long value) {
+    // mov leaves the flags alone, so literals can be read between a
+    // comparison and the jump or cmov testing it.
+    if (value >= INT_MIN && value <= INT_MAX) emit("movq", { immediate(value), reg64(reg) });
+    else emit("movabsq", { immediate(value), reg64(reg) });
+}
+
+std::string X86Generator::generate() {
+    m_output << ".text\n";
+    m_output << ".globl main\n\n";
+    for (const auto& func : m_module->functions) {
+        emit_function(*func);
+    }
+    m_output << ".section .rodata\n";
+    m_output << "fmt: .string \"%d\\n\"\n";
+    m_output << ".section .note.GNU-stack,\"\",@progbits\n";
+    return m_output.str();
+}
+
+ElfObject X86Generator::generate_object(std::string& listing) const {
+    ElfObject object(Target::X86_64);
+    std::vector<uint8_t>& rodata = object.contents(ElfObject::Section::Rodata);
+    rodata = { '%', 'd', '\n', 0 };
+    object.define_symbol("fmt", ElfObject::Section::Rodata, 0, rodata.size(), false, false);
+    X86Encoder encoder(object);
+    for (const auto& code : m_functions) encoder.add_function(code);
+    listing = encoder.listing();
+    return object;
+}
+
+void X86Generator::layout_frame(const ir::Function& func) {
+    m_selector = std::make_unique<InstructionSelector>(func, Target::X86_64);
+    m_alloc = std::make_unique<RegisterAllocator>(func, *m_selector, Target::X86_64);
+    m_alloc->run();
+    m_slots.clear();
+    m_skipped.clear();
+
+    // Frame objects at their natural size and alignment, packed by lifetime
+    // as in the ARM64 Generator.
+    struct FrameObject {
+        const ir::Value* value;
+        size_t size;
+        size_t align;
+        std::pair<int, int> lifetime;
+        size_t offset = 0;
+    };
+    std::vector<FrameObject> objects;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::Alloca || m_alloc->promoted(instr.get())) continue;
+            auto lifetime = m_alloc->lifetime(instr.get());
+            if (lifetime.first > lifetime.second) continue;
+            size_t size = type_size(element_type(instr->type));
+            objects.push_back({ instr.get(), size * static_cast<size_t>(instr->count), size, lifetime });
+        }
+    }
+    for (const ir::Value* value : m_alloc->spilled()) objects.push_back({ value, 8, 8, m_alloc->lifetime(value) });
+
+    std::stable_sort(objects.begin(), objects.end(), [](const FrameObject& a, const FrameObject& b) { return a.size > b.size; });
+    std::vector<const FrameObject*> placed;
+    size_t area = 0;
+    for (FrameObject& object : objects) {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (const FrameObject* other : placed) {
+                bool coexist = object.lifetime.first <= other->lifetime.second && other->lifetime.first <= object.lifetime.second;
+                bool overlap = object.offset < other->offset + other->size && other->offset < object.offset + object.size;
+                if (coexist && overlap) {
+                    object.offset = (other->offset + other->size + object.align - 1) / object.align * object.align;
+                    moved = true;
+                }
+            }
+        }
+        placed.push_back(&object);
+        area = std::max(area, object.offset + object.size);
+    }
+
+    // Callee-saved registers right below %rbp, then the objects, then the
+    // outgoing stack arguments at %rsp. %rsp is 16-byte aligned after the
+    // push of %rbp, and stays so at calls.
+    size_t saved = m_alloc->used_callee_saved().size() * 8;
+    area = (area + 7) / 8 * 8;
+    for (const FrameObject& object : objects) {
+        m_slots[object.value] = saved + area - object.offset;
+    }
+    size_t outgoing = 0;
+    bool calls = false;
+    for (const auto& block : func.blocks) {
+        for (const auto& instr : block->instrs) {
+            if (instr->op != Opcode::Call && instr->op != Opcode::Print) continue;
+            calls = true;
+            if (instr->operands.size() > register_args) outgoing = std::max(outgoing, (instr->operands.size() - register_args) * 8);
+        }
+    }
+    m_frame_size = (saved + area + outgoing + 15) / 16 * 16;
+    m_frameless = !calls && m_frame_size == 0;
+}
+
+void X86Generator::emit_function(const ir::Function& func) {
+    m_func = &func;
+    layout_frame(func);
+    m_labels.clear();
+    for (const auto& block : func.blocks) {
+        if (block.get() != func.entry()) m_labels[block.get()] = create_label();
+    }
+
+    m_code.clear();
+    emit_label(func.name);
+    if (!m_frameless) {
+        emit("pushq", { "%rbp" });
+        emit("movq", { "%rsp", "%rbp" });
+    }
+    if (m_frame_size > 0) emit("subq", { immediate(static_cast<long long>(m_frame_size)), "%rsp" });
+    const auto& saved = m_alloc->used_callee_saved();
+    for (size_t i = 0; i < saved.size(); ++i) {
+        emit("movq", { reg64(saved[i]), frame_slot((i + 1) * 8) });
+    }
+    // Register arguments may arrive in each other's allocated registers.
+    std::vector<std::pair<Location, Location>> moves;
+    for (const auto& arg : func.args) {
+        if (arg->index < register_args && m_alloc->live(arg.get())) moves.push_back({ location(arg.get()), { argument_regs[arg->index], 0 } });
+    }
+    emit_parallel_copies(moves, {});
+    for (const auto& arg : func.args) {
+        if (arg->index < register_args || !m_alloc->live(arg.get())) continue;
+        Location loc = location(arg.get());
+        int reg = loc.reg >= 0 ? loc.reg : R10;
+        emit("movq", { stack_argument(arg->index), reg64(reg) });
+        emit_move(loc, { reg, 0 });
+    }
+
+    for (size_t b = 0; b < func.blocks.size(); ++b) {
+        const ir::BasicBlock& block = *func.blocks[b];
+        const ir::BasicBlock* next = b + 1 < func.blocks.size() ? func.blocks[b + 1].get() : nullptr;
+        if (&block != func.entry()) emit_label(m_labels.at(&block));
+        for (const auto& instr : block.instrs) {
+            if (!m_skipped.count(instr.get())) emit_instruction(*instr, next);
+        }
+    }
+    for (const auto& stub : m_stubs) {
+        emit_label(stub.label);
+        emit_branch(*stub.from, *stub.to, nullptr);
+    }
+    m_stubs.clear();
+
+    for (const AsmInstr& line : m_code) m_output << line.print() << "\n";
+    m_output << "\n";
+    m_functions.push_back(std::move(m_code));
+}
+
+void X86Generator::emit_epilogue() {
+    if (m_frameless) return;
+    const auto& saved = m_alloc->used_callee_saved();
+    for (size_t i = 0; i < saved.size(); ++i) {
+        emit("movq", { frame_slot((i + 1) * 8), reg64(saved[i]) });
+    }
+    if (m_frame_size > 0) emit("movq", { "%rbp", "%rsp" });
+    emit("popq", { "%rbp" });
+}
+
+void X86Generator::emit_load(Type type, int reg, const std::string& address) {
+    if (type.ptr_level > 0) emit("movq", { address, reg64(reg) });
+    else if (type.base == Type::Base::Bool) emit("movzbq", { address, reg64(reg) });
+    else emit("movslq", { address, reg64(reg) });
+}
+
+void X86Generator::emit_store(Type type, int reg, const std::string& address) {
+    if (type.ptr_level > 0) emit("movq", { reg64(reg), address });
+    else if (type.base == Type::Base::Bool) emit("movb", { reg8(reg), address });
+    else emit("movl", { reg32(reg), address });
+}
+
+X86Generator::Location X86Generator::location(const ir::Value* vreg) {
+    int reg = m_alloc->reg(vreg);
+    return { reg, reg >= 0 ? 0 : m_slots.at(vreg) };
+}
+
+std::string X86Generator::address(const ir::Value* pointer, int base_scratch, int index_scratch) {
+    if (is_memory_alloca(pointer)) return frame_slot(m_slots.at(pointer));
+    if (!m_selector->covered(pointer)) return "(" + reg64(read(pointer, base_scratch)) + ")";
+
+    // A covered element address becomes the memory operand: a displacement
+    // from %rbp or the base for a constant index, base + index * size
+    // otherwise.
+    const auto* element = static_cast<const ir::Instruction*>(pointer);
+    const ir::Value* base = element->operands[0];
+    const ir::Value* index = element->operands[1];
+    size_t size = type_size(element_type(element->type));
+    if (is_constant(index)) {
+        size_t offset = size * static_cast<size_t>(constant_value(index));
+        if (is_memory_alloca(base) && offset < m_slots.at(base)) return frame_slot(m_slots.at(base) - offset);
+        std::string b = reg64(read(base, base_scratch));
+        return offset == 0 ? "(" + b + ")" : std::to_string(offset) + "(" + b + ")";
+    }
+    std::string b = reg64(read(base, base_scratch));
+    std::string i = reg64(read(index, index_scratch));
+    return "(" + b + ", " + i + ", " + std::to_string(size) + ")";
+}
+
+Opcode X86Generator::emit_compare(const ir::Instruction& cmp) {
+    // A literal moves to the right, where cmp takes an immediate.
+    Opcode op = cmp.op;
+    const ir::Value* left = cmp.operands[0];
+    const ir::Value* right = cmp.operands[1];
+    if (is_constant(left) && !is_constant(right)) {
+        std::swap(left, right);
+        if (op == Opcode::CmpLt) op = Opcode::CmpGt;
+        else if (op == Opcode::CmpGt) op = Opcode::CmpLt;
+    }
+    int lhs = read(left, R10);
+    if (is_imm32(right)) {
+        emit("cmpq", { immediate(constant_value(right)), reg64(lhs) });
+        return op;
+    }
+    int rhs = read(right, R11);
+    emit("cmpq", { reg64(rhs), reg64(lhs) });
+    return op;
+}
+
+int X86Generator::read(const ir::Value* value, int scratch) {
+    if (value->kind == ir::Value::Kind::Constant) {
+        move_immediate(scratch, static_cast<const ir::Constant*>(value)->value);
+        return scratch;
+    }
+    const ir::Value* vreg = m_alloc->vreg(value);
+    if (!vreg) {
+        emit("leaq", { frame_slot(m_slots.at(value)), reg64(scratch) });
+        return scratch;
+    }
+    Location loc = location(vreg);
+    if (loc.reg >= 0) return loc.reg;
+    emit("movq", { frame_slot(loc.slot), reg64(scratch) });
+    return scratch;
+}
+
+void X86Generator::read_into(const ir::Value* value, int reg) {
+    int src = read(value, reg);
+    if (src != reg) emit("movq", { reg64(src), reg64(reg) });
+}
+
+int X86Generator::result_reg(const ir::Instruction& instr) {
+    int reg = m_alloc->live(&instr) ? m_alloc->reg(&instr) : -1;
+    return reg >= 0 ? reg : R10;
+}
+
+void X86Generator::write_result(const ir::Instruction& instr, int reg) {
+    if (!m_alloc->live(&instr)) return;
+    emit_move(location(&instr), { reg, 0 });
+}
+
+void X86Generator::emit_move(const Location& dst, const Location& src) {
+    if (dst == src) return;
+    if (dst.reg >= 0 && src.reg >= 0) {
+        emit("movq", { reg64(src.reg), reg64(dst.reg) });
+        return;
+    }
+    int reg = src.reg;
+    if (reg < 0) {
+        reg = dst.reg >= 0 ? dst.reg : R10;
+        emit("movq", { frame_slot(src.slot), reg64(reg) });
+    }
+    if (dst.reg < 0) emit("movq", { reg64(reg), frame_slot(dst.slot) });
+}
+
+void X86Generator::emit_parallel_copies(std::vector<std::pair<Location, Location>> moves, const std::vector<std::pair<Location, const ir::Value*>>& materialised) {
+    // Every location is read before it is overwritten, with %r11 breaking
+    // cycles.
+    while (!moves.empty()) {
+        auto is_read = [&moves](const Location& loc) {
+            return std::any_of(moves.begin(), moves.end(), [&loc](const auto& move) { return move.second == loc && !(move.first == loc); });
+        };
+        auto ready = std::find_if(moves.begin(), moves.end(), [&is_read](const auto& move) { return !is_read(move.first); });
+        if (ready == moves.end()) {
+            Location temp { R11, 0 };
+            Location saved = moves.front().first;
+            emit_move(temp, saved);
+            for (auto& move : moves) {
+                if (move.second == saved) move.second = temp;
+            }
+            continue;
+        }
+        emit_move(ready->first, ready->second);
+        moves.erase(ready);
+    }
+    for (const auto& [dst, value] : materialised) {
+        int reg = read(value, dst.reg >= 0 ? dst.reg : R10);
+        emit_move(dst, { reg, 0 });
+    }
+}
+
+void X86Generator::emit_phi_copies(const ir::BasicBlock& from, const ir::BasicBlock& to) {
+    std::vector<std::pair<Location, Location>> moves;
+    std::vector<std::pair<Location, const ir::Value*>> materialised;
+    for (const auto& instr : to.instrs) {
+        if (instr->op != Opcode::Phi) break;
+        if (!m_alloc->live(instr.get())) continue;
+        for (size_t i = 0; i < instr->blocks.size(); ++i) {
+            if (instr->blocks[i] != &from) continue;
+            const ir::Value* value = instr->operands[i];
+            const ir::Value* vreg = m_alloc->vreg(value);
+            if (vreg) moves.push_back({ location(instr.get()), location(vreg) });
+            else materialised.push_back({ location(instr.get()), value });
+        }
+    }
+    emit_parallel_copies(std::move(moves), materialised);
+}
+
+void X86Generator::emit_branch(const ir::BasicBlock& from, const ir::BasicBlock& to, const ir::BasicBlock* next) {
+    emit_phi_copies(from, to);
+    if (&to != next) emit("jmp", { m_labels.at(&to) });
+}
+
+void X86Generator::emit_instruction(const ir::Instruction& instr, const ir::BasicBlock* next) {
+    const auto& ops = instr.operands;
+    bool dead = instr.has_result() && instr.op != Opcode::Call && !m_alloc->live(&instr);
+
+    switch (instr.op) {
+        case Opcode::Alloca:
+        case Opcode::Phi:
+        case Opcode::LifetimeStart:
+        case Opcode::LifetimeEnd:
+            return;
+        case Opcode::Load: {
+            if (dead || m_alloc->folded(&instr)) return;
+            int dst = result_reg(instr);
+            if (m_alloc->promoted(ops[0])) {
+                read_into(ops[0], dst);
+            } else {
+                emit_load(instr.type, dst, address(ops[0], R10, R11));
+            }
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Store:
+            if (m_alloc->promoted(ops[1])) {
+                if (!m_alloc->live(ops[1])) return;
+                Location var = location(ops[1]);
+                int reg = read(ops[0], var.reg >= 0 ? var.reg : R10);
+                emit_move(var, { reg, 0 });
+            } else {
+                int value = read(ops[0], R10);
+                emit_store(ops[0]->type, value, address(ops[1], R11, RAX));
+            }
+            return;
+        case Opcode::ElementAddr: {
+            if (dead) return;
+            int base = read(ops[0], R10);
+            int dst = result_reg(instr);
+            size_t size = type_size(element_type(instr.type));
+            if (is_constant(ops[1])) {
+                long long offset = constant_value(ops[1]) * static_cast<long long>(size);
+                emit("leaq", { std::to_string(offset) + "(" + reg64(base) + ")", reg64(dst) });
+                write_result(instr, dst);
+                return;
+            }
+            int index = read(ops[1], R11);
+            emit("leaq", { "(" + reg64(base) + ", " + reg64(index) + ", " + std::to_string(size) + ")", reg64(dst) });
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Not: {
+            if (dead) return;
+            int operand = read(ops[0], R10);
+            int dst = result_reg(instr);
+            emit("cmpq", { "$0", reg64(operand) });
+            emit("sete", { reg8(dst) });
+            emit("movzbq", { reg8(dst), reg64(dst) });
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Select: {
+            if (dead) return;
+            Opcode op = Opcode::CmpNe;
+            if (m_selector->covered(ops[0])) {
+                op = emit_compare(*static_cast<const ir::Instruction*>(ops[0]));
+            } else {
+                emit("cmpq", { "$0", reg64(read(ops[0], R10)) });
+            }
+            // Reading the arms only moves, which keeps the flags. The
+            // destination starts as one arm and is conditionally replaced by
+            // the other; whichever arm already is the destination stays.
+            int if_false = read(ops[2], R11);
+            int if_true = read(ops[1], RAX);
+            int dst = result_reg(instr);
+            if (if_true == if_false) {
+                if (dst != if_true) emit("movq", { reg64(if_true), reg64(dst) });
+            } else if (dst == if_true) {
+                emit(std::string("cmov") + inverse_condition(op) + "q", { reg64(if_false), reg64(dst) });
+            } else {
+                if (dst != if_false) emit("movq", { reg64(if_false), reg64(dst) });
+                emit(std::string("cmov") + condition(op) + "q", { reg64(if_true), reg64(dst) });
+            }
+            write_result(instr, dst);
+            return;
+        }
+        case Opcode::Call: {
+            // Stack arguments first, through the scratch registers; the
+            // register arguments are then copied in parallel, since values
+            // may live in argument registers.
+            for (size_t i = register_args; i < ops.size(); ++i) {
+                int reg = read(ops[i], R10);
+                emit("movq", { reg64(reg), std::to_string((i - register_args) * 8) + "(%rsp)" });
+            }
+            std::vector<std::pair<Location, Location>> moves;
+            std::vector<std::pair<Location, const ir::Value*>> materialised;
+            for (size_t i = 0; i < ops.size() && i < register_args; ++i) {
+                Location dst { argument_regs[i], 0 };
+                const ir::Value* vreg = m_alloc->vreg(ops[i]);
+                if (vreg) moves.push_back({ dst, location(vreg) });
+                else materialised.push_back({ dst, ops[i] });
+            }
+            emit_parallel_copies(std::move(moves), materialised);
+            const auto& instrs = instr.parent->instrs;
+            const ir::Instruction* after = nullptr;
+            for (size_t i = 0; i + 1 < instrs.size(); ++i) {
+                if (instrs[i].get() == &instr) after = instrs[i + 1].get();
+            }
+            if (instr.tail_call && after && after->op == Opcode::Ret && ops.size() <= register_args) {
+                emit_epilogue();
+                emit("jmp", { instr.name });
+                m_skipped.insert(after);
+                return;
+            }
+            emit("call", { instr.name });
+            if (instr.has_result()) write_result(instr, RAX);
+            return;
+        }
+        case Opcode::Print:
+            // printf is variadic: %al holds the number of vector registers used.
+            read_into(ops[0], RSI);
+            emit("leaq", { "fmt(%rip)", "%rdi" });
+            emit("xorl", { "%eax", "%eax" });
+            emit("call", { "printf@PLT" });
+            return;
+        case Opcode::Br:
+            emit_branch(*instr.parent, *instr.blocks[0], next);
+            return;
+        case Opcode::CondBr: {
+            const ir::BasicBlock& from = *instr.parent;
+            const ir::BasicBlock& if_true = *instr.blocks[0];
+            const ir::BasicBlock& if_false = *instr.blocks[1];
+            bool false_copies = !if_false.instrs.empty() && if_false.instrs.front()->op == Opcode::Phi;
+            bool true_copies = !if_true.instrs.empty() && if_true.instrs.front()->op == Opcode::Phi;
+            bool on_true = &if_false == next && !false_copies && !true_copies;
+            std::string target = on_true ? m_labels.at(&if_true) : false_copies ? create_label() : m_labels.at(&if_false);
+            // As on ARM64: comparisons with zero test their operand, other
+            // covered comparisons jump on their flags, and the jump goes to
+            // the true target when the false one follows.
+            const auto* cmp = m_selector->covered(ops[0]) ? static_cast<const ir::Instruction*>(ops[0]) : nullptr;
+            const ir::Value* zero_tested = cmp ? nullptr : ops[0];
+            bool branch_if_zero = true;
+            if (cmp && (cmp->op == Opcode::CmpEq || cmp->op == Opcode::CmpNe)) {
+                for (int side = 0; side < 2 && !zero_tested; ++side) {
+                    const ir::Value* zero = cmp->operands[side];
+                    if (!is_constant(zero) || constant_value(zero) != 0) continue;
+                    zero_tested = cmp->operands[1 - side];
+                    branch_if_zero = cmp->op == Opcode::CmpNe;
+                }
+            }
+            if (zero_tested) {
+                int reg = read(zero_tested, R10);
+                emit("testq", { reg64(reg), reg64(reg) });
+                emit(branch_if_zero != on_true ? "je" : "jne", { target });
+            } else {
+                Opcode op = emit_compare(*cmp);
+                emit(std::string("j") + (on_true ? condition(op) : inverse_condition(op)), { target });
+            }
+            emit_branch(from, on_true ? if_false : if_true, next);
+            if (false_copies) m_stubs.push_back({ target, &from, &if_false });
+            return;
+        }
+        case Opcode::Ret:
+            if (!ops.empty()) read_into(ops[0], RAX);
+            emit_epilogue();
+            emit("ret");
+            return;
+        default:
+            break;
+    }
+    if (dead) return;
+
+    if (ir::is_compare(instr.op)) {
+        Opcode op = emit_compare(instr);
+        int dst = result_reg(instr);
+        emit(std::string("set") + condition(op), { reg8(dst) });
+        emit("movzbq", { reg8(dst), reg64(dst) });
+        write_result(instr, dst);
+        return;
+    }
+    emit_binary(instr);
+}
+
+void X86Generator::emit_binary(const ir::Instruction& instr) {
+    // The result is computed in place: the left operand is copied to the
+    // destination, and the right one applied to it. Literals that fit in 32
+    // bits are immediates; additions and multiplications first move a
+    // literal to the right.
+    //
+    // int is 32 bits wide. Registers hold it sign-extended to 64 bits, as
+    // movslq loads it, for the 64-bit comparisons and address arithmetic.
+    // Operations that can leave that range use their 32-bit forms and the
+    // result is sign-extended again; sarq and the high half of a product
+    // stay in range.
+    Opcode op = instr.op;
+    const ir::Value* left = instr.operands[0];
+    const ir::Value* right = instr.operands[1];
+    bool commutative = op == Opcode::Add || op == Opcode::Mul;
+    if (is_constant(left) && !is_constant(right) && commutative) std::swap(left, right);
+    int dst = result_reg(instr);
+    std::string d = reg64(dst);
+
+    if (op == Opcode::Sub && is_constant(left) && constant_value(left) == 0) {
+        int operand = read(right, R11);
+        if (operand != dst) emit("movq", { reg64(operand), d });
+        emit("negl", { reg32(dst) });
+        emit("movslq", { reg32(dst), d });
+        write_result(instr, dst);
+        return;
+    }
+    int lhs = read(left, R10);
+    if (op == Opcode::MulHi || op == Opcode::SDiv) {
+        // Both work in %rax, and division also takes %rdx.
+        int rhs = read(right, R11);
+        if (op == Opcode::MulHi) {
+            emit("movslq", { reg32(lhs), "%rax" });
+            emit("movslq", { reg32(rhs), "%r11" });
+            emit("imulq", { "%r11", "%rax" });
+            emit("sarq", { "$32", "%rax" });
+            if (dst != RAX) emit("movq", { "%rax", d });
+        } else {
+            if (lhs != RAX) emit("movq", { reg64(lhs), "%rax" });
+            emit("cltd");
+            emit("idivl", { reg32(rhs) });
+            emit("movslq", { "%eax", d });
+        }
+        write_result(instr, dst);
+        return;
+    }
+    bool shift = op == Opcode::Shl || op == Opcode::AShr || op == Opcode::LShr;
+    bool narrow = op == Opcode::Add || op == Opcode::Sub || op == Opcode::Mul || op == Opcode::Shl;
+    const char* mnemonic = op == Opcode::Add ? "addl" : op == Opcode::Sub ? "subl" : op == Opcode::Mul ? "imull" : op == Opcode::Shl ? "shll" : op == Opcode::AShr ? "sarq" : "shrl";
+    auto operand = [&](int reg) { return op == Opcode::AShr ? reg64(reg) : reg32(reg); };
+    // Logical shifts right work on the low 32 bits, as on ARM64.
+    auto copy_left = [&](int to) {
+        if (op == Opcode::LShr) emit("movl", { reg32(lhs), reg32(to) });
+        else if (lhs != to) emit("movq", { reg64(lhs), reg64(to) });
+    };
+    auto finish = [&]() {
+        if (narrow) emit("movslq", { reg32(dst), d });
+        write_result(instr, dst);
+    };
+    if (is_imm32(right)) {
+        if (op == Opcode::Mul) {
+            emit("imull", { immediate(constant_value(right)), reg32(lhs), reg32(dst) });
+        } else {
+            copy_left(dst);
+            emit(mnemonic, { immediate(constant_value(right)), operand(dst) });
+        }
+        finish();
+        return;
+    }
+    if (shift) {
+        read_into(right, RCX);
+        copy_left(dst);
+        emit(mnemonic, { "%cl", operand(dst) });
+        finish();
+        return;
+    }
+    int rhs = read(right, R11);
+    if (dst == rhs && dst != lhs) {
+        if (commutative) {
+            emit(mnemonic, { reg32(lhs), reg32(dst) });
+            finish();
+        } else {
+            // The destination holds the right operand; compute aside.
+            copy_left(RAX);
+            emit(mnemonic, { reg32(rhs), "%eax" });
+            emit("movslq", { "%eax", d });
+            write_result(instr, dst);
+        }
+        return;
+    }
+    copy_left(dst);
+    emit(mnemonic, { reg32(rhs), reg32(dst) });
+    finish();
+}
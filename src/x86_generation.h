@@ -0,0 +1,103 @@
+#pragma once
+#include "elf_object.h"
+#include "instruction_selection.h"
+#include "ir.h"
+#include "peephole.h"
+#include "register_allocator.h"
+#include <memory>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// x86-64 assembly generation from the IR, for Linux and the System V ABI, in
+// the AT&T syntax of the GNU assembler.
+//
+// The lowering is the one of the ARM64 Generator: values live where the
+// RegisterAllocator put them, in a register or an 8-byte frame slot below
+// %rbp; allocas that stay in memory hold their elements at natural size; both
+// share the frame below the save area of the callee-saved registers by
+// lifetime; phis are resolved by parallel copies at the end of each
+// predecessor; and leaf functions that need no frame get no prologue.
+//
+// The argument registers %rsi, %rdi, %r8 and %r9 are allocatable, so the
+// incoming arguments and those of calls are moved in parallel, like phi
+// copies. Arguments beyond the sixth are passed on the stack. %r10/%r11 hold
+// operands that are not in registers and spilled results, %rax is the third
+// scratch register, and %rcx and %rdx are taken by shifts and division.
+//
+// Instructions are two-address: an operation writes its destination after
+// copying the left operand there. Element addresses fold into the base +
+// index * scale operands of loads and stores, and comparisons into the jumps
+// and conditional moves testing them.
+//
+// As in the ARM64 Generator, each function's code is kept as a list of
+// AsmInstr, which generate_object() encodes into an ELF object.
+class X86Generator {
+public:
+    explicit X86Generator(const ir::Module* module);
+    std::string generate();
+    // The code of generate() as an ELF relocatable object for x86-64 Linux;
+    // `listing` receives the encoded instructions with their offsets.
+    ElfObject generate_object(std::string& listing) const;
+
+private:
+    const ir::Module* m_module;
+    std::stringstream m_output;
+    int m_label_count = 0;
+    std::vector<AsmInstr> m_code;   // Code of the function being generated
+    std::vector<std::vector<AsmInstr>> m_functions;   // Final code of each function
+
+    // Function being generated, as in the ARM64 Generator.
+    const ir::Function* m_func = nullptr;
+    std::unique_ptr<InstructionSelector> m_selector;
+    std::unique_ptr<RegisterAllocator> m_alloc;
+    std::unordered_map<const ir::Value*, size_t> m_slots;
+    std::unordered_map<const ir::BasicBlock*, std::string> m_labels;
+    std::unordered_set<const ir::Instruction*> m_skipped;
+    size_t m_frame_size = 0;
+    bool m_frameless = false;
+
+    struct EdgeStub {
+        std::string label;
+        const ir::BasicBlock* from;
+        const ir::BasicBlock* to;
+    };
+    std::vector<EdgeStub> m_stubs;
+
+    // A register, or a frame slot when `reg` is -1.
+    struct Location {
+        int reg;
+        size_t slot;
+        bool operator==(const Location& other) const { return reg == other.reg && (reg >= 0 || slot == other.slot); }
+    };
+
+    void emit(const std::string& op, std::vector<std::string> operands = {});
+    void emit_label(const std::string& label);
+    std::string create_label();
+    void emit_function(const ir::Function& func);
+    void layout_frame(const ir::Function& func);
+    void emit_instruction(const ir::Instruction& instr, const ir::BasicBlock* next);
+    void emit_branch(const ir::BasicBlock& from, const ir::BasicBlock& to, const ir::BasicBlock* next);
+    void emit_phi_copies(const ir::BasicBlock& from, const ir::BasicBlock& to);
+    // Copies every source to its destination as if all were read first;
+    // values without a virtual register are materialised afterwards.
+    void emit_parallel_copies(std::vector<std::pair<Location, Location>> moves, const std::vector<std::pair<Location, const ir::Value*>>& materialised);
+    void emit_move(const Location& dst, const Location& src);
+    void emit_epilogue();
+    void emit_load(Type type, int reg, const std::string& address);
+    void emit_store(Type type, int reg, const std::string& address);
+    void emit_binary(const ir::Instruction& instr);
+
+    std::string address(const ir::Value* pointer, int base_scratch, int index_scratch);
+    ir::Opcode emit_compare(const ir::Instruction& cmp);
+    int read(const ir::Value* value, int scratch);
+    void read_into(const ir::Value* value, int reg);
+    int result_reg(const ir::Instruction& instr);
+    void write_result(const ir::Instruction& instr, int reg);
+    Location location(const ir::Value* vreg);
+    std::string frame_slot(size_t stack_offset);
+    std::string stack_argument(size_t index);
+    void move_immediate(int reg, long long value);
+};
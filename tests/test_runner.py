@@ -5,7 +5,7 @@ import sys
 # Get the directory where this script is located
 SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
 
-# Define test cases: (filename, expected_exit_code)
+# Define test cases: (filename, expected_exit_code[, compiler_flags])
 tests = [
     ("test.hy", 5),
     ("test2.hy", 5),
@@ -16,6 +16,26 @@ tests = [
     ("test_logic.hy", 42),
     ("test_for.hy", 10),
     ("test_ptr.hy", 20),
+    ("test_strength.hy", 57, "-fno-eval"),
+    ("test_inline.hy", 53, "-fno-eval"),
+    ("test_alias.hy", 21, "-fno-eval"),
+    ("test_tail.hy", 97, "-fno-eval"),
+    ("test_licm.hy", 33, "-fno-eval"),
+    ("test_unroll.hy", 0, "-fno-eval"),
+    ("test_cse.hy", 109, "-fno-eval"),
+    ("test_ir.hy", 79, "-fno-eval"),
+    ("test_eval.hy", 36),
+    ("test_regalloc.hy", 190, "-fno-eval", "-fno-inline"),
+    ("test_frame.hy", 85),
+    ("test_wrap.hy", 15),
+    ("test_immediates.hy", 58, "-fno-eval"),
+    ("test_peephole.hy", 111, "-fno-eval"),
+    ("test_isel.hy", 224, "-fno-eval"),
+    ("test_branches.hy", 13),
+    ("test_select.hy", 156),
+    ("test_calls.hy", 167, "-fno-inline", "-fno-eval"),
+    ("test_lsr.hy", 158, "-fno-eval"),
+    ("test_lifetime.hy", 19, "-fno-eval", "-fno-inline"),
 ]
 
 # Adjust paths for Windows if necessary
@@ -45,12 +65,17 @@ def main():
             print(f"Error: Compiler not found at {COMPILER_PATH}. Please build it first.")
             sys.exit(1)
 
-    # Warning for non-ARM64 platforms
-    # This is a heuristic check.
+    # x86-64 hosts use the x86-64 backend; other non-ARM64 platforms get a
+    # warning. This is a heuristic check.
     import platform
     machine = platform.machine().lower()
-    if 'arm' not in machine and 'aarch64' not in machine:
-        print(f"WARNING: You are running on {machine}, but this test suite relies on ARM64 assembly.")
+    target_flags = []
+    assembler = "clang"
+    if machine in ('x86_64', 'amd64'):
+        target_flags = ["--target=x86_64-linux"]
+        assembler = "cc"
+    elif 'arm' not in machine and 'aarch64' not in machine:
+        print(f"WARNING: You are running on {machine}, but this test suite relies on ARM64 or x86-64 assembly.")
         print("It will likely fail. Please use test_runner_llvm.py instead.")
         print("-" * 60)
 
@@ -60,7 +85,7 @@ def main():
     print(f"{'Test File':<20} | {'Status':<10} | {'Expected':<10} | {'Actual':<10}")
     print("-" * 60)
 
-    for filename, expected in tests:
+    for filename, expected, *flags in tests:
         filepath = os.path.join(SCRIPT_DIR, filename)
         if not os.path.exists(filepath):
             print(f"{filename:<20} | {'MISSING':<10} | {expected:<10} | {'-':<10}")
@@ -69,7 +94,7 @@ def main():
 
         # 1. Compile .hy to .s
         # We run the command in SCRIPT_DIR so out.s is generated there
-        compile_cmd = f"\"{COMPILER_PATH}\" \"{filepath}\""
+        compile_cmd = f"\"{COMPILER_PATH}\" {' '.join(target_flags + flags)} \"{filepath}\""
         compile_res = subprocess.run(compile_cmd, shell=True, capture_output=True, text=True, cwd=SCRIPT_DIR)
         
         if compile_res.returncode != 0:
@@ -79,8 +104,8 @@ def main():
             continue
 
         # 2. Assemble .s to executable
-        # Using clang for macOS (Darwin) or generic *nix
-        assemble_cmd = f"clang -o \"{EXECUTABLE}\" \"{ASM_OUTPUT}\""
+        # Using clang for macOS (Darwin), or cc for x86-64 Linux
+        assemble_cmd = f"{assembler} -o \"{EXECUTABLE}\" \"{ASM_OUTPUT}\""
         assemble_res = run_command(assemble_cmd)
 
         if assemble_res.returncode != 0:
@@ -93,6 +118,15 @@ def main():
         run_res = run_command(f"\"{EXECUTABLE}\"")
         actual = run_res.returncode
 
+        # 4. Run the program in process with `compiler run`
+        jit_cmd = f"\"{COMPILER_PATH}\" run {' '.join(flags)} \"{filepath}\""
+        jit_res = subprocess.run(jit_cmd, shell=True, capture_output=True, text=True, cwd=SCRIPT_DIR)
+        if jit_res.returncode != actual or jit_res.stdout != run_res.stdout:
+            print(f"{filename:<20} | {'JIT ERR':<10} | {expected:<10} | {jit_res.returncode:<10}")
+            print(f"  JIT Error: {jit_res.stderr}")
+            failed += 1
+            continue
+
         if actual == expected:
             print(f"{filename:<20} | {'PASS':<10} | {expected:<10} | {actual:<10}")
             passed += 1
@@ -108,6 +142,8 @@ def main():
         os.remove(ASM_OUTPUT)
     if os.path.exists(os.path.join(SCRIPT_DIR, "out.ll")): # Cleanup out.ll too
         os.remove(os.path.join(SCRIPT_DIR, "out.ll"))
+    if os.path.exists(os.path.join(SCRIPT_DIR, "out.o")):
+        os.remove(os.path.join(SCRIPT_DIR, "out.o"))
     if os.path.exists(EXECUTABLE):
         os.remove(EXECUTABLE)
 
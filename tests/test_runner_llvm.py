@@ -1,11 +1,13 @@
 import os
+import platform
+import shutil
 import subprocess
 import sys
 
 # Get the directory where this script is located
 SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
 
-# Define test cases: (filename, expected_exit_code)
+# Define test cases: (filename, expected_exit_code[, compiler_flags])
 tests = [
     ("test.hy", 5),
     ("test2.hy", 5),
@@ -16,6 +18,26 @@ tests = [
     ("test_logic.hy", 42),
     ("test_for.hy", 10),
     ("test_ptr.hy", 20),
+    ("test_strength.hy", 57, "-fno-eval"),
+    ("test_inline.hy", 53, "-fno-eval"),
+    ("test_alias.hy", 21, "-fno-eval"),
+    ("test_tail.hy", 97, "-fno-eval"),
+    ("test_licm.hy", 33, "-fno-eval"),
+    ("test_unroll.hy", 0, "-fno-eval"),
+    ("test_cse.hy", 109, "-fno-eval"),
+    ("test_ir.hy", 79, "-fno-eval"),
+    ("test_eval.hy", 36),
+    ("test_regalloc.hy", 190, "-fno-eval", "-fno-inline"),
+    ("test_frame.hy", 85),
+    ("test_wrap.hy", 15),
+    ("test_immediates.hy", 58, "-fno-eval"),
+    ("test_peephole.hy", 111, "-fno-eval"),
+    ("test_isel.hy", 224, "-fno-eval"),
+    ("test_branches.hy", 13),
+    ("test_select.hy", 156),
+    ("test_calls.hy", 167, "-fno-inline", "-fno-eval"),
+    ("test_lsr.hy", 158, "-fno-eval"),
+    ("test_lifetime.hy", 19, "-fno-eval", "-fno-inline"),
 ]
 
 # Adjust paths for Windows if necessary
@@ -23,6 +45,11 @@ COMPILER_NAME = "compiler.exe" if os.name == 'nt' else "compiler"
 COMPILER_PATH = os.path.join(SCRIPT_DIR, "../build", COMPILER_NAME)
 
 LLVM_OUTPUT = os.path.join(SCRIPT_DIR, "out.ll")
+OBJECT_OUTPUT = os.path.join(SCRIPT_DIR, "out.llvm.o")
+
+# Without clang, the compiler's in-process LLVM backend (--llvm-emit) builds
+# the objects, which the system cc links.
+IN_PROCESS = shutil.which("clang") is None
 
 EXECUTABLE_NAME = "test_bin_llvm.exe" if os.name == 'nt' else "test_bin_llvm"
 EXECUTABLE = os.path.join(SCRIPT_DIR, EXECUTABLE_NAME)
@@ -51,10 +78,18 @@ def main():
     passed = 0
     failed = 0
 
+    emit_flags = []
+    if IN_PROCESS:
+        machine = platform.machine().lower()
+        emit_flags = ["--llvm-emit=object"]
+        if machine in ('x86_64', 'amd64'):
+            emit_flags.append("--target=x86_64-linux")
+        print("clang not found; using the in-process LLVM backend")
+
     print(f"{ 'Test File':<20} | { 'Status':<10} | { 'Expected':<10} | { 'Actual':<10}")
     print("-" * 60)
 
-    for filename, expected in tests:
+    for filename, expected, *flags in tests:
         filepath = os.path.join(SCRIPT_DIR, filename)
         if not os.path.exists(filepath):
             print(f"{filename:<20} | {'MISSING':<10} | {expected:<10} | {'-':<10}")
@@ -63,7 +98,7 @@ def main():
 
         # 1. Compile .hy to .ll
         # We run the command in SCRIPT_DIR so out.ll is generated there
-        compile_cmd = f"{COMPILER_PATH} {filepath}"
+        compile_cmd = f"{COMPILER_PATH} {' '.join(emit_flags + flags)} {filepath}"
         compile_res = subprocess.run(compile_cmd, shell=True, capture_output=True, text=True, cwd=SCRIPT_DIR)
         
         if compile_res.returncode != 0:
@@ -85,6 +120,8 @@ def main():
 
         # -Wno-override-module suppresses warnings about target triple mismatch (e.g. macos vs windows)
         assemble_cmd = f"clang -Wno-override-module -o {EXECUTABLE} {LLVM_OUTPUT} {link_flags}"
+        if IN_PROCESS:
+            assemble_cmd = f"cc -o {EXECUTABLE} {OBJECT_OUTPUT}"
         assemble_res = run_command(assemble_cmd)
 
         if assemble_res.returncode != 0:
@@ -112,6 +149,8 @@ def main():
         os.remove(LLVM_OUTPUT)
     if os.path.exists(os.path.join(SCRIPT_DIR, "out.s")):
         os.remove(os.path.join(SCRIPT_DIR, "out.s"))
+    if os.path.exists(OBJECT_OUTPUT):
+        os.remove(OBJECT_OUTPUT)
     if os.path.exists(EXECUTABLE):
         os.remove(EXECUTABLE)
 